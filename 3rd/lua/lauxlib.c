@@ -1241,6 +1241,324 @@ static int cache_mode(lua_State *L) {
 	return 0;
 }
 
+/*
+** {======================================================
+** Bytecode cache on disk (config bytecode_cache)
+** The records of compiled chunks are appended to one file, shared by the
+** processes. A record is keyed by the path, and used when the mtime, the
+** size and the hash of source are the same. The file is mapped at start,
+** the records appended later are kept in memory for this process.
+** =======================================================
+*/
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "atomic.h"
+
+#define BCACHE_MAGIC 0x43424b53  /* "SKBC" */
+#define BCACHE_LIMIT (256 * 1024 * 1024)  /* don't append when the file is larger, remove it to reset */
+
+struct bcache_record {
+  uint32_t magic;
+  uint32_t version;  /* LUA_VERSION_NUM */
+  uint32_t pathsz;
+  uint32_t codesz;
+  int64_t mtime;
+  int64_t size;  /* of source */
+  uint64_t hash;  /* of source */
+  uint64_t check;  /* of code */
+};  /* the path and the code follow, the record is aligned to 8 */
+
+struct bytecodecache {
+  struct spinlock lock;
+  char *filename;  /* NULL when it's off */
+  int n;
+  int cap;
+  const struct bcache_record **slot;  /* open addressing by path, the records are never freed */
+  ATOM_INT hit;
+  ATOM_INT miss;
+};
+
+static struct bytecodecache BC;
+
+static uint64_t
+bcache_hash(const char *p, size_t sz) {
+  uint64_t h = 0xcbf29ce484222325ull ^ sz;
+  uint64_t v;
+  while (sz >= 8) {
+    memcpy(&v, p, 8);
+    h = (h ^ v) * 0x100000001b3ull;
+    h ^= h >> 29;
+    p += 8;
+    sz -= 8;
+  }
+  while (sz > 0) {
+    h = (h ^ (uint8_t)*p++) * 0x100000001b3ull;
+    --sz;
+  }
+  return h ^ (h >> 32);
+}
+
+static const char *
+record_path(const struct bcache_record *r) {
+  return (const char *)(r + 1);
+}
+
+static const char *
+record_code(const struct bcache_record *r) {
+  return (const char *)(r + 1) + r->pathsz;
+}
+
+static size_t
+record_size(size_t pathsz, size_t codesz) {
+  return (sizeof(struct bcache_record) + pathsz + codesz + 7) & ~(size_t)7;
+}
+
+static int
+slot_index(const struct bcache_record **slot, int cap, const char *path, size_t sz) {
+  int i = (int)(bcache_hash(path, sz) & (cap - 1));
+  while (slot[i]) {
+    if (slot[i]->pathsz == sz && memcmp(record_path(slot[i]), path, sz) == 0)
+      break;
+    i = (i + 1) & (cap - 1);
+  }
+  return i;
+}
+
+/* the later record of a path replaces the earlier one */
+static void
+bcache_insert(const struct bcache_record *r) {
+  int i;
+  if (BC.n * 2 >= BC.cap) {
+    int cap = BC.cap ? BC.cap * 2 : 256;
+    const struct bcache_record **slot = calloc(cap, sizeof(*slot));
+    if (slot == NULL)
+      return;
+    for (i = 0; i < BC.cap; i++) {
+      if (BC.slot[i])
+        slot[slot_index(slot, cap, record_path(BC.slot[i]), BC.slot[i]->pathsz)] = BC.slot[i];
+    }
+    free(BC.slot);
+    BC.slot = slot;
+    BC.cap = cap;
+  }
+  i = slot_index(BC.slot, BC.cap, record_path(r), r->pathsz);
+  if (BC.slot[i] == NULL)
+    ++BC.n;
+  BC.slot[i] = r;
+}
+
+static const struct bcache_record *
+bcache_find(const char *path, const struct stat *st, uint64_t hash) {
+  const struct bcache_record *r = NULL;
+  SPIN_LOCK(&BC)
+    if (BC.cap > 0) {
+      r = BC.slot[slot_index(BC.slot, BC.cap, path, strlen(path))];
+      if (r && (r->mtime != (int64_t)st->st_mtime || r->size != (int64_t)st->st_size || r->hash != hash))
+        r = NULL;
+    }
+  SPIN_UNLOCK(&BC)
+  return r;
+}
+
+LUALIB_API void
+luaL_initbytecodecache(const char *filename) {
+  struct stat st;
+  int fd;
+  SPIN_INIT(&BC);
+  ATOM_INIT(&BC.hit, 0);
+  ATOM_INIT(&BC.miss, 0);
+  fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open bytecode cache %s : %s\n", filename, strerror(errno));
+    return;
+  }
+  BC.filename = strdup(filename);
+  flock(fd, LOCK_EX);
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size_t sz = (size_t)st.st_size;
+    const char *base = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED) {
+      size_t off = 0;
+      while (sz - off >= sizeof(struct bcache_record)) {
+        const struct bcache_record *r = (const struct bcache_record *)(base + off);
+        size_t rsz;
+        if (r->magic != BCACHE_MAGIC || r->pathsz > sz || r->codesz > sz)
+          break;
+        rsz = record_size(r->pathsz, r->codesz);
+        if (rsz > sz - off)
+          break;
+        if (r->version == LUA_VERSION_NUM)
+          bcache_insert(r);
+        off += rsz;
+      }
+      /* a torn record of the writer crashed */
+      if (off < sz && ftruncate(fd, (off_t)off) != 0)
+        fprintf(stderr, "Can't truncate bytecode cache %s : %s\n", filename, strerror(errno));
+    }
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+struct dumpbuffer {
+  char *p;
+  size_t sz;
+  size_t cap;
+};
+
+static int
+dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  struct dumpbuffer *b = (struct dumpbuffer *)ud;
+  (void)L;
+  if (b->sz + sz + 8 > b->cap) {  /* and the padding */
+    size_t cap = (b->sz + sz + 8) * 2;
+    char *np = realloc(b->p, cap);
+    if (np == NULL)
+      return 1;
+    b->p = np;
+    b->cap = cap;
+  }
+  memcpy(b->p + b->sz, p, sz);
+  b->sz += sz;
+  return 0;
+}
+
+/* append the function on the top of stack */
+static void
+bcache_save(lua_State *L, const char *path, const struct stat *st, uint64_t hash) {
+  struct dumpbuffer b;
+  struct bcache_record *r;
+  size_t pathsz = strlen(path);
+  size_t rsz;
+  int fd;
+  b.sz = sizeof(*r) + pathsz;
+  b.cap = b.sz + 4096;
+  b.p = malloc(b.cap);
+  if (b.p == NULL)
+    return;
+  if (lua_dump(L, dump_writer, &b, 0) != 0) {
+    free(b.p);
+    return;
+  }
+  r = (struct bcache_record *)b.p;
+  r->magic = BCACHE_MAGIC;
+  r->version = LUA_VERSION_NUM;
+  r->pathsz = (uint32_t)pathsz;
+  r->codesz = (uint32_t)(b.sz - sizeof(*r) - pathsz);
+  r->mtime = (int64_t)st->st_mtime;
+  r->size = (int64_t)st->st_size;
+  r->hash = hash;
+  memcpy(r + 1, path, pathsz);
+  r->check = bcache_hash(record_code(r), r->codesz);
+  rsz = record_size(pathsz, r->codesz);
+  memset(b.p + b.sz, 0, rsz - b.sz);
+  SPIN_LOCK(&BC)
+    const struct bcache_record *old = BC.cap ? BC.slot[slot_index(BC.slot, BC.cap, path, pathsz)] : NULL;
+    if (old && old->mtime == r->mtime && old->size == r->size && old->hash == hash) {
+      /* another state has saved it */
+      r = NULL;
+    } else {
+      bcache_insert(r);
+    }
+  SPIN_UNLOCK(&BC)
+  if (r == NULL) {
+    free(b.p);
+    return;
+  }
+  fd = open(BC.filename, O_WRONLY | O_APPEND);
+  if (fd >= 0) {
+    struct stat fst;
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &fst) == 0 && fst.st_size + rsz <= BCACHE_LIMIT) {
+      if (write(fd, r, rsz) != (ssize_t)rsz)
+        fprintf(stderr, "Can't write bytecode cache %s : %s\n", BC.filename, strerror(errno));
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+}
+
+/* the same as luaL_loadfilex_, but load the bytecode of cache if the source isn't changed */
+static int
+bcache_loadfile(lua_State *L, const char *filename, const char *mode) {
+  FILE *f;
+  struct stat st;
+  char *src;
+  const char *p;
+  size_t n;
+  uint64_t hash;
+  const struct bcache_record *r;
+  int err;
+  if (filename == NULL || (mode && strchr(mode, 't') == NULL))
+    return luaL_loadfilex_(L, filename, mode);
+  f = fopen(filename, "rb");
+  if (f == NULL)
+    return luaL_loadfilex_(L, filename, mode);  /* for the error message */
+  if (fstat(fileno(f), &st) != 0 || (src = malloc(st.st_size + 1)) == NULL) {
+    fclose(f);
+    return luaL_loadfilex_(L, filename, mode);
+  }
+  n = fread(src, 1, st.st_size, f);
+  fclose(f);
+  if (n != (size_t)st.st_size) {
+    free(src);
+    return luaL_loadfilex_(L, filename, mode);
+  }
+  hash = bcache_hash(src, n);
+  lua_pushfstring(L, "@%s", filename);
+  r = bcache_find(filename, &st, hash);
+  if (r && bcache_hash(record_code(r), r->codesz) == r->check) {
+    if (luaL_loadbufferx(L, record_code(r), r->codesz, lua_tostring(L, -1), "b") == LUA_OK) {
+      ATOM_FINC(&BC.hit);
+      lua_remove(L, -2);
+      free(src);
+      return LUA_OK;
+    }
+    lua_pop(L, 1);
+  }
+  ATOM_FINC(&BC.miss);
+  /* skip the BOM and the first line of '#' as skipcomment, keep the newline for line numbers */
+  p = src;
+  if (n >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+    p += 3;
+    n -= 3;
+  }
+  if (n > 0 && *p == '#') {
+    while (n > 0 && *p != '\n') {
+      ++p;
+      --n;
+    }
+  }
+  if (n > 0 && *p == LUA_SIGNATURE[0]) {  /* precompiled file */
+    lua_pop(L, 1);
+    free(src);
+    return luaL_loadfilex_(L, filename, mode);
+  }
+  err = luaL_loadbufferx(L, p, n, lua_tostring(L, -1), mode);
+  if (err == LUA_OK)
+    bcache_save(L, filename, &st, hash);
+  lua_remove(L, -2);
+  free(src);
+  return err;
+}
+
+static int
+cache_bytecode(lua_State *L) {
+  if (BC.filename == NULL)
+    return 0;
+  lua_pushstring(L, BC.filename);
+  lua_pushinteger(L, ATOM_LOAD(&BC.hit));
+  lua_pushinteger(L, ATOM_LOAD(&BC.miss));
+  return 3;
+}
+
+/* }====================================================== */
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   int level = cache_level(L);
@@ -1264,7 +1582,10 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
     lua_pushliteral(L, "New state failed");
     return LUA_ERRMEM;
   }
-  err = luaL_loadfilex_(eL, filename, mode);
+  if (BC.filename)
+    err = bcache_loadfile(eL, filename, mode);
+  else
+    err = luaL_loadfilex_(eL, filename, mode);
   if (err != LUA_OK) {
     size_t sz = 0;
     const char * msg = lua_tolstring(eL, -1, &sz);
@@ -1297,6 +1618,7 @@ LUAMOD_API int luaopen_cache(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "clear", cache_clear },
 		{ "mode", cache_mode },
+		{ "bytecode", cache_bytecode },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
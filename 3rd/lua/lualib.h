@@ -47,6 +47,8 @@ LUAMOD_API int (luaopen_package) (lua_State *L);
 #define LUA_CACHELIB
 LUAMOD_API int (luaopen_cache) (lua_State *L);
 LUALIB_API void (luaL_initcodecache) (void);
+/* the file of bytecode cache on disk, call it after luaL_initcodecache */
+LUALIB_API void (luaL_initbytecodecache) (const char *filename);
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
@@ -2,3 +2,4 @@ __nowaiting = true	-- If you turn this flag off, cluster.call would block when n
 
 db = "127.0.0.1:2528"
 db2 = "127.0.0.1:2529"
+-- db3 = "unix:/tmp/skynet_db3.sock"	-- unix domain socket for the nodes on the same host
@@ -243,6 +243,15 @@ static void sat_SHA1_Final(SHA1_CTX* context, uint8_t digest[SHA1_DIGEST_SIZE])
 	memset(finalcount, 0, 8);	/* SWR */
 }
 
+// for C code without lua, such as the websocket handshake in service_gate.c
+void
+sha1_digest(const uint8_t *data, size_t sz, uint8_t digest[SHA1_DIGEST_SIZE]) {
+	SHA1_CTX ctx;
+	sat_SHA1_Init(&ctx);
+	sat_SHA1_Update(&ctx, data, sz);
+	sat_SHA1_Final(&ctx, digest);
+}
+
 #include <lua.h>
 #include <lauxlib.h>
 
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h> 
+#include <errno.h>
 #include <openssl/err.h>
 #include <openssl/dh.h>
 #include <openssl/ssl.h>
@@ -10,6 +11,10 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "skynet.h"
+#include "skynet_socket.h"
+#include "socket_server.h"
+
 
 static bool TLS_IS_INIT = false;
 
@@ -399,6 +404,167 @@ lnew_tls(lua_State* L) {
     return 1;
 }
 
+// tls mode of socket server : the SSL reads and writes the fd in socket thread directly
+
+static int
+_socket_tls_attach(void* ud, int fd) {
+    return SSL_set_fd((SSL*)ud, fd) == 1 ? 0 : -1;
+}
+
+static int
+_socket_tls_error(SSL* ssl, int ret) {
+    int err = SSL_get_error(ssl, ret);
+    ERR_clear_error();
+    switch(err) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        break;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if(errno != 0) {
+            break;
+        }
+        // fall through
+    default:
+        errno = EPROTO;
+        break;
+    }
+    return -1;
+}
+
+static int
+_socket_tls_handshake(void* ud) {
+    SSL* ssl = (SSL*)ud;
+    int ret = SSL_do_handshake(ssl);
+    if(ret == 1) {
+        return SOCKET_TLS_FINISH;
+    }
+    int err = SSL_get_error(ssl, ret);
+    ERR_clear_error();
+    if(err == SSL_ERROR_WANT_READ) {
+        return SOCKET_TLS_WANTREAD;
+    } else if(err == SSL_ERROR_WANT_WRITE) {
+        return SOCKET_TLS_WANTWRITE;
+    }
+    return -1;
+}
+
+static int
+_socket_tls_read(void* ud, void* buffer, int sz) {
+    SSL* ssl = (SSL*)ud;
+    int n = 0;
+    // SSL_read returns one record at most, fill the buffer so that socket server reads again when it's full.
+    while(n < sz) {
+        int ret = SSL_read(ssl, (char*)buffer + n, sz - n);
+        if(ret <= 0) {
+            if(n > 0) {
+                ERR_clear_error();
+                break;
+            }
+            return _socket_tls_error(ssl, ret);
+        }
+        n += ret;
+    }
+    return n;
+}
+
+static int
+_socket_tls_write(void* ud, const void* buffer, int sz) {
+    SSL* ssl = (SSL*)ud;
+    int ret = SSL_write(ssl, buffer, sz);
+    if(ret > 0) {
+        return ret;
+    }
+    ret = _socket_tls_error(ssl, ret);
+    if(ret == 0) {
+        errno = EPIPE;
+    }
+    return -1;
+}
+
+// SSL_read may wait for writable (renegotiation), and SSL_write for readable
+static int
+_socket_tls_want(void* ud) {
+    return SSL_want_write((SSL*)ud) ? SOCKET_TLS_WANTWRITE : SOCKET_TLS_WANTREAD;
+}
+
+static void
+_socket_tls_release(void* ud) {
+    SSL* ssl = (SSL*)ud;
+    if(SSL_is_init_finished(ssl)) {
+        // send close_notify, don't wait for the peer's
+        SSL_shutdown(ssl);
+        ERR_clear_error();
+    }
+    SSL_free(ssl);
+}
+
+static const struct socket_tls_interface SOCKET_TLS = {
+    _socket_tls_attach,
+    _socket_tls_handshake,
+    _socket_tls_read,
+    _socket_tls_write,
+    _socket_tls_want,
+    _socket_tls_release,
+};
+
+/*
+    integer socket id
+    string method ("client" or "server")
+    ssl_ctx
+    string hostname (optional, for client)
+    return boolean
+
+    Encrypt the socket in socket thread, then socket.read/socket.write get/put the plain text.
+    Call it before socket.start for the accepted socket, or after socket.open for client.
+    The kernel tls (kTLS) is used after the handshake when openssl and the kernel support it.
+*/
+static int
+lsocket_tls(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    const char* method = luaL_checkstring(L, 2);
+    struct ssl_ctx* ctx_p = _check_sslctx(L, 3);
+    lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+    struct skynet_context* ctx = lua_touserdata(L, -1);
+    if(ctx == NULL) {
+        return luaL_error(L, "Init skynet context first");
+    }
+    lua_pop(L, 1);
+    bool is_server;
+    if(strcmp(method, "client") == 0) {
+        is_server = false;
+    } else if(strcmp(method, "server") == 0) {
+        is_server = true;
+    } else {
+        return luaL_error(L, "invalid method:%s e.g[server, client]", method);
+    }
+    const char* hostname = luaL_optstring(L, 4, NULL);
+    SSL* ssl = SSL_new(ctx_p->ctx);
+    if(!ssl) {
+        return luaL_error(L, "SSL_new failed");
+    }
+    if(is_server) {
+        SSL_set_accept_state(ssl);
+    } else {
+        SSL_set_connect_state(ssl);
+        if(hostname) {
+            SSL_set_tlsext_host_name(ssl, hostname);
+        }
+    }
+    // the buffer may be moved (by socket server) before SSL_write is retried
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    SSL_set_options(ssl, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+    lua_pushboolean(L, skynet_socket_tls(ctx, id, &SOCKET_TLS, ssl) == 0);
+    return 1;
+}
+
 int
 luaopen_ltls_c(lua_State* L) {
     if(!TLS_IS_INIT) {
@@ -407,6 +573,7 @@ luaopen_ltls_c(lua_State* L) {
     luaL_Reg l[] = {
         {"newctx", lnew_ctx},
         {"newtls", lnew_tls},
+        {"socket", lsocket_tls},
         {NULL, NULL},
     };
     luaL_checkversion(L);
@@ -3,6 +3,7 @@
 #include "skynet_malloc.h"
 
 #include "skynet_socket.h"
+#include "lua-slice.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -13,7 +14,7 @@
 #include <string.h>
 
 #define QUEUESIZE 1024
-#define HASHSIZE 4096
+#define HASHSIZE 64	// the initial size of uncomplete hash, it grows with the number of uncomplete packages
 #define SMALLSTRING 2048
 
 #define TYPE_DATA 1
@@ -41,11 +42,15 @@ struct uncomplete {
 	int header;
 };
 
+#define QUEUE_METATABLE "netpack_queue"
+
 struct queue {
 	int cap;
 	int head;
 	int tail;
-	struct uncomplete * hash[HASHSIZE];
+	int hashsize;	// power of 2, 0 before the first uncomplete package
+	int uncomplete;	// the number of uncomplete packages in hash
+	struct uncomplete ** hash;
 	struct netpack queue[QUEUESIZE];
 };
 
@@ -66,10 +71,13 @@ lclear(lua_State *L) {
 		return 0;
 	}
 	int i;
-	for (i=0;i<HASHSIZE;i++) {
+	for (i=0;i<q->hashsize;i++) {
 		clear_list(q->hash[i]);
-		q->hash[i] = NULL;
 	}
+	skynet_free(q->hash);
+	q->hash = NULL;
+	q->hashsize = 0;
+	q->uncomplete = 0;
 	if (q->head > q->tail) {
 		q->tail += q->cap;
 	}
@@ -83,33 +91,58 @@ lclear(lua_State *L) {
 }
 
 static inline int
-hash_fd(int fd) {
+hash_fd(int fd, int size) {
 	int a = fd >> 24;
 	int b = fd >> 12;
 	int c = fd;
-	return (int)(((uint32_t)(a + b + c)) % HASHSIZE);
+	return (int)(((uint32_t)(a + b + c)) & (size - 1));
+}
+
+static void
+expand_hash(struct queue *q) {
+	int size = q->hashsize ? q->hashsize * 2 : HASHSIZE;
+	struct uncomplete ** hash = skynet_malloc(size * sizeof(struct uncomplete *));
+	memset(hash, 0, size * sizeof(struct uncomplete *));
+	int i;
+	for (i=0;i<q->hashsize;i++) {
+		struct uncomplete * uc = q->hash[i];
+		while (uc) {
+			struct uncomplete * next = uc->next;
+			int h = hash_fd(uc->pack.id, size);
+			uc->next = hash[h];
+			hash[h] = uc;
+			uc = next;
+		}
+	}
+	skynet_free(q->hash);
+	q->hash = hash;
+	q->hashsize = size;
+}
+
+static void
+insert_uncomplete(struct queue *q, struct uncomplete *uc) {
+	if (q->uncomplete >= q->hashsize) {
+		expand_hash(q);
+	}
+	int h = hash_fd(uc->pack.id, q->hashsize);
+	uc->next = q->hash[h];
+	q->hash[h] = uc;
+	++q->uncomplete;
 }
 
 static struct uncomplete *
 find_uncomplete(struct queue *q, int fd) {
-	if (q == NULL)
-		return NULL;
-	int h = hash_fd(fd);
-	struct uncomplete * uc = q->hash[h];
-	if (uc == NULL)
+	if (q == NULL || q->uncomplete == 0)
 		return NULL;
-	if (uc->pack.id == fd) {
-		q->hash[h] = uc->next;
-		return uc;
-	}
-	struct uncomplete * last = uc;
-	while (last->next) {
-		uc = last->next;
+	struct uncomplete ** prev = &q->hash[hash_fd(fd, q->hashsize)];
+	struct uncomplete * uc;
+	while ((uc = *prev)) {
 		if (uc->pack.id == fd) {
-			last->next = uc->next;
+			*prev = uc->next;
+			--q->uncomplete;
 			return uc;
 		}
-		last = uc;
+		prev = &uc->next;
 	}
 	return NULL;
 }
@@ -122,10 +155,10 @@ get_queue(lua_State *L) {
 		q->cap = QUEUESIZE;
 		q->head = 0;
 		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
-		}
+		q->hashsize = 0;
+		q->uncomplete = 0;
+		q->hash = NULL;
+		luaL_setmetatable(L, QUEUE_METATABLE);
 		lua_replace(L, 1);
 	}
 	return q;
@@ -133,12 +166,19 @@ get_queue(lua_State *L) {
 
 static void
 expand_queue(lua_State *L, struct queue *q) {
-	struct queue *nq = lua_newuserdatauv(L, sizeof(struct queue) + q->cap * sizeof(struct netpack), 0);
-	nq->cap = q->cap + QUEUESIZE;
+	// double the ring, it's full now (head == tail)
+	int cap = q->cap * 2;
+	struct queue *nq = lua_newuserdatauv(L, sizeof(struct queue) + (cap - QUEUESIZE) * sizeof(struct netpack), 0);
+	luaL_setmetatable(L, QUEUE_METATABLE);
+	nq->cap = cap;
 	nq->head = 0;
 	nq->tail = q->cap;
-	memcpy(nq->hash, q->hash, sizeof(nq->hash));
-	memset(q->hash, 0, sizeof(q->hash));
+	nq->hashsize = q->hashsize;
+	nq->uncomplete = q->uncomplete;
+	nq->hash = q->hash;
+	q->hashsize = 0;
+	q->uncomplete = 0;
+	q->hash = NULL;
 	int i;
 	for (i=0;i<q->cap;i++) {
 		int idx = (q->head + i) % q->cap;
@@ -149,12 +189,7 @@ expand_queue(lua_State *L, struct queue *q) {
 }
 
 static void
-push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
-	if (clone) {
-		void * tmp = skynet_malloc(size);
-		memcpy(tmp, buffer, size);
-		buffer = tmp;
-	}
+push_data(lua_State *L, int fd, void *buffer, int size) {
 	struct queue *q = get_queue(L);
 	struct netpack *np = &q->queue[q->tail];
 	if (++q->tail >= q->cap)
@@ -167,52 +202,29 @@ push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 	}
 }
 
-static struct uncomplete *
-save_uncomplete(lua_State *L, int fd) {
-	struct queue *q = get_queue(L);
-	int h = hash_fd(fd);
-	struct uncomplete * uc = skynet_malloc(sizeof(struct uncomplete));
-	memset(uc, 0, sizeof(*uc));
-	uc->next = q->hash[h];
-	uc->pack.id = fd;
-	q->hash[h] = uc;
-
-	return uc;
-}
-
 static inline int
-read_size(uint8_t * buffer) {
+read_size(const uint8_t * buffer) {
 	int r = (int)buffer[0] << 8 | (int)buffer[1];
 	return r;
 }
 
+// save the rest bytes (less than one package) of fd
 static void
-push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
+save_uncomplete(lua_State *L, int fd, const uint8_t *buffer, int size) {
+	struct queue *q = get_queue(L);
+	struct uncomplete * uc = skynet_malloc(sizeof(struct uncomplete));
+	memset(uc, 0, sizeof(*uc));
+	uc->pack.id = fd;
 	if (size == 1) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
 		uc->read = -1;
 		uc->header = *buffer;
-		return;
-	}
-	int pack_size = read_size(buffer);
-	buffer += 2;
-	size -= 2;
-
-	if (size < pack_size) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = size;
-		uc->pack.size = pack_size;
-		uc->pack.buffer = skynet_malloc(pack_size);
-		memcpy(uc->pack.buffer, buffer, size);
-		return;
-	}
-	push_data(L, fd, buffer, pack_size, 1);
-
-	buffer += pack_size;
-	size -= pack_size;
-	if (size > 0) {
-		push_more(L, fd, buffer, size);
+	} else {
+		uc->read = size - 2;
+		uc->pack.size = read_size(buffer);
+		uc->pack.buffer = skynet_malloc(uc->pack.size);
+		memcpy(uc->pack.buffer, buffer + 2, size - 2);
 	}
+	insert_uncomplete(q, uc);
 }
 
 static void
@@ -225,18 +237,38 @@ close_uncomplete(lua_State *L, int fd) {
 	}
 }
 
+// the package is the only one, return it directly; otherwise push it into queue
+static void
+output(lua_State *L, struct netpack *one, int total, int fd, void *buffer, int size) {
+	if (total == 1) {
+		one->id = fd;
+		one->buffer = buffer;
+		one->size = size;
+	} else {
+		push_data(L, fd, buffer, size);
+	}
+}
+
+/*
+	buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
+	The first whole package in buffer is moved to the head of buffer and hands out the buffer itself,
+	so the most common case (one package in one message) needs no malloc and copy. The others are copied,
+	because each package should be freed by skynet_free alone (netpack.tostring, or skynet.redirect).
+ */
 static int
-filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
+	uint8_t * ptr = buffer;
+	int buffer_size = size;
 	if (uc) {
 		// fill uncomplete
 		if (uc->read < 0) {
 			// read size
 			assert(uc->read == -1);
-			int pack_size = *buffer;
+			int pack_size = *ptr;
 			pack_size |= uc->header << 8 ;
-			++buffer;
+			++ptr;
 			--size;
 			uc->pack.size = pack_size;
 			uc->pack.buffer = skynet_malloc(pack_size);
@@ -244,76 +276,71 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		}
 		int need = uc->pack.size - uc->read;
 		if (size < need) {
-			memcpy(uc->pack.buffer + uc->read, buffer, size);
+			memcpy(uc->pack.buffer + uc->read, ptr, size);
 			uc->read += size;
-			int h = hash_fd(fd);
-			uc->next = q->hash[h];
-			q->hash[h] = uc;
+			insert_uncomplete(q, uc);
+			skynet_free(buffer);
 			return 1;
 		}
-		memcpy(uc->pack.buffer + uc->read, buffer, need);
-		buffer += need;
+		memcpy(uc->pack.buffer + uc->read, ptr, need);
+		ptr += need;
 		size -= need;
-		if (size == 0) {
-			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
-			lua_pushinteger(L, fd);
-			lua_pushlightuserdata(L, uc->pack.buffer);
-			lua_pushinteger(L, uc->pack.size);
-			skynet_free(uc);
-			return 5;
-		}
-		// more data
-		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
+	}
+	// count the whole packages in buffer
+	int n = 0;
+	const uint8_t * p = ptr;
+	int rest = size;
+	while (rest >= 2) {
+		int pack_size = read_size(p);
+		if (rest - 2 < pack_size)
+			break;
+		p += 2 + pack_size;
+		rest -= 2 + pack_size;
+		++n;
+	}
+	int total = n + (uc != NULL);
+	struct netpack one;
+	if (uc) {
+		output(L, &one, total, fd, uc->pack.buffer, uc->pack.size);
 		skynet_free(uc);
-		push_more(L, fd, buffer, size);
-		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
-		return 2;
-	} else {
-		if (size == 1) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = -1;
-			uc->header = *buffer;
-			return 1;
-		}
-		int pack_size = read_size(buffer);
-		buffer+=2;
-		size-=2;
-
-		if (size < pack_size) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
-			memcpy(uc->pack.buffer, buffer, size);
-			return 1;
-		}
-		if (size == pack_size) {
-			// just one package
-			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
-			lua_pushinteger(L, fd);
-			void * result = skynet_malloc(pack_size);
-			memcpy(result, buffer, size);
-			lua_pushlightuserdata(L, result);
-			lua_pushinteger(L, size);
-			return 5;
+	}
+	int owned = 0;	// buffer is handed out with the first package
+	int i;
+	for (i=0;i<n;i++) {
+		int pack_size = read_size(ptr);
+		void * data;
+		if (!owned && pack_size >= buffer_size / 2) {
+			// the package is before the rest bytes, so it can be moved to the head.
+			// don't hold a large buffer for a small package.
+			memmove(buffer, ptr + 2, pack_size);
+			data = buffer;
+			owned = 1;
+		} else {
+			data = skynet_malloc(pack_size);
+			memcpy(data, ptr + 2, pack_size);
 		}
-		// more data
-		push_data(L, fd, buffer, pack_size, 1);
-		buffer += pack_size;
-		size -= pack_size;
-		push_more(L, fd, buffer, size);
-		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
-		return 2;
+		output(L, &one, total, fd, data, pack_size);
+		ptr += 2 + pack_size;
+		size -= 2 + pack_size;
 	}
-}
-
-static inline int
-filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
-	int ret = filter_data_(L, fd, buffer, size);
-	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
-	// it should be free before return,
-	skynet_free(buffer);
-	return ret;
+	if (size > 0) {
+		save_uncomplete(L, fd, ptr, size);
+	}
+	if (!owned) {
+		skynet_free(buffer);
+	}
+	if (total == 0) {
+		return 1;
+	}
+	if (total == 1) {
+		lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
+		lua_pushinteger(L, fd);
+		lua_pushlightuserdata(L, one.buffer);
+		lua_pushinteger(L, one.size);
+		return 5;
+	}
+	lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
+	return 2;
 }
 
 static void
@@ -422,6 +449,9 @@ lpop(lua_State *L) {
 static const char *
 tolstring(lua_State *L, size_t *sz, int index) {
 	const char * ptr;
+	if ((ptr = socket_slice_bytes(L, index, sz))) {
+		return ptr;
+	}
 	if (lua_isuserdata(L,index)) {
 		ptr = (const char *)lua_touserdata(L,index);
 		*sz = (size_t)luaL_checkinteger(L, index+1);
@@ -480,6 +510,12 @@ luaopen_skynet_netpack(lua_State *L) {
 	};
 	luaL_newlib(L,l);
 
+	// the hash and the pending packages of queue are freed by clear, or when the queue is collected
+	luaL_newmetatable(L, QUEUE_METATABLE);
+	lua_pushcfunction(L, lclear);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
 	// the order is same with macros : TYPE_* (defined top)
 	lua_pushliteral(L, "data");
 	lua_pushliteral(L, "more");
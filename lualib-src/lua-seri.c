@@ -5,6 +5,7 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "lua-slice.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -30,6 +31,18 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_EXTEND 7
+// format 2 (luaseri_pack2), hibits :
+// 0 : string def, a string follows, and it's the next one of the string table in this message
+// 1 : string ref, an integer (index of the string table) follows
+// 2 : shape def, integers array_size and n, n keys, array_size values and n values. The keys are the next shape
+// 3 : shape ref, integers shape index and array_size, array_size values and n values of the shape
+#define EXTEND_STRING_DEF 0
+#define EXTEND_STRING_REF 1
+#define EXTEND_SHAPE_DEF 2
+#define EXTEND_SHAPE_REF 3
+// 4 : record of schema (skynet.packschema), uint32 id, the fixed fields, then the strings and the values of "any" fields
+#define EXTEND_SCHEMA 4
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
@@ -37,75 +50,128 @@
 #define BLOCK_SIZE 128
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+// the strings (in [DEDUP_MIN_STRING, DEDUP_MAX_STRING)) and the key sets of tables can be referenced in format 2
+#define DEDUP_MIN_STRING 4
+#define DEDUP_MAX_STRING 64
+#define DEDUP_STRINGS 256
+#define DEDUP_SHAPES 64
+#define SHAPE_MAX_KEYS 32
+
+// skynet.unpackview : the strings not shorter than the threshold are slices of the message, the dedup strings are never slices
+#define VIEW_THRESHOLD 1024
+#define VIEW_MIN_THRESHOLD DEDUP_MAX_STRING
+
+#define SCHEMA_MAX_FIELDS 64
+#define SCHEMA_REGISTRY "skynet.schema"	// id -> the metatable of records
+
+#define FIELD_ANY 0
+#define FIELD_INT 1
+#define FIELD_INT32 2
+#define FIELD_NUMBER 3
+#define FIELD_BOOLEAN 4
+#define FIELD_STRING 5
+
+struct schema_field {
+	int type;
+	int offset;		// in the fixed part
+	const char * name;
+};
+
+// the full userdata in the metatable of records (the key is the address of schema_key), the names follow the fields
+static const int schema_key = 0;
+
+struct schema {
+	uint32_t id;
+	int n;
+	int fixed;	// the size of fixed part
+	const char * name;
+	struct schema_field f[1];
+};
+
+struct dedup_entry {
+	uint32_t hash;
+	int n;		// the length of string, or the number of keys of shape
+	int offset;	// in text (string) or keys (shape)
+};
+
+struct dedup {
+	int nstr;
+	int nshape;
+	int ntext;
+	int nkeys;
+	uint16_t str_slot[DEDUP_STRINGS * 2];	// index + 1, 0 for empty
+	uint16_t shape_slot[DEDUP_SHAPES * 2];
+	struct dedup_entry str[DEDUP_STRINGS];
+	struct dedup_entry shape[DEDUP_SHAPES];
+	int keys[DEDUP_SHAPES * SHAPE_MAX_KEYS];	// the string indexes of shape keys
+	char text[DEDUP_STRINGS * DEDUP_MAX_STRING];	// the copies of strings, the strings returned by __pairs may be collected
 };
 
+// A contiguous buffer, it starts at init (on stack) and grows by realloc.
+// The heap buffer is handed off as the message directly, see seri().
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	int format;
+	struct dedup *dd;	// format 2, allocated at the first string
+	char init[BLOCK_SIZE];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	// format 2 : the string table and the shape table at the stack index, see luaseri_unpack
+	int strings;
+	int shapes;
+	int nstr;
+	int nshape;
+	int schemas;	// the registry of schemas, loaded at the first record
+	struct socket_slice * view;	// the slice of whole message in luaseri_unpackview, NULL for lua strings
+	size_t threshold;
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap - b->len < sz) {
+		cap *= 2;
+	}
+	if (b->buffer == b->init) {
+		b->buffer = skynet_malloc(cap);
+		memcpy(b->buffer, b->init, b->len);
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->cap - b->len < sz) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb, int format) {
+	wb->buffer = wb->init;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = BLOCK_SIZE;
+	wb->format = format;
+	wb->dd = NULL;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
-	wb->len = 0;
+	if (wb->buffer != wb->init) {
+		skynet_free(wb->buffer);
+	}
+	skynet_free(wb->dd);
+	wb_init(wb, wb->format);
 }
 
 static void
@@ -113,6 +179,13 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->strings = 0;
+	rb->shapes = 0;
+	rb->nstr = 0;
+	rb->nshape = 0;
+	rb->schemas = 0;
+	rb->view = NULL;
+	rb->threshold = 0;
 }
 
 static const void *
@@ -212,6 +285,114 @@ wb_string(struct write_block *wb, const char *str, int len) {
 	}
 }
 
+static inline uint32_t
+dedup_hash(const char *str, int len) {
+	uint32_t h = 2166136261u ^ (uint32_t)len;
+	int i;
+	for (i=0;i<len;i++) {
+		h = (h ^ (uint8_t)str[i]) * 16777619u;
+	}
+	return h;
+}
+
+static struct dedup *
+dedup_get(struct write_block *wb) {
+	struct dedup *d = wb->dd;
+	if (d == NULL) {
+		// only the heads are initialized
+		d = wb->dd = skynet_malloc(sizeof(*d));
+		d->nstr = 0;
+		d->nshape = 0;
+		d->ntext = 0;
+		d->nkeys = 0;
+		memset(d->str_slot, 0, sizeof(d->str_slot));
+		memset(d->shape_slot, 0, sizeof(d->shape_slot));
+	}
+	return d;
+}
+
+// return the index of string, or -1 and the empty slot
+static int
+dedup_find_string(struct dedup *d, const char *str, int len, uint32_t h, int *slot) {
+	int mask = DEDUP_STRINGS * 2 - 1;
+	int i = h & mask;
+	while (d->str_slot[i]) {
+		int idx = d->str_slot[i] - 1;
+		struct dedup_entry *e = &d->str[idx];
+		if (e->hash == h && e->n == len && memcmp(d->text + e->offset, str, len) == 0)
+			return idx;
+		i = (i + 1) & mask;
+	}
+	*slot = i;
+	return -1;
+}
+
+static int
+dedup_string_index(struct dedup *d, const char *str, int len) {
+	int slot;
+	return dedup_find_string(d, str, len, dedup_hash(str, len), &slot);
+}
+
+// write a string of format 2 : def or ref. force for the keys of shape. return the index, or -1 when it's written in full
+static int
+wb_string_dedup(struct write_block *wb, const char *str, int len, int force) {
+	if (len >= DEDUP_MAX_STRING || len < (force ? 1 : DEDUP_MIN_STRING)) {
+		wb_string(wb, str, len);
+		return -1;
+	}
+	struct dedup *d = dedup_get(wb);
+	uint32_t h = dedup_hash(str, len);
+	int slot;
+	int idx = dedup_find_string(d, str, len, h, &slot);
+	if (idx >= 0) {
+		uint8_t n = COMBINE_TYPE(TYPE_EXTEND, EXTEND_STRING_REF);
+		wb_push(wb, &n, 1);
+		wb_integer(wb, idx);
+		return idx;
+	}
+	if (d->nstr >= DEDUP_STRINGS) {
+		wb_string(wb, str, len);
+		return -1;
+	}
+	idx = d->nstr++;
+	struct dedup_entry *e = &d->str[idx];
+	e->hash = h;
+	e->n = len;
+	e->offset = d->ntext;
+	memcpy(d->text + d->ntext, str, len);
+	d->ntext += len;
+	d->str_slot[slot] = idx + 1;
+	uint8_t n = COMBINE_TYPE(TYPE_EXTEND, EXTEND_STRING_DEF);
+	wb_push(wb, &n, 1);
+	wb_string(wb, str, len);
+	return idx;
+}
+
+static uint32_t
+shape_hash(const int *keys, int n) {
+	uint32_t h = (uint32_t)n;
+	int i;
+	for (i=0;i<n;i++) {
+		h = (h ^ (uint32_t)keys[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int
+dedup_find_shape(struct dedup *d, const int *keys, int n, uint32_t h, int *slot) {
+	int mask = DEDUP_SHAPES * 2 - 1;
+	int i = h & mask;
+	while (d->shape_slot[i]) {
+		int idx = d->shape_slot[i] - 1;
+		struct dedup_entry *e = &d->shape[idx];
+		if (e->hash == h && e->n == n && memcmp(d->keys + e->offset, keys, n * sizeof(int)) == 0)
+			return idx;
+		i = (i + 1) & mask;
+	}
+	*slot = i;
+	return -1;
+}
+
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
 static int
@@ -282,6 +463,205 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 	return 0;
 }
 
+// format 2 : the table with string keys in hash part is written as a shape (def or ref) and the values.
+// return 1 if it's not a shape
+static int
+wb_table_shape(lua_State *L, struct write_block *wb, int index, int depth) {
+	const char * key[SHAPE_MAX_KEYS];
+	int len[SHAPE_MAX_KEYS];
+	int keys[SHAPE_MAX_KEYS];
+	int array_size = lua_rawlen(L,index);
+	int n = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_type(L, -2) != LUA_TSTRING) {
+			if (lua_isinteger(L, -2)) {
+				lua_Integer x = lua_tointeger(L,-2);
+				if (x>0 && x<=array_size) {
+					lua_pop(L,1);
+					continue;
+				}
+			}
+			lua_pop(L,2);
+			return 1;
+		}
+		size_t sz = 0;
+		const char * str = lua_tolstring(L, -2, &sz);
+		if (n >= SHAPE_MAX_KEYS || sz == 0 || sz >= DEDUP_MAX_STRING) {
+			lua_pop(L,2);
+			return 1;
+		}
+		key[n] = str;
+		len[n] = (int)sz;
+		++n;
+		lua_pop(L,1);
+	}
+	if (n == 0)
+		return 1;
+	struct dedup *d = dedup_get(wb);
+	int i, missing = 0;
+	for (i=0;i<n;i++) {
+		keys[i] = dedup_string_index(d, key[i], len[i]);
+		if (keys[i] < 0)
+			++missing;
+	}
+	int slot = 0;
+	int idx = -1;
+	uint32_t h = 0;
+	if (missing == 0) {
+		h = shape_hash(keys, n);
+		idx = dedup_find_shape(d, keys, n, h, &slot);
+	}
+	if (idx >= 0) {
+		uint8_t t = COMBINE_TYPE(TYPE_EXTEND, EXTEND_SHAPE_REF);
+		wb_push(wb, &t, 1);
+		wb_integer(wb, idx);
+		wb_integer(wb, array_size);
+	} else {
+		if (d->nshape >= DEDUP_SHAPES || d->nstr + missing > DEDUP_STRINGS)
+			return 1;
+		uint8_t t = COMBINE_TYPE(TYPE_EXTEND, EXTEND_SHAPE_DEF);
+		wb_push(wb, &t, 1);
+		wb_integer(wb, array_size);
+		wb_integer(wb, n);
+		for (i=0;i<n;i++) {
+			keys[i] = wb_string_dedup(wb, key[i], len[i], 1);
+		}
+		if (missing) {
+			h = shape_hash(keys, n);
+			dedup_find_shape(d, keys, n, h, &slot);
+		}
+		idx = d->nshape++;
+		struct dedup_entry *e = &d->shape[idx];
+		e->hash = h;
+		e->n = n;
+		e->offset = d->nkeys;
+		memcpy(d->keys + d->nkeys, keys, n * sizeof(int));
+		d->nkeys += n;
+		d->shape_slot[slot] = idx + 1;
+	}
+	for (i=1;i<=array_size;i++) {
+		lua_rawgeti(L,index,i);
+		pack_one(L, wb, -1, depth);
+		lua_pop(L,1);
+	}
+	// the values in the same order of the keys
+	int count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_type(L, -2) != LUA_TSTRING) {
+			lua_pop(L,1);
+			continue;
+		}
+		++count;
+		pack_one(L, wb, -1, depth);
+		lua_pop(L,1);
+	}
+	if (count != n) {
+		lua_pushstring(L, "table changed during serialize");
+		return -1;
+	}
+	return 0;
+}
+
+// a string or a slice
+static inline const char *
+tobytes(lua_State *L, int index, size_t *sz) {
+	if (lua_type(L, index) == LUA_TSTRING) {
+		return lua_tolstring(L, index, sz);
+	}
+	return socket_slice_bytes(L, index, sz);
+}
+
+static void
+schema_error(lua_State *L, struct schema *sc, int i, const char *what) {
+	lua_pushfstring(L, "serialize schema %s : field %s %s", sc->name, sc->f[i].name, what);
+}
+
+// the record of schema : the fields are read by name, and the fixed part is written at the offsets. The schema is on the top of stack
+static int
+wb_schema(lua_State *L, struct write_block *wb, int index, int depth) {
+	struct schema *sc = lua_touserdata(L, -1);
+	char fixed[SCHEMA_MAX_FIELDS * 8];
+	int i;
+	for (i=0;i<sc->n;i++) {
+		struct schema_field *f = &sc->f[i];
+		if (f->type == FIELD_ANY)
+			continue;
+		lua_getfield(L, index, f->name);
+		char *ptr = fixed + f->offset;
+		// the numeric strings aren't converted, and nil isn't false
+		int isnum = lua_type(L, -1) == LUA_TNUMBER;
+		switch (f->type) {
+		case FIELD_INT: {
+			int64_t v = isnum ? lua_tointegerx(L, -1, &isnum) : 0;
+			if (!isnum) {
+				schema_error(L, sc, i, "is not an integer");
+				return 1;
+			}
+			memcpy(ptr, &v, sizeof(v));
+			break;
+		}
+		case FIELD_INT32: {
+			lua_Integer v = isnum ? lua_tointegerx(L, -1, &isnum) : 0;
+			if (!isnum || v != (int32_t)v) {
+				schema_error(L, sc, i, "is not an int32");
+				return 1;
+			}
+			int32_t v32 = (int32_t)v;
+			memcpy(ptr, &v32, sizeof(v32));
+			break;
+		}
+		case FIELD_NUMBER: {
+			if (!isnum) {
+				schema_error(L, sc, i, "is not a number");
+				return 1;
+			}
+			double v = lua_tonumber(L, -1);
+			memcpy(ptr, &v, sizeof(v));
+			break;
+		}
+		case FIELD_BOOLEAN:
+			if (lua_type(L, -1) != LUA_TBOOLEAN) {
+				schema_error(L, sc, i, "is not a boolean");
+				return 1;
+			}
+			*ptr = lua_toboolean(L, -1);
+			break;
+		case FIELD_STRING: {
+			size_t sz;
+			if (tobytes(L, -1, &sz) == NULL) {
+				schema_error(L, sc, i, "is not a string");
+				return 1;
+			}
+			uint32_t len = (uint32_t)sz;
+			memcpy(ptr, &len, sizeof(len));
+			break;
+		}
+		}
+		lua_pop(L, 1);
+	}
+	uint8_t t = COMBINE_TYPE(TYPE_EXTEND, EXTEND_SCHEMA);
+	wb_push(wb, &t, 1);
+	wb_push(wb, &sc->id, sizeof(sc->id));
+	wb_push(wb, fixed, sc->fixed);
+	for (i=0;i<sc->n;i++) {
+		struct schema_field *f = &sc->f[i];
+		if (f->type == FIELD_STRING) {
+			lua_getfield(L, index, f->name);
+			size_t sz;
+			const char * str = tobytes(L, -1, &sz);
+			wb_push(wb, str, (int)sz);
+			lua_pop(L, 1);
+		} else if (f->type == FIELD_ANY) {
+			lua_getfield(L, index, f->name);
+			pack_one(L, wb, -1, depth);
+			lua_pop(L, 1);
+		}
+	}
+	return 0;
+}
+
 static int
 wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (!lua_checkstack(L, LUA_MINSTACK)) {
@@ -291,9 +671,24 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (index < 0) {
 		index = lua_gettop(L) + index + 1;
 	}
+	if (lua_getmetatable(L, index)) {
+		if (lua_rawgetp(L, -1, &schema_key) == LUA_TUSERDATA) {
+			int err = wb_schema(L, wb, index, depth);
+			if (err)
+				return err;
+			lua_pop(L, 2);
+			return 0;
+		}
+		lua_pop(L, 2);
+	}
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		return wb_table_metapairs(L, wb, index, depth);
 	} else {
+		if (wb->format == 2) {
+			int r = wb_table_shape(L, wb, index, depth);
+			if (r <= 0)
+				return -r;
+		}
 		int array_size = wb_table_array(L, wb, index, depth);
 		wb_table_hash(L, wb, index, depth, array_size);
 		return 0;
@@ -327,12 +722,27 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TSTRING: {
 		size_t sz = 0;
 		const char *str = lua_tolstring(L,index,&sz);
-		wb_string(b, str, (int)sz);
+		if (b->format == 2) {
+			wb_string_dedup(b, str, (int)sz, 0);
+		} else {
+			wb_string(b, str, (int)sz);
+		}
 		break;
 	}
 	case LUA_TLIGHTUSERDATA:
 		wb_pointer(b, lua_touserdata(L,index));
 		break;
+	case LUA_TUSERDATA: {
+		// a slice is packed as a string, from its memory
+		size_t sz = 0;
+		const char *str = socket_slice_bytes(L,index,&sz);
+		if (str == NULL) {
+			wb_free(b);
+			luaL_error(L, "Unsupport type %s to serialize", luaL_typename(L, index));
+		}
+		wb_string(b, str, (int)sz);
+		break;
+	}
 	case LUA_TTABLE: {
 		if (index < 0) {
 			index = lua_gettop(L) + index + 1;
@@ -436,7 +846,11 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 	if (p == NULL) {
 		invalid_stream(L,rb);
 	}
-	lua_pushlstring(L,p,len);
+	if (rb->view && (size_t)len >= rb->threshold) {
+		socket_slice_sub(L, rb->view, p, len);
+	} else {
+		lua_pushlstring(L,p,len);
+	}
 }
 
 static void unpack_one(lua_State *L, struct read_block *rb);
@@ -463,8 +877,12 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		unpack_one(L,rb);
 		lua_rawseti(L,-2,i);
 	}
+	// the keys are always lua strings
+	struct socket_slice * view = rb->view;
 	for (;;) {
+		rb->view = NULL;
 		unpack_one(L,rb);
+		rb->view = view;
 		if (lua_isnil(L,-1)) {
 			lua_pop(L,1);
 			return;
@@ -474,6 +892,180 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+// the integers in the header of format 2
+static int
+get_index(lua_State *L, struct read_block *rb) {
+	const uint8_t * t = (const uint8_t *)rb_read(rb, 1);
+	if (t==NULL) {
+		invalid_stream(L,rb);
+	}
+	int cookie = *t >> 3;
+	if ((*t & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer n = get_integer(L,rb,cookie);
+	if (n < 0 || n > INT32_MAX) {
+		invalid_stream(L,rb);
+	}
+	return (int)n;
+}
+
+// the table of shape, the keys are on the top of stack
+static void
+unpack_shape(lua_State *L, struct read_block *rb, int array_size) {
+	int n = (int)lua_rawlen(L, -1);
+	lua_createtable(L, array_size, n);
+	int i;
+	for (i=1;i<=array_size;i++) {
+		unpack_one(L,rb);
+		lua_rawseti(L,-2,i);
+	}
+	for (i=1;i<=n;i++) {
+		// the interned keys of shape
+		lua_rawgeti(L,-2,i);
+		unpack_one(L,rb);
+		lua_rawset(L,-3);
+	}
+	lua_remove(L,-2);
+}
+
+static const void *
+rb_read_schema(lua_State *L, struct read_block *rb, int sz) {
+	const void * p = rb_read(rb, sz);
+	if (p == NULL) {
+		invalid_stream(L,rb);
+	}
+	return p;
+}
+
+static void
+unpack_schema(lua_State *L, struct read_block *rb) {
+	uint32_t id;
+	memcpy(&id, rb_read_schema(L, rb, sizeof(id)), sizeof(id));
+	if (lua_type(L, rb->schemas) == LUA_TNIL) {
+		lua_getfield(L, LUA_REGISTRYINDEX, SCHEMA_REGISTRY);
+		lua_replace(L, rb->schemas);
+	}
+	if (lua_type(L, rb->schemas) != LUA_TTABLE || lua_rawgeti(L, rb->schemas, id) != LUA_TTABLE) {
+		luaL_error(L, "Unknown schema %I, call skynet.packschema with the same name and fields as the sender", (lua_Integer)id);
+	}
+	// the metatable of record
+	lua_rawgetp(L, -1, &schema_key);
+	struct schema *sc = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	const char * fixed = rb_read_schema(L, rb, sc->fixed);
+	lua_createtable(L, 0, sc->n);
+	int i;
+	for (i=0;i<sc->n;i++) {
+		struct schema_field *f = &sc->f[i];
+		const char * ptr = fixed + f->offset;
+		switch (f->type) {
+		case FIELD_INT: {
+			int64_t v;
+			memcpy(&v, ptr, sizeof(v));
+			lua_pushinteger(L, v);
+			break;
+		}
+		case FIELD_INT32: {
+			int32_t v;
+			memcpy(&v, ptr, sizeof(v));
+			lua_pushinteger(L, v);
+			break;
+		}
+		case FIELD_NUMBER: {
+			double v;
+			memcpy(&v, ptr, sizeof(v));
+			lua_pushnumber(L, v);
+			break;
+		}
+		case FIELD_BOOLEAN:
+			lua_pushboolean(L, *ptr);
+			break;
+		case FIELD_STRING: {
+			uint32_t len;
+			memcpy(&len, ptr, sizeof(len));
+			if (len > (uint32_t)rb->len) {
+				invalid_stream(L,rb);
+			}
+			get_buffer(L, rb, (int)len);
+			break;
+		}
+		default:
+			unpack_one(L, rb);
+			break;
+		}
+		lua_setfield(L, -2, f->name);
+	}
+	lua_insert(L, -2);
+	lua_setmetatable(L, -2);
+}
+
+static void
+unpack_extend(lua_State *L, struct read_block *rb, int cookie) {
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	switch (cookie) {
+	case EXTEND_STRING_DEF:
+		unpack_one(L,rb);
+		if (lua_type(L,-1) != LUA_TSTRING) {
+			invalid_stream(L,rb);
+		}
+		if (rb->nstr == 0) {
+			lua_newtable(L);
+			lua_replace(L, rb->strings);
+		}
+		lua_pushvalue(L,-1);
+		lua_rawseti(L, rb->strings, ++rb->nstr);
+		break;
+	case EXTEND_STRING_REF: {
+		int idx = get_index(L,rb);
+		if (idx >= rb->nstr) {
+			invalid_stream(L,rb);
+		}
+		lua_rawgeti(L, rb->strings, idx + 1);
+		break;
+	}
+	case EXTEND_SHAPE_DEF: {
+		int array_size = get_index(L,rb);
+		int n = get_index(L,rb);
+		if (n == 0 || n > SHAPE_MAX_KEYS) {
+			invalid_stream(L,rb);
+		}
+		lua_createtable(L,n,0);
+		int i;
+		for (i=1;i<=n;i++) {
+			unpack_one(L,rb);
+			if (lua_type(L,-1) != LUA_TSTRING) {
+				invalid_stream(L,rb);
+			}
+			lua_rawseti(L,-2,i);
+		}
+		if (rb->nshape == 0) {
+			lua_newtable(L);
+			lua_replace(L, rb->shapes);
+		}
+		lua_pushvalue(L,-1);
+		lua_rawseti(L, rb->shapes, ++rb->nshape);
+		unpack_shape(L, rb, array_size);
+		break;
+	}
+	case EXTEND_SHAPE_REF: {
+		int idx = get_index(L,rb);
+		if (idx >= rb->nshape) {
+			invalid_stream(L,rb);
+		}
+		int array_size = get_index(L,rb);
+		lua_rawgeti(L, rb->shapes, idx + 1);
+		unpack_shape(L, rb, array_size);
+		break;
+	}
+	case EXTEND_SCHEMA:
+		unpack_schema(L, rb);
+		break;
+	default:
+		invalid_stream(L,rb);
+	}
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -523,6 +1115,9 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		unpack_table(L,rb,cookie);
 		break;
 	}
+	case TYPE_EXTEND:
+		unpack_extend(L,rb,cookie);
+		break;
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -542,24 +1137,60 @@ unpack_one(lua_State *L, struct read_block *rb) {
 }
 
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
+seri(lua_State *L, struct write_block *wb) {
+	int len = wb->len;
+	char * buffer = wb->buffer;
+	if (buffer == wb->init) {
+		buffer = skynet_malloc(len);
+		memcpy(buffer, wb->init, len);
+	} else {
+		if (wb->cap - len > len / 4) {
+			// give back the unused space of the last growth, it's kept in message queue
+			buffer = skynet_realloc(buffer, len);
 		}
+		// hand off the buffer as the message
+		wb->buffer = wb->init;
 	}
-	
+
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, len);
+}
+
+// unpack the buffer at index 1, the values are returned above it
+static int
+unpack_buffer(lua_State *L, void *buffer, int len, struct socket_slice *view, size_t threshold) {
+	lua_settop(L,1);
+	struct read_block rb;
+	rball_init(&rb, buffer, len);
+	rb.view = view;
+	rb.threshold = threshold;
+	// the string table and the shape table of format 2 (created at the first def), and the schemas
+	lua_pushnil(L);
+	lua_pushnil(L);
+	lua_pushnil(L);
+	rb.strings = 2;
+	rb.shapes = 3;
+	rb.schemas = 4;
+
+	int i;
+	for (i=0;;i++) {
+		if (i%8==7) {
+			luaL_checkstack(L,LUA_MINSTACK,NULL);
+		}
+		uint8_t type = 0;
+		const uint8_t * t = (const uint8_t *)rb_read(&rb, sizeof(type));
+		if (t==NULL)
+			break;
+		type = *t;
+		push_value(L, &rb, type & 0x7, type>>3);
+	}
+
+	// Need not free buffer
+	lua_remove(L, rb.schemas);
+	lua_remove(L, rb.shapes);
+	lua_remove(L, rb.strings);
+
+	return lua_gettop(L) - 1;
 }
 
 int
@@ -569,10 +1200,12 @@ luaseri_unpack(lua_State *L) {
 	}
 	void * buffer;
 	int len;
+	size_t sz;
 	if (lua_type(L,1) == LUA_TSTRING) {
-		size_t sz;
 		 buffer = (void *)lua_tolstring(L,1,&sz);
 		len = (int)sz;
+	} else if ((buffer = (void *)socket_slice_bytes(L,1,&sz))) {
+		len = (int)sz;
 	} else {
 		buffer = lua_touserdata(L,1);
 		len = luaL_checkinteger(L,2);
@@ -583,40 +1216,151 @@ luaseri_unpack(lua_State *L) {
 	if (buffer == NULL) {
 		return luaL_error(L, "deserialize null pointer");
 	}
+	return unpack_buffer(L, buffer, len, NULL, 0);
+}
 
-	lua_settop(L,1);
-	struct read_block rb;
-	rball_init(&rb, buffer, len);
-
-	int i;
-	for (i=0;;i++) {
-		if (i%8==7) {
-			luaL_checkstack(L,LUA_MINSTACK,NULL);
+int
+luaseri_unpackview(lua_State *L) {
+	lua_Integer threshold = luaL_optinteger(L, 3, VIEW_THRESHOLD);
+	if (threshold < VIEW_MIN_THRESHOLD) {
+		threshold = VIEW_MIN_THRESHOLD;
+	}
+	struct socket_slice * s = (struct socket_slice *)luaL_testudata(L, 1, SOCKET_SLICE);
+	if (s) {
+		// the views share the memory of slice
+		size_t sz = 0;
+		void * buffer = (void *)socket_slice_bytes(L, 1, &sz);
+		if (sz == 0) {
+			return 0;
 		}
-		uint8_t type = 0;
-		const uint8_t * t = (const uint8_t *)rb_read(&rb, sizeof(type));
-		if (t==NULL)
-			break;
-		type = *t;
-		push_value(L, &rb, type & 0x7, type>>3);
+		return unpack_buffer(L, buffer, (int)sz, s, (size_t)threshold);
 	}
-
-	// Need not free buffer
-
-	return lua_gettop(L) - 1;
+	if (lua_type(L,1) != LUA_TLIGHTUSERDATA) {
+		return luaseri_unpack(L);
+	}
+	void * buffer = lua_touserdata(L,1);
+	int len = luaL_checkinteger(L,2);
+	if (buffer == NULL) {
+		return luaL_error(L, "deserialize null pointer");
+	}
+	// the message is owned by the slice of whole message from now on, it's freed with the last view
+	s = socket_slice_new(L, buffer, len);
+	lua_replace(L, 1);
+	int n = 0;
+	if (len > 0) {
+		n = unpack_buffer(L, buffer, len, s, (size_t)threshold);
+	}
+	socket_slice_free(s);
+	return n;
 }
 
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, 1);
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	seri(L, &wb);
+	wb_free(&wb);
 
+	return 2;
+}
+
+LUAMOD_API int
+luaseri_pack2(lua_State *L) {
+	struct write_block wb;
+	wb_init(&wb, 2);
+	pack_from(L,&wb,0);
+	seri(L, &wb);
 	wb_free(&wb);
 
 	return 2;
 }
+
+static int
+field_type(const char *type) {
+	static const char * types[] = { "any", "int", "int32", "number", "boolean", "string", NULL };
+	int i;
+	for (i=0;types[i];i++) {
+		if (strcmp(type, types[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static const int field_size[] = { 0, 8, 4, 8, 1, 4 };
+
+// packschema(name, { "field:type", ... }), type is any (default), int, int32, number, boolean or string.
+// return the metatable of records, the tables with it are packed by the schema.
+LUAMOD_API int
+luaseri_schema(lua_State *L) {
+	size_t namesz;
+	const char * name = luaL_checklstring(L, 1, &namesz);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int n = (int)lua_rawlen(L, 2);
+	luaL_argcheck(L, n > 0 && n <= SCHEMA_MAX_FIELDS, 2, "too many fields or empty");
+	// the layout is the string "name\0field:type\0..." , and the id is the hash of it
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	luaL_addlstring(&b, name, namesz + 1);
+	int i;
+	for (i=1;i<=n;i++) {
+		if (lua_rawgeti(L, 2, i) != LUA_TSTRING) {
+			return luaL_error(L, "schema %s : field %d should be a string", name, i);
+		}
+		const char * field = lua_tostring(L, -1);
+		const char * sep = strchr(field, ':');
+		if (sep == field || field_type(sep ? sep + 1 : "any") < 0) {
+			return luaL_error(L, "schema %s : invalid field %s", name, field);
+		}
+		luaL_addvalue(&b);
+		if (sep == NULL) {
+			luaL_addstring(&b, ":any");
+		}
+		luaL_addchar(&b, '\0');
+	}
+	luaL_pushresult(&b);
+	size_t layoutsz;
+	const char * layout = lua_tolstring(L, -1, &layoutsz);
+	uint32_t id = dedup_hash(layout, (int)layoutsz);
+
+	if (luaL_getsubtable(L, LUA_REGISTRYINDEX, SCHEMA_REGISTRY)) {
+		if (lua_rawgeti(L, -1, id) == LUA_TTABLE) {
+			lua_getfield(L, -1, "__layout");
+			if (!lua_rawequal(L, -1, -4)) {
+				return luaL_error(L, "schema %s : the id %I is used by another schema", name, (lua_Integer)id);
+			}
+			lua_pop(L, 1);
+			return 1;
+		}
+		lua_pop(L, 1);
+	}
+	struct schema *sc = lua_newuserdatauv(L, sizeof(*sc) + (n - 1) * sizeof(struct schema_field) + layoutsz, 0);
+	// the names are in the copy of layout
+	char * text = (char *)&sc->f[n];
+	memcpy(text, layout, layoutsz);
+	sc->id = id;
+	sc->n = n;
+	sc->name = text;
+	int offset = 0;
+	char * ptr = text + namesz + 1;
+	for (i=0;i<n;i++) {
+		char * sep = strchr(ptr, ':');
+		*sep = '\0';
+		int type = field_type(sep + 1);
+		sc->f[i].name = ptr;
+		sc->f[i].type = type;
+		sc->f[i].offset = offset;
+		offset += field_size[type];
+		ptr = sep + strlen(sep + 1) + 2;
+	}
+	sc->fixed = offset;
+
+	lua_createtable(L, 0, 2);
+	lua_insert(L, -2);
+	lua_rawsetp(L, -2, &schema_key);
+	lua_pushvalue(L, -3);
+	lua_setfield(L, -2, "__layout");
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -3, id);
+	return 1;
+}
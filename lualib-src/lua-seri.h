@@ -4,6 +4,13 @@
 #include <lua.h>
 
 int luaseri_pack(lua_State *L);
+// format 2 : the repeated strings and the key sets of tables are referenced in the message, luaseri_unpack decodes both
+int luaseri_pack2(lua_State *L);
+// register a schema of records : name, { "field:type", ... }. return the metatable of records
+int luaseri_schema(lua_State *L);
 int luaseri_unpack(lua_State *L);
+// msg, sz [, threshold] : the long strings are slices (see lua-slice.h) share the memory of msg, which is owned by the slices.
+// msg can be a slice, then the views share its memory
+int luaseri_unpackview(lua_State *L);
 
 #endif
@@ -2,6 +2,7 @@
 
 #include "skynet.h"
 #include "lua-seri.h"
+#include "lua-slice.h"
 
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
@@ -48,6 +49,9 @@ traceback (lua_State *L) {
 
 struct callback_context {
 	lua_State *L;
+	const void *msg;	// the message in dispatch
+	const void *claimed;	// the message is owned by the slices of skynet.unpackview, don't delete it
+	int forward;	// forward mode : the message is never deleted by callback, lua trashes it after dispatch
 };
 
 static int
@@ -56,6 +60,8 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 	lua_State *L = cb_ctx->L;
 	int trace = 1;
 	int r;
+	cb_ctx->msg = msg;
+	cb_ctx->claimed = NULL;
 	lua_pushvalue(L,2);
 
 	lua_pushinteger(L, type);
@@ -65,9 +71,12 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 	lua_pushinteger(L, source);
 
 	r = lua_pcall(L, 5, 0 , trace); //调用lua层的skynet.dispatch_message，入参是上面5个值
+	int keep = cb_ctx->claimed != NULL;
+	cb_ctx->msg = NULL;
+	cb_ctx->claimed = NULL;
  
 	if (r == LUA_OK) {
-		return 0;
+		return keep;
 	}
 	const char * self = skynet_command(context, "REG", NULL);
 	switch (r) {
@@ -84,7 +93,7 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 
 	lua_pop(L,1);
 
-	return 0;
+	return keep;
 }
 
 static int
@@ -131,6 +140,9 @@ lcallback(lua_State *L) {
 	struct callback_context * cb_ctx = (struct callback_context *)lua_newuserdatauv(L, sizeof(*cb_ctx), 2);
 	//创建一个新的 Lua 协程，将其作为 cb_ctx->L 的回调环境。使用协程使得回调可以被异步调用，不会阻塞主 Lua 线程
 	cb_ctx->L = lua_newthread(L);
+	cb_ctx->msg = NULL;
+	cb_ctx->claimed = NULL;
+	cb_ctx->forward = forward;
 	lua_pushcfunction(cb_ctx->L, traceback);//将 traceback 函数（通常用于调试或捕获错误）压入协程栈。
 	lua_setiuservalue(L, -2, 1);//将 traceback 函数设置为 cb_ctx 用户数据的第一个用户值，用于回调时捕获错误信息
 	lua_getfield(L, LUA_REGISTRYINDEX, "callback_context");//从 Lua 注册表中获取 callback_context 表并将其压入栈顶
@@ -282,6 +294,23 @@ send_message(lua_State *L, int source, int idx_type) {
 		}
 		break;
 	}
+	case LUA_TUSERDATA: {
+		// a slice is copied into the message, like a string
+		size_t len = 0;
+		void * msg = (void *)socket_slice_bytes(L,idx_type+2,&len);
+		if (msg == NULL) {
+			luaL_error(L, "invalid param %s", luaL_typename(L,idx_type+2));
+		}
+		if (len == 0) {
+			msg = NULL;
+		}
+		if (dest_string) {
+			session = skynet_sendname(context, source, dest_string, type, session , msg, len);
+		} else {
+			session = skynet_send(context, source, dest, type, session , msg, len);
+		}
+		break;
+	}
 	case LUA_TLIGHTUSERDATA: {
 		void * msg = lua_touserdata(L,idx_type+2);
 		int size = luaL_checkinteger(L,idx_type+3);
@@ -315,6 +344,7 @@ send_message(lua_State *L, int source, int idx_type) {
 	integer type
 	integer session
 	string message
+	 slice message
 	 lightuserdata message_ptr
 	 integer len
  */
@@ -387,6 +417,38 @@ lharbor(lua_State *L) {
 	return 2;
 }
 
+/*
+	lightuserdata msg / slice / string
+	integer sz
+	integer threshold (optional)
+
+	The message of current dispatch is kept until the slices are collected, see luaseri_unpackview.
+	In forward mode (skynet.forward_type) the message is trashed after dispatch, so the slices own a copy of it.
+ */
+static int
+lunpackview(lua_State *L) {
+	if (lua_type(L,1) == LUA_TLIGHTUSERDATA) {
+		const void * msg = lua_touserdata(L,1);
+		if (lua_getfield(L, LUA_REGISTRYINDEX, "callback_context") == LUA_TUSERDATA) {
+			struct callback_context *cb_ctx = (struct callback_context *)lua_touserdata(L, -1);
+			if (cb_ctx->forward) {
+				size_t sz = (size_t)luaL_checkinteger(L, 2);
+				void * copy = skynet_malloc(sz);
+				memcpy(copy, msg, sz);
+				lua_pushlightuserdata(L, copy);
+				lua_replace(L, 1);
+			} else if (msg == cb_ctx->claimed) {
+				return luaL_error(L, "The message is unpacked by unpackview already");
+			}
+			if (msg == cb_ctx->msg) {
+				cb_ctx->claimed = msg;
+			}
+		}
+		lua_pop(L, 1);
+	}
+	return luaseri_unpackview(L);
+}
+
 static int
 lpackstring(lua_State *L) {
 	luaseri_pack(L);
@@ -519,7 +581,10 @@ luaopen_skynet_core(lua_State *L) {
 	luaL_Reg l2[] = {
 		{ "tostring", ltostring },
 		{ "pack", luaseri_pack },
+		{ "pack2", luaseri_pack2 },
+		{ "packschema", luaseri_schema },
 		{ "unpack", luaseri_unpack },
+		{ "unpackview", lunpackview },
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
 		{ "now", lnow },
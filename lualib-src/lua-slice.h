@@ -0,0 +1,43 @@
+#ifndef LUA_SOCKET_SLICE_H
+#define LUA_SOCKET_SLICE_H
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stddef.h>
+
+#define SOCKET_SLICE "socket_slice"	// metatable name of the slice userdata
+
+struct slice_block;
+
+// A view of the bytes received by socket, created by socket.read_slice (see lua-socket.c), or of a long
+// string in a message unpacked by skynet.unpackview (see lua-seri.c).
+// It keeps the memory of the socket buffer (or the message) alive without copying it into a lua string.
+struct socket_slice {
+	const char * ptr;
+	size_t sz;
+	struct slice_block * block;	// NULL after slice:free()
+};
+
+// return the bytes of the slice at index, or NULL if it isn't a slice.
+// the bytes are valid while the slice is on the stack.
+static inline const char *
+socket_slice_bytes(lua_State *L, int index, size_t *sz) {
+	struct socket_slice * s = (struct socket_slice *)luaL_testudata(L, index, SOCKET_SLICE);
+	if (s == NULL)
+		return NULL;
+	if (s->block == NULL)
+		luaL_argerror(L, index, "the slice is freed");
+	*sz = s->sz;
+	return s->ptr;
+}
+
+// implemented in lua-socket.c, for the modules in skynet.so. The slices are used in one lua vm.
+
+// push a slice owns msg (allocated by skynet_malloc), msg is freed with the last slice shares it
+struct socket_slice * socket_slice_new(lua_State *L, char *msg, size_t sz);
+// push a slice of the bytes in the memory of s
+struct socket_slice * socket_slice_sub(lua_State *L, struct socket_slice *s, const char *ptr, size_t sz);
+// the same as slice:free()
+void socket_slice_free(struct socket_slice *s);
+
+#endif
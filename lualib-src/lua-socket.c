@@ -13,18 +13,26 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "skynet.h"
 #include "skynet_socket.h"
+#include "lua-slice.h"
 
 #define BACKLOG 32	// 默认的 listen 的 backlog 参数
 // 2 ** 12 == 4096
 #define LARGE_PAGE_NODE 12		// 决定分配缓存数据块的最大数量, 2 的次方
 #define POOL_SIZE_WARNING 32
 #define BUFFER_LIMIT (256 * 1024)
+#define ZEROCOPY_THRESHOLD (32 * 1024)	// 默认使用 MSG_ZEROCOPY 的数据大小下限
+#define FRAME_MAX (16 * 1024 * 1024)	// 分帧模式默认的帧长度上限
+#define SCAN_SEP_MAX 16		// readline 的分隔符不超过这个长度时, 记录扫描进度
 
 // 缓存节点, buffer_node 是不会被删除掉的, 除非所在的 lua 虚拟机 close 了, 这时 buffer_node 的内存资源才会被回收.
 // 在使用过程中, 都是对 msg 指向的内容做操作.
@@ -32,14 +40,32 @@ struct buffer_node {
 	char * msg;	// 数据指针
 	int sz;	// 数据大小
 	struct buffer_node *next;	// 关联的下一个节点
+	struct slice_block *block;	// msg 被 slice 引用时不为 NULL, 由 block 负责释放 msg
 };
 
+// slice 和 buffer_node 共享的内存, 引用计数为 0 时释放. 只在一个 lua 虚拟机中使用, 不需要原子操作
+struct slice_block {
+	int ref;
+	char * msg;
+};
+
+static void
+slice_release(struct slice_block *block) {
+	if (--block->ref == 0) {
+		skynet_free(block->msg);
+		skynet_free(block);
+	}
+}
+
 /// socket 数据缓存, 队列数据结构, 这里保存的 buffer_node 都是引用可用数据的
 struct socket_buffer {
 	int size;		// 当前链表存储数据的总大小
 	int offset;		// 当前正在读取的 buffer_node 的指针偏移量, 因为可能存在当前的 buffer_node 的数据只读取了部分的情况, 所以需要记录已经被读取的内容
 	struct buffer_node *head;	// 指向队列头元素的指针
 	struct buffer_node *tail;	// 指向队列尾元素的指针
+	int scan;		// readline 已经扫描过的字节数(从 offset 开始), 分隔符 scan_sep 不会从这些位置开始
+	int scan_seplen;	// 0 表示没有扫描进度
+	char scan_sep[SCAN_SEP_MAX];
 };
 
 /**
@@ -60,10 +86,13 @@ lfreepool(lua_State *L) {
 	int i;
 	for (i=0;i<sz;i++) {
 		struct buffer_node *node = &pool[i];
-		if (node->msg) {
+		if (node->block) {
+			slice_release(node->block);
+			node->block = NULL;
+		} else if (node->msg) {
 			skynet_free(node->msg);
-			node->msg = NULL;
 		}
+		node->msg = NULL;
 	}
 	return 0;
 }
@@ -79,6 +108,7 @@ lnewpool(lua_State *L, int sz) {
 		pool[i].msg = NULL;
 		pool[i].sz = 0;
 		pool[i].next = &pool[i+1];
+		pool[i].block = NULL;
 	}
 	// luaL_newmetatable 这时栈顶是一个 table 类型
 	pool[sz-1].next = NULL;
@@ -104,6 +134,8 @@ lnewbuffer(lua_State *L) {
 	sb->offset = 0;
 	sb->head = NULL;
 	sb->tail = NULL;
+	sb->scan = 0;
+	sb->scan_seplen = 0;
 	
 	return 1;
 }
@@ -231,7 +263,12 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 	lua_rawgeti(L,pool,1);
 	free_node->next = lua_touserdata(L,-1);
 	lua_pop(L,1);
-	skynet_free(free_node->msg);
+	if (free_node->block) {
+		slice_release(free_node->block);
+		free_node->block = NULL;
+	} else {
+		skynet_free(free_node->msg);
+	}
 	free_node->msg = NULL;
 
 	free_node->sz = 0;
@@ -242,6 +279,7 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 static void
 pop_lstring(lua_State *L, struct socket_buffer *sb, int sz, int skip) {
 	struct buffer_node * current = sb->head;
+	sb->scan = sb->scan > sz ? sb->scan - sz : 0;
 	if (sz < current->sz - sb->offset) {
 		lua_pushlstring(L, current->msg + sb->offset, sz-skip);
 		sb->offset+=sz;
@@ -324,6 +362,162 @@ lpopbuffer(lua_State *L) {
 	return 2;
 }
 
+void
+socket_slice_free(struct socket_slice *slice) {
+	if (slice->block) {
+		slice_release(slice->block);
+		slice->block = NULL;
+	}
+}
+
+static int
+lslice_gc(lua_State *L) {
+	socket_slice_free(luaL_checkudata(L, 1, SOCKET_SLICE));
+	return 0;
+}
+
+static int
+lslice_len(lua_State *L) {
+	size_t sz = 0;
+	luaL_checkudata(L, 1, SOCKET_SLICE);
+	socket_slice_bytes(L, 1, &sz);
+	lua_pushinteger(L, sz);
+	return 1;
+}
+
+static int
+lslice_tostring(lua_State *L) {
+	size_t sz = 0;
+	luaL_checkudata(L, 1, SOCKET_SLICE);
+	const char * ptr = socket_slice_bytes(L, 1, &sz);
+	lua_pushlstring(L, ptr, sz);
+	return 1;
+}
+
+// return lightuserdata, size for the apis accept (msg, sz). the pointer is valid until the slice is freed.
+static int
+lslice_ptr(lua_State *L) {
+	size_t sz = 0;
+	luaL_checkudata(L, 1, SOCKET_SLICE);
+	const char * ptr = socket_slice_bytes(L, 1, &sz);
+	lua_pushlightuserdata(L, (void *)ptr);
+	lua_pushinteger(L, sz);
+	return 2;
+}
+
+static struct socket_slice *
+new_slice(lua_State *L) {
+	struct socket_slice *slice = lua_newuserdatauv(L, sizeof(*slice), 0);
+	slice->ptr = NULL;
+	slice->sz = 0;
+	slice->block = NULL;
+	if (luaL_newmetatable(L, SOCKET_SLICE)) {
+		luaL_Reg l[] = {
+			{ "tostring", lslice_tostring },
+			{ "ptr", lslice_ptr },
+			{ "free", lslice_gc },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lslice_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, lslice_len);
+		lua_setfield(L, -2, "__len");
+		lua_pushcfunction(L, lslice_tostring);
+		lua_setfield(L, -2, "__tostring");
+	}
+	lua_setmetatable(L, -2);
+	return slice;
+}
+
+struct socket_slice *
+socket_slice_new(lua_State *L, char *msg, size_t sz) {
+	struct socket_slice *slice = new_slice(L);
+	struct slice_block *block = skynet_malloc(sizeof(*block));
+	block->ref = 1;
+	block->msg = msg;
+	slice->block = block;
+	slice->ptr = msg;
+	slice->sz = sz;
+	return slice;
+}
+
+struct socket_slice *
+socket_slice_sub(lua_State *L, struct socket_slice *s, const char *ptr, size_t sz) {
+	struct socket_slice *slice = new_slice(L);
+	++s->block->ref;
+	slice->block = s->block;
+	slice->ptr = ptr;
+	slice->sz = sz;
+	return slice;
+}
+
+/*
+	userdata send_buffer
+	table pool
+	integer sz
+
+	return slice, size of buffer
+
+	The slice shares the memory of the buffer node when the bytes are in one node (always in frame mode),
+	otherwise the bytes are copied into one block. No lua string is created.
+ */
+static int
+lpopslice(lua_State *L) {
+	struct socket_buffer * sb = lua_touserdata(L, 1);
+	if (sb == NULL) {
+		return luaL_error(L, "Need buffer object at param 1");
+	}
+	luaL_checktype(L,2,LUA_TTABLE);
+	int sz = luaL_checkinteger(L,3);
+	if (sb->size < sz || sz <= 0) {
+		lua_pushnil(L);
+		lua_pushinteger(L, sb->size);
+		return 2;
+	}
+	struct buffer_node * current = sb->head;
+	int bytes = current->sz - sb->offset;
+	if (sz <= bytes) {
+		struct socket_slice *slice = new_slice(L);
+		if (current->block == NULL) {
+			struct slice_block *block = skynet_malloc(sizeof(*block));
+			block->ref = 1;
+			block->msg = current->msg;
+			current->block = block;
+		}
+		++current->block->ref;
+		slice->block = current->block;
+		slice->ptr = current->msg + sb->offset;
+		slice->sz = sz;
+		sb->offset += sz;
+		if (sz == bytes) {
+			return_free_node(L,2,sb);
+		}
+	} else {
+		char * ptr = skynet_malloc(sz);
+		socket_slice_new(L, ptr, sz);
+		int left = sz;
+		while (left > 0) {
+			current = sb->head;
+			bytes = current->sz - sb->offset;
+			if (bytes > left) {
+				memcpy(ptr, current->msg + sb->offset, left);
+				sb->offset += left;
+				break;
+			}
+			memcpy(ptr, current->msg + sb->offset, bytes);
+			ptr += bytes;
+			left -= bytes;
+			return_free_node(L,2,sb);
+		}
+	}
+	sb->size -= sz;
+	sb->scan = sb->scan > sz ? sb->scan - sz : 0;
+	lua_pushinteger(L, sb->size);
+	return 2;
+}
+
 /*
 	userdata send_buffer
 	table pool
@@ -342,6 +536,7 @@ lclearbuffer(lua_State *L) {
 		return_free_node(L,2,sb);
 	}
 	sb->size = 0;
+	sb->scan = 0;
 	return 0;
 }
 
@@ -361,6 +556,7 @@ lreadall(lua_State *L) {
 	}
 	luaL_pushresult(&b);
 	sb->size = 0;
+	sb->scan = 0;
 	return 1;
 }
 
@@ -391,10 +587,33 @@ check_sep(struct buffer_node * node, int from, const char *sep, int seplen) {
 	}
 }
 
+// the bytes scanned by the last readline with the same separator, see lreadline
+static int
+scan_start(struct socket_buffer *sb, const char *sep, int seplen) {
+	if (sb->scan_seplen == seplen && memcmp(sb->scan_sep, sep, seplen) == 0) {
+		return sb->scan;
+	}
+	return 0;
+}
+
+static void
+scan_save(struct socket_buffer *sb, const char *sep, int seplen, int scan) {
+	if (seplen > SCAN_SEP_MAX) {
+		sb->scan_seplen = 0;
+		return;
+	}
+	sb->scan = scan;
+	sb->scan_seplen = seplen;
+	memcpy(sb->scan_sep, sep, seplen);
+}
+
 /*
 	userdata send_buffer
 	table pool , nil for check
 	string sep
+
+	Find the first byte of sep by memchr, and compare the rest by check_sep (it may cross the nodes).
+	The scanned bytes are recorded, so checking again after more data arrived doesn't rescan them.
  */
 static int
 lreadline(lua_State *L) {
@@ -404,34 +623,58 @@ lreadline(lua_State *L) {
 	}
 	// only check
 	bool check = !lua_istable(L, 2);
-	size_t seplen = 0;
-	const char *sep = luaL_checklstring(L,3,&seplen);
-	int i;
+	size_t sl = 0;
+	const char *sep = luaL_checklstring(L,3,&sl);
+	int seplen = (int)sl;
 	struct buffer_node *current = sb->head;
 	if (current == NULL)
 		return 0;
 	int from = sb->offset;
-	int bytes = current->sz - from;
-	for (i=0;i<=sb->size - (int)seplen;i++) {
-		if (check_sep(current, from, sep, seplen)) {
-			if (check) {
-				lua_pushboolean(L,true);
-			} else {
-				pop_lstring(L, sb, i+seplen, seplen);
-				sb->size -= i+seplen;
-			}
-			return 1;
-		}
-		++from;
-		--bytes;
-		if (bytes == 0) {
+	int i = 0;	// the position from offset
+	if (seplen > 0) {
+		int skip = i = scan_start(sb, sep, seplen);
+		while (skip >= current->sz - from) {
+			skip -= current->sz - from;
 			current = current->next;
 			from = 0;
 			if (current == NULL)
+				return 0;
+		}
+		from += skip;
+	}
+	int last = sb->size - seplen;	// the last position sep may start
+	while (i <= last) {
+		if (seplen > 0) {
+			const char *p = memchr(current->msg + from, sep[0], current->sz - from);
+			if (p == NULL) {
+				i += current->sz - from;
+				current = current->next;
+				from = 0;
+				if (current == NULL)
+					break;
+				continue;
+			}
+			int off = p - current->msg;
+			i += off - from;
+			if (i > last)
 				break;
-			bytes = current->sz;
+			from = off;
+			if (!check_sep(current, from, sep, seplen)) {
+				++from;
+				++i;
+				continue;
+			}
 		}
+		if (check) {
+			scan_save(sb, sep, seplen, i);
+			lua_pushboolean(L,true);
+		} else {
+			pop_lstring(L, sb, i+seplen, seplen);
+			sb->size -= i+seplen;
+		}
+		return 1;
 	}
+	scan_save(sb, sep, seplen, i < sb->size ? i : sb->size);
 	return 0;
 }
 
@@ -459,6 +702,9 @@ lunpack(lua_State *L) {
 	struct skynet_socket_message *message = lua_touserdata(L,1);
 	int size = luaL_checkinteger(L,2);
 
+	if (message->type == SKYNET_SOCKET_TYPE_DATA) {
+		skynet_socket_latency(message);
+	}
 	lua_pushinteger(L, message->type);
 	lua_pushinteger(L, message->id);
 	lua_pushinteger(L, message->ud);
@@ -478,9 +724,19 @@ lunpack(lua_State *L) {
 	return 4;
 }
 
+static inline int
+is_unix(const char *addr) {
+	return strncmp(addr, "unix:", 5) == 0;
+}
+
 static const char *
 address_port(lua_State *L, char *tmp, const char * addr, int port_index, int *port) {
 	const char * host;
+	if (is_unix(addr)) {
+		// unix domain socket : "unix:path", no port
+		*port = 0;
+		return addr;
+	}
 	if (lua_isnoneornil(L,port_index)) {
 		host = strchr(addr, '[');
 		if (host) {
@@ -523,7 +779,7 @@ lconnect(lua_State *L) {
 	char tmp[sz];
 	int port = 0;
 	const char * host = address_port(L, tmp, addr, 2, &port);
-	if (port == 0) {
+	if (port == 0 && !is_unix(host)) {
 		return luaL_error(L, "Invalid port");
 	}
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -556,7 +812,7 @@ lshutdown(lua_State *L) {
 static int
 llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
-	int port = luaL_checkinteger(L,2);
+	int port = is_unix(host) ? luaL_optinteger(L,2,0) : luaL_checkinteger(L,2);
 	int backlog = luaL_optinteger(L,3,BACKLOG);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
 	int id = skynet_socket_listen(ctx, host,port,backlog);
@@ -612,6 +868,9 @@ get_buffer(lua_State *L, int index, struct socket_sendbuffer *buf) {
 	case LUA_TUSERDATA:
 		// lua full useobject must be a raw pointer, it can't be a socket object or a memory object.
 		buf->type = SOCKET_BUFFER_RAWPOINTER;
+		if ((buf->buffer = socket_slice_bytes(L, index, &buf->sz))) {
+			break;
+		}
 		buf->buffer = lua_touserdata(L, index);
 		if (lua_isinteger(L, index+1)) {
 			buf->sz = lua_tointeger(L, index+1);
@@ -683,6 +942,96 @@ lsendlow(lua_State *L) {
 	return 1;
 }
 
+/**
+ * 广播, 同一份数据发送给多个 socket, 只复制(或接管)一次数据, 由一个请求交给 socket 线程
+ * lua: 接收 2 或者 3 个参数, 参数 1, socket id 的数组; 参数 2, 参数 3 与 send 相同. 1 个返回值, 是否成功.
+ */
+static int
+lmultisend(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = lua_rawlen(L, 1);
+	if (n == 0) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	int *id = lua_newuserdatauv(L, n * sizeof(int), 0);
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 1, i+1);
+		int isnum;
+		id[i] = lua_tointegerx(L, -1, &isnum);
+		if (!isnum) {
+			return luaL_error(L, "Invalid socket id at [%d]", i+1);
+		}
+		lua_pop(L, 1);
+	}
+	struct socket_sendbuffer buf;
+	buf.id = 0;
+	get_buffer(L, 2, &buf);
+	if (buf.type == SOCKET_BUFFER_OBJECT) {
+		return luaL_error(L, "Can't multisend socket object");
+	}
+	int err = skynet_socket_multisend(ctx, id, n, &buf);
+	lua_pushboolean(L, !err);
+	return 1;
+}
+
+/**
+ * 发送文件, 文件内容由 socket 线程通过 sendfile 发出, 与之前/之后 send 的数据保持顺序.
+ * lua: 接收 4 个参数, 参数 1, socket id; 参数 2, 文件路径或者文件描述符(会 dup 一份, 不影响调用者);
+ * 参数 3, 文件偏移, 默认为 0; 参数 4, 发送的长度, 默认发送到文件末尾.
+ * 返回发送的字节数, 失败返回 false 和错误信息.
+ */
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int fd;
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		fd = dup((int)luaL_checkinteger(L, 2));
+	} else {
+		fd = open(luaL_checkstring(L, 2), O_RDONLY);
+	}
+	if (fd < 0) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, strerror(errno));
+		return 2;
+	}
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer len = luaL_optinteger(L, 4, -1);
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, strerror(errno));
+		return 2;
+	}
+	if (offset < 0 || (S_ISREG(st.st_mode) && offset > st.st_size)) {
+		close(fd);
+		return luaL_error(L, "Invalid file offset %I", offset);
+	}
+	if (len < 0) {
+		if (!S_ISREG(st.st_mode)) {
+			close(fd);
+			return luaL_error(L, "Need length for non-regular file");
+		}
+		len = st.st_size - offset;
+	}
+	if (len == 0) {
+		close(fd);
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	if (skynet_socket_sendfile(ctx, id, fd, offset, (size_t)len)) {
+		lua_pushboolean(L, 0);
+		lua_pushliteral(L, "invalid socket");
+		return 2;
+	}
+	lua_pushinteger(L, len);
+	return 1;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -716,6 +1065,105 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+/**
+ * 开启 zero-copy 发送, 不小于 threshold 的数据使用 MSG_ZEROCOPY 发送(仅 linux), threshold 为 0 表示关闭
+ * lua: 接收 2 个参数, 参数 1, socket id; 参数 2, threshold, 默认为 ZEROCOPY_THRESHOLD
+ */
+static int
+lzerocopy(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int threshold = luaL_optinteger(L, 2, ZEROCOPY_THRESHOLD);
+	skynet_socket_zerocopy(ctx, id, threshold);
+	return 0;
+}
+
+/**
+ * 发送流量整形
+ * lua: 接收 4 个参数, 参数 1, socket id; 参数 2, 每秒发送的字节数, 0 表示不限速; 参数 3, 发送缓存的上限, 0 表示不限制;
+ * 参数 4, 达到上限时的策略: "drop" 丢弃低优先级的数据(默认), "close" 关闭连接, "pause" 暂停读取直到发送缓存降到上限的一半
+ */
+static int
+lshape(lua_State *L) {
+	static const char * const policy[] = { "drop", "close", "pause", NULL };
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int rate = luaL_optinteger(L, 2, 0);
+	int limit = luaL_optinteger(L, 3, 0);
+	// the order is same with SOCKET_LIMIT_*
+	int p = luaL_checkoption(L, 4, "drop", policy);
+	skynet_socket_shape(ctx, id, rate, limit, p);
+	return 0;
+}
+
+/**
+ * 监听 socket 的 accept 限速
+ * lua: 接收 3 个参数, 参数 1, 监听 socket id; 参数 2, 每秒 accept 的连接数, 0 表示不限速;
+ * 参数 3, 超过速率的连接进入等待队列的上限, 队列满以后关闭新连接, 0 (默认) 表示暂停 accept, 让连接留在内核的 backlog 中
+ */
+static int
+lacceptrate(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int rate = luaL_optinteger(L, 2, 0);
+	int queue = luaL_optinteger(L, 3, 0);
+	skynet_socket_acceptrate(ctx, id, rate, queue);
+	return 0;
+}
+
+/**
+ * 分帧模式, socket 线程按长度头切分数据, 每个完整的帧(不含长度头)产生一个 SOCKET_DATA
+ * lua: 接收 4 个参数, 参数 1, socket id; 参数 2, 长度头的字节数 1/2/4, 0 表示关闭; 参数 3, "big"(默认) 或 "little";
+ * 参数 4, 帧的最大长度, 默认为 FRAME_MAX, 超过则关闭连接
+ */
+static int
+lframe(lua_State *L) {
+	static const char * const endian[] = { "big", "little", NULL };
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int header = luaL_checkinteger(L, 2);
+	if (header != 0 && header != 1 && header != 2 && header != 4) {
+		return luaL_error(L, "Invalid frame header size %d", header);
+	}
+	int little = luaL_checkoption(L, 3, "big", endian);
+	int max = luaL_optinteger(L, 4, FRAME_MAX);
+	if (max <= 0 || (header < 4 && max >= (1 << (header * 8)))) {
+		max = header < 4 ? (1 << (header * 8)) - 1 : FRAME_MAX;
+	}
+	skynet_socket_frame(ctx, id, header, little, max);
+	return 0;
+}
+
+/**
+ * cork 模式, 攒批发送
+ * lua: 接收 3 个参数, 参数 1, socket id; 参数 2, 发送缓存达到这个字节数就 flush, 0 表示不限制, false 表示关闭 cork 模式;
+ * 参数 3, 定时 flush 的间隔(微秒), 0 表示只在 socket.flush 或达到参数 2 时发送
+ */
+static int
+lcork(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int threshold;
+	if (lua_isboolean(L, 2) && !lua_toboolean(L, 2)) {
+		threshold = -1;
+	} else {
+		threshold = luaL_optinteger(L, 2, 0);
+		if (threshold < 0)
+			return luaL_error(L, "Invalid cork threshold %d", threshold);
+	}
+	int interval = luaL_optinteger(L, 3, 0);
+	skynet_socket_cork(ctx, id, threshold, interval);
+	return 0;
+}
+
+static int
+lflush(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	skynet_socket_flush(ctx, id);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -793,6 +1241,42 @@ ludp_listen(lua_State *L){
 	return 1;
 }
 
+static int
+lrudp_listen(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	size_t sz = 0;
+	const char * addr = luaL_checklstring(L, 1, &sz);
+	char tmp[sz];
+	int port = 0;
+	const char * host = address_port(L, tmp, addr, 2, &port);
+
+	int id = skynet_socket_rudp_listen(ctx, host, port);
+	if (id < 0) {
+		return luaL_error(L, "rudp listen host failed");
+	}
+
+	lua_pushinteger(L, id);
+	return 1;
+}
+
+static int
+lrudp_dial(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	size_t sz = 0;
+	const char * addr = luaL_checklstring(L, 1, &sz);
+	char tmp[sz];
+	int port = 0;
+	const char * host = address_port(L, tmp, addr, 2, &port);
+	uint32_t conv = (uint32_t)luaL_optinteger(L, 3, 0);
+
+	int id = skynet_socket_rudp_dial(ctx, host, port, conv);
+	if (id < 0) {
+		return luaL_error(L, "rudp dial host failed");
+	}
+
+	lua_pushinteger(L, id);
+	return 1;
+}
 
 static int
 ludp_send(lua_State *L) {
@@ -835,6 +1319,24 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+// latency[i] is the count of data messages dispatched in [2^(i-2), 2^(i-1)) us (latency[1] for < 1us)
+static void
+getlatency(lua_State *L, struct socket_info *si) {
+	int i, n = 0;
+	for (i=0;i<SOCKET_LATENCY_BUCKETS;i++) {
+		if (si->latency[i])
+			n = i + 1;
+	}
+	if (n == 0)
+		return;
+	lua_createtable(L, n, 0);
+	for (i=0;i<n;i++) {
+		lua_pushinteger(L, si->latency[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_setfield(L, -2, "latency");
+}
+
 static void
 getinfo(lua_State *L, struct socket_info *si) {
 	lua_newtable(L);
@@ -850,10 +1352,23 @@ getinfo(lua_State *L, struct socket_info *si) {
 		lua_setfield(L, -2, "accept");
 		lua_pushinteger(L, si->rtime);
 		lua_setfield(L, -2, "rtime");
+		if (si->rate || si->rejected || si->deferred) {
+			lua_pushinteger(L, si->rate);
+			lua_setfield(L, -2, "rate");
+			lua_pushinteger(L, si->rejected);
+			lua_setfield(L, -2, "rejected");
+			lua_pushinteger(L, si->deferred);
+			lua_setfield(L, -2, "deferred");
+			lua_pushinteger(L, si->pending);
+			lua_setfield(L, -2, "pending");
+			lua_pushinteger(L, si->throttled);
+			lua_setfield(L, -2, "throttled");
+		}
 		if (si->name[0]) {
 			lua_pushstring(L, si->name);
 			lua_setfield(L, -2, "sock");
 		}
+		getlatency(L, si);
 		return;
 	case SOCKET_INFO_TCP:
 		lua_pushstring(L, "TCP");
@@ -867,18 +1382,59 @@ getinfo(lua_State *L, struct socket_info *si) {
 	case SOCKET_INFO_CLOSING:
 		lua_pushstring(L, "CLOSING");
 		break;
+	case SOCKET_INFO_RUDP:
+		lua_pushstring(L, "RUDP");
+		break;
 	default:
 		lua_pushstring(L, "UNKNOWN");
 		lua_setfield(L, -2, "type");
 		return;
 	}
 	lua_setfield(L, -2, "type");
+	if (si->type == SOCKET_INFO_RUDP) {
+		lua_pushinteger(L, si->rtt);
+		lua_setfield(L, -2, "rtt");
+		lua_pushinteger(L, si->rto);
+		lua_setfield(L, -2, "rto");
+		lua_pushinteger(L, si->cwnd);
+		lua_setfield(L, -2, "cwnd");
+		lua_pushinteger(L, si->inflight);
+		lua_setfield(L, -2, "inflight");
+		lua_pushinteger(L, si->waitsnd);
+		lua_setfield(L, -2, "waitsnd");
+		lua_pushinteger(L, si->resend);
+		lua_setfield(L, -2, "resend");
+	}
 	lua_pushinteger(L, si->read);
 	lua_setfield(L, -2, "read");
 	lua_pushinteger(L, si->write);
 	lua_setfield(L, -2, "write");
+	if (si->zerocopy || si->zcfallback) {
+		// the bytes of MSG_ZEROCOPY reported by kernel : sent without copy, and copied by kernel (or ENOBUFS)
+		lua_pushinteger(L, si->zerocopy);
+		lua_setfield(L, -2, "zerocopy");
+		lua_pushinteger(L, si->zcfallback);
+		lua_setfield(L, -2, "zcfallback");
+	}
 	lua_pushinteger(L, si->wbuffer);
 	lua_setfield(L, -2, "wbuffer");
+	if (si->rate || si->wlimit || si->dropped) {
+		lua_pushinteger(L, si->wpeak);
+		lua_setfield(L, -2, "wpeak");
+		lua_pushinteger(L, si->rate);
+		lua_setfield(L, -2, "rate");
+		lua_pushinteger(L, si->wlimit);
+		lua_setfield(L, -2, "wlimit");
+		lua_pushinteger(L, si->dropped);
+		lua_setfield(L, -2, "dropped");
+		lua_pushinteger(L, si->throttled);
+		lua_setfield(L, -2, "throttled");
+	}
+	if (si->rejected) {
+		// the endpoint of reliable udp
+		lua_pushinteger(L, si->rejected);
+		lua_setfield(L, -2, "rejected");
+	}
 	lua_pushinteger(L, si->rtime);
 	lua_setfield(L, -2, "rtime");
 	lua_pushinteger(L, si->wtime);
@@ -946,6 +1502,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "buffer", lnewbuffer },
 		{ "push", lpushbuffer },
 		{ "pop", lpopbuffer },
+		{ "popslice", lpopslice },
 		{ "drop", ldrop },
 		{ "readall", lreadall },
 		{ "clear", lclearbuffer },
@@ -966,14 +1523,24 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "multisend", lmultisend },
+		{ "sendfile", lsendfile },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "pause", lpause },
 		{ "nodelay", lnodelay },
+		{ "zerocopy", lzerocopy },
+		{ "shape", lshape },
+		{ "acceptrate", lacceptrate },
+		{ "frame", lframe },
+		{ "cork", lcork },
+		{ "flush", lflush },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_dial", ludp_dial},
 		{ "udp_listen", ludp_listen},
+		{ "rudp_listen", lrudp_listen },
+		{ "rudp_dial", lrudp_dial },
 		{ "udp_send", ludp_send },
 		{ "udp_address", ludp_address },
 		{ "resolve", lresolve },
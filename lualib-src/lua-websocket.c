@@ -0,0 +1,113 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "websocket.h"
+
+/*
+	string op (0 ~ 15)
+	string data (or nil)
+	integer masking_key (or nil)
+	boolean fin (default true)
+	return string (frame header and payload)
+ */
+static int
+lpack(lua_State *L) {
+	int op = luaL_checkinteger(L, 1);
+	size_t sz = 0;
+	const uint8_t * data = (const uint8_t *)luaL_optlstring(L, 2, "", &sz);
+	uint8_t key[4];
+	const uint8_t * k = NULL;
+	if (!lua_isnoneornil(L, 3)) {
+		uint32_t v = (uint32_t)luaL_checkinteger(L, 3);
+		key[0] = v >> 24;
+		key[1] = (v >> 16) & 0xff;
+		key[2] = (v >> 8) & 0xff;
+		key[3] = v & 0xff;
+		k = key;
+	}
+	int fin = lua_isnoneornil(L, 4) ? 1 : lua_toboolean(L, 4);
+	luaL_Buffer b;
+	uint8_t * buffer = (uint8_t *)luaL_buffinitsize(L, &b, WS_HEADER_MAX + sz);
+	int n = ws_header(buffer, fin, op, sz, k);
+	if (k) {
+		ws_mask(buffer + n, data, sz, k, 0);
+	} else {
+		memcpy(buffer + n, data, sz);
+	}
+	luaL_pushresultsize(&b, n + sz);
+	return 1;
+}
+
+/*
+	string (the first 2 bytes of frame)
+	return integer (the size of frame header)
+ */
+static int
+lheadersize(lua_State *L) {
+	size_t sz = 0;
+	const uint8_t * head = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	luaL_argcheck(L, sz >= 2, 1, "need 2 bytes");
+	lua_pushinteger(L, ws_header_size(head));
+	return 1;
+}
+
+/*
+	string (frame header)
+	return boolean fin, integer op, integer payload_len, string masking_key (or false)
+ */
+static int
+lparse(lua_State *L) {
+	size_t sz = 0;
+	const uint8_t * head = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	struct ws_frame f;
+	int r = ws_parse(head, sz, &f);
+	if (r == 0)
+		return luaL_error(L, "incomplete websocket frame header");
+	if (r < 0)
+		return luaL_error(L, "invalid websocket frame");
+	lua_pushboolean(L, f.fin);
+	lua_pushinteger(L, f.op);
+	lua_pushinteger(L, (lua_Integer)f.len);
+	if (f.mask) {
+		lua_pushlstring(L, (const char *)f.key, 4);
+	} else {
+		lua_pushboolean(L, 0);
+	}
+	return 4;
+}
+
+/*
+	string data
+	string masking_key (4 bytes)
+	return string
+ */
+static int
+lmask(lua_State *L) {
+	size_t sz = 0, ksz = 0;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	const uint8_t * key = (const uint8_t *)luaL_checklstring(L, 2, &ksz);
+	luaL_argcheck(L, ksz == 4, 2, "masking key should be 4 bytes");
+	luaL_Buffer b;
+	uint8_t * buffer = (uint8_t *)luaL_buffinitsize(L, &b, sz);
+	ws_mask(buffer, data, sz, key, 0);
+	luaL_pushresultsize(&b, sz);
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_websocket(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "pack", lpack },
+		{ "header_size", lheadersize },
+		{ "parse", lparse },
+		{ "mask", lmask },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
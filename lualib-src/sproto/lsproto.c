@@ -8,6 +8,7 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "sproto.h"
+#include "../lua-slice.h"
 
 #define MAX_GLOBALSPROTO 16
 #define ENCODE_BUFFERSIZE 2050
@@ -606,6 +607,9 @@ getbuffer(lua_State *L, int index, size_t *sz) {
 			luaL_argerror(L, index, "Need a string or userdata");
 			return NULL;
 		}
+		if ((buffer = socket_slice_bytes(L, index, sz))) {
+			return buffer;
+		}
 		buffer = lua_touserdata(L, index);
 		*sz = luaL_checkinteger(L, index+1);
 	}
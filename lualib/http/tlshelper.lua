@@ -96,4 +96,10 @@ function tlshelper.newtls(method, ssl_ctx, hostname)
     return c.newtls(method, ssl_ctx, hostname)
 end
 
+-- encrypt the socket in socket thread, read/write the plain text by the socket api after it.
+-- call it before socket.start for the accepted socket, or after connected for client.
+function tlshelper.socket(fd, method, ssl_ctx, hostname)
+    return c.socket(fd, method, ssl_ctx, hostname)
+end
+
 return tlshelper
\ No newline at end of file
@@ -1,6 +1,7 @@
 local internal = require "http.internal"
 local socket = require "skynet.socket"
 local crypt = require "skynet.crypt"
+local codec = require "skynet.websocket"
 local httpd = require "http.httpd"
 local skynet = require "skynet"
 local sockethelper = require "http.sockethelper"
@@ -209,32 +210,8 @@ local op_code = {
 }
 
 local function write_frame(self, op, payload_data, masking_key)
-    payload_data = payload_data or ""
-    local payload_len = #payload_data
-    local op_v = assert(op_code[op])
-    local v1 = 0x80 | op_v -- fin is 1 with opcode
-    local s
-    local mask = masking_key and 0x80 or 0x00
-    -- mask set to 0
-    if payload_len < 126 then
-        s = string.pack("I1I1", v1, mask | payload_len)
-    elseif payload_len <= 0xffff then
-        s = string.pack("I1I1>I2", v1, mask | 126, payload_len)
-    else
-        s = string.pack("I1I1>I8", v1, mask | 127, payload_len)
-    end
-    self.write(s)
-
-    -- write masking_key
-    if masking_key then
-        s = string.pack(">I4", masking_key)
-        self.write(s)
-        payload_data = crypt.xor_str(payload_data, s)
-    end
-
-    if payload_len > 0 then
-        self.write(payload_data)
-    end
+    -- header and (masked) payload in one write
+    self.write(codec.pack(assert(op_code[op]), payload_data, masking_key))
 end
 
 
@@ -251,31 +228,19 @@ end
 
 local function read_frame(self)
     local s = self.read(2)
-    local v1, v2 = string.unpack("I1I1", s)
-    local fin  = (v1 & 0x80) ~= 0
-    -- unused flag
-    -- local rsv1 = (v1 & 0x40) ~= 0
-    -- local rsv2 = (v1 & 0x20) ~= 0
-    -- local rsv3 = (v1 & 0x10) ~= 0
-    local op   =  v1 & 0x0f
-    local mask = (v2 & 0x80) ~= 0
-    local payload_len = (v2 & 0x7f)
-    if payload_len == 126 then
-        s = self.read(2)
-        payload_len = string.unpack(">I2", s)
-    elseif payload_len == 127 then
-        s = self.read(8)
-        payload_len = string.unpack(">I8", s)
+    local header_size = codec.header_size(s)
+    if header_size > 2 then
+        s = s .. self.read(header_size - 2)
     end
+    local fin, op, payload_len, masking_key = codec.parse(s)
 
     if self.mode == "server" and payload_len > MAX_FRAME_SIZE then
         error("payload_len is too large")
     end
 
-    -- print(string.format("fin:%s, op:%s, mask:%s, payload_len:%s", fin, op_code[op], mask, payload_len))
-    local masking_key = mask and self.read(4) or false
+    -- print(string.format("fin:%s, op:%s, mask:%s, payload_len:%s", fin, op_code[op], masking_key, payload_len))
     local payload_data = payload_len>0 and self.read(payload_len) or ""
-    payload_data = masking_key and crypt.xor_str(payload_data, masking_key) or payload_data
+    payload_data = masking_key and codec.mask(payload_data, masking_key) or payload_data
     return fin, assert(op_code[op]), payload_data
 end
 
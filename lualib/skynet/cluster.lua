@@ -77,6 +77,7 @@ function cluster.send(node, address, ...)
 	end
 end
 
+-- port can be a node name in cluster config, or "unix:/path/of/socket" to listen on a unix domain socket
 function cluster.open(port, maxclient)
 	if type(port) == "string" then
 		return skynet.call(clusterd, "lua", "listen", port, nil, maxclient)
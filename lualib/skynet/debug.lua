@@ -120,6 +120,12 @@ local function init(skynet, export)
 			skynet.ret()
 		end
 
+		function dbgcmd.SAMPLE(hz)
+			-- SAMPLE(hz) starts sampling, SAMPLE() returns the folded stacks
+			local profile = require "skynet.profile"
+			skynet.ret(skynet.pack(profile.sample(hz)))
+		end
+
 		return dbgcmd
 	end -- function init_dbgcmd
 
@@ -27,6 +27,17 @@ local function wakeup(s)
 	end
 end
 
+local function wakeup_sendfile(s, err)
+	local q = s.sendfile
+	if q then
+		s.sendfile = nil
+		for _, w in ipairs(q) do
+			w.err = err
+			skynet.wakeup(w.co)
+		end
+	end
+end
+
 local function pause_socket(s, size)
 	if s.pause ~= nil then
 		return
@@ -124,6 +135,8 @@ socket_message[3] = function(id)
 	local s = socket_pool[id]
 	if s then
 		s.connected = false
+		-- the pending files are dropped without SOCKET_SENDFILE
+		wakeup_sendfile(s, "closed")
 		wakeup(s)
 	else
 		driver.close(id)
@@ -164,6 +177,7 @@ socket_message[5] = function(id, _, err)
 	end
 	s.connected = false
 	driver.shutdown(id)
+	wakeup_sendfile(s, err)
 
 	wakeup(s)
 end
@@ -198,6 +212,23 @@ socket_message[7] = function(id, size)
 	end
 end
 
+-- SKYNET_SOCKET_TYPE_SENDFILE = 8
+socket_message[8] = function(id, _, err)
+	local s = socket_pool[id]
+	local q = s and s.sendfile
+	if q == nil then
+		return
+	end
+	local w = table.remove(q, 1)
+	if q[1] == nil then
+		s.sendfile = nil
+	end
+	if err ~= "" then
+		w.err = err
+	end
+	skynet.wakeup(w.co)
+end
+
 skynet.register_protocol {
 	name = "socket",
 	id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -286,6 +317,7 @@ function socket.close(id)
 		return
 	end
 	driver.close(id)
+	wakeup_sendfile(s, "closed")
 	if s.connected then
 		s.pause = false -- Do not resume this fd if it paused.
 		if s.co then
@@ -345,6 +377,33 @@ function socket.read(id, sz)
 	end
 end
 
+-- socket.read_slice(id, sz) : like socket.read(id, sz), but returns a slice instead of a string.
+-- A slice is a view of the received bytes without copying them into a lua string (see lua-socket.c).
+-- skynet.unpack, sproto decode, netpack.pack and socket.write accept it directly; #slice, tostring(slice),
+-- slice:ptr() (lightuserdata, size, valid while the slice is alive) and slice:free() are supported.
+function socket.read_slice(id, sz)
+	assert(sz and sz > 0, "Need size")
+	local s = socket_pool[id]
+	assert(s)
+	local ret = driver.popslice(s.buffer, s.pool, sz)
+	if ret then
+		return ret
+	end
+	if s.closing or not s.connected then
+		return false, driver.readall(s.buffer, s.pool)
+	end
+
+	assert(not s.read_required)
+	s.read_required = sz
+	suspend(s)
+	ret = driver.popslice(s.buffer, s.pool, sz)
+	if ret then
+		return ret
+	else
+		return false, driver.readall(s.buffer, s.pool)
+	end
+end
+
 function socket.readall(id)
 	local s = socket_pool[id]
 	assert(s)
@@ -393,8 +452,37 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+-- socket.multiwrite(ids, data [, sz]) : send the same data to a list of sockets by one request,
+-- the data is copied (or taken) once and shared by them.
+socket.multiwrite = assert(driver.multisend)
 socket.header = assert(driver.header)
 
+-- send a file (path or os fd) in socket thread by sendfile, keeping the order with socket.write .
+-- block until the file is sent out, returns the number of bytes or false, error
+function socket.sendfile(id, file, offset, len)
+	local s = socket_pool[id]
+	assert(s)
+	local sz, err = driver.sendfile(id, file, offset, len)
+	if not sz then
+		return false, err
+	end
+	if sz == 0 then
+		return 0
+	end
+	local w = { co = coroutine.running() }
+	local q = s.sendfile
+	if q == nil then
+		q = {}
+		s.sendfile = q
+	end
+	q[#q+1] = w
+	skynet.wait(w.co)
+	if w.err then
+		return false, w.err
+	end
+	return sz
+end
+
 function socket.invalid(id)
 	return socket_pool[id] == nil
 end
@@ -406,8 +494,9 @@ function socket.disconnected(id)
 	end
 end
 
+-- host can be "unix:/path/of/socket" for unix domain socket, then port is ignored
 function socket.listen(host, port, backlog)
-	if port == nil then
+	if port == nil and not host:find "^unix:" then
 		host, port = string.match(host, "([^:]+):(.+)$")
 		port = tonumber(port)
 	end
@@ -483,9 +572,62 @@ function socket.udp_dial(addr, port, callback)
 	return id
 end
 
+-- reliable udp (KCP style ARQ in socket thread) : the sessions are used like tcp connections (read/write/close).
+-- socket.rudp_listen returns id, addr, port of the endpoint, and socket.start(id, func) accepts the sessions.
+function socket.rudp_listen(host, port)
+	if port == nil then
+		host, port = string.match(host, "([^:]+):(.+)$")
+		port = tonumber(port)
+	end
+	local id = driver.rudp_listen(host, port)
+	local s = {
+		id = id,
+		connected = false,
+		listen = true,
+	}
+	assert(socket_pool[id] == nil)
+	socket_pool[id] = s
+	suspend(s)
+	return id, s.addr, s.port
+end
+
+-- conv is the id of the session, the same address can open many sessions with different conv (default is the socket id)
+function socket.rudp_open(host, port, conv)
+	local id = driver.rudp_dial(host, port, conv)
+	return connect(id)
+end
+
+socket.zerocopy = assert(driver.zerocopy)	-- socket.zerocopy(id [, threshold]), use MSG_ZEROCOPY for large buffers
+-- socket.shape(id, rate, limit [, policy]) : limit outbound bytes per second and the size of send buffer,
+-- policy is "drop" (low priority packages, default ; socket.write is still queued), "close", or "pause" (stop reading
+-- the peer until send buffer drains ; the writes of this service are still queued). It's ignored by listen sockets.
+socket.shape = assert(driver.shape)
+-- socket.acceptrate(id, rate [, queue]) : limit the connections accepted per second by a listen socket, the rest wait
+-- in a queue (at most queue, the others are closed) or in the backlog of kernel (queue is 0)
+socket.acceptrate = assert(driver.acceptrate)
+-- socket.frame(id, header [, endian [, max]]) : call before socket.start, the socket thread strips the length header
+-- (1/2/4 bytes, "big" endian by default) and raises one data message per frame. The socket is closed when a frame exceeds max.
+socket.frame = assert(driver.frame)
+-- socket.cork(id [, threshold [, interval]]) : hold the outbound data until socket.flush(id), the send buffer reach threshold bytes,
+-- or every interval microseconds. socket.cork(id, false) turns it off and flushes.
+socket.cork = assert(driver.cork)
+socket.flush = assert(driver.flush)
 socket.sendto = assert(driver.udp_send)
 socket.udp_address = assert(driver.udp_address)
-socket.netstat = assert(driver.info)
+-- socket.netstat() : the LISTEN sockets have a latency histogram of data messages from socket thread to the dispatch,
+-- latency[1] counts < 1us, and latency[i] counts [2^(i-2), 2^(i-1)) us
+-- socket.netstat(id) returns the info of one socket, or nil if it's closed
+function socket.netstat(id)
+	local info = driver.info()
+	if id == nil then
+		return info
+	end
+	for _, v in ipairs(info) do
+		if v.id == id then
+			return v
+		end
+	end
+end
 socket.resolve = assert(driver.resolve)
 
 function socket.warning(id, callback)
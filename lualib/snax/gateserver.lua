@@ -10,6 +10,9 @@ local maxclient	-- max client
 local client_number = 0
 local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
 local nodelay = false
+local coalesce	-- nil : off, or the ticks before flush
+local outbound = {}	-- fd -> { data, ... } : the bytes to send in coalesce mode
+local flushing = false
 
 local connection = {}
 -- true : connected
@@ -22,10 +25,46 @@ function gateserver.openclient(fd)
 	end
 end
 
+local function flush()
+	flushing = false
+	local out = outbound
+	outbound = {}
+	for fd, q in pairs(out) do
+		-- false (close read) can still write
+		if connection[fd] ~= nil then
+			-- the strings in q are packed into one buffer
+			socketdriver.send(fd, q)
+		end
+	end
+end
+
+-- write data (a package with netpack header, see netpack.pack) to fd.
+-- In coalesce mode, the data to one connection are packed and sent after the messages in queue (or conf.coalesce ticks later).
+function gateserver.write(fd, data)
+	if not coalesce then
+		return socketdriver.send(fd, data)
+	end
+	local q = outbound[fd]
+	if q then
+		q[#q+1] = data
+	else
+		outbound[fd] = { data }
+	end
+	if not flushing then
+		flushing = true
+		skynet.timeout(coalesce, flush)
+	end
+end
+
 function gateserver.closeclient(fd)
 	local c = connection[fd]
 	if c ~= nil then
 		connection[fd] = nil
+		local q = outbound[fd]
+		if q then
+			outbound[fd] = nil
+			socketdriver.send(fd, q)
+		end
 		socketdriver.close(fd)
 	end
 end
@@ -42,6 +81,9 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		if conf.coalesce then
+			coalesce = conf.coalesce == true and 0 or conf.coalesce
+		end
 		skynet.error(string.format("Listen on %s:%d", address, port))
 		socket = socketdriver.listen(address, port, conf.backlog)
 		listen_context.co = coroutine.running()
@@ -2,7 +2,6 @@ local skynet = require "skynet"
 local gateserver = require "snax.gateserver"
 local netpack = require "skynet.netpack"
 local crypt = require "skynet.crypt"
-local socketdriver = require "skynet.socketdriver"
 local assert = assert
 local b64encode = crypt.base64encode
 local b64decode = crypt.base64decode
@@ -73,6 +72,7 @@ Config for server.start:
 	conf.request_handler(username, session, msg) : the function when recv a new request.
 	conf.register_handler(servername) : call when gate open
 	conf.disconnect_handler(username) : call when a connection disconnect (afk)
+	conf.coalesce : true (or ticks), pack the responses to one connection and send them together (see gateserver.write)
 ]]
 
 local server = {}
@@ -209,7 +209,7 @@ function server.start(conf)
 			result = "200 OK"
 		end
 
-		socketdriver.send(fd, netpack.pack(result))
+		gateserver.write(fd, string.pack(">s2", result))
 
 		if close then
 			gateserver.closeclient(fd)
@@ -290,7 +290,7 @@ function server.start(conf)
 		-- the return fd is p[1] (fd may change by multi request) check connect
 		fd = p[1]
 		if connection[fd] then
-			socketdriver.send(fd, p[2])
+			gateserver.write(fd, p[2])
 		end
 		p[1] = nil
 		retire_response(u)
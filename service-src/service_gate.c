@@ -1,23 +1,50 @@
 #include "skynet.h"
 #include "skynet_socket.h"
-#include "databuffer.h"
-#include "hashid.h"
+#include "websocket.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 
 #define BACKLOG 128
+#define FRAME_MAX 0xffffff
+#define HANDSHAKE_MAX 8192
+#define COALESCE_MAX 0x10000	// flush the connection at once when the bytes to send exceed it
+#define SLOT_SIZE 64	// the initial size of connection slots
+#define SHARD_MAX 64
+#define SOCKET_MASK 0xffff	// MAX_SOCKET - 1 in socket_server.c
+
+// defined in lualib-src/lsha1.c
+void sha1_digest(const uint8_t *data, size_t sz, uint8_t digest[20]);
+
+// websocket mode, the gate does the handshake and forwards each message (without frame header)
+struct websocket {
+	int handshake;		// 1 after handshake
+	int closed;			// 1 after the connection is closing, ignore the following data
+	int op;				// opcode of the fragmented message, 0 for none
+	char * buffer;		// the bytes not parsed yet
+	int sz;
+	int cap;
+	char * message;		// the fragments received
+	int msz;
+	int mcap;
+};
 
 struct connection {
-	int id;	// skynet_socket id
+	int id;	// skynet_socket id, -1 for the free slot
 	uint32_t agent;
 	uint32_t client;
+	uint32_t shard;	// the handle of the shard owns this connection, 0 for self
 	char remote_name[32];
-	struct databuffer buffer;
+	struct websocket *ws;
+	int dirty;	// in gate.dirty
+	int out_sz;	// coalesce mode : the bytes to send in out
+	int out_cap;
+	char * out;
 };
 
 struct gate {
@@ -27,11 +54,20 @@ struct gate {
 	uint32_t broker;
 	int client_tag;
 	int header_size;
+	int websocket;
 	int max_connection;
-	struct hashid hash;
-	struct connection *conn;
-	// todo: save message pool ptr for release
-	struct messagepool mp;
+	int connection;		// the number of connections
+	int slot_mask;		// the size of slot - 1
+	struct connection *slot;	// indexed by socket id & slot_mask, as the slots of socket_server
+	int shards;			// the number of gate contexts behind the listener
+	int next_shard;		// hand over the connections to the shards by turns
+	uint32_t shard[SHARD_MAX];	// the handles of shards, shard[0] is 0 for self
+	uint32_t master;	// the gate which hands over the connections to this shard
+	int coalesce;		// -1 for off, otherwise the ticks (1/100s) before flush, 0 flushes after the messages in queue
+	int flush_session;	// the session of flush timer, 0 for none
+	int dirty_n;
+	int dirty_cap;
+	int *dirty;			// the socket ids of the connections to flush
 };
 
 struct gate *
@@ -39,28 +75,121 @@ gate_create(void) {
 	struct gate * g = skynet_malloc(sizeof(*g));
 	memset(g,0,sizeof(*g));
 	g->listen_id = -1;
+	g->coalesce = -1;
 	return g;
 }
 
+static void
+free_websocket(struct connection *c) {
+	struct websocket *ws = c->ws;
+	if (ws) {
+		skynet_free(ws->buffer);
+		skynet_free(ws->message);
+		skynet_free(ws);
+		c->ws = NULL;
+	}
+}
+
 void
 gate_release(struct gate *g) {
 	int i;
 	struct skynet_context *ctx = g->ctx;
-	for (i=0;i<g->max_connection;i++) {
-		struct connection *c = &g->conn[i];
-		if (c->id >=0) {
-			skynet_socket_close(ctx, c->id);
+	if (g->slot) {
+		for (i=0;i<=g->slot_mask;i++) {
+			struct connection *c = &g->slot[i];
+			if (c->id >=0 && c->shard == 0) {
+				skynet_socket_close(ctx, c->id);
+			}
+			free_websocket(c);
+			skynet_free(c->out);
 		}
 	}
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
-	messagepool_free(&g->mp);
-	hashid_clear(&g->hash);
-	skynet_free(g->conn);
+	for (i=1;i<g->shards;i++) {
+		char tmp[16];
+		snprintf(tmp, sizeof(tmp), ":%x", g->shard[i]);
+		skynet_command(ctx, "KILL", tmp);
+	}
+	skynet_free(g->slot);
+	skynet_free(g->dirty);
 	skynet_free(g);
 }
 
+static struct connection *
+_lookup(struct gate *g, int id) {
+	struct connection *c = &g->slot[id & g->slot_mask];
+	if (c->id == id && id >= 0)
+		return c;
+	return NULL;
+}
+
+// move the connections into larger slots, return 0 if two connections are in the same slot
+static int
+_rehash(struct gate *g, int size) {
+	struct connection * slot = skynet_malloc(size * sizeof(struct connection));
+	memset(slot, 0, size * sizeof(struct connection));
+	int i;
+	for (i=0;i<size;i++) {
+		slot[i].id = -1;
+	}
+	for (i=0;i<=g->slot_mask;i++) {
+		struct connection *c = &g->slot[i];
+		if (c->id >= 0) {
+			struct connection *nc = &slot[c->id & (size - 1)];
+			if (nc->id >= 0) {
+				skynet_free(slot);
+				return 0;
+			}
+			*nc = *c;
+		}
+	}
+	skynet_free(g->slot);
+	g->slot = slot;
+	g->slot_mask = size - 1;
+	return 1;
+}
+
+static void
+_remove(struct gate *g, struct connection *c) {
+	free_websocket(c);
+	skynet_free(c->out);
+	memset(c, 0, sizeof(*c));
+	c->id = -1;
+	--g->connection;
+}
+
+// the ids of the sockets alive are different in the low bits (see HASH_ID in socket_server.c),
+// so the slots stop growing at MAX_SOCKET at most.
+static struct connection *
+_insert(struct gate *g, int id) {
+	for (;;) {
+		struct connection *c = &g->slot[id & g->slot_mask];
+		if (c->id >= 0 && c->shard && ((c->id ^ id) & SOCKET_MASK) == 0) {
+			// the socket slot is reused, so the connection in the shard is closed, and its notice is on the way
+			_remove(g, c);
+		}
+		if (c->id < 0) {
+			c->id = id;
+			++g->connection;
+			return c;
+		}
+		int size = (g->slot_mask + 1) * 2;
+		while (!_rehash(g, size)) {
+			size *= 2;
+		}
+	}
+}
+
+static void
+_send_shards(struct gate *g, const void * msg, int sz) {
+	int i;
+	for (i=1;i<g->shards;i++) {
+		skynet_send(g->ctx, 0, g->shard[i], PTYPE_TEXT, 0, (void *)msg, sz);
+	}
+}
+
 static void
 _parm(char *msg, int sz, int command_sz) {
 	while (command_sz < sz) {
@@ -77,16 +206,138 @@ _parm(char *msg, int sz, int command_sz) {
 
 static void
 _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr) {
-	int id = hashid_lookup(&g->hash, fd);
-	if (id >=0) {
-		struct connection * agent = &g->conn[id];
+	struct connection * agent = _lookup(g, fd);
+	if (agent) {
 		agent->agent = agentaddr;
 		agent->client = clientaddr;
 	}
 }
 
 static void
-_ctrl(struct gate * g, const void * msg, int sz) {
+_flush_connection(struct gate *g, struct connection *c) {
+	if (c->out_sz > 0) {
+		skynet_socket_send(g->ctx, c->id, c->out, c->out_sz);
+		c->out = NULL;
+		c->out_sz = 0;
+		c->out_cap = 0;
+	}
+}
+
+static void
+_flush(struct gate *g) {
+	int i;
+	for (i=0;i<g->dirty_n;i++) {
+		// the connection may be closed after it's pushed
+		struct connection *c = _lookup(g, g->dirty[i]);
+		if (c) {
+			c->dirty = 0;
+			_flush_connection(g, c);
+		}
+	}
+	g->dirty_n = 0;
+}
+
+static void
+_flush_later(struct gate *g) {
+	if (g->flush_session == 0) {
+		char tmp[16];
+		sprintf(tmp, "%d", g->coalesce);
+		const char * session = skynet_command(g->ctx, "TIMEOUT", tmp);
+		g->flush_session = strtol(session, NULL, 10);
+	}
+}
+
+// write header and data to connection, they are packed into one buffer in coalesce mode.
+static void
+_write(struct gate *g, struct connection *c, const void *header, int hsz, const void *data, int sz) {
+	if (g->coalesce < 0) {
+		char * buffer = skynet_malloc(hsz + sz);
+		memcpy(buffer, header, hsz);
+		memcpy(buffer + hsz, data, sz);
+		skynet_socket_send(g->ctx, c->id, buffer, hsz + sz);
+		return;
+	}
+	int need = c->out_sz + hsz + sz;
+	if (need > c->out_cap) {
+		int cap = c->out_cap ? c->out_cap : 256;
+		while (cap < need)
+			cap *= 2;
+		c->out = skynet_realloc(c->out, cap);
+		c->out_cap = cap;
+	}
+	if (hsz > 0)
+		memcpy(c->out + c->out_sz, header, hsz);
+	memcpy(c->out + c->out_sz + hsz, data, sz);
+	c->out_sz = need;
+	if (need >= COALESCE_MAX) {
+		_flush_connection(g, c);
+		return;
+	}
+	if (!c->dirty) {
+		if (g->dirty_n >= g->dirty_cap) {
+			g->dirty_cap = g->dirty_cap ? g->dirty_cap * 2 : 64;
+			g->dirty = skynet_realloc(g->dirty, g->dirty_cap * sizeof(int));
+		}
+		g->dirty[g->dirty_n++] = c->id;
+		c->dirty = 1;
+	}
+	_flush_later(g);
+}
+
+static void
+_report(struct gate * g, const char * data, ...) {
+	if (g->watchdog == 0) {
+		return;
+	}
+	struct skynet_context * ctx = g->ctx;
+	va_list ap;
+	va_start(ap, data);
+	char tmp[1024];
+	int n = vsnprintf(tmp, sizeof(tmp), data, ap);
+	va_end(ap);
+
+	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
+}
+
+// report accept, then it will be get a SKYNET_SOCKET_TYPE_CONNECT message after start
+static void
+_accept(struct gate *g, int id, const char *addr, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	if (g->connection >= g->max_connection) {
+		skynet_socket_close(ctx, id);
+		return;
+	}
+	struct connection *c = _insert(g, id);
+	if (sz >= sizeof(c->remote_name)) {
+		sz = sizeof(c->remote_name) - 1;
+	}
+	uint32_t shard = g->shard[g->next_shard];
+	g->next_shard = (g->next_shard + 1) % g->shards;
+	if (shard) {
+		// hand over the connection, the shard owns it after "start"
+		char tmp[64];
+		int n = snprintf(tmp, sizeof(tmp), "accept %d %.*s", id, sz, addr);
+		c->shard = shard;
+		skynet_send(ctx, 0, shard, PTYPE_TEXT, 0, tmp, n);
+		return;
+	}
+	if (g->websocket) {
+		c->ws = skynet_malloc(sizeof(struct websocket));
+		memset(c->ws, 0, sizeof(struct websocket));
+	} else {
+		// split packages in socket thread, the package larger than 16M closes the socket
+		skynet_socket_frame(ctx, c->id, g->header_size, 0, FRAME_MAX);
+	}
+	memcpy(c->remote_name, addr, sz);
+	c->remote_name[sz] = '\0';
+	// the source of open (and of the client messages) is the shard owns the connection,
+	// send start/kick/forward and the writes to it, rather than to the gate which listens
+	_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
+	skynet_error(ctx, "socket open: %x", c->id);
+}
+
+static void
+_ctrl(struct gate * g, uint32_t source, const void * msg, int sz) {
 	struct skynet_context * ctx = g->ctx;
 	char tmp[sz+1];
 	memcpy(tmp, msg, sz);
@@ -100,11 +351,20 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 			break;
 		}
 	}
+	if (g->shards > 1 && (memcmp(command,"kick",i)==0 || memcmp(command,"forward",i)==0 || memcmp(command,"start",i)==0)) {
+		// the commands of the connection in other shard, sent to the gate which listens
+		struct connection *c = _lookup(g, strtol(command+i, NULL, 10));
+		if (c && c->shard) {
+			skynet_send(ctx, 0, c->shard, PTYPE_TEXT, 0, (void *)msg, sz);
+			return;
+		}
+	}
 	if (memcmp(command,"kick",i)==0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		struct connection *c = _lookup(g, uid);
+		if (c) {
+			_flush_connection(g, c);
 			skynet_socket_close(ctx, uid);
 		}
 		return;
@@ -127,6 +387,7 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 		return;
 	}
 	if (memcmp(command,"broker",i)==0) {
+		_send_shards(g, msg, sz);
 		_parm(tmp, sz, i);
 		g->broker = skynet_queryname(ctx, command);
 		return;
@@ -134,12 +395,46 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"start",i) == 0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		if (_lookup(g, uid)) {
+			// the socket is owned by this context after start, even if it's accepted by another shard
 			skynet_socket_start(ctx, uid);
 		}
 		return;
 	}
+	if (memcmp(command,"accept",i) == 0) {
+		// accept id addr : the connection handed over by the gate which listens
+		_parm(tmp, sz, i);
+		char * addr = tmp;
+		char * idstr = strsep(&addr, " ");
+		if (addr == NULL) {
+			return;
+		}
+		g->master = source;
+		_accept(g, strtol(idstr, NULL, 10), addr, strlen(addr));
+		return;
+	}
+	if (memcmp(command,"closed",i) == 0) {
+		// closed id : the connection handed over to a shard is closed
+		_parm(tmp, sz, i);
+		struct connection *c = _lookup(g, strtol(command, NULL, 10));
+		if (c && c->shard) {
+			_remove(g, c);
+		}
+		return;
+	}
+	if (memcmp(command, "coalesce", i) == 0) {
+		// coalesce [ticks|off] : pack the messages to each connection into one buffer, and send it later
+		_send_shards(g, msg, sz);
+		_parm(tmp, sz, i);
+		if (strcmp(command, "off") == 0) {
+			_flush(g);
+			g->coalesce = -1;
+		} else {
+			int ticks = strtol(command, NULL, 10);
+			g->coalesce = ticks > 0 ? ticks : 0;
+		}
+		return;
+	}
 	if (memcmp(command, "close", i) == 0) {
 		if (g->listen_id >= 0) {
 			skynet_socket_close(ctx, g->listen_id);
@@ -150,67 +445,265 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	skynet_error(ctx, "[gate] Unknown command : %s", command);
 }
 
+// the socket is in frame mode (see skynet_socket_frame), so data is a whole package without header.
 static void
-_report(struct gate * g, const char * data, ...) {
-	if (g->watchdog == 0) {
-		return;
-	}
-	struct skynet_context * ctx = g->ctx;
-	va_list ap;
-	va_start(ap, data);
-	char tmp[1024];
-	int n = vsnprintf(tmp, sizeof(tmp), data, ap);
-	va_end(ap);
-
-	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
-}
-
-static void
-_forward(struct gate *g, struct connection * c, int size) {
+_forward(struct gate *g, struct connection * c, void * data, int size) {
 	struct skynet_context * ctx = g->ctx;
 	int fd = c->id;
-	if (fd <= 0) {
-		// socket error
+	if (fd <= 0 || size == 0) {
+		// socket error or empty package
+		skynet_free(data);
 		return;
 	}
 	if (g->broker) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,(char *)temp, size);
-		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, fd, temp, size);
+		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, fd, data, size);
 		return;
 	}
 	if (c->agent) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,(char *)temp, size);
-		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, fd , temp, size);
+		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, fd , data, size);
 	} else if (g->watchdog) {
 		char * tmp = skynet_malloc(size + 32);
 		int n = snprintf(tmp,32,"%d data ",c->id);
-		databuffer_read(&c->buffer,&g->mp,tmp+n,size);
+		memcpy(tmp+n, data, size);
+		skynet_free(data);
 		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, fd, tmp, size + n);
+	} else {
+		skynet_free(data);
 	}
 }
 
 static void
-dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);
-	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
-			return;
-		} else if (size > 0) {
-			if (size >= 0x1000000) {
-				struct skynet_context * ctx = g->ctx;
-				databuffer_clear(&c->buffer,&g->mp);
-				skynet_socket_close(ctx, id);
-				skynet_error(ctx, "Recv socket message > 16M");
-				return;
-			} else {
-				_forward(g, c, size);
-				databuffer_reset(&c->buffer);
+_send_frame(struct gate *g, struct connection *c, int op, const void *payload, int sz) {
+	uint8_t header[WS_HEADER_MAX];
+	int n = ws_header(header, 1, op, sz, NULL);
+	_write(g, c, header, n, payload, sz);
+}
+
+static void
+_copy_payload(char *dst, const struct ws_frame *f, const uint8_t *payload, int sz) {
+	if (f->mask) {
+		ws_mask((uint8_t *)dst, payload, sz, f->key, 0);
+	} else {
+		memcpy(dst, payload, sz);
+	}
+}
+
+static void
+_reserve(char **buffer, int *cap, int sz) {
+	if (sz > *cap) {
+		int n = *cap ? *cap : 1024;
+		while (n < sz)
+			n *= 2;
+		*buffer = skynet_realloc(*buffer, n);
+		*cap = n;
+	}
+}
+
+// return -1 if the connection should be closed
+static int
+_websocket_frame(struct gate *g, struct connection *c, const struct ws_frame *f, const uint8_t *payload) {
+	struct websocket *ws = c->ws;
+	int sz = (int)f->len;
+	switch (f->op) {
+	case WS_OP_PING: {
+		char tmp[WS_CONTROL_MAX];
+		_copy_payload(tmp, f, payload, sz);
+		_send_frame(g, c, WS_OP_PONG, tmp, sz);
+		return 0;
+	}
+	case WS_OP_PONG:
+		return 0;
+	case WS_OP_CLOSE: {
+		// echo the status code
+		char tmp[WS_CONTROL_MAX];
+		_copy_payload(tmp, f, payload, sz);
+		_send_frame(g, c, WS_OP_CLOSE, tmp, sz >= 2 ? 2 : 0);
+		return -1;
+	}
+	case WS_OP_TEXT:
+	case WS_OP_BINARY:
+		if (ws->op)
+			return -1;
+		if (f->fin) {
+			char * msg = skynet_malloc(sz);
+			_copy_payload(msg, f, payload, sz);
+			_forward(g, c, msg, sz);
+			return 0;
+		}
+		ws->op = f->op;
+		break;
+	case WS_OP_CONTINUATION:
+		if (ws->op == 0)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+	// reassemble the fragments
+	if (ws->msz + sz > FRAME_MAX)
+		return -1;
+	_reserve(&ws->message, &ws->mcap, ws->msz + sz);
+	_copy_payload(ws->message + ws->msz, f, payload, sz);
+	ws->msz += sz;
+	if (f->fin) {
+		_forward(g, c, ws->message, ws->msz);
+		ws->message = NULL;
+		ws->msz = ws->mcap = 0;
+		ws->op = 0;
+	}
+	return 0;
+}
+
+static const char *
+_header_field(const char *line, const char *end, const char *name, int *sz) {
+	int n = strlen(name);
+	if (end - line <= n || strncasecmp(line, name, n) != 0 || line[n] != ':')
+		return NULL;
+	line += n + 1;
+	while (line < end && *line == ' ')
+		++line;
+	const char * value = line;
+	while (line < end && *line != '\r')
+		++line;
+	while (line > value && line[-1] == ' ')
+		--line;
+	*sz = line - value;
+	return value;
+}
+
+static void
+_base64(const uint8_t *data, int sz, char *out) {
+	static const char encoding[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	int i, j = 0;
+	for (i=0;i+2<sz;i+=3) {
+		uint32_t v = data[i] << 16 | data[i+1] << 8 | data[i+2];
+		out[j++] = encoding[v >> 18];
+		out[j++] = encoding[(v >> 12) & 0x3f];
+		out[j++] = encoding[(v >> 6) & 0x3f];
+		out[j++] = encoding[v & 0x3f];
+	}
+	if (i < sz) {
+		uint32_t v = data[i] << 16 | (i+1 < sz ? data[i+1] << 8 : 0);
+		out[j++] = encoding[v >> 18];
+		out[j++] = encoding[(v >> 12) & 0x3f];
+		out[j++] = i+1 < sz ? encoding[(v >> 6) & 0x3f] : '=';
+		out[j++] = '=';
+	}
+	out[j] = '\0';
+}
+
+// return the size of the handshake request, 0 for more data, -1 for bad request
+static int
+_websocket_handshake(struct gate *g, struct connection *c, const char *req, int sz) {
+	int i;
+	for (i=0;i+3<sz;i++) {
+		if (memcmp(req+i, "\r\n\r\n", 4) == 0)
+			break;
+	}
+	if (i+3 >= sz)
+		return sz > HANDSHAKE_MAX ? -1 : 0;
+	const char * end = req + i + 2;
+	const char * key = NULL;
+	int key_sz = 0;
+	int upgrade = 0;
+	int version = 0;
+	if (memcmp(req, "GET ", 4) == 0) {
+		const char * line = memchr(req, '\n', end - req) + 1;
+		while (line < end) {
+			const char * eol = memchr(line, '\n', end - line);
+			const char * value;
+			int vsz;
+			if ((value = _header_field(line, eol, "Sec-WebSocket-Key", &vsz))) {
+				key = value;
+				key_sz = vsz;
+			} else if ((value = _header_field(line, eol, "Upgrade", &vsz))) {
+				upgrade = vsz == 9 && strncasecmp(value, "websocket", 9) == 0;
+			} else if ((value = _header_field(line, eol, "Sec-WebSocket-Version", &vsz))) {
+				version = vsz == 2 && memcmp(value, "13", 2) == 0;
 			}
+			line = eol + 1;
+		}
+	}
+	if (key == NULL || key_sz > 64 || !upgrade || !version) {
+		static const char bad[] = "HTTP/1.1 400 Bad Request\r\n\r\n";
+		skynet_socket_send(g->ctx, c->id, skynet_strdup(bad), sizeof(bad) - 1);
+		return -1;
+	}
+	char tmp[64 + sizeof(WS_GUID)];
+	memcpy(tmp, key, key_sz);
+	memcpy(tmp + key_sz, WS_GUID, sizeof(WS_GUID) - 1);
+	uint8_t digest[20];
+	sha1_digest((const uint8_t *)tmp, key_sz + sizeof(WS_GUID) - 1, digest);
+	char accept[32];
+	_base64(digest, sizeof(digest), accept);
+	char * resp = skynet_malloc(256);
+	int n = snprintf(resp, 256, "HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+	skynet_socket_send(g->ctx, c->id, resp, n);
+	c->ws->handshake = 1;
+	return i + 4;
+}
+
+// parse the websocket stream, data is freed here
+static void
+_forward_websocket(struct gate *g, struct connection *c, char * data, int size) {
+	struct websocket *ws = c->ws;
+	if (ws->closed) {
+		skynet_free(data);
+		return;
+	}
+	const uint8_t * ptr = (const uint8_t *)data;
+	int sz = size;
+	if (ws->sz > 0) {
+		_reserve(&ws->buffer, &ws->cap, ws->sz + size);
+		memcpy(ws->buffer + ws->sz, data, size);
+		skynet_free(data);
+		data = NULL;
+		ptr = (const uint8_t *)ws->buffer;
+		sz = ws->sz + size;
+	}
+	int offset = 0;
+	if (!ws->handshake) {
+		offset = _websocket_handshake(g, c, (const char *)ptr, sz);
+		if (offset < 0)
+			goto _close;
+	}
+	if (ws->handshake) {
+		while (offset < sz) {
+			struct ws_frame f;
+			int r = ws_parse(ptr + offset, sz - offset, &f);
+			if (r == 0)
+				break;
+			if (r < 0 || !ws_valid(&f) || f.len > FRAME_MAX)
+				goto _close;
+			if ((uint64_t)(sz - offset - f.header) < f.len)
+				break;
+			const uint8_t * payload = ptr + offset + f.header;
+			offset += f.header + (int)f.len;
+			if (_websocket_frame(g, c, &f, payload))
+				goto _close;
 		}
 	}
+	// keep the rest bytes
+	if (offset < sz) {
+		if (ptr == (const uint8_t *)ws->buffer) {
+			memmove(ws->buffer, ws->buffer + offset, sz - offset);
+		} else {
+			_reserve(&ws->buffer, &ws->cap, sz - offset);
+			memcpy(ws->buffer, ptr + offset, sz - offset);
+		}
+	}
+	ws->sz = sz - offset;
+	skynet_free(data);
+	return;
+_close:
+	ws->closed = 1;
+	ws->sz = 0;
+	skynet_free(data);
+	_flush_connection(g, c);
+	skynet_socket_close(g->ctx, c->id);
 }
 
 static void
@@ -218,10 +711,14 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 	struct skynet_context * ctx = g->ctx;
 	switch(message->type) {
 	case SKYNET_SOCKET_TYPE_DATA: {
-		int id = hashid_lookup(&g->hash, message->id);
-		if (id>=0) {
-			struct connection *c = &g->conn[id];
-			dispatch_message(g, c, message->id, message->buffer, message->ud);
+		skynet_socket_latency(message);
+		struct connection *c = _lookup(g, message->id);
+		if (c) {
+			if (c->ws) {
+				_forward_websocket(g, c, message->buffer, message->ud);
+			} else {
+				_forward(g, c, message->buffer, message->ud);
+			}
 		} else {
 			skynet_error(ctx, "Drop unknown connection %d message", message->id);
 			skynet_socket_close(ctx, message->id);
@@ -234,8 +731,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 			// start listening
 			break;
 		}
-		int id = hashid_lookup(&g->hash, message->id);
-		if (id<0) {
+		if (_lookup(g, message->id) == NULL) {
 			skynet_error(ctx, "Close unknown connection %d", message->id);
 			skynet_socket_close(ctx, message->id);
 		}
@@ -243,33 +739,23 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 	}
 	case SKYNET_SOCKET_TYPE_CLOSE:
 	case SKYNET_SOCKET_TYPE_ERROR: {
-		int id = hashid_remove(&g->hash, message->id);
-		if (id>=0) {
-			struct connection *c = &g->conn[id];
-			databuffer_clear(&c->buffer,&g->mp);
-			memset(c, 0, sizeof(*c));
-			c->id = -1;
+		struct connection *c = _lookup(g, message->id);
+		if (c) {
+			_remove(g, c);
 			_report(g, "%d close", message->id);
+			if (g->master) {
+				char tmp[32];
+				int n = snprintf(tmp, sizeof(tmp), "closed %d", message->id);
+				skynet_send(ctx, 0, g->master, PTYPE_TEXT, 0, tmp, n);
+			}
 		}
 		break;
 	}
-	case SKYNET_SOCKET_TYPE_ACCEPT:
-		// report accept, then it will be get a SKYNET_SOCKET_TYPE_CONNECT message
+	case SKYNET_SOCKET_TYPE_ACCEPT: {
 		assert(g->listen_id == message->id);
-		if (hashid_full(&g->hash)) {
-			skynet_socket_close(ctx, message->ud);
-		} else {
-			struct connection *c = &g->conn[hashid_insert(&g->hash, message->ud)];
-			if (sz >= sizeof(c->remote_name)) {
-				sz = sizeof(c->remote_name) - 1;
-			}
-			c->id = message->ud;
-			memcpy(c->remote_name, message+1, sz);
-			c->remote_name[sz] = '\0';
-			_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
-			skynet_error(ctx, "socket open: %x", c->id);
-		}
+		_accept(g, message->ud, (const char *)(message+1), sz);
 		break;
+	}
 	case SKYNET_SOCKET_TYPE_WARNING:
 		skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
 		break;
@@ -281,7 +767,7 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 	struct gate *g = ud;
 	switch(type) {
 	case PTYPE_TEXT:
-		_ctrl(g , msg , (int)sz);
+		_ctrl(g , source, msg , (int)sz);
 		break;
 	case PTYPE_CLIENT: {
 		if (sz <=4 ) {
@@ -291,8 +777,27 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 		// The last 4 bytes in msg are the id of socket, write following bytes to it
 		const uint8_t * idbuf = msg + sz - 4;
 		uint32_t uid = idbuf[0] | idbuf[1] << 8 | idbuf[2] << 16 | idbuf[3] << 24;
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		struct connection *c = _lookup(g, uid);
+		if (c && c->shard) {
+			// the writes should go to the shard directly (the source of open), this forwarding costs one more message
+			skynet_send(ctx, source, c->shard, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, session, (void *)msg, sz);
+			// the shard frees msg
+			return 1;
+		}
+		if (c) {
+			if (c->ws) {
+				// send as one binary frame
+				if (c->ws->handshake && !c->ws->closed) {
+					_send_frame(g, c, WS_OP_BINARY, msg, sz-4);
+				} else {
+					skynet_error(ctx, "Drop message to websocket %d before handshake", (int)uid);
+				}
+				break;
+			}
+			if (g->coalesce >= 0) {
+				_write(g, c, NULL, 0, msg, sz-4);
+				break;
+			}
 			// don't send id (last 4 bytes)
 			skynet_socket_send(ctx, uid, (void*)msg, sz-4);
 			// return 1 means don't free msg
@@ -302,6 +807,13 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 			break;
 		}
 	}
+	case PTYPE_RESPONSE:
+		// the flush timer of coalesce mode
+		if (session == g->flush_session) {
+			g->flush_session = 0;
+			_flush(g);
+		}
+		break;
 	case PTYPE_SOCKET:
 		// recv socket message from skynet_socket
 		dispatch_socket_message(g, msg, (int)(sz-sizeof(struct skynet_socket_message)));
@@ -348,8 +860,9 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
+	int shards = 1;
 	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	int n = sscanf(parm, "%c %s %s %d %d %d", &header, watchdog, binding, &client_tag, &max, &shards);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -358,10 +871,14 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		skynet_error(ctx, "Need max connection");
 		return 1;
 	}
-	if (header != 'S' && header !='L') {
+	if (header != 'S' && header !='L' && header != 'W') {
 		skynet_error(ctx, "Invalid data header style");
 		return 1;
 	}
+	if (shards < 1 || shards > SHARD_MAX) {
+		skynet_error(ctx, "Invalid shards %d", shards);
+		return 1;
+	}
 
 	if (client_tag == 0) {
 		client_tag = PTYPE_CLIENT;
@@ -378,19 +895,40 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 
 	g->ctx = ctx;
 
-	hashid_init(&g->hash, max);
-	g->conn = skynet_malloc(max * sizeof(struct connection));
-	memset(g->conn, 0, max *sizeof(struct connection));
+	// the gate which listens counts the connections of all the shards
 	g->max_connection = max;
+	g->slot = skynet_malloc(SLOT_SIZE * sizeof(struct connection));
+	memset(g->slot, 0, SLOT_SIZE * sizeof(struct connection));
+	g->slot_mask = SLOT_SIZE - 1;
 	int i;
-	for (i=0;i<max;i++) {
-		g->conn[i].id = -1;
+	for (i=0;i<SLOT_SIZE;i++) {
+		g->slot[i].id = -1;
 	}
-	
+	g->shards = shards;
+	g->shard[0] = 0;
+	for (i=1;i<shards;i++) {
+		// the shards don't listen (binding is "-"), the connections are handed over by this one
+		char tmp[sz + 64];
+		snprintf(tmp, sizeof(tmp), "gate %c %s - %d %d", header, watchdog, client_tag, max);
+		const char * handle = skynet_command(ctx, "LAUNCH", tmp);
+		if (handle == NULL) {
+			skynet_error(ctx, "Launch gate shard failed");
+			g->shards = i;
+			return 1;
+		}
+		g->shard[i] = strtoul(handle+1, NULL, 16);
+	}
+
 	g->client_tag = client_tag;
+	// 'W' for websocket
 	g->header_size = header=='S' ? 2 : 4;
+	g->websocket = header=='W';
 
 	skynet_callback(ctx,g,_cb);
 
+	if (strcmp(binding, "-") == 0) {
+		// a shard without listener
+		return 0;
+	}
 	return start_listen(g,binding);
 }
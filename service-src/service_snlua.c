@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #if defined(__APPLE__)
 #include <mach/task.h>
@@ -31,6 +33,38 @@ struct snlua {
     size_t mem_limit; 			// 内存的上限设置
     lua_State *activeL; 		// 目前正在运行的状态机
     ATOM_INT trap; 				// 打断状态
+    struct arena *arena;		// 小对象的内存池 (config snlua_arena), NULL 表示直接用 skynet_lalloc
+    int sample_interval;		// 采样的间隔 (毫秒), 0 表示没有采样 (见 sample_hook)
+    int sample_countdown;		// 采样线程使用, 距离下次采样的毫秒数
+    uint64_t sample_time;		// 采样线程设置 hook 的时间
+    ATOM_INT sampling;			// sample_L 的自旋锁, 采样线程和服务线程共用
+    ATOM_INT busy;				// lua_resumeX 的嵌套层数, 0 表示服务空闲, 不采样
+    lua_State *sample_L;		// 设置了 sample_hook 还没触发的状态机, NULL 表示没有
+    lua_Hook sample_saved;		// sample_hook 替换掉的 hook (用户或调试器设置), 触发或取消时恢复
+    int sample_mask;
+    int sample_count;
+    struct snlua *sample_next;	// 采样中的服务链表
+};
+
+// Per-service arena (config snlua_arena = true). The small objects of lua are allocated from the size classed
+// free lists in the chunks of the service, and the chunks are freed at once when the service exits.
+// lua always passes the size of a block to the allocator, so the blocks have no header.
+#define ARENA_ALIGN 16
+#define ARENA_MAXSIZE 256
+#define ARENA_CLASSES (ARENA_MAXSIZE / ARENA_ALIGN)
+#define ARENA_CHUNKSIZE (64 * 1024)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	char padding[ARENA_ALIGN - sizeof(struct arena_chunk *)];
+};
+
+struct arena {
+	void *freelist[ARENA_CLASSES];
+	char *ptr;	// the free space of the current chunk
+	char *end;
+	struct arena_chunk *chunk;
+	int closing;	// in lua_close, the blocks are not reused
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -50,6 +84,7 @@ codecache(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "clear", cleardummy },
 		{ "mode", cleardummy },
+		{ "bytecode", cleardummy },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -73,6 +108,201 @@ signal_hook(lua_State *L, lua_Debug *ar) {
 	}
 }
 
+// Sampling profiler. The sampler thread sets a hook on the running state of the services every interval,
+// like snlua_signal does, and the hook records the folded stack (the format of flamegraph.pl) in a table of registry.
+// A service is busy while lua_resumeX runs a coroutine (the code of the main thread outside coroutines isn't sampled).
+// The hook also catches the return of a C function, so the time spent in C is charged to the C frame, and a late
+// hook counts the intervals it missed. The replaced hook of the user is restored when sample_hook fires or is canceled.
+#define SAMPLE_DEPTH 64
+#define SAMPLE_TABLE "skynet.profile.sample"
+
+struct sampler {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct snlua *list;
+};
+
+static struct sampler SAMPLER;
+static ATOM_INT SAMPLER_INIT;
+
+static uint64_t
+sample_clock(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * NANOSEC + ti.tv_nsec;
+}
+
+static void
+sample_frame(luaL_Buffer *b, lua_Debug *ar) {
+	char tmp[LUA_IDSIZE + 64];
+	const char *name = ar->name;
+	if (name == NULL)
+		name = *ar->what == 'm' ? "main" : "?";
+	if (*ar->what == 'C') {
+		snprintf(tmp, sizeof(tmp), "%s@[C]", name);
+	} else {
+		snprintf(tmp, sizeof(tmp), "%s@%s:%d", name, ar->short_src, ar->linedefined);
+	}
+	luaL_addstring(b, tmp);
+}
+
+static void
+sample_stack(lua_State *L, lua_Integer weight) {
+	lua_Debug ar;
+	int depth = 0;
+	while (depth < SAMPLE_DEPTH && lua_getstack(L, depth, &ar))
+		++depth;
+	if (depth == 0)
+		return;
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	if (lua_getstack(L, depth, &ar)) {
+		// too deep, keep the frames near the leaf
+		luaL_addstring(&b, "...;");
+	}
+	int i;
+	for (i = depth - 1; i >= 0; i--) {
+		lua_getstack(L, i, &ar);
+		lua_getinfo(L, "Sn", &ar);
+		sample_frame(&b, &ar);
+		if (i > 0)
+			luaL_addchar(&b, ';');
+	}
+	luaL_pushresult(&b);
+	if (lua_getfield(L, LUA_REGISTRYINDEX, SAMPLE_TABLE) != LUA_TTABLE) {
+		lua_pop(L, 2);
+		return;
+	}
+	lua_pushvalue(L, -2);
+	lua_Integer n = (lua_rawget(L, -2) == LUA_TNUMBER) ? lua_tointeger(L, -1) : 0;
+	lua_pop(L, 1);
+	lua_insert(L, -2);
+	lua_pushinteger(L, n + weight);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+static void
+sample_hook(lua_State *L, lua_Debug *ar) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+
+	while (!ATOM_CAS(&l->sampling, 0, 1)) ;
+	lua_Hook hook = l->sample_saved;
+	int mask = l->sample_mask;
+	uint64_t ti = l->sample_time;
+	l->sample_L = NULL;
+	lua_sethook(L, hook, mask, l->sample_count);
+	ATOM_STORE(&l->sampling, 0);
+	int interval = l->sample_interval;
+	if (interval) {
+		uint64_t weight = (sample_clock() - ti) / ((uint64_t)interval * 1000000);
+		sample_stack(L, weight > 1 ? (lua_Integer)weight : 1);
+	}
+	if (ATOM_LOAD(&l->trap)) {
+		// the sampler replaced signal_hook
+		signal_hook(L, ar);
+	} else if (hook && ar->event == LUA_HOOKRET && (mask & LUA_MASKRET)) {
+		hook(L, ar);
+	}
+}
+
+// the service thread cancels the hook on a state which stops running, it may be collected later.
+static void
+sample_cancel(struct snlua *l, lua_State *running) {
+	while (!ATOM_CAS(&l->sampling, 0, 1)) ;
+	lua_State *L = l->sample_L;
+	if (L && (L != running || ATOM_LOAD(&l->busy) == 0 || lua_gethook(L) != sample_hook)) {
+		if (lua_gethook(L) == sample_hook) {
+			lua_sethook(L, l->sample_saved, l->sample_mask, l->sample_count);
+		}
+		// else the hook was replaced by debug.sethook or snlua_signal
+		l->sample_L = NULL;
+	}
+	ATOM_STORE(&l->sampling, 0);
+}
+
+static void *
+sampler_thread(void *p) {
+	(void)p;
+	pthread_mutex_lock(&SAMPLER.lock);
+	for (;;) {
+		if (SAMPLER.list == NULL) {
+			pthread_cond_wait(&SAMPLER.cond, &SAMPLER.lock);
+			continue;
+		}
+		struct snlua *l;
+		for (l = SAMPLER.list; l; l = l->sample_next) {
+			if (--l->sample_countdown > 0)
+				continue;
+			l->sample_countdown = l->sample_interval;
+			if (ATOM_LOAD(&l->trap) || !ATOM_CAS(&l->sampling, 0, 1))
+				continue;
+			lua_State *L = l->activeL;
+			if (L && l->sample_L == NULL && ATOM_LOAD(&l->busy) > 0) {
+				l->sample_saved = lua_gethook(L);
+				l->sample_mask = lua_gethookmask(L);
+				l->sample_count = lua_gethookcount(L);
+				l->sample_time = sample_clock();
+				l->sample_L = L;
+				lua_sethook(L, sample_hook, LUA_MASKCOUNT | LUA_MASKRET, 1);
+			}
+			ATOM_STORE(&l->sampling, 0);
+		}
+		pthread_mutex_unlock(&SAMPLER.lock);
+		usleep(1000);
+		pthread_mutex_lock(&SAMPLER.lock);
+	}
+	return NULL;
+}
+
+static int
+sampler_init(void) {
+	if (ATOM_LOAD(&SAMPLER_INIT) == 2)
+		return 1;
+	if (ATOM_CAS(&SAMPLER_INIT, 0, 1)) {
+		pthread_mutex_init(&SAMPLER.lock, NULL);
+		pthread_cond_init(&SAMPLER.cond, NULL);
+		pthread_t pid;
+		if (pthread_create(&pid, NULL, sampler_thread, NULL)) {
+			ATOM_STORE(&SAMPLER_INIT, 0);
+			return 0;
+		}
+		pthread_detach(pid);
+		ATOM_STORE(&SAMPLER_INIT, 2);
+		return 1;
+	}
+	while (ATOM_LOAD(&SAMPLER_INIT) == 1) ;
+	return ATOM_LOAD(&SAMPLER_INIT) == 2;
+}
+
+static void
+sample_stop(struct snlua *l) {
+	if (l->sample_interval == 0)
+		return;
+	pthread_mutex_lock(&SAMPLER.lock);
+	struct snlua **p = &SAMPLER.list;
+	while (*p != l)
+		p = &(*p)->sample_next;
+	*p = l->sample_next;
+	l->sample_next = NULL;
+	l->sample_interval = 0;
+	pthread_mutex_unlock(&SAMPLER.lock);
+}
+
+static void
+sample_start(struct snlua *l, int interval) {
+	sample_stop(l);
+	pthread_mutex_lock(&SAMPLER.lock);
+	l->sample_interval = interval;
+	l->sample_countdown = interval;
+	l->sample_next = SAMPLER.list;
+	SAMPLER.list = l;
+	pthread_cond_signal(&SAMPLER.cond);
+	pthread_mutex_unlock(&SAMPLER.lock);
+}
+
 static void
 switchL(lua_State *L, struct snlua *l) {
 	l->activeL = L;
@@ -87,12 +317,18 @@ lua_resumeX(lua_State *L, lua_State *from, int nargs, int *nresults) {
 	lua_getallocf(L, &ud);
 	struct snlua *l = (struct snlua *)ud;
 	switchL(L, l);
+	ATOM_FINC(&l->busy);
 	int err = lua_resume(L, from, nargs, nresults);
+	ATOM_FDEC(&l->busy);
 	if (ATOM_LOAD(&l->trap)) {
 		// wait for lua_sethook. (l->trap == -1)
 		while (ATOM_LOAD(&l->trap) >= 0) ;
 	}
 	switchL(from, l);
+	if (l->sample_interval || l->sample_L) {
+		// L may be collected after return
+		sample_cancel(l, from);
+	}
 	return err;
 }
 
@@ -326,11 +562,53 @@ lstop(lua_State *L) {
 	return 1;
 }
 
+// sample(hz) starts sampling the stacks of this service, sample() stops it and returns the folded stacks
+static int
+lsample(lua_State *L) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+	lua_Integer hz = luaL_optinteger(L, 1, 0);
+	if (hz > 0) {
+		if (hz > 1000)
+			return luaL_error(L, "The frequency of sampling should be 1 ~ 1000 (%d)", (int)hz);
+		if (!sampler_init())
+			return luaL_error(L, "Create the thread of sampler failed");
+		lua_newtable(L);
+		lua_setfield(L, LUA_REGISTRYINDEX, SAMPLE_TABLE);
+		sample_start(l, (int)(1000 / hz));
+		return 0;
+	}
+	sample_stop(l);
+	if (lua_getfield(L, LUA_REGISTRYINDEX, SAMPLE_TABLE) != LUA_TTABLE)
+		return 0;
+	lua_pushnil(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, SAMPLE_TABLE);
+	int t = lua_gettop(L);
+	lua_newtable(L);
+	int i, n = 0;
+	lua_pushnil(L);
+	while (lua_next(L, t) != 0) {
+		lua_pushfstring(L, "%s %I\n", lua_tostring(L, -2), lua_tointeger(L, -1));
+		lua_rawseti(L, t + 1, ++n);
+		lua_pop(L, 1);
+	}
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, t + 1, i);
+		luaL_addvalue(&b);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
 static int
 init_profile(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "start", lstart },
 		{ "stop", lstop },
+		{ "sample", lsample },
 		{ "resume", luaB_coresume },
 		{ "wrap", luaB_cowrap },
 		{ NULL, NULL },
@@ -502,6 +780,94 @@ snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
 	return 0;
 }
 
+#define ARENA_CLASS(sz) (((sz) - 1) / ARENA_ALIGN)
+
+static void
+arena_free(struct arena *a, void *ptr, size_t sz) {
+	if (sz > ARENA_MAXSIZE) {
+		skynet_lalloc(ptr, sz, 0);
+	} else if (!a->closing) {
+		void **block = ptr;
+		int c = ARENA_CLASS(sz);
+		*block = a->freelist[c];
+		a->freelist[c] = block;
+	}
+}
+
+static void *
+arena_alloc(struct arena *a, size_t sz) {
+	if (sz > ARENA_MAXSIZE)
+		return skynet_lalloc(NULL, 0, sz);
+	int c = ARENA_CLASS(sz);
+	void **block = a->freelist[c];
+	if (block) {
+		a->freelist[c] = *block;
+		return block;
+	}
+	sz = (c + 1) * ARENA_ALIGN;
+	if (a->ptr + sz > a->end) {
+		// put the rest of the chunk into the free list
+		size_t rest = a->end - a->ptr;
+		if (rest >= ARENA_ALIGN)
+			arena_free(a, a->ptr, rest - rest % ARENA_ALIGN);
+		struct arena_chunk *chunk = skynet_malloc(ARENA_CHUNKSIZE);
+		chunk->next = a->chunk;
+		a->chunk = chunk;
+		a->ptr = (char *)(chunk + 1);
+		a->end = (char *)chunk + ARENA_CHUNKSIZE;
+	}
+	block = (void **)a->ptr;
+	a->ptr += sz;
+	return block;
+}
+
+static void *
+arena_realloc(struct arena *a, void *ptr, size_t osize, size_t nsize) {
+	if (ptr == NULL) {
+		// osize is the type of object
+		return nsize == 0 ? NULL : arena_alloc(a, nsize);
+	}
+	if (nsize == 0) {
+		arena_free(a, ptr, osize);
+		return NULL;
+	}
+	if (osize > ARENA_MAXSIZE && nsize > ARENA_MAXSIZE)
+		return skynet_lalloc(ptr, osize, nsize);
+	if (osize <= ARENA_MAXSIZE && nsize <= ARENA_MAXSIZE && ARENA_CLASS(osize) == ARENA_CLASS(nsize))
+		return ptr;
+	void *block = arena_alloc(a, nsize);
+	if (block == NULL)
+		return NULL;
+	memcpy(block, ptr, osize < nsize ? osize : nsize);
+	arena_free(a, ptr, osize);
+	return block;
+}
+
+static struct arena *
+arena_new(void) {
+	static int enable = -1;
+	if (enable < 0) {
+		const char * opt = skynet_command(NULL, "GETENV", "snlua_arena");
+		enable = opt != NULL && strcmp(opt, "false") != 0 && strcmp(opt, "0") != 0;
+	}
+	if (!enable)
+		return NULL;
+	struct arena *a = skynet_malloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	return a;
+}
+
+static void
+arena_delete(struct arena *a) {
+	struct arena_chunk *chunk = a->chunk;
+	while (chunk) {
+		struct arena_chunk *next = chunk->next;
+		skynet_free(chunk);
+		chunk = next;
+	}
+	skynet_free(a);
+}
+
 static void *
 lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 	struct snlua *l = ud;
@@ -519,6 +885,8 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->arena)
+		return arena_realloc(l->arena, ptr, osize, nsize);
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
@@ -528,6 +896,7 @@ snlua_create(void) {
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
+	l->arena = arena_new();
 	l->L = lua_newstate(lalloc, l);
 	l->activeL = NULL;
 	ATOM_INIT(&l->trap , 0);
@@ -536,7 +905,14 @@ snlua_create(void) {
 
 void
 snlua_release(struct snlua *l) {
-	lua_close(l->L);
+	sample_stop(l);
+	if (l->arena) {
+		l->arena->closing = 1;
+		lua_close(l->L);
+		arena_delete(l->arena);
+	} else {
+		lua_close(l->L);
+	}
 	skynet_free(l);
 }
 
@@ -0,0 +1,147 @@
+#ifndef skynet_websocket_h
+#define skynet_websocket_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// websocket frame codec (RFC 6455), shared by service_gate.c and lua-websocket.c
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+#define WS_HEADER_MAX 14	// 2 + 8 (extended payload length) + 4 (masking key)
+#define WS_CONTROL_MAX 125	// the max payload of control frames
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+struct ws_frame {
+	int fin;
+	int op;
+	int mask;
+	int rsv;		// rsv1-3 bits
+	uint8_t key[4];
+	int header;		// size of frame header
+	uint64_t len;	// payload length
+};
+
+// the size of frame header, decided by the first 2 bytes
+static inline int
+ws_header_size(const uint8_t head[2]) {
+	int n = 2;
+	switch (head[1] & 0x7f) {
+	case 126:
+		n += 2;
+		break;
+	case 127:
+		n += 8;
+		break;
+	}
+	if (head[1] & 0x80)
+		n += 4;
+	return n;
+}
+
+// parse the frame header, return 1 when it's complete, 0 for more data, -1 for invalid frame.
+static inline int
+ws_parse(const uint8_t *buf, size_t sz, struct ws_frame *f) {
+	if (sz < 2)
+		return 0;
+	int header = ws_header_size(buf);
+	if (sz < (size_t)header)
+		return 0;
+	f->fin = (buf[0] & 0x80) != 0;
+	f->rsv = (buf[0] >> 4) & 0x7;
+	f->op = buf[0] & 0x0f;
+	f->mask = (buf[1] & 0x80) != 0;
+	f->header = header;
+	uint64_t len = buf[1] & 0x7f;
+	const uint8_t *ptr = buf + 2;
+	if (len == 126) {
+		len = (uint64_t)ptr[0] << 8 | ptr[1];
+		ptr += 2;
+	} else if (len == 127) {
+		int i;
+		len = 0;
+		for (i=0;i<8;i++) {
+			len = len << 8 | ptr[i];
+		}
+		ptr += 8;
+		if (len >> 63)
+			return -1;
+	}
+	f->len = len;
+	if (f->mask) {
+		memcpy(f->key, ptr, 4);
+	}
+	return 1;
+}
+
+// the rules of RFC 6455 checked by the gate : no rsv bits without extension, the control frames are
+// small and not fragmented. http.websocket doesn't check them (the same as the lua parser before).
+static inline int
+ws_valid(const struct ws_frame *f) {
+	if (f->rsv)
+		return 0;
+	if (f->op >= WS_OP_CLOSE && (!f->fin || f->len > WS_CONTROL_MAX))
+		return 0;
+	return 1;
+}
+
+// copy sz bytes from src to dst (may be the same) and xor with the masking key.
+// offset is the position of src in the payload.
+static inline void
+ws_mask(uint8_t *dst, const uint8_t *src, size_t sz, const uint8_t key[4], size_t offset) {
+	uint8_t k[8];
+	int i;
+	for (i=0;i<8;i++) {
+		k[i] = key[(offset + i) & 3];
+	}
+	uint64_t k64;
+	memcpy(&k64, k, 8);
+	size_t n = sz & ~(size_t)7;
+	size_t j;
+	for (j=0;j<n;j+=8) {
+		uint64_t v;
+		memcpy(&v, src + j, 8);
+		v ^= k64;
+		memcpy(dst + j, &v, 8);
+	}
+	for (;j<sz;j++) {
+		dst[j] = src[j] ^ k[j & 7];
+	}
+}
+
+// write the frame header into buf (WS_HEADER_MAX bytes at least), return the size. key is NULL for no mask.
+static inline int
+ws_header(uint8_t *buf, int fin, int op, uint64_t len, const uint8_t *key) {
+	int n = 2;
+	buf[0] = (fin ? 0x80 : 0) | (op & 0x0f);
+	uint8_t mask = key ? 0x80 : 0;
+	if (len < 126) {
+		buf[1] = mask | (uint8_t)len;
+	} else if (len <= 0xffff) {
+		buf[1] = mask | 126;
+		buf[2] = (len >> 8) & 0xff;
+		buf[3] = len & 0xff;
+		n = 4;
+	} else {
+		int i;
+		buf[1] = mask | 127;
+		for (i=0;i<8;i++) {
+			buf[2+i] = (len >> ((7-i) * 8)) & 0xff;
+		}
+		n = 10;
+	}
+	if (key) {
+		memcpy(buf + n, key, 4);
+		n += 4;
+	}
+	return n;
+}
+
+#endif
@@ -12,6 +12,14 @@ local nodename = cluster.nodename()
 
 local connecting = {}
 
+-- "host:port", or "unix:/path/of/socket" for unix domain socket (port is 0)
+local function split_address(address, pattern)
+	if address:find "^unix:" then
+		return address, 0
+	end
+	return string.match(address, pattern)
+end
+
 local function open_channel(t, key)
 	local ct = connecting[key]
 	if ct then
@@ -39,7 +47,7 @@ local function open_channel(t, key)
 	end
 	local succ, err, c
 	if address then
-		local host, port = string.match(address, "([^:]+):(.*)$")
+		local host, port = split_address(address, "([^:]+):(.*)$")
 		c = node_sender[key]
 		if c == nil then
 			c = skynet.newservice("clustersender", key, nodename, host, port)
@@ -145,10 +153,11 @@ end
 function command.listen(source, addr, port, maxclient)
 	local gate = skynet.newservice("gate")
 	if port == nil then
-		local address = assert(node_address[addr], addr .. " is down")
-		addr, port = string.match(address, "(.+):([^:]+)$")
+		local address = node_address[addr] or (addr:find "^unix:" and addr)
+		assert(address, addr .. " is down")
+		addr, port = split_address(address, "(.+):([^:]+)$")
 		port = tonumber(port)
-		assert(port ~= 0)
+		assert(port ~= 0 or addr:find "^unix:")
 		skynet.call(gate, "lua", "open", { address = addr, port = port, maxclient = maxclient })
 		skynet.ret(skynet.pack(addr, port))
 	else
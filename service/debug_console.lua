@@ -167,6 +167,7 @@ function COMMAND.help()
 		ping = "ping address",
 		call = "call address ...",
 		trace = "trace address [proto] [on|off]",
+		sample = "sample address [seconds] [hz] : the folded stacks of lua for flamegraph",
 		netstat = "netstat : show netstat",
 		profactive = "profactive [on|off] : active/deactive jemalloc heap profilling",
 		dumpheap = "dumpheap : dump heap profilling",
@@ -405,6 +406,15 @@ function COMMAND.trace(address, proto, flag)
 	skynet.call(address, "debug", "TRACELOG", proto, flag)
 end
 
+function COMMAND.sample(address, ti, hz)
+	address = adjust_address(address)
+	ti = tonumber(ti) or 10
+	hz = tonumber(hz) or 100
+	skynet.call(address, "debug", "SAMPLE", hz)
+	skynet.sleep(ti * 100)
+	return skynet.call(address, "debug", "SAMPLE") or ""
+end
+
 function COMMANDX.call(cmd)
 	local address = adjust_address(cmd[2])
 	local cmdline = assert(cmd[1]:match("%S+%s+%S+%s(.+)") , "need arguments")
@@ -430,6 +440,32 @@ local function bytes(size)
 	return tostring(size/(1024*1024)) .. "M"
 end
 
+-- latency histogram : latency[1] is < 1us, latency[i] is < 2^(i-1) us
+local function latency(h)
+	if h == nil then
+		return
+	end
+	local n = 0
+	for _, c in ipairs(h) do
+		n = n + c
+	end
+	local function percentile(p)
+		local limit = n * p
+		local c = 0
+		for i, v in ipairs(h) do
+			c = c + v
+			if c >= limit then
+				local us = 1 << (i - 1)
+				if us >= 1000 then
+					return string.format("<%gms", us / 1000)
+				end
+				return string.format("<%dus", us)
+			end
+		end
+	end
+	return string.format("n=%d p50%s p99%s max%s", n, percentile(0.5), percentile(0.99), percentile(1))
+end
+
 local function convert_stat(info)
 	local now = skynet.now()
 	local function time(t)
@@ -452,8 +488,11 @@ local function convert_stat(info)
 	info.read = bytes(info.read)
 	info.write = bytes(info.write)
 	info.wbuffer = bytes(info.wbuffer)
+	info.wpeak = bytes(info.wpeak)
+	info.dropped = bytes(info.dropped)
 	info.rtime = time(info.rtime)
 	info.wtime = time(info.wtime)
+	info.latency = latency(info.latency)
 end
 
 function COMMAND.netstat()
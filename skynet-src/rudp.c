@@ -0,0 +1,639 @@
+#include "rudp.h"
+#include "skynet_malloc.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// the segment : conv(4) cmd(1) frg(1) wnd(2) ts(4) sn(4) una(4) len(4) data(len), little endian
+#define CMD_PUSH 81
+#define CMD_ACK 82
+#define CMD_WASK 83		// ask the window of peer
+#define CMD_WINS 84		// tell the window
+#define CMD_FIN 85		// the end of stream, sequenced as a push
+
+#define MSS (RUDP_MTU - RUDP_HEADER)
+#define SND_WND 128
+#define RCV_WND 256
+#define RTO_MIN 30
+#define RTO_DEF 200
+#define RTO_MAX 10000
+#define FASTRESEND 2	// retransmit a segment when it's skipped by 2 acks
+#define FASTLIMIT 5		// stop fast retransmit after 5 times, wait for the timeout
+#define DEADLINK 20
+#define PROBE_INIT 500
+#define PROBE_LIMIT 10000
+
+#define PROBE_ASK 1
+#define PROBE_TELL 2
+
+#define DIFF(a,b) ((int32_t)((a) - (b)))
+
+struct segment {
+	struct segment *next;
+	uint8_t cmd;
+	uint32_t sn;
+	uint32_t ts;
+	uint32_t resendts;
+	uint32_t rto;
+	uint32_t fastack;
+	uint32_t xmit;
+	int len;
+	int cap;
+	char data[1];
+};
+
+struct queue {
+	struct segment *head;
+	struct segment *tail;
+	int n;
+};
+
+struct rudp {
+	uint32_t conv;
+	uint32_t snd_una;	// the first sn not acked
+	uint32_t snd_nxt;
+	uint32_t rcv_nxt;
+	uint32_t rmt_wnd;
+	uint32_t cwnd;
+	uint32_t ssthresh;
+	uint32_t incr;
+	int32_t rx_srtt;
+	int32_t rx_rttval;
+	int32_t rx_rto;
+	int probe;
+	uint32_t ts_probe;
+	uint32_t probe_wait;
+	bool fin;
+	bool dead;
+	uint64_t resend;
+	struct queue snd_queue;	// wait for the window
+	struct queue snd_buf;	// sent, wait for the acks
+	struct queue rcv_buf;	// received out of order
+	struct queue rcv_queue;	// in order, wait for rudp_recv
+	uint32_t *acklist;		// pairs of sn and ts
+	int ackcount;
+	int ackcap;
+	rudp_output output;
+	void *ud;
+	char buffer[RUDP_MTU];
+};
+
+static inline char *
+encode8(char *p, uint8_t v) {
+	*p = (char)v;
+	return p + 1;
+}
+
+static inline char *
+encode16(char *p, uint16_t v) {
+	p[0] = (char)(v & 0xff);
+	p[1] = (char)(v >> 8);
+	return p + 2;
+}
+
+static inline char *
+encode32(char *p, uint32_t v) {
+	p[0] = (char)(v & 0xff);
+	p[1] = (char)((v >> 8) & 0xff);
+	p[2] = (char)((v >> 16) & 0xff);
+	p[3] = (char)(v >> 24);
+	return p + 4;
+}
+
+static inline uint32_t
+decode16(const uint8_t *p) {
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t
+decode32(const uint8_t *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static struct segment *
+segment_new(int cap) {
+	struct segment *seg = skynet_malloc(sizeof(*seg) + cap);
+	memset(seg, 0, sizeof(*seg));
+	seg->cap = cap;
+	return seg;
+}
+
+static inline void
+queue_push(struct queue *q, struct segment *seg) {
+	seg->next = NULL;
+	if (q->tail) {
+		q->tail->next = seg;
+	} else {
+		q->head = seg;
+	}
+	q->tail = seg;
+	++q->n;
+}
+
+static inline struct segment *
+queue_pop(struct queue *q) {
+	struct segment *seg = q->head;
+	q->head = seg->next;
+	if (q->head == NULL)
+		q->tail = NULL;
+	--q->n;
+	return seg;
+}
+
+static void
+queue_clear(struct queue *q) {
+	while (q->head) {
+		skynet_free(queue_pop(q));
+	}
+}
+
+struct rudp *
+rudp_new(uint32_t conv, rudp_output output, void *ud) {
+	struct rudp *r = skynet_malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->conv = conv;
+	r->rmt_wnd = RCV_WND;
+	r->cwnd = 1;
+	r->ssthresh = SND_WND;
+	r->incr = MSS;
+	r->rx_rto = RTO_DEF;
+	r->output = output;
+	r->ud = ud;
+	return r;
+}
+
+void
+rudp_delete(struct rudp *r) {
+	queue_clear(&r->snd_queue);
+	queue_clear(&r->snd_buf);
+	queue_clear(&r->rcv_buf);
+	queue_clear(&r->rcv_queue);
+	skynet_free(r->acklist);
+	skynet_free(r);
+}
+
+int
+rudp_send(struct rudp *r, const void *buffer, int sz) {
+	if (r->fin)
+		return -1;
+	const char *ptr = buffer;
+	// fill the last segment which is not sent
+	struct segment *seg = r->snd_queue.tail;
+	if (seg && seg->cmd == CMD_PUSH && seg->len < seg->cap) {
+		int n = seg->cap - seg->len;
+		if (n > sz)
+			n = sz;
+		memcpy(seg->data + seg->len, ptr, n);
+		seg->len += n;
+		ptr += n;
+		sz -= n;
+	}
+	while (sz > 0) {
+		int n = sz > MSS ? MSS : sz;
+		seg = segment_new(MSS);
+		seg->cmd = CMD_PUSH;
+		memcpy(seg->data, ptr, n);
+		seg->len = n;
+		queue_push(&r->snd_queue, seg);
+		ptr += n;
+		sz -= n;
+	}
+	return 0;
+}
+
+void
+rudp_fin(struct rudp *r) {
+	if (r->fin)
+		return;
+	r->fin = true;
+	struct segment *seg = segment_new(0);
+	seg->cmd = CMD_FIN;
+	queue_push(&r->snd_queue, seg);
+}
+
+static void
+update_rtt(struct rudp *r, int32_t rtt) {
+	if (r->rx_srtt == 0) {
+		r->rx_srtt = rtt;
+		r->rx_rttval = rtt / 2;
+	} else {
+		int32_t delta = rtt - r->rx_srtt;
+		if (delta < 0)
+			delta = -delta;
+		r->rx_rttval = (3 * r->rx_rttval + delta) / 4;
+		r->rx_srtt = (7 * r->rx_srtt + rtt) / 8;
+		if (r->rx_srtt < 1)
+			r->rx_srtt = 1;
+	}
+	int32_t rto = r->rx_srtt + (r->rx_rttval * 4 > 10 ? r->rx_rttval * 4 : 10);
+	r->rx_rto = rto < RTO_MIN ? RTO_MIN : (rto > RTO_MAX ? RTO_MAX : rto);
+}
+
+static void
+shrink_buf(struct rudp *r) {
+	r->snd_una = r->snd_buf.head ? r->snd_buf.head->sn : r->snd_nxt;
+}
+
+// cumulative ack
+static void
+parse_una(struct rudp *r, uint32_t una) {
+	struct queue *q = &r->snd_buf;
+	while (q->head && DIFF(una, q->head->sn) > 0) {
+		skynet_free(queue_pop(q));
+	}
+}
+
+// selective ack
+static void
+parse_ack(struct rudp *r, uint32_t sn) {
+	if (DIFF(sn, r->snd_una) < 0 || DIFF(sn, r->snd_nxt) >= 0)
+		return;
+	struct queue *q = &r->snd_buf;
+	struct segment *prev = NULL;
+	struct segment *seg = q->head;
+	while (seg) {
+		if (seg->sn == sn) {
+			if (prev) {
+				prev->next = seg->next;
+			} else {
+				q->head = seg->next;
+			}
+			if (q->tail == seg)
+				q->tail = prev;
+			--q->n;
+			skynet_free(seg);
+			return;
+		}
+		if (DIFF(sn, seg->sn) < 0)
+			return;
+		prev = seg;
+		seg = seg->next;
+	}
+}
+
+// the segments before the largest ack (and sent before it) are skipped
+static void
+parse_fastack(struct rudp *r, uint32_t sn, uint32_t ts) {
+	struct segment *seg;
+	for (seg = r->snd_buf.head; seg; seg = seg->next) {
+		if (DIFF(sn, seg->sn) <= 0)
+			break;
+		if (DIFF(ts, seg->ts) >= 0)
+			++seg->fastack;
+	}
+}
+
+static void
+ack_push(struct rudp *r, uint32_t sn, uint32_t ts) {
+	if (r->ackcount * 2 >= r->ackcap) {
+		int cap = r->ackcap ? r->ackcap * 2 : 64;
+		uint32_t *list = skynet_malloc(cap * sizeof(uint32_t));
+		if (r->ackcount)
+			memcpy(list, r->acklist, r->ackcount * 2 * sizeof(uint32_t));
+		skynet_free(r->acklist);
+		r->acklist = list;
+		r->ackcap = cap;
+	}
+	r->acklist[r->ackcount * 2] = sn;
+	r->acklist[r->ackcount * 2 + 1] = ts;
+	++r->ackcount;
+}
+
+// move the segments in order from rcv_buf to rcv_queue
+static void
+move_rcv(struct rudp *r) {
+	struct queue *q = &r->rcv_buf;
+	while (q->head && q->head->sn == r->rcv_nxt && r->rcv_queue.n < RCV_WND) {
+		queue_push(&r->rcv_queue, queue_pop(q));
+		++r->rcv_nxt;
+	}
+}
+
+static void
+parse_data(struct rudp *r, struct segment *nseg) {
+	uint32_t sn = nseg->sn;
+	if (DIFF(sn, r->rcv_nxt + RCV_WND) >= 0 || DIFF(sn, r->rcv_nxt) < 0) {
+		skynet_free(nseg);
+		return;
+	}
+	struct queue *q = &r->rcv_buf;
+	struct segment *prev = NULL;
+	struct segment *seg = q->head;
+	while (seg && DIFF(seg->sn, sn) < 0) {
+		prev = seg;
+		seg = seg->next;
+	}
+	if (seg && seg->sn == sn) {
+		// duplicate
+		skynet_free(nseg);
+		return;
+	}
+	nseg->next = seg;
+	if (prev) {
+		prev->next = nseg;
+	} else {
+		q->head = nseg;
+	}
+	if (seg == NULL)
+		q->tail = nseg;
+	++q->n;
+	move_rcv(r);
+}
+
+int
+rudp_input(struct rudp *r, const void *data, int sz, uint32_t current) {
+	const uint8_t *ptr = data;
+	uint32_t una = r->snd_una;
+	uint32_t maxack = 0, latest_ts = 0;
+	bool ack = false;
+	if (sz < RUDP_HEADER)
+		return -1;
+	while (sz >= RUDP_HEADER) {
+		uint32_t conv = decode32(ptr);
+		uint8_t cmd = ptr[4];
+		uint32_t wnd = decode16(ptr + 6);
+		uint32_t ts = decode32(ptr + 8);
+		uint32_t sn = decode32(ptr + 12);
+		uint32_t seg_una = decode32(ptr + 16);
+		uint32_t len = decode32(ptr + 20);
+		ptr += RUDP_HEADER;
+		sz -= RUDP_HEADER;
+		if (conv != r->conv || len > (uint32_t)sz || cmd < CMD_PUSH || cmd > CMD_FIN)
+			return -1;
+		r->rmt_wnd = wnd;
+		parse_una(r, seg_una);
+		shrink_buf(r);
+		switch (cmd) {
+		case CMD_ACK:
+			if (DIFF(current, ts) >= 0) {
+				update_rtt(r, DIFF(current, ts));
+			}
+			parse_ack(r, sn);
+			shrink_buf(r);
+			if (!ack || DIFF(sn, maxack) > 0) {
+				ack = true;
+				maxack = sn;
+				latest_ts = ts;
+			}
+			break;
+		case CMD_PUSH:
+		case CMD_FIN:
+			if (DIFF(sn, r->rcv_nxt + RCV_WND) < 0) {
+				ack_push(r, sn, ts);
+				if (DIFF(sn, r->rcv_nxt) >= 0) {
+					struct segment *seg = segment_new(len);
+					seg->cmd = cmd;
+					seg->sn = sn;
+					seg->len = len;
+					memcpy(seg->data, ptr, len);
+					parse_data(r, seg);
+				}
+			}
+			break;
+		case CMD_WASK:
+			r->probe |= PROBE_TELL;
+			break;
+		case CMD_WINS:
+			break;
+		}
+		ptr += len;
+		sz -= len;
+	}
+	if (ack) {
+		parse_fastack(r, maxack, latest_ts);
+	}
+	if (DIFF(r->snd_una, una) > 0 && r->cwnd < r->rmt_wnd) {
+		// slow start, or congestion avoidance (about one segment per rtt)
+		if (r->cwnd < r->ssthresh) {
+			++r->cwnd;
+			r->incr += MSS;
+		} else {
+			if (r->incr < MSS)
+				r->incr = MSS;
+			r->incr += (MSS * MSS) / r->incr + MSS / 16;
+			if ((r->cwnd + 1) * MSS <= r->incr)
+				r->cwnd = (r->incr + MSS - 1) / MSS;
+		}
+		if (r->cwnd > r->rmt_wnd) {
+			r->cwnd = r->rmt_wnd;
+			r->incr = r->rmt_wnd * MSS;
+		}
+	}
+	return 0;
+}
+
+int
+rudp_peeksize(struct rudp *r) {
+	struct segment *seg = r->rcv_queue.head;
+	if (seg == NULL)
+		return -1;
+	if (seg->cmd == CMD_FIN)
+		return RUDP_EOF;
+	int sz = 0;
+	for (; seg && seg->cmd == CMD_PUSH; seg = seg->next) {
+		sz += seg->len;
+	}
+	return sz;
+}
+
+int
+rudp_recv(struct rudp *r, void *buffer, int sz) {
+	struct queue *q = &r->rcv_queue;
+	bool full = q->n >= RCV_WND;
+	char *ptr = buffer;
+	int n = 0;
+	while (q->head && q->head->cmd == CMD_PUSH && n + q->head->len <= sz) {
+		struct segment *seg = queue_pop(q);
+		memcpy(ptr + n, seg->data, seg->len);
+		n += seg->len;
+		skynet_free(seg);
+	}
+	move_rcv(r);
+	if (full && q->n < RCV_WND) {
+		// tell the peer the window is open again
+		r->probe |= PROBE_TELL;
+	}
+	return n;
+}
+
+static char *
+output_header(struct rudp *r, char *p, uint8_t cmd, uint32_t wnd, uint32_t ts, uint32_t sn, uint32_t len) {
+	p = encode32(p, r->conv);
+	p = encode8(p, cmd);
+	p = encode8(p, 0);
+	p = encode16(p, (uint16_t)wnd);
+	p = encode32(p, ts);
+	p = encode32(p, sn);
+	p = encode32(p, r->rcv_nxt);
+	p = encode32(p, len);
+	return p;
+}
+
+// make room for sz bytes in the buffer, send the buffer out when it's full
+static char *
+output_reserve(struct rudp *r, char *p, int sz) {
+	if (p - r->buffer + sz > RUDP_MTU) {
+		r->output(r->ud, r->buffer, (int)(p - r->buffer));
+		return r->buffer;
+	}
+	return p;
+}
+
+void
+rudp_flush(struct rudp *r, uint32_t current) {
+	char *p = r->buffer;
+	uint32_t wnd = r->rcv_queue.n < RCV_WND ? RCV_WND - r->rcv_queue.n : 0;
+	int i;
+	for (i=0;i<r->ackcount;i++) {
+		p = output_reserve(r, p, RUDP_HEADER);
+		p = output_header(r, p, CMD_ACK, wnd, r->acklist[i*2+1], r->acklist[i*2], 0);
+	}
+	r->ackcount = 0;
+
+	// probe the window of peer when it's 0
+	if (r->rmt_wnd == 0) {
+		if (r->probe_wait == 0) {
+			r->probe_wait = PROBE_INIT;
+			r->ts_probe = current + r->probe_wait;
+		} else if (DIFF(current, r->ts_probe) >= 0) {
+			r->probe_wait += r->probe_wait / 2;
+			if (r->probe_wait > PROBE_LIMIT)
+				r->probe_wait = PROBE_LIMIT;
+			r->ts_probe = current + r->probe_wait;
+			r->probe |= PROBE_ASK;
+		}
+	} else {
+		r->ts_probe = 0;
+		r->probe_wait = 0;
+	}
+	if (r->probe & PROBE_ASK) {
+		p = output_reserve(r, p, RUDP_HEADER);
+		p = output_header(r, p, CMD_WASK, wnd, current, 0, 0);
+	}
+	if (r->probe & PROBE_TELL) {
+		p = output_reserve(r, p, RUDP_HEADER);
+		p = output_header(r, p, CMD_WINS, wnd, current, 0, 0);
+	}
+	r->probe = 0;
+
+	uint32_t cwnd = r->cwnd < SND_WND ? r->cwnd : SND_WND;
+	if (cwnd > r->rmt_wnd)
+		cwnd = r->rmt_wnd;
+	while (r->snd_queue.head && DIFF(r->snd_nxt, r->snd_una + cwnd) < 0) {
+		struct segment *seg = queue_pop(&r->snd_queue);
+		seg->sn = r->snd_nxt++;
+		seg->xmit = 0;
+		seg->fastack = 0;
+		queue_push(&r->snd_buf, seg);
+	}
+
+	bool change = false, lost = false;
+	struct segment *seg;
+	for (seg = r->snd_buf.head; seg; seg = seg->next) {
+		bool send = false;
+		if (seg->xmit == 0) {
+			send = true;
+			seg->rto = r->rx_rto;
+		} else if (DIFF(current, seg->resendts) >= 0) {
+			// timeout, back off by 1.5x
+			send = true;
+			lost = true;
+			seg->rto += seg->rto / 2;
+			if (seg->rto > RTO_MAX)
+				seg->rto = RTO_MAX;
+		} else if (seg->fastack >= FASTRESEND && seg->xmit <= FASTLIMIT) {
+			send = true;
+			change = true;
+		}
+		if (send) {
+			if (seg->xmit > 0)
+				++r->resend;
+			++seg->xmit;
+			seg->fastack = 0;
+			seg->ts = current;
+			seg->resendts = current + seg->rto;
+			p = output_reserve(r, p, RUDP_HEADER + seg->len);
+			p = output_header(r, p, seg->cmd, wnd, seg->ts, seg->sn, seg->len);
+			memcpy(p, seg->data, seg->len);
+			p += seg->len;
+			if (seg->xmit >= DEADLINK)
+				r->dead = true;
+		}
+	}
+	if (p > r->buffer) {
+		r->output(r->ud, r->buffer, (int)(p - r->buffer));
+	}
+
+	if (change) {
+		uint32_t inflight = r->snd_nxt - r->snd_una;
+		r->ssthresh = inflight / 2 < 2 ? 2 : inflight / 2;
+		r->cwnd = r->ssthresh + FASTRESEND;
+		r->incr = r->cwnd * MSS;
+	}
+	if (lost) {
+		r->ssthresh = cwnd / 2 < 2 ? 2 : cwnd / 2;
+		r->cwnd = 1;
+		r->incr = MSS;
+	}
+}
+
+uint32_t
+rudp_check(struct rudp *r, uint32_t current) {
+	if (r->ackcount || r->probe)
+		return current;
+	// idle, check again after a long time
+	uint32_t next = current + RTO_MAX;
+	if (r->rmt_wnd == 0) {
+		if (r->probe_wait == 0)
+			return current;
+		if (DIFF(r->ts_probe, next) < 0)
+			next = r->ts_probe;
+	}
+	struct segment *seg;
+	for (seg = r->snd_buf.head; seg; seg = seg->next) {
+		if (DIFF(seg->resendts, next) < 0)
+			next = seg->resendts;
+		if (seg->fastack >= FASTRESEND && seg->xmit <= FASTLIMIT)
+			return current;
+	}
+	if (r->snd_queue.head && DIFF(r->snd_nxt, r->snd_una + (r->cwnd < r->rmt_wnd ? r->cwnd : r->rmt_wnd)) < 0)
+		return current;
+	return DIFF(next, current) < 0 ? current : next;
+}
+
+void
+rudp_probe(struct rudp *r) {
+	r->probe |= PROBE_ASK;
+}
+
+int
+rudp_waitsnd(struct rudp *r) {
+	return r->snd_buf.n + r->snd_queue.n;
+}
+
+int
+rudp_dead(struct rudp *r) {
+	return r->dead;
+}
+
+void
+rudp_stat(struct rudp *r, struct rudp_stat *st) {
+	st->rtt = r->rx_srtt;
+	st->rto = r->rx_rto;
+	st->cwnd = r->cwnd;
+	st->inflight = r->snd_buf.n;
+	st->waitsnd = r->snd_buf.n + r->snd_queue.n;
+	st->resend = r->resend;
+}
+
+int
+rudp_conv(const void *data, int sz, uint32_t *conv) {
+	const uint8_t *ptr = data;
+	if (sz < RUDP_HEADER)
+		return -1;
+	uint8_t cmd = ptr[4];
+	if (cmd < CMD_PUSH || cmd > CMD_FIN)
+		return -1;
+	*conv = decode32(ptr);
+	return cmd == CMD_PUSH && decode32(ptr + 12) == 0;
+}
@@ -0,0 +1,54 @@
+#ifndef skynet_rudp_h
+#define skynet_rudp_h
+
+#include <stdint.h>
+
+// A KCP style ARQ, which makes a reliable byte stream over unreliable datagrams. It's used by socket_server
+// for the reliable udp sessions : sequence numbers, cumulative (una) and selective (per segment) acks,
+// fast retransmit, rto estimation, flow control by the window of receiver, and a congestion window.
+// It doesn't do any io : the datagrams are fed by rudp_input(), and the output callback sends the segments.
+
+#define RUDP_HEADER 24
+#define RUDP_MTU 1400
+#define RUDP_EOF (-2)
+
+typedef void (*rudp_output)(void *ud, const char *buffer, int sz);
+
+struct rudp;
+
+struct rudp_stat {
+	int rtt;		// smoothed rtt (ms)
+	int rto;		// retransmission timeout (ms)
+	int cwnd;		// congestion window (segments)
+	int inflight;	// the segments sent but not acked
+	int waitsnd;	// the segments not acked, including the ones wait for the window
+	uint64_t resend;	// the segments retransmitted (timeout or fast retransmit)
+};
+
+struct rudp * rudp_new(uint32_t conv, rudp_output output, void *ud);
+void rudp_delete(struct rudp *);
+// append the data to the stream, return -1 after rudp_fin()
+int rudp_send(struct rudp *, const void *buffer, int sz);
+// the end of stream, the peer reads RUDP_EOF after all the data
+void rudp_fin(struct rudp *);
+// feed a datagram, return -1 when it's invalid (or belongs to another conv)
+int rudp_input(struct rudp *, const void *data, int sz, uint32_t current);
+// the bytes can be read, -1 for none, or RUDP_EOF when the peer has finished
+int rudp_peeksize(struct rudp *);
+// read at most sz bytes, return the size
+int rudp_recv(struct rudp *, void *buffer, int sz);
+// send the acks, the new segments in the window and the retransmissions
+void rudp_flush(struct rudp *, uint32_t current);
+// the time (ms) when rudp_flush() should be called again for the retransmissions or the window probe
+uint32_t rudp_check(struct rudp *, uint32_t current);
+// ask the window of peer, for keepalive
+void rudp_probe(struct rudp *);
+int rudp_waitsnd(struct rudp *);
+// 1 when a segment has been retransmitted too many times
+int rudp_dead(struct rudp *);
+void rudp_stat(struct rudp *, struct rudp_stat *);
+
+// read the conv of a datagram. return 1 if it's the first segment of a stream, 0 for the others, -1 when it's invalid
+int rudp_conv(const void *data, int sz, uint32_t *conv);
+
+#endif
@@ -162,6 +162,13 @@ main(int argc, char *argv[]) {
 	config.logservice = optstring("logservice", "logger");//默认的日志模块是 logservice.c	
 	config.profile = optboolean("profile", 1);
 
+#ifdef LUA_CACHELIB
+	const char * bytecode = optstring("bytecode_cache", NULL);
+	if (bytecode) {
+		luaL_initbytecodecache(bytecode);
+	}
+#endif
+
 	skynet_start(&config);
 	skynet_globalexit();
 
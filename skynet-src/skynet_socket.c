@@ -54,6 +54,7 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	sm->type = type;
 	sm->id = result->id;
 	sm->ud = result->ud;
+	sm->time = result->time;
 	if (padding) {
 		sm->buffer = NULL;
 		memcpy(sm+1, result->data, sz - sizeof(*sm));
@@ -106,6 +107,9 @@ skynet_socket_poll() {
 	case SOCKET_WARNING:
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
+	case SOCKET_SENDFILE:
+		forward_message(SKYNET_SOCKET_TYPE_SENDFILE, true, &result);
+		break;
 	default:
 		skynet_error(NULL, "Unknown socket message type %d.",type);
 		return -1;
@@ -126,6 +130,16 @@ skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_s
 	return socket_server_send_lowpriority(SOCKET_SERVER, buffer);
 }
 
+int
+skynet_socket_multisend(struct skynet_context *ctx, const int *id, int n, struct socket_sendbuffer *buffer) {
+	return socket_server_multisend(SOCKET_SERVER, id, n, buffer);
+}
+
+int
+skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, size_t sz) {
+	return socket_server_sendfile(SOCKET_SERVER, id, fd, offset, sz);
+}
+
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -174,6 +188,46 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_zerocopy(struct skynet_context *ctx, int id, int threshold) {
+	socket_server_zerocopy(SOCKET_SERVER, id, threshold);
+}
+
+void
+skynet_socket_shape(struct skynet_context *ctx, int id, int rate, int limit, int policy) {
+	socket_server_shape(SOCKET_SERVER, id, rate, limit, policy);
+}
+
+void
+skynet_socket_latency(const struct skynet_socket_message *sm) {
+	socket_server_latency(SOCKET_SERVER, sm->id, sm->time);
+}
+
+void
+skynet_socket_frame(struct skynet_context *ctx, int id, int header, int little, int max) {
+	socket_server_frame(SOCKET_SERVER, id, header, little, max);
+}
+
+void
+skynet_socket_cork(struct skynet_context *ctx, int id, int threshold, int interval) {
+	socket_server_cork(SOCKET_SERVER, id, threshold, interval);
+}
+
+void
+skynet_socket_flush(struct skynet_context *ctx, int id) {
+	socket_server_flush(SOCKET_SERVER, id);
+}
+
+void
+skynet_socket_acceptrate(struct skynet_context *ctx, int id, int rate, int queue) {
+	socket_server_acceptrate(SOCKET_SERVER, id, rate, queue);
+}
+
+int
+skynet_socket_tls(struct skynet_context *ctx, int id, const struct socket_tls_interface *tif, void *ud) {
+	return socket_server_tls(SOCKET_SERVER, id, tif, ud);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -192,6 +246,18 @@ skynet_socket_udp_listen(struct skynet_context *ctx, const char * addr, int port
 	return socket_server_udp_listen(SOCKET_SERVER, source, addr, port);
 }
 
+int
+skynet_socket_rudp_listen(struct skynet_context *ctx, const char * addr, int port) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_rudp_listen(SOCKET_SERVER, source, addr, port);
+}
+
+int
+skynet_socket_rudp_dial(struct skynet_context *ctx, const char * addr, int port, uint32_t conv) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_rudp_dial(SOCKET_SERVER, source, addr, port, conv);
+}
+
 int 
 skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port) {
 	return socket_server_udp_connect(SOCKET_SERVER, id, addr, port);
@@ -5,6 +5,7 @@
 #include "socket_buffer.h"
 
 struct skynet_context;
+struct socket_tls_interface;
 
 #define SKYNET_SOCKET_TYPE_DATA 1       // tcp 接收到数据
 #define SKYNET_SOCKET_TYPE_CONNECT 2    // 与其他主机成功建立连接, 这时可以操作该 socket
@@ -13,6 +14,7 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5      // socket 出错, 已经无法使用
 #define SKYNET_SOCKET_TYPE_UDP 6        // udp 接收到数据
 #define SKYNET_SOCKET_TYPE_WARNING 7    // socket 相关的警告通知
+#define SKYNET_SOCKET_TYPE_SENDFILE 8   // 文件发送完毕(或者失败), 附带的字符串为空表示成功, 否则是错误信息
 
 // skynet 与 socket_server 的数据转化, 一般是将 socket_message 的内容传给 skynet_socket_message
 struct skynet_socket_message {
@@ -20,6 +22,7 @@ struct skynet_socket_message {
 	int id;    // socket id
 	int ud;    // 数据长度
 	char * buffer; // 数据指针
+	uint64_t time; // socket 线程得到这个事件的时间(微秒), 见 socket_server_clock
 };
 
 // 当前节点的 socket 环境初始化
@@ -34,6 +37,8 @@ void skynet_socket_updatetime();
 
 int skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
+int skynet_socket_multisend(struct skynet_context *ctx, const int *id, int n, struct socket_sendbuffer *buffer);
+int skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, size_t sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
@@ -42,11 +47,25 @@ void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_pause(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_zerocopy(struct skynet_context *ctx, int id, int threshold);
+void skynet_socket_shape(struct skynet_context *ctx, int id, int rate, int limit, int policy);
+void skynet_socket_frame(struct skynet_context *ctx, int id, int header, int little, int max);
+void skynet_socket_cork(struct skynet_context *ctx, int id, int threshold, int interval);
+void skynet_socket_flush(struct skynet_context *ctx, int id);
+// 监听 socket 的 accept 限速, 见 socket_server_acceptrate
+void skynet_socket_acceptrate(struct skynet_context *ctx, int id, int rate, int queue);
+// 打开 tls 模式, 在 socket 线程加解密, 见 socket_server_tls
+int skynet_socket_tls(struct skynet_context *ctx, int id, const struct socket_tls_interface *tif, void *ud);
+// 在 worker 线程派发 socket 消息时调用, 把 socket 线程到 worker 的延迟记录到监听 socket 的统计中
+void skynet_socket_latency(const struct skynet_socket_message *);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
 int skynet_socket_udp_dial(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_listen(struct skynet_context *ctx, const char * addr, int port);
+// 可靠 udp, 见 socket_server_rudp_listen / socket_server_rudp_dial
+int skynet_socket_rudp_listen(struct skynet_context *ctx, const char * addr, int port);
+int skynet_socket_rudp_dial(struct skynet_context *ctx, const char * addr, int port, uint32_t conv);
 int skynet_socket_udp_sendbuffer(struct skynet_context *ctx, const char * address, struct socket_sendbuffer *buffer);
 const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addrsz);
 
@@ -53,9 +53,9 @@ sp_enable(int efd, int sock, void *ud, bool read_enable, bool write_enable) {
 }
 
 static int 
-sp_wait(int efd, struct event *e, int max) {
+sp_wait(int efd, struct event *e, int max, int timeout) {
 	struct epoll_event ev[max];
-	int n = epoll_wait(efd , ev, max, -1);
+	int n = epoll_wait(efd , ev, max, timeout);
 	int i;
 	for (i=0;i<n;i++) {
 		e[i].s = ev[i].data.ptr;
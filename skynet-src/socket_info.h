@@ -7,9 +7,13 @@
 #define SOCKET_INFO_UDP 3
 #define SOCKET_INFO_BIND 4
 #define SOCKET_INFO_CLOSING 5
+#define SOCKET_INFO_RUDP 6
 
 #include <stdint.h>
 
+// latency histogram of listen socket, bucket 0 : < 1us, bucket n : [2^(n-1), 2^n) us
+#define SOCKET_LATENCY_BUCKETS 20
+
 struct socket_info {
 	int id;
 	int type;
@@ -18,10 +22,28 @@ struct socket_info {
 	uint64_t write;
 	uint64_t rtime;
 	uint64_t wtime;
+	uint64_t zerocopy;
+	uint64_t zcfallback;
+	uint64_t dropped;	// tcp : the bytes dropped by the send limit (SOCKET_LIMIT_DROP)
+	uint64_t rejected;	// listen (or the endpoint of reliable udp) : the connections closed (accept queue full or fd exhausted)
+	uint64_t throttled;
+	uint64_t deferred;	// listen : the connections put into the accept queue
+	int pending;		// listen : the length of accept queue
 	int64_t wbuffer;
+	int64_t wpeak;
+	int rate;
+	int wlimit;
 	uint8_t reading;
 	uint8_t writing;
 	char name[128];
+	uint64_t latency[SOCKET_LATENCY_BUCKETS];
+	// reliable udp session, see struct rudp_stat
+	int rtt;
+	int rto;
+	int cwnd;
+	int inflight;
+	int waitsnd;
+	uint64_t resend;
 	struct socket_info *next;
 };
 
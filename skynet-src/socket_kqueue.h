@@ -71,9 +71,15 @@ sp_enable(int kfd, int sock, void *ud, bool read_enable, bool write_enable) {
 }
 
 static int 
-sp_wait(int kfd, struct event *e, int max) {
+sp_wait(int kfd, struct event *e, int max, int timeout) {
 	struct kevent ev[max];
-	int n = kevent(kfd, NULL, 0, ev, max, NULL);
+	struct timespec ts, *pts = NULL;
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		pts = &ts;
+	}
+	int n = kevent(kfd, NULL, 0, ev, max, pts);
 
 	int i;
 	for (i=0;i<n;i++) {
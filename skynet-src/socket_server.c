@@ -1,14 +1,22 @@
+#ifdef __linux__
+#define _GNU_SOURCE		// for accept4
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
 #include "socket_poll.h"
 #include "atomic.h"
 #include "spinlock.h"
+#include "rudp.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -16,12 +24,22 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define SOCKET_ZEROCOPY
+#endif
+#endif
 
 #define MAX_INFO 128			// socker_server 存储一些信息数据分配的内存空间
 // MAX_SOCKET will be 2^MAX_SOCKET_P
 #define MAX_SOCKET_P 16			// 决定能够管理的 socket 数量, 直接控制当前 skynet 节点能够操作的 socket 数量
 #define MAX_EVENT 64			// 每次从 event pool 中读取 event 的最大数量
 #define MIN_READ_BUFFER 64		// 初始化 socket 读取数据的最小字节数
+#define ACCEPT_BUDGET 64		// 每次 sp_wait 以后, 最多连续 accept 的连接数, 超过则等下一轮
 
 // socket 的状态
 /*
@@ -66,6 +84,7 @@
 #define PROTOCOL_TCP 0		// tcp 协议, ipv4
 #define PROTOCOL_UDP 1		// udp 协议, ipv4
 #define PROTOCOL_UDPv6 2	// udp 协议, ipv6
+#define PROTOCOL_RUDP 3		// 可靠 udp 的会话 (rudp.h), 通过 endpoint 的 udp socket 收发数据报
 #define PROTOCOL_UNKNOWN 255
 
 #define UDP_ADDRESS_SIZE 19	// ipv6 128bit + port 16bit + 1 byte type, udp 地址信息分配内存空间
@@ -81,7 +100,34 @@
 
 #define WARNING_SIZE (1024*1024)
 
+#define FRAME_BUFFER 1024			// 分帧模式下读缓存的初始大小
+#define FRAME_BUFFER_MAX (64*1024)	// 分帧模式下读缓存的最大大小
+#define FRAME_DIRECT 4096			// 不小于这个大小的帧直接读入帧自己的内存
+
+#define THROTTLE_INTERVAL 10	// ms, 有 socket 因为限速而暂停写时, sp_wait 的超时时间
+#define CORK_OFF (-1)			// SOCKET_OPT_CORK 的值, 关闭 cork 模式
+
+// socket.nodirect : 工作线程不能直接写 socket 的原因
+#define NODIRECT_CORK 1			// cork 模式, 攒批和定时器都只在 socket 线程中处理
+#define NODIRECT_SHAPE 2		// 限速, 令牌桶只在 socket 线程中处理
+#define NODIRECT_TLS 4			// tls 模式, 由 socket_server_tls() 在 dw_lock 保护下设置, 之后的数据都要加密. 切换失败时清除
+
+// socket.hold : socket 线程暂时停止读的原因, 和服务的 pause/start (socket.reading) 互不影响
+#define HOLD_LIMIT 1			// SOCKET_LIMIT_PAUSE, 发送缓存降到上限的一半时恢复
+#define HOLD_THROTTLE 2			// 监听 socket 的 accept 令牌用完, 补充令牌后恢复
+
+#define RUDP_INTERVAL 10		// ms, 有可靠 udp 会话时, 检查重传定时器的间隔 (也是 sp_wait 的超时时间)
+#define RUDP_KEEPALIVE 5000		// ms, 会话空闲这么久以后, 探测对端的窗口
+#define RUDP_TIMEOUT 30000		// ms, 会话这么久没有收到数据报, 报告 "timeout" 错误
+
 #define USEROBJECT ((size_t)(-1))
+#define SHAREDOBJECT ((size_t)(-2))	// request_send.buffer 是 struct send_shared
+
+// write_buffer 的类型
+#define WRITE_BUFFER_MEMORY 0		// buffer 由 FREE 释放
+#define WRITE_BUFFER_USEROBJECT 1	// 用户对象, 内存控制由 socker_server 的 (soi)socket_object_interface 来决定
+#define WRITE_BUFFER_FILE 2			// 文件, 见 struct write_buffer_file
+#define WRITE_BUFFER_SHARED 3		// 多个 socket 共享的只读数据, 见 struct send_shared
 
 // 写数据的缓存, 这是一个链表
 struct write_buffer {
@@ -89,7 +135,30 @@ struct write_buffer {
 	const void *buffer;				// 数据的起始地址
 	char *ptr;						// 剩余发送数据的起始地址, 这里有个小细节, ptr 是 char * 类型, 指针每次的变化是 1 个字节. 可以参考 send_list_tcp 函数
 	size_t sz;						// 剩余发送数据的大小
-	bool userobject;				// 判断 buffer 是否是用户对象, 用户对象的内存控制由 socker_server 的 (soi)socket_object_interface 来决定
+	uint8_t type;					// WRITE_BUFFER_*
+	bool zerocopy;					// 已经以 MSG_ZEROCOPY 发送过, 需要等到内核通知完成后才能释放
+	bool nozc;						// MSG_ZEROCOPY 失败 (ENOBUFS), 余下的数据复制发送
+};
+
+// 广播的数据, 多个 socket 的 write_buffer 共享同一块内存, 最后一个引用发送完毕(或丢弃)时释放
+struct send_shared {
+	ATOM_INT ref;
+	size_t sz;
+	const void * buffer;	// 由 FREE 释放
+};
+
+/// 广播, 把同一份数据发送给 n 个 socket. id 数组由 socket 线程释放
+struct request_multisend {
+	int n;
+	int *id;
+	struct send_shared *buffer;
+};
+
+// 文件发送缓存, 数据由 sendfile 直接从文件送到 socket, 不经过用户态内存. buffer/ptr 不使用, sz 是剩余的字节数
+struct write_buffer_file {
+	struct write_buffer buffer;
+	int fd;							// 文件描述符, 发送完毕后关闭
+	int64_t offset;					// 下一次读取文件的偏移
 };
 
 // udp 地址信息, 0 字节存储协议类型; 1, 2 字节存储端口号; 剩下的是地址数据, 对于 IPv4 使用 4 个字节存储, 对于 IPv6 使用 16 个字节存储;
@@ -109,6 +178,110 @@ struct socket_stat {
 	uint64_t wtime;
 	uint64_t read;
 	uint64_t write;
+	int64_t wpeak;		// 发送缓存的峰值
+	uint64_t rejected;	// 监听 socket 或者可靠 udp 的 endpoint : 因为等待队列满, fd 或 id 用尽而关闭的连接数
+};
+
+// 发送流量整形, 令牌桶限速和发送缓存上限. 第一次设置时分配, 直到 socket_server_release 才释放 (query_info 在工作线程中读)
+struct socket_shape {
+	int rate;			// 每秒发送的字节数, 0 表示不限速. 令牌桶的容量也是 rate
+	int limit;			// 发送缓存(wb_size)的上限, 0 表示不限制
+	int policy;			// 达到上限时的策略 SOCKET_LIMIT_*
+	bool throttled;		// 令牌用完, 已经关闭写事件, 并加入 socket_server 的 throttle 列表
+	int64_t tokens;
+	uint64_t time;		// 上一次补充令牌的时间
+	uint64_t throttle;	// 因为限速而暂停写的次数 (监听 socket : 因为 accept 限速而暂停 accept 的次数)
+	uint64_t dropped;	// 因为超过发送缓存上限而丢弃的字节数 (SOCKET_LIMIT_DROP)
+};
+
+// cork 模式, 攒批发送, 在显式 flush, 发送缓存达到 threshold 或定时器到期时才打开写事件. 只在 socket 线程中读写, 关闭时释放
+struct socket_cork {
+	bool on;
+	bool corked;		// 发送缓存中有数据, 但还没有打开写事件
+	int threshold;		// 发送缓存达到这个大小就 flush, 0 表示不限制
+	int interval;		// 微秒, 定时 flush 的间隔, 0 表示只在显式 flush 或达到 threshold 时发送
+	uint64_t deadline;	// corked 时为定时 flush 的时间; 否则在这个时间之前的写入会被攒批, 之后的立即发送
+};
+
+// 分帧模式, 每个完整的帧产生一个 SOCKET_DATA. 只在 socket 线程中读写, 关闭时释放
+struct socket_frame {
+	uint8_t header;		// 帧头(帧长度)的字节数 1/2/4, 0 表示不分帧
+	bool little;		// 帧头是否为小端
+	int max;			// 帧的最大长度, 超过则关闭连接
+	char * buffer;		// 已读取但未分帧的数据 [offset, offset+sz)
+	int offset;
+	int sz;
+	int cap;
+	char * frame;		// 大帧直接读入这块内存, 不经过 buffer
+	int frame_sz;
+	int frame_read;
+};
+
+// socket id 列表, 记录因为限速而暂停写的 socket, 以及等待定时 flush 的 socket
+struct throttle_list {
+	int n;
+	int cap;
+	int *id;
+};
+
+// 监听 socket 的 accept 限速, 令牌桶在 socket.shape 中 (rate 为每秒 accept 的连接数)
+// 令牌用完以后, 新连接 accept 进等待队列 (PACCEPT 状态, 不报告), 有令牌时再依次报告 SOCKET_ACCEPT
+struct accept_queue {
+	uint64_t deferred;	// 进入等待队列的连接数
+	int max;		// 等待队列的上限, 队列满以后关闭新连接. 0 表示不用队列, 令牌用完时暂停 accept (连接留在内核的 backlog 中)
+	bool ready;		// 在 socket_server.accepting 列表中
+	int head;
+	int n;
+	int cap;
+	int *id;
+};
+
+// 可靠 udp (rudp.h) : 会话 (session) 像 tcp 连接一样报告 SOCKET_OPEN/DATA/CLOSE, 通过一个 udp socket (endpoint) 收发数据报.
+// 监听的 endpoint 为每个新的 (地址, conv) 创建会话并报告 SOCKET_ACCEPT; 主动连接的会话自己持有 udp fd, 就是自己的 endpoint.
+struct socket_rudp {
+	struct rudp * arq;		// 会话的 ARQ, 监听的 endpoint 为 NULL
+	struct socket_server * ss;
+	int endpoint;			// endpoint 的 id, endpoint 关闭以后为 -1
+	int fd;					// endpoint 的 fd, endpoint 关闭以后为 -1
+	int next;				// endpoint 的 hash 表中, 同一个桶的下一个会话
+	uint32_t conv;
+	uint32_t flush;			// 下次需要 rudp_flush 的时间 (ms)
+	uint32_t recent;		// 最近一次收到数据报的时间 (ms)
+	uint32_t ping;			// 最近一次 keepalive 探测的时间 (ms)
+	bool ready;				// 在 socket_server.rudp_ready 中
+	bool eof;				// 收到了对端的 FIN
+	const char * err;		// 等待报告的错误
+	// 监听的 endpoint : 按 (地址, conv) 索引会话的 hash 表
+	int *bucket;
+	int cap;
+	int n;
+	struct rudp_stat stat;	// 会话 : 由 check_rudp 定时更新, query_info 在 dw_lock 保护下读取
+};
+
+// 一次 MSG_ZEROCOPY 的 send 调用, 等待 MSG_ERRQUEUE 中的完成通知
+struct zerocopy_pending {
+	struct zerocopy_pending * next;
+	struct write_buffer * wb;	// 整个 write_buffer 发送完毕后挂在最后一次调用上, 完成时释放
+	uint32_t seq;				// 内核为每次成功的 send 调用分配的序号
+	size_t sz;
+};
+
+// tls 模式 : 数据流在 socket 线程中由 tif 加密, 见 socket_server_tls(). 只在 socket 线程中读写, 关闭时释放
+struct socket_tls {
+	const struct socket_tls_interface *tif;
+	void * ud;
+	bool ready;		// 握手已完成
+	bool read_wantwrite;	// 读在等待 socket 可写 (SSL_ERROR_WANT_WRITE), 可写时重试读, 见 tls_resume()
+	bool write_wantread;	// 写在等待 socket 可读 (SSL_ERROR_WANT_READ), 期间关闭写事件, 可读时恢复
+};
+
+// 打开 MSG_ZEROCOPY 时分配, 直到 socket_server_release 才释放 (query_info 在工作线程中读)
+struct zerocopy_list {
+	struct zerocopy_pending * head;
+	struct zerocopy_pending * tail;
+	uint32_t seq;				// 下一次 send 调用的序号
+	uint64_t zerocopy;			// 内核确认以 zero-copy 发出的字节数
+	uint64_t fallback;			// 使用了 MSG_ZEROCOPY, 但内核回退为复制的字节数
 };
 
 struct socket {
@@ -122,11 +295,24 @@ struct socket {
     int id;                 // 位于socket_server的slot列表中的位置
 	ATOM_INT type;          // epoll事件触发时，会根据type来选择处理事件的逻辑
 	uint8_t protocol;		// 使用的协议tcp or udp
-	bool reading;
+	bool reading;			// 服务要求读 (start/pause), 只有 hold 为 0 时才真正打开读事件
 	bool writing;
+	uint8_t hold;			// HOLD_* 的组合
 	bool closing;
 	ATOM_INT udpconnecting;
+	ATOM_INT nodirect;		// NODIRECT_* 的组合, 非 0 时工作线程不直接写, 见 can_direct_write
+	ATOM_INT zerocopy;		// MSG_ZEROCOPY 的阈值, 0 表示关闭, 否则不小于阈值的 write_buffer 使用 MSG_ZEROCOPY
 	int64_t warn_size;
+	// 以下功能的状态在用到时才分配, NULL 表示没有用过
+	struct zerocopy_list * zc;
+	struct socket_shape * shape;
+	struct socket_cork * cork;
+	struct socket_frame * frame;
+	struct socket_tls * tls;
+	ATOM_INT listener;		// accept 这个连接的监听 socket id, 否则为 -1. 工作线程在 socket_server_latency 中读取
+	ATOM_ULONG * latency;	// 监听 socket 的延迟统计(SOCKET_LATENCY_BUCKETS), 分配以后直到 socket_server_release 才释放
+	struct accept_queue * aq;	// 监听 socket 的 accept 等待队列, 同上, 设置 accept 限速时分配
+	struct socket_rudp * rudp;	// 可靠 udp 的会话或者监听的 endpoint, 关闭时释放
 	union {
 		int size; // tcp 情况, read 数据的大小
 		uint8_t udp_address[UDP_ADDRESS_SIZE]; // udp 情况下, 存储的是 udp 的地址信息
@@ -139,6 +325,7 @@ struct socket {
 
 struct socket_server {
 	volatile uint64_t time;
+	uint64_t event_time;	// 最近一次 sp_wait 返回的时间(微秒)
 	int reserve_fd;	// for EMFILE
     int recvctrl_fd;        // 接收管道消息的文件描述
     int sendctrl_fd;        // 发送管道消息的文件描述
@@ -148,6 +335,15 @@ struct socket_server {
     int event_n;            // 标记本次epoll事件的数量
     int event_index;        // 下一个未处理的epoll事件索引
 	struct socket_object_interface soi;
+	struct throttle_list throttle;
+	struct throttle_list cork;	// 等待定时 flush 的 socket
+	struct throttle_list accepting;	// 有等待报告的连接, 并且有令牌的监听 socket
+	int accept_n;			// 本轮 sp_wait 以后 accept 的连接数, 见 ACCEPT_BUDGET
+	struct throttle_list rudp;	// 所有可靠 udp 会话, 由 check_rudp 驱动定时器
+	struct throttle_list rudp_ready;	// 有数据, FIN 或者错误需要报告的会话
+	uint32_t rudp_time;		// 上一次 check_rudp 的时间 (ms)
+	struct request_multisend multisend;	// 正在处理的广播请求, 可能被 send_socket 的返回结果打断
+	int multisend_index;	// 下一个要发送的 multisend.id 的索引
 	struct event ev[MAX_EVENT]; // epoll事件列表
 	struct socket slot[MAX_SOCKET];  // socket 列表
 	char buffer[MAX_INFO];  // 地址信息转成字符串以后，存在这里
@@ -158,6 +354,7 @@ struct socket_server {
 struct request_open {
 	int id;		// socket id
 	int port;	// 端口
+	int family;	// AF_UNIX 表示 unix domain socket, 否则为 AF_UNSPEC
 	uintptr_t opaque;
 	char host[1];	// 主机名或者地址(IPv4的点分十进制串或者IPv6的16进制串)的字符串起始地址
 };
@@ -168,6 +365,14 @@ struct request_send {
 	const void * buffer;	// 发送数据地址
 };
 
+/// 发送文件, fd 的所有权交给 socket 线程
+struct request_sendfile {
+	int id;
+	int fd;
+	int64_t offset;
+	size_t sz;
+};
+
 /// 基于 udp 协议发送数据
 struct request_send_udp {
 	struct request_send send;
@@ -204,7 +409,7 @@ struct request_resumepause {
 	uintptr_t opaque;
 };
 
-/// 基于 IPPROTO_TCP level, 设置 socket 的选项
+/// 基于 IPPROTO_TCP level, 设置 socket 的选项; 'G' 请求也使用这个结构设置 socket_server 自己的选项 (SOCKET_OPT_*)
 struct request_setopt {
 	int id;
 	int what; // 设置的选项 setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
@@ -225,6 +430,22 @@ struct request_dial_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_tls {
+	int id;
+	const struct socket_tls_interface *tif;
+	void * ud;
+};
+
+// 可靠 udp 的 endpoint. listen 为 0 时, 创建会话, address 是对端地址; 否则只用 address[0] (协议)
+struct request_rudp {
+	int id;
+	int fd;
+	int listen;
+	uint32_t conv;
+	uintptr_t opaque;
+	uint8_t address[UDP_ADDRESS_SIZE];
+};
+
 /*
 	The first byte is TYPE
 	R Resume socket
@@ -237,11 +458,15 @@ struct request_dial_udp {
 	W Enable write
 	D Send package (high)
 	P Send package (low)
+	F Send file
 	A Send UDP package
 	C set udp address
 	N client dial to UDP host port
 	T Set opt
+	G Set socket server option
 	U Create UDP socket
+	E Encrypt the socket by tls
+	Q Reliable UDP (listen or dial)
  */
 
 // 这里也是一个很屌的处理, 每个 request_package 变量, 所占的内存空间是连续的 8 + 256 + 256 = 520 字节大小
@@ -251,6 +476,8 @@ struct request_package {
 		char buffer[256]; // 这个 buffer 其实不会直接使用, 为的是保证分配的内存空间足够 256 大小
 		struct request_open open;
 		struct request_send send;
+		struct request_sendfile sendfile;
+		struct request_multisend multisend;
 		struct request_send_udp send_udp;
 		struct request_close close;
 		struct request_listen listen;
@@ -260,6 +487,8 @@ struct request_package {
 		struct request_udp udp;
 		struct request_setudp set_udp;
 		struct request_dial_udp dial_udp;
+		struct request_tls tls;
+		struct request_rudp rudp;
 	} u;
 	uint8_t dummy[256]; // 这是一个虚拟的内存空间, 预留使用, 例如: 可以给 request_open.host 用来存储字符串
 };
@@ -275,8 +504,13 @@ union sockaddr_all {
 	struct sockaddr_in v4;
 	// 同上, 但是是 ipv6 的协议.
 	struct sockaddr_in6 v6;
+	// unix domain socket, 地址是文件路径
+	struct sockaddr_un un;
 };
 
+#define UNIX_PREFIX "unix:"		// "unix:/path/of/socket" 或 "unix:@name"(linux 的抽象命名空间) 表示 unix domain socket
+#define UNIX_PREFIX_SZ (sizeof(UNIX_PREFIX) - 1)
+
 struct send_object {
 	const void * buffer;
 	size_t sz;
@@ -329,18 +563,34 @@ socket_invalid(struct socket *s, int id) {
 	return (s->id != id || ATOM_LOAD(&s->type) == SOCKET_TYPE_INVALID);
 }
 
-static inline bool
+static void
+shared_release(void *ptr) {
+	struct send_shared *sh = (struct send_shared *)ptr;
+	if (ATOM_FDEC(&sh->ref) == 1) {
+		FREE((void *)sh->buffer);
+		FREE(sh);
+	}
+}
+
+// return WRITE_BUFFER_*
+static inline uint8_t
 send_object_init(struct socket_server *ss, struct send_object *so, const void *object, size_t sz) {
 	if (sz == USEROBJECT) {
 		so->buffer = ss->soi.buffer(object);
 		so->sz = ss->soi.size(object);
 		so->free_func = ss->soi.free;
-		return true;
+		return WRITE_BUFFER_USEROBJECT;
+	} else if (sz == SHAREDOBJECT) {
+		const struct send_shared *sh = (const struct send_shared *)object;
+		so->buffer = sh->buffer;
+		so->sz = sh->sz;
+		so->free_func = shared_release;
+		return WRITE_BUFFER_SHARED;
 	} else {
 		so->buffer = object;
 		so->sz = sz;
 		so->free_func = FREE;
-		return false;
+		return WRITE_BUFFER_MEMORY;
 	}
 }
 
@@ -374,14 +624,120 @@ send_object_init_from_sendbuffer(struct socket_server *ss, struct send_object *s
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	switch (wb->type) {
+	case WRITE_BUFFER_USEROBJECT:
 		ss->soi.free((void *)wb->buffer);
-	} else {
+		break;
+	case WRITE_BUFFER_FILE:
+		close(((struct write_buffer_file *)wb)->fd);
+		break;
+	case WRITE_BUFFER_SHARED:
+		shared_release((void *)wb->buffer);
+		break;
+	default:
 		FREE((void *)wb->buffer);
+		break;
 	}
 	FREE(wb);
 }
 
+// socket server options, see option_socket()
+#define SOCKET_OPT_ZEROCOPY 0
+#define SOCKET_OPT_RATE 1
+#define SOCKET_OPT_LIMIT 2
+#define SOCKET_OPT_POLICY 3
+#define SOCKET_OPT_FRAME 4			// value : header size | little endian << 8
+#define SOCKET_OPT_FRAMEMAX 5
+#define SOCKET_OPT_CORK 6			// value : threshold, CORK_OFF for turn off
+#define SOCKET_OPT_CORKTIME 7		// value : interval in microseconds
+#define SOCKET_OPT_FLUSH 8
+#define SOCKET_OPT_ACCEPTRATE 9		// value : connections per second
+#define SOCKET_OPT_ACCEPTQUEUE 10	// value : max pending connections
+
+static void
+free_zerocopy(struct socket_server *ss, struct zerocopy_list *zc) {
+	if (zc == NULL)
+		return;
+	struct zerocopy_pending *p = zc->head;
+	while (p) {
+		struct zerocopy_pending *tmp = p;
+		p = p->next;
+		if (tmp->wb) {
+			write_buffer_free(ss, tmp->wb);
+		}
+		FREE(tmp);
+	}
+	zc->head = zc->tail = NULL;
+}
+
+static void
+free_tls(struct socket *s) {
+	struct socket_tls *t = s->tls;
+	if (t == NULL)
+		return;
+	if (t->ud) {
+		t->tif->release(t->ud);
+	}
+	FREE(t);
+	s->tls = NULL;
+}
+
+// free the buffers of frame mode, keep the settings
+static void
+free_frame(struct socket_frame *f) {
+	FREE(f->buffer);
+	FREE(f->frame);
+	f->buffer = NULL;
+	f->frame = NULL;
+	f->offset = 0;
+	f->sz = 0;
+	f->cap = 0;
+}
+
+// the state of the features below is allocated at the first use, see struct socket
+static struct socket_shape *
+shape_get(struct socket *s) {
+	if (s->shape == NULL) {
+		s->shape = MALLOC(sizeof(*s->shape));
+		memset(s->shape, 0, sizeof(*s->shape));
+	}
+	return s->shape;
+}
+
+static struct socket_cork *
+cork_get(struct socket *s) {
+	if (s->cork == NULL) {
+		s->cork = MALLOC(sizeof(*s->cork));
+		memset(s->cork, 0, sizeof(*s->cork));
+	}
+	return s->cork;
+}
+
+static struct socket_frame *
+frame_get(struct socket *s) {
+	if (s->frame == NULL) {
+		s->frame = MALLOC(sizeof(*s->frame));
+		memset(s->frame, 0, sizeof(*s->frame));
+	}
+	return s->frame;
+}
+
+static inline bool
+is_throttled(struct socket *s) {
+	return s->shape && s->shape->throttled;
+}
+
+static inline bool
+is_corked(struct socket *s) {
+	return s->cork && s->cork->corked;
+}
+
+// the kernel still refers some buffers sent by MSG_ZEROCOPY
+static inline bool
+zc_pending(struct socket *s) {
+	return s->zc && s->zc->head;
+}
+
 static void
 socket_keepalive(int fd) {
 	int keepalive = 1;
@@ -458,12 +814,32 @@ socket_server_create(uint64_t time) {
 		ATOM_INIT(&s->type, SOCKET_TYPE_INVALID);
 		clear_wb_list(&s->high);
 		clear_wb_list(&s->low);
+		s->zc = NULL;
+		s->shape = NULL;
+		s->cork = NULL;
+		s->frame = NULL;
+		s->tls = NULL;
+		ATOM_INIT(&s->nodirect, 0);
+		ATOM_INIT(&s->zerocopy, 0);
+		s->latency = NULL;
+		s->aq = NULL;
+		s->rudp = NULL;
 		spinlock_init(&s->dw_lock);
 	}
 	ATOM_INIT(&ss->alloc_id , 0);
 	ss->event_n = 0;
 	ss->event_index = 0;
+	ss->event_time = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
+	memset(&ss->throttle, 0, sizeof(ss->throttle));
+	memset(&ss->cork, 0, sizeof(ss->cork));
+	memset(&ss->accepting, 0, sizeof(ss->accepting));
+	ss->accept_n = 0;
+	memset(&ss->rudp, 0, sizeof(ss->rudp));
+	memset(&ss->rudp_ready, 0, sizeof(ss->rudp_ready));
+	ss->rudp_time = 0;
+	memset(&ss->multisend, 0, sizeof(ss->multisend));
+	ss->multisend_index = 0;
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
 
@@ -475,6 +851,38 @@ socket_server_updatetime(struct socket_server *ss, uint64_t time) {
 	ss->time = time;
 }
 
+uint64_t
+socket_server_clock(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+}
+
+// bucket 0 : < 1us, bucket n : [2^(n-1), 2^n) us, the last bucket counts all the larger ones
+static inline int
+latency_bucket(uint64_t us) {
+	int n = 0;
+	while (us) {
+		++n;
+		us >>= 1;
+	}
+	return n < SOCKET_LATENCY_BUCKETS ? n : SOCKET_LATENCY_BUCKETS - 1;
+}
+
+// call in worker thread when the message (read at time) of socket id is dispatched
+void
+socket_server_latency(struct socket_server *ss, int id, uint64_t time) {
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	int listener = ATOM_LOAD(&s->listener);
+	if (s->id != id || listener < 0)
+		return;
+	struct socket *l = &ss->slot[HASH_ID(listener)];
+	if (l->id != listener || ATOM_LOAD(&l->type) != SOCKET_TYPE_LISTEN)
+		return;
+	uint64_t now = socket_server_clock();
+	ATOM_FINC(&l->latency[latency_bucket(now > time ? now - time : 0)]);
+}
+
 static void
 free_wb_list(struct socket_server *ss, struct wb_list *list) {
 	struct write_buffer *wb = list->head;
@@ -523,6 +931,28 @@ clone_buffer(struct socket_sendbuffer *buf, size_t *sz) {
 	return NULL;
 }
 
+static void force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result);
+static void free_rudp(struct socket_server *ss, struct socket *s);
+
+// close the connections in the accept queue of listen socket
+static void
+close_pending(struct socket_server *ss, struct accept_queue *q) {
+	struct socket_message dummy;
+	while (q->n > 0) {
+		int id = q->id[q->head];
+		q->head = (q->head + 1) % q->cap;
+		--q->n;
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (s->id == id && ATOM_LOAD(&s->type) == SOCKET_TYPE_PACCEPT) {
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			force_close(ss, s, &l, &dummy);
+		}
+	}
+	q->head = 0;
+	q->ready = false;
+}
+
 static void
 force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	result->id = s->id;
@@ -536,9 +966,27 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	assert(type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
-	sp_del(ss->event_fd, s->fd);
+	free_zerocopy(ss,s->zc);
+	if (s->frame) {
+		free_frame(s->frame);
+		FREE(s->frame);
+		s->frame = NULL;
+	}
+	free_tls(s);
+	FREE(s->cork);
+	s->cork = NULL;
+	if (s->aq && (type == SOCKET_TYPE_LISTEN || type == SOCKET_TYPE_PLISTEN)) {
+		close_pending(ss, s->aq);
+	}
+	if (s->rudp) {
+		free_rudp(ss, s);
+	}
+	// the session of reliable udp (accepted by endpoint) has no fd
+	if (s->fd >= 0) {
+		sp_del(ss->event_fd, s->fd);
+	}
 	socket_lock(l);
-	if (type != SOCKET_TYPE_BIND) {
+	if (type != SOCKET_TYPE_BIND && s->fd >= 0) {
 		if (close(s->fd) < 0) {
 			perror("close socket:");
 		}
@@ -568,12 +1016,25 @@ socket_server_release(struct socket_server *ss) {
 			force_close(ss, s, &l, &dummy);
 		}
 		spinlock_destroy(&s->dw_lock);
+		FREE(s->latency);
+		if (s->aq) {
+			FREE(s->aq->id);
+			FREE(s->aq);
+		}
+		FREE(s->zc);
+		FREE(s->shape);
 	}
 	close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
 	sp_release(ss->event_fd);
 	if (ss->reserve_fd >= 0)
 		close(ss->reserve_fd);
+	FREE(ss->throttle.id);
+	FREE(ss->cork.id);
+	FREE(ss->accepting.id);
+	FREE(ss->rudp.id);
+	FREE(ss->rudp_ready.id);
+	FREE(ss->multisend.id);
 	FREE(ss);
 }
 
@@ -583,22 +1044,80 @@ check_wb_list(struct wb_list *s) {
 	assert(s->tail == NULL);
 }
 
+static void rudp_ready(struct socket_server *ss, struct socket *s);
+
 static inline int
 enable_write(struct socket_server *ss, struct socket *s, bool enable) {
 	if (s->writing != enable) {
 		s->writing = enable;
-		return sp_enable(ss->event_fd, s->fd, s, s->reading, enable);
+		if (s->protocol == PROTOCOL_RUDP) {
+			// the segments are sent by rudp_sendto()
+			return 0;
+		}
+		return sp_enable(ss->event_fd, s->fd, s, s->reading && s->hold == 0, enable);
 	}
 	return 0;
 }
 
+// apply the read event after s->reading or s->hold changed, old is the state before
+static int
+read_event(struct socket_server *ss, struct socket *s, bool old) {
+	bool enable = s->reading && s->hold == 0;
+	if (enable == old)
+		return 0;
+	if (s->protocol == PROTOCOL_RUDP) {
+		// the endpoint always reads for the acks, s->reading only stops reporting the data
+		if (enable) {
+			rudp_ready(ss, s);
+		}
+		return 0;
+	}
+	return sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
+}
+
 static inline int
 enable_read(struct socket_server *ss, struct socket *s, bool enable) {
-	if (s->reading != enable) {
-		s->reading = enable;
-		return sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
+	bool old = s->reading && s->hold == 0;
+	s->reading = enable;
+	return read_event(ss, s, old);
+}
+
+static inline int
+hold_read(struct socket_server *ss, struct socket *s, int flag, bool hold) {
+	bool old = s->reading && s->hold == 0;
+	s->hold = hold ? (s->hold | flag) : (s->hold & ~flag);
+	return read_event(ss, s, old);
+}
+
+// read/write the plain text of tcp socket, the same as read(2)/write(2)
+static ssize_t
+socket_read(struct socket_server *ss, struct socket *s, void *buffer, size_t sz) {
+	if (s->tls == NULL) {
+		return read(s->fd, buffer, sz);
 	}
-	return 0;
+	ssize_t n = s->tls->tif->read(s->tls->ud, buffer, (int)sz);
+	if (n < 0 && errno == AGAIN_WOULDBLOCK && s->tls->tif->want(s->tls->ud) == SOCKET_TLS_WANTWRITE) {
+		// retry reading when the socket is writable, see tls_resume()
+		s->tls->read_wantwrite = true;
+		enable_write(ss, s, true);
+		errno = AGAIN_WOULDBLOCK;
+	}
+	return n;
+}
+
+static ssize_t
+socket_write(struct socket_server *ss, struct socket *s, const void *buffer, size_t sz) {
+	if (s->tls == NULL) {
+		return write(s->fd, buffer, sz);
+	}
+	ssize_t n = s->tls->tif->write(s->tls->ud, buffer, (int)sz);
+	if (n < 0 && errno == AGAIN_WOULDBLOCK && s->reading && s->hold == 0 && s->tls->tif->want(s->tls->ud) == SOCKET_TLS_WANTREAD) {
+		// the socket is always writable, turn off the write event until it's readable, see tls_resume()
+		s->tls->write_wantread = true;
+		enable_write(ss, s, false);
+		errno = AGAIN_WOULDBLOCK;
+	}
+	return n;
 }
 
 static struct socket *
@@ -606,7 +1125,8 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	assert(ATOM_LOAD(&s->type) == SOCKET_TYPE_RESERVE);
 
-	if (sp_add(ss->event_fd, fd, s)) {
+	// fd < 0 : the session of reliable udp accepted by endpoint
+	if (fd >= 0 && sp_add(ss->event_fd, fd, s)) {
 		ATOM_STORE(&s->type, SOCKET_TYPE_INVALID);
 		return NULL;
 	}
@@ -614,6 +1134,7 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->id = id;
 	s->fd = fd;
 	s->reading = true;
+	s->hold = 0;
 	s->writing = false;
 	s->closing = false;
 	ATOM_INIT(&s->sending , ID_TAG16(id) << 16 | 0);
@@ -624,10 +1145,24 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->warn_size = 0;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
+	ATOM_STORE(&s->zerocopy, 0);
+	if (s->zc) {
+		assert(!zc_pending(s));
+		memset(s->zc, 0, sizeof(*s->zc));
+	}
+	if (s->shape) {
+		memset(s->shape, 0, sizeof(*s->shape));
+	}
+	ATOM_STORE(&s->nodirect, 0);
+	assert(s->cork == NULL && s->frame == NULL && s->tls == NULL);
+	ATOM_STORE(&s->listener, -1);
 	s->dw_buffer = NULL;
 	s->dw_size = 0;
 	memset(&s->stat, 0, sizeof(s->stat));
-	if (enable_read(ss, s, reading)) {
+	assert(s->rudp == NULL);
+	if (fd < 0) {
+		s->reading = reading;
+	} else if (enable_read(ss, s, reading)) {
 		ATOM_STORE(&s->type , SOCKET_TYPE_INVALID);
 		return NULL;
 	}
@@ -646,6 +1181,86 @@ stat_write(struct socket_server *ss, struct socket *s, int n) {
 	s->stat.wtime = ss->time;
 }
 
+static inline bool
+is_unix_address(const char *host) {
+	return host && strncmp(host, UNIX_PREFIX, UNIX_PREFIX_SZ) == 0;
+}
+
+// fill sockaddr_un by "unix:path", return the length of address, or 0 when the path is too long
+static socklen_t
+unix_address(const char *host, struct sockaddr_un *sa) {
+	const char * path = host + UNIX_PREFIX_SZ;
+	size_t sz = strlen(path);
+	if (sz == 0 || sz >= sizeof(sa->sun_path))
+		return 0;
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	memcpy(sa->sun_path, path, sz);
+#ifdef __linux__
+	if (path[0] == '@') {
+		// abstract namespace
+		sa->sun_path[0] = '\0';
+		return offsetof(struct sockaddr_un, sun_path) + sz;
+	}
+#endif
+	return offsetof(struct sockaddr_un, sun_path) + sz + 1;
+}
+
+// the address (without port) of u, "unix:path" for unix domain socket. return NULL when failed
+static const char *
+address_string(union sockaddr_all *u, socklen_t len, char *buffer, size_t sz) {
+	if (u->s.sa_family == AF_UNIX) {
+		int n = (int)len - (int)offsetof(struct sockaddr_un, sun_path);
+		if (n <= 0) {
+			// unnamed
+			snprintf(buffer, sz, "%s", UNIX_PREFIX);
+		} else if (u->un.sun_path[0] == '\0') {
+			snprintf(buffer, sz, "%s@%.*s", UNIX_PREFIX, n - 1, u->un.sun_path + 1);
+		} else {
+			snprintf(buffer, sz, "%s%.*s", UNIX_PREFIX, n, u->un.sun_path);
+		}
+		return buffer;
+	}
+	void * sin_addr = (u->s.sa_family == AF_INET) ? (void*)&u->v4.sin_addr : (void *)&u->v6.sin6_addr;
+	return inet_ntop(u->s.sa_family, sin_addr, buffer, sz);
+}
+
+static int
+open_unix_socket(struct socket_server *ss, struct request_open * request, struct socket_message *result) {
+	int id = request->id;
+	struct sockaddr_un sa;
+	socklen_t len = unix_address(request->host, &sa);
+	if (len == 0) {
+		result->data = "invalid unix socket path";
+		goto _failed;
+	}
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		result->data = strerror(errno);
+		goto _failed;
+	}
+	sp_nonblocking(sock);
+	// connect of unix domain socket never returns EINPROGRESS, EAGAIN means the backlog of listener is full
+	if (connect(sock, (struct sockaddr *)&sa, len) != 0) {
+		result->data = strerror(errno);
+		close(sock);
+		goto _failed;
+	}
+	struct socket *ns = new_fd(ss, id, sock, PROTOCOL_TCP, request->opaque, true);
+	if (ns == NULL) {
+		close(sock);
+		result->data = "reach skynet socket number limit";
+		goto _failed;
+	}
+	ATOM_STORE(&ns->type , SOCKET_TYPE_CONNECTED);
+	snprintf(ss->buffer, sizeof(ss->buffer), "%s", request->host);
+	result->data = ss->buffer;
+	return SOCKET_OPEN;
+_failed:
+	ATOM_STORE(&ss->slot[HASH_ID(id)].type, SOCKET_TYPE_INVALID);
+	return SOCKET_ERR;
+}
+
 // return -1 when connecting
 static int
 open_socket(struct socket_server *ss, struct request_open * request, struct socket_message *result) {
@@ -659,6 +1274,9 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 	struct addrinfo ai_hints;
 	struct addrinfo *ai_list = NULL;
 	struct addrinfo *ai_ptr = NULL;
+	if (request->family == AF_UNIX) {
+		return open_unix_socket(ss, request, result);
+	}
 	char port[16];
 	sprintf(port, "%d", request->port);
 	memset(&ai_hints, 0, sizeof( ai_hints ) );
@@ -759,77 +1377,490 @@ close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	}
 }
 
-static int
-send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
-	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
-			if (sz < 0) {
-				switch(errno) {
-				case EINTR:
-					continue;
-				case AGAIN_WOULDBLOCK:
-					return -1;
-				}
-				return close_write(ss, s, l, result);
-			}
-			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
-				return -1;
-			}
-			break;
+static inline void
+refill_tokens(struct socket_server *ss, struct socket *s) {
+	uint64_t now = ss->time;
+	if (now != s->shape->time) {
+		// ss->time is in 1/100 second
+		int64_t add = (int64_t)(now - s->shape->time) * s->shape->rate / 100;
+		if (add > 0) {
+			// don't move time forward when the rate is too low to get one token (accept rate of listen socket)
+			int64_t tokens = s->shape->tokens + add;
+			s->shape->tokens = tokens > s->shape->rate ? s->shape->rate : tokens;
+			s->shape->time = now;
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
 	}
-	list->tail = NULL;
+}
 
-	return -1;
+static void
+throttle_push(struct throttle_list *t, int id) {
+	if (t->n >= t->cap) {
+		t->cap = t->cap ? t->cap * 2 : 16;
+		t->id = skynet_realloc(t->id, t->cap * sizeof(int));
+	}
+	t->id[t->n++] = id;
 }
 
-static socklen_t
-udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE], union sockaddr_all *sa) {
-	int type = (uint8_t)udp_address[0];
-	if (type != s->protocol)
-		return 0;
-	uint16_t port = 0;
-	memcpy(&port, udp_address+1, sizeof(uint16_t));
-	switch (s->protocol) {
-	case PROTOCOL_UDP:
-		memset(&sa->v4, 0, sizeof(sa->v4));
-		sa->s.sa_family = AF_INET;
-		sa->v4.sin_port = port;
-		memcpy(&sa->v4.sin_addr, udp_address + 1 + sizeof(uint16_t), sizeof(sa->v4.sin_addr));	// ipv4 address is 32 bits
-		return sizeof(sa->v4);
-	case PROTOCOL_UDPv6:
-		memset(&sa->v6, 0, sizeof(sa->v6));
-		sa->s.sa_family = AF_INET6;
-		sa->v6.sin6_port = port;
-		memcpy(&sa->v6.sin6_addr, udp_address + 1 + sizeof(uint16_t), sizeof(sa->v6.sin6_addr)); // ipv6 address is 128 bits
-		return sizeof(sa->v6);
+static void
+accept_push(struct accept_queue *q, int id) {
+	if (q->n >= q->cap) {
+		int cap = q->cap ? q->cap * 2 : 16;
+		int * ids = MALLOC(cap * sizeof(int));
+		int i;
+		for (i=0;i<q->n;i++) {
+			ids[i] = q->id[(q->head + i) % q->cap];
+		}
+		FREE(q->id);
+		q->id = ids;
+		q->head = 0;
+		q->cap = cap;
 	}
-	return 0;
+	q->id[(q->head + q->n) % q->cap] = id;
+	++q->n;
 }
 
+// the pending connections of listen socket can be reported, see accept_pending()
 static void
-drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct write_buffer *tmp) {
-	s->wb_size -= tmp->sz;
-	list->head = tmp->next;
-	if (list->head == NULL)
-		list->tail = NULL;
-	write_buffer_free(ss,tmp);
+accept_ready(struct socket_server *ss, struct socket *s) {
+	if (!s->aq->ready) {
+		s->aq->ready = true;
+		throttle_push(&ss->accepting, s->id);
+	}
 }
 
-static int
-send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
-	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
-		union sockaddr_all sa;
+static void
+throttle_socket(struct socket_server *ss, struct socket *s) {
+	++s->shape->throttle;
+	if (s->shape->throttled)
+		return;
+	s->shape->throttled = true;
+	enable_write(ss, s, false);
+	throttle_push(&ss->throttle, s->id);
+}
+
+// return the bytes can be sent now (no more than sz), 0 means the socket is throttled.
+static inline size_t
+shape_size(struct socket_server *ss, struct socket *s, size_t sz) {
+	if (s->shape == NULL || s->shape->rate == 0)
+		return sz;
+	refill_tokens(ss, s);
+	if (s->shape->tokens <= 0) {
+		throttle_socket(ss, s);
+		return 0;
+	}
+	if ((int64_t)sz > s->shape->tokens)
+		sz = (size_t)s->shape->tokens;
+	return sz;
+}
+
+static inline void
+shape_consume(struct socket *s, ssize_t sz) {
+	if (s->shape && s->shape->rate && sz > 0) {
+		s->shape->tokens -= sz;
+	}
+}
+
+// call after sp_wait, enable write event of the throttled sockets which have tokens again.
+static void
+check_throttle(struct socket_server *ss) {
+	struct throttle_list *t = &ss->throttle;
+	int i, n = 0;
+	for (i=0;i<t->n;i++) {
+		int id = t->id[i];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || !is_throttled(s))
+			continue;
+		if (s->shape->rate) {
+			refill_tokens(ss, s);
+			if (s->shape->tokens <= 0) {
+				t->id[n++] = id;
+				continue;
+			}
+		}
+		s->shape->throttled = false;
+		if (ATOM_LOAD(&s->type) == SOCKET_TYPE_LISTEN) {
+			// accept again
+			if (s->aq && s->aq->n > 0) {
+				accept_ready(ss, s);
+			}
+			hold_read(ss, s, HOLD_THROTTLE, false);
+		} else {
+			enable_write(ss, s, true);
+		}
+	}
+	t->n = n;
+}
+
+static void
+set_nodirect(struct socket *s, int flag, bool on) {
+	for (;;) {
+		int v = ATOM_LOAD(&s->nodirect);
+		if (ATOM_CAS(&s->nodirect, v, on ? (v | flag) : (v & ~flag)))
+			return;
+	}
+}
+
+// release the corked send buffer, and start a new batching window.
+static int
+cork_flush(struct socket_server *ss, struct socket *s, uint64_t now) {
+	s->cork->deadline = now + s->cork->interval;
+	if (!s->cork->corked)
+		return 0;
+	s->cork->corked = false;
+	if (is_throttled(s))
+		return 0;
+	return enable_write(ss, s, true);
+}
+
+// call after a package is appended to the send buffer in cork mode, return true if the write event should be enabled.
+static bool
+cork_append(struct socket_server *ss, struct socket *s) {
+	if (s->cork->threshold > 0 && s->wb_size >= s->cork->threshold) {
+		s->cork->corked = false;
+		return true;
+	}
+	if (s->cork->corked)
+		return false;
+	if (s->cork->interval > 0) {
+		uint64_t now = socket_server_clock();
+		if (now >= s->cork->deadline) {
+			// idle for an interval, send it at once
+			s->cork->deadline = now + s->cork->interval;
+			return true;
+		}
+		throttle_push(&ss->cork, s->id);
+	}
+	s->cork->corked = true;
+	return false;
+}
+
+// call after sp_wait, flush the corked sockets which reach the deadline.
+static void
+check_cork(struct socket_server *ss) {
+	struct throttle_list *t = &ss->cork;
+	uint64_t now = socket_server_clock();
+	int i, n = 0;
+	for (i=0;i<t->n;i++) {
+		int id = t->id[i];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || !is_corked(s))
+			continue;
+		if (now < s->cork->deadline) {
+			t->id[n++] = id;
+			continue;
+		}
+		cork_flush(ss, s, now);
+	}
+	t->n = n;
+}
+
+// the timeout (ms) of sp_wait
+static int
+wait_timeout(struct socket_server *ss) {
+	int timeout = ss->throttle.n ? THROTTLE_INTERVAL : -1;
+	if (ss->rudp.n && (timeout < 0 || RUDP_INTERVAL < timeout)) {
+		timeout = RUDP_INTERVAL;
+	}
+	struct throttle_list *t = &ss->cork;
+	if (t->n == 0)
+		return timeout;
+	uint64_t now = socket_server_clock();
+	int i;
+	for (i=0;i<t->n;i++) {
+		int id = t->id[i];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || !is_corked(s) || now >= s->cork->deadline)
+			return 0;
+		// round up, epoll's resolution is 1ms
+		int ms = (int)((s->cork->deadline - now + 999) / 1000);
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	return timeout;
+}
+
+static void
+resume_paused(struct socket_server *ss, struct socket *s) {
+	// SOCKET_LIMIT_PAUSE : resume reading when the send buffer drains to half of the limit
+	if ((s->hold & HOLD_LIMIT) && s->wb_size <= s->shape->limit / 2) {
+		hold_read(ss, s, HOLD_LIMIT, false);
+	}
+}
+
+static int
+report_sendfile(struct socket *s, struct socket_message *result, const char *err) {
+	result->id = s->id;
+	result->ud = 0;
+	result->opaque = s->opaque;
+	result->data = (char *)err;
+	return SOCKET_SENDFILE;
+}
+
+static ssize_t
+file_send(struct socket_server *ss, struct socket *s, struct write_buffer_file *f, size_t sz) {
+#ifdef __linux__
+	if (s->tls == NULL) {
+		off_t offset = (off_t)f->offset;
+		ssize_t n = sendfile(s->fd, f->fd, &offset, sz);
+		if (n > 0) {
+			f->offset = offset;
+		}
+		return n;
+	}
+#endif
+	// No portable sendfile (or the file should be encrypted), use udpbuffer (only used in socket thread) as a bounce buffer.
+	if (sz > sizeof(ss->udpbuffer)) {
+		sz = sizeof(ss->udpbuffer);
+	}
+	ssize_t rd = pread(f->fd, ss->udpbuffer, sz, (off_t)f->offset);
+	if (rd <= 0) {
+		return rd;
+	}
+	ssize_t n = socket_write(ss, s, ss->udpbuffer, rd);
+	if (n > 0) {
+		f->offset += n;
+	}
+	return n;
+}
+
+#ifdef SOCKET_ZEROCOPY
+
+static ssize_t
+send_zerocopy(struct socket *s, struct write_buffer *wb, size_t wsz) {
+	ssize_t sz = send(s->fd, wb->ptr, wsz, MSG_ZEROCOPY);
+	if (sz > 0) {
+		// The kernel assigns a sequence number for each successful send call
+		struct zerocopy_pending * p = MALLOC(sizeof(*p));
+		p->next = NULL;
+		p->wb = NULL;
+		p->seq = s->zc->seq++;
+		p->sz = (size_t)sz;
+		if (!zc_pending(s)) {
+			s->zc->head = s->zc->tail = p;
+		} else {
+			s->zc->tail->next = p;
+			s->zc->tail = p;
+		}
+	}
+	return sz;
+}
+
+/*
+	Read the notifications from MSG_ERRQUEUE, and free the write buffers which the kernel doesn't refer any more.
+	Each notification is a range [lo, hi] of send sequence number, tcp reports them in order.
+ */
+static void
+zerocopy_complete(struct socket_server *ss, struct socket *s) {
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+				|| (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			uint32_t hi = serr->ee_data;
+			bool copied = (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+			struct zerocopy_pending *p;
+			while ((p = s->zc->head) && (int32_t)(p->seq - hi) <= 0) {
+				s->zc->head = p->next;
+				if (copied) {
+					s->zc->fallback += p->sz;
+				} else {
+					s->zc->zerocopy += p->sz;
+				}
+				if (p->wb) {
+					write_buffer_free(ss, p->wb);
+				}
+				FREE(p);
+			}
+			if (!zc_pending(s)) {
+				s->zc->tail = NULL;
+			}
+		}
+	}
+}
+
+#else
+
+static ssize_t
+send_zerocopy(struct socket *s, struct write_buffer *wb, size_t wsz) {
+	// never get here, s->zerocopy is always 0
+	return write(s->fd, wb->ptr, wsz);
+}
+
+static void
+zerocopy_complete(struct socket_server *ss, struct socket *s) {
+}
+
+#endif
+
+/*
+	Send the file at the head of list.
+	return -1 when blocked, SOCKET_SENDFILE when the file is finished (or failed), or the result of close_write.
+ */
+static int
+send_file_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct write_buffer * tmp = list->head;
+	struct write_buffer_file * f = (struct write_buffer_file *)tmp;
+	const char * err = NULL;
+	for (;;) {
+		size_t wsz = shape_size(ss, s, tmp->sz);
+		if (wsz == 0)
+			return -1;
+		ssize_t sz = file_send(ss, s, f, wsz);
+		if (sz < 0) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			case EPIPE:
+			case ECONNRESET:
+				return close_write(ss, s, l, result);
+			}
+			// file error, drop this file and go on
+			err = strerror(errno);
+			break;
+		}
+		if (sz == 0) {
+			err = "sendfile: unexpected end of file";
+			break;
+		}
+		stat_write(ss,s,(int)sz);
+		shape_consume(s, sz);
+		s->wb_size -= sz;
+		tmp->sz -= sz;
+		if (tmp->sz != 0) {
+			return -1;
+		}
+		break;
+	}
+	s->wb_size -= tmp->sz;
+	list->head = tmp->next;
+	if (list->head == NULL) {
+		list->tail = NULL;
+	}
+	write_buffer_free(ss,tmp);
+	return report_sendfile(s, result, err);
+}
+
+static int
+send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		if (tmp->type == WRITE_BUFFER_FILE) {
+			return send_file_tcp(ss, s, list, l, result);
+		}
+		for (;;) {
+			size_t wsz = shape_size(ss, s, tmp->sz);
+			if (wsz == 0)
+				return -1;
+			int threshold = ATOM_LOAD(&s->zerocopy);
+			bool zc = !tmp->nozc && s->tls == NULL
+				&& (tmp->zerocopy || (threshold && tmp->sz >= threshold));
+			ssize_t sz = zc ? send_zerocopy(s, tmp, wsz) : socket_write(ss, s, tmp->ptr, wsz);
+			if (sz < 0) {
+				switch(errno) {
+				case EINTR:
+					continue;
+				case AGAIN_WOULDBLOCK:
+					return -1;
+				case ENOBUFS:
+					if (zc) {
+						// optmem_max is used up by the pending notifications, copy the rest of buffer
+						tmp->nozc = true;
+						s->zc->fallback += tmp->sz;
+						continue;
+					}
+					break;
+				}
+				return close_write(ss, s, l, result);
+			}
+			if (zc) {
+				tmp->zerocopy = true;
+			}
+			stat_write(ss,s,(int)sz);
+			shape_consume(s, sz);
+			s->wb_size -= sz;
+			if (sz != tmp->sz) {
+				tmp->ptr += sz;
+				tmp->sz -= sz;
+				return -1;
+			}
+			break;
+		}
+		list->head = tmp->next;
+		if (tmp->zerocopy && s->zc->tail) {
+			// free it after the kernel reports completion, see zerocopy_complete()
+			// zc->tail is the last part of tmp, or the notifications of tmp are all received.
+			s->zc->tail->wb = tmp;
+		} else {
+			write_buffer_free(ss,tmp);
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+static socklen_t
+udp_sockaddr(const uint8_t udp_address[UDP_ADDRESS_SIZE], union sockaddr_all *sa) {
+	uint16_t port = 0;
+	memcpy(&port, udp_address+1, sizeof(uint16_t));
+	switch (udp_address[0]) {
+	case PROTOCOL_UDP:
+		memset(&sa->v4, 0, sizeof(sa->v4));
+		sa->s.sa_family = AF_INET;
+		sa->v4.sin_port = port;
+		memcpy(&sa->v4.sin_addr, udp_address + 1 + sizeof(uint16_t), sizeof(sa->v4.sin_addr));	// ipv4 address is 32 bits
+		return sizeof(sa->v4);
+	case PROTOCOL_UDPv6:
+		memset(&sa->v6, 0, sizeof(sa->v6));
+		sa->s.sa_family = AF_INET6;
+		sa->v6.sin6_port = port;
+		memcpy(&sa->v6.sin6_addr, udp_address + 1 + sizeof(uint16_t), sizeof(sa->v6.sin6_addr)); // ipv6 address is 128 bits
+		return sizeof(sa->v6);
+	}
+	return 0;
+}
+
+static socklen_t
+udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE], union sockaddr_all *sa) {
+	int type = (uint8_t)udp_address[0];
+	if (type != s->protocol)
+		return 0;
+	return udp_sockaddr(udp_address, sa);
+}
+
+static void
+drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct write_buffer *tmp) {
+	s->wb_size -= tmp->sz;
+	list->head = tmp->next;
+	if (list->head == NULL)
+		list->tail = NULL;
+	write_buffer_free(ss,tmp);
+}
+
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
+		union sockaddr_all sa;
 		socklen_t sasz = udp_socket_address(s, udp->udp_address, &sa);
 		if (sasz == 0) {
 			skynet_error(NULL, "socket-server : udp (%d) type mismatch.", s->id);
@@ -911,9 +1942,9 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 	// step 1
 	int ret = send_list(ss,s,&s->high,l,result);
 	if (ret != -1) {
-		if (ret == SOCKET_ERR) {
-			// HALFCLOSE_WRITE
-			return SOCKET_ERR;
+		if (ret == SOCKET_ERR || ret == SOCKET_SENDFILE) {
+			// HALFCLOSE_WRITE, or a file is finished (rest data will be sent in next write event)
+			return ret;
 		}
 		// SOCKET_RST (ignore)
 		return -1;
@@ -923,9 +1954,9 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 		if (s->low.head != NULL) {
 			int ret = send_list(ss,s,&s->low,l,result);
 			if (ret != -1) {
-				if (ret == SOCKET_ERR) {
-					// HALFCLOSE_WRITE
-					return SOCKET_ERR;
+				if (ret == SOCKET_ERR || ret == SOCKET_SENDFILE) {
+					// HALFCLOSE_WRITE, or a file is finished
+					return ret;
 				}
 				// SOCKET_RST (ignore)
 				return -1;
@@ -941,11 +1972,12 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 		// step 4
 		assert(send_buffer_empty(s) && s->wb_size == 0);
 
-		if (s->closing) {
+		if (s->closing && !zc_pending(s)) {
 			// finish writing
 			force_close(ss, s, l, result);
 			return -1;
 		}
+		// If closing, wait for the zerocopy notifications (error event) before close. See zerocopy_event()
 
 		int err = enable_write(ss, s, false);
 
@@ -974,7 +2006,9 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		// add direct write buffer before high.head
 		struct write_buffer * buf = MALLOC(sizeof(*buf));
 		struct send_object so;
-		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
+		buf->type = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
+		buf->zerocopy = false;
+		buf->nozc = false;
 		buf->ptr = (char*)so.buffer+s->dw_offset;
 		buf->sz = so.sz - s->dw_offset;
 		buf->buffer = (void *)s->dw_buffer;
@@ -988,7 +2022,21 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 		s->dw_buffer = NULL;
 	}
+#ifdef TCP_CORK
+	// send the batch of cork mode in full frames
+	int cork = s->cork && s->cork->on && s->high.head && (s->high.head->next || s->low.head);
+	if (cork) {
+		setsockopt(s->fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+	}
+#endif
 	int r = send_buffer_(ss,s,l,result);
+#ifdef TCP_CORK
+	if (cork && ATOM_LOAD(&s->type) != SOCKET_TYPE_INVALID) {
+		cork = 0;
+		setsockopt(s->fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+	}
+#endif
+	resume_paused(ss, s);
 	socket_unlock(l);
 
 	return r;
@@ -998,7 +2046,9 @@ static struct write_buffer *
 append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_send * request, int size) {
 	struct write_buffer * buf = MALLOC(size);
 	struct send_object so;
-	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->type = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->zerocopy = false;
+	buf->nozc = false;
 	buf->ptr = (char*)so.buffer;
 	buf->sz = so.sz;
 	buf->buffer = request->buffer;
@@ -1046,37 +2096,381 @@ trigger_write(struct socket_server *ss, struct request_send * request, struct so
 	return -1;
 }
 
-/*
-	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
+static inline uint32_t
+rudp_clock(void) {
+	return (uint32_t)(socket_server_clock() / 1000);
+}
 
-	If socket buffer is empty, write to fd directly.
-		If write a part, append the rest part to high list. (Even priority is PRIORITY_LOW)
-	Else append package to high (PRIORITY_HIGH) or low (PRIORITY_LOW) list.
- */
-static int
-send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
-	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
-	struct send_object so;
-	send_object_init(ss, &so, request->buffer, request->sz);
-	uint8_t type = ATOM_LOAD(&s->type);
-	if (type == SOCKET_TYPE_INVALID || s->id != id
-		|| type == SOCKET_TYPE_HALFCLOSE_WRITE
-		|| type == SOCKET_TYPE_PACCEPT
-		|| s->closing) {
-		so.free_func((void *)request->buffer);
-		return -1;
+// the data, FIN or error of the session are reported by rudp_report()
+static void
+rudp_ready(struct socket_server *ss, struct socket *s) {
+	struct socket_rudp *r = s->rudp;
+	if (!r->ready) {
+		r->ready = true;
+		throttle_push(&ss->rudp_ready, s->id);
 	}
-	if (type == SOCKET_TYPE_PLISTEN || type == SOCKET_TYPE_LISTEN) {
-		skynet_error(NULL, "socket-server: write to listen fd %d.", id);
-		so.free_func((void *)request->buffer);
-		return -1;
+}
+
+static void
+rudp_error(struct socket_server *ss, struct socket *s, const char *err) {
+	if (s->rudp->err == NULL) {
+		s->rudp->err = err;
 	}
-	if (send_buffer_empty(s)) {
-		if (s->protocol == PROTOCOL_TCP) {
-			append_sendbuffer(ss, s, request);	// add to high priority list, even priority == PRIORITY_LOW
-		} else {
-			// udp
+	rudp_ready(ss, s);
+}
+
+static void
+rudp_sendto(void *ud, const char *buffer, int sz) {
+	struct socket *s = ud;
+	struct socket_rudp *r = s->rudp;
+	union sockaddr_all sa;
+	socklen_t sasz = udp_sockaddr(s->p.udp_address, &sa);
+	if (r->fd < 0 || sasz == 0)
+		return;
+	// ignore the error (EAGAIN), the ARQ retransmits
+	sendto(r->fd, buffer, sz, 0, &sa.s, sasz);
+}
+
+static inline unsigned
+rudp_hash(uint32_t conv, const uint8_t address[UDP_ADDRESS_SIZE]) {
+	unsigned h = conv * 2654435761u;
+	int i;
+	for (i=0;i<UDP_ADDRESS_SIZE;i++) {
+		h = (h ^ address[i]) * 16777619u;
+	}
+	return h;
+}
+
+static struct socket *
+rudp_find(struct socket_server *ss, struct socket *ep, uint32_t conv, const uint8_t address[UDP_ADDRESS_SIZE]) {
+	struct socket_rudp *e = ep->rudp;
+	if (e->arq) {
+		// the session of dial is the endpoint itself, it only accepts the datagrams from the address dialed
+		return (e->conv == conv && memcmp(ep->p.udp_address, address, UDP_ADDRESS_SIZE) == 0) ? ep : NULL;
+	}
+	if (e->cap == 0)
+		return NULL;
+	int id = e->bucket[rudp_hash(conv, address) & (e->cap - 1)];
+	while (id >= 0) {
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		struct socket_rudp *r = s->rudp;
+		if (r->conv == conv && memcmp(s->p.udp_address, address, UDP_ADDRESS_SIZE) == 0)
+			return s;
+		id = r->next;
+	}
+	return NULL;
+}
+
+static void
+rudp_insert(struct socket_server *ss, struct socket_rudp *e, struct socket *s) {
+	if (e->n >= e->cap) {
+		int cap = e->cap ? e->cap * 2 : 64;
+		int *bucket = MALLOC(cap * sizeof(int));
+		int i;
+		for (i=0;i<cap;i++) {
+			bucket[i] = -1;
+		}
+		for (i=0;i<e->cap;i++) {
+			int id = e->bucket[i];
+			while (id >= 0) {
+				struct socket *s = &ss->slot[HASH_ID(id)];
+				struct socket_rudp *r = s->rudp;
+				int next = r->next;
+				unsigned h = rudp_hash(r->conv, s->p.udp_address) & (cap - 1);
+				r->next = bucket[h];
+				bucket[h] = id;
+				id = next;
+			}
+		}
+		FREE(e->bucket);
+		e->bucket = bucket;
+		e->cap = cap;
+	}
+	struct socket_rudp *r = s->rudp;
+	unsigned h = rudp_hash(r->conv, s->p.udp_address) & (e->cap - 1);
+	r->next = e->bucket[h];
+	e->bucket[h] = s->id;
+	++e->n;
+}
+
+static void
+rudp_remove(struct socket_server *ss, struct socket_rudp *e, struct socket *s) {
+	struct socket_rudp *r = s->rudp;
+	int *p = &e->bucket[rudp_hash(r->conv, s->p.udp_address) & (e->cap - 1)];
+	while (*p >= 0) {
+		if (*p == s->id) {
+			*p = r->next;
+			--e->n;
+			return;
+		}
+		p = &ss->slot[HASH_ID(*p)].rudp->next;
+	}
+}
+
+static void
+rudp_session(struct socket_server *ss, struct socket *s, struct socket *ep, uint32_t conv, const uint8_t address[UDP_ADDRESS_SIZE]) {
+	struct socket_rudp *r = MALLOC(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->arq = rudp_new(conv, rudp_sendto, s);
+	r->ss = ss;
+	r->endpoint = ep->id;
+	r->fd = ep->fd;
+	r->next = -1;
+	r->conv = conv;
+	r->flush = r->recent = r->ping = rudp_clock();
+	// the address of peer, like the udp socket connected
+	memcpy(s->p.udp_address, address, UDP_ADDRESS_SIZE);
+	s->rudp = r;
+	throttle_push(&ss->rudp, s->id);
+}
+
+static void
+free_rudp(struct socket_server *ss, struct socket *s) {
+	struct socket_rudp *r = s->rudp;
+	if (r->arq) {
+		// send the pending acks, for the FIN of peer
+		rudp_flush(r->arq, rudp_clock());
+		rudp_delete(r->arq);
+		if (r->endpoint != s->id) {
+			struct socket *ep = &ss->slot[HASH_ID(r->endpoint)];
+			if (!socket_invalid(ep, r->endpoint) && ep->rudp) {
+				rudp_remove(ss, ep->rudp, s);
+			}
+		}
+	} else {
+		// the listen endpoint is closed, so are its sessions
+		int i;
+		for (i=0;i<r->cap;i++) {
+			int id = r->bucket[i];
+			while (id >= 0) {
+				struct socket_rudp *sr = ss->slot[HASH_ID(id)].rudp;
+				sr->fd = -1;
+				sr->endpoint = -1;
+				rudp_error(ss, &ss->slot[HASH_ID(id)], "endpoint closed");
+				id = sr->next;
+			}
+		}
+		FREE(r->bucket);
+	}
+	// query_info reads r->stat in the worker thread
+	spinlock_lock(&s->dw_lock);
+	s->rudp = NULL;
+	spinlock_unlock(&s->dw_lock);
+	FREE(r);
+}
+
+// append the data to the stream of session, and send the segments in the window at once
+static int
+rudp_send_socket(struct socket_server *ss, struct socket *s, struct send_object *so, const void *buffer) {
+	struct socket_rudp *r = s->rudp;
+	if (r->err == NULL && so->sz > 0) {
+		uint32_t now = rudp_clock();
+		rudp_send(r->arq, so->buffer, (int)so->sz);
+		stat_write(ss, s, (int)so->sz);
+		rudp_flush(r->arq, now);
+		r->flush = rudp_check(r->arq, now);
+	}
+	so->free_func((void *)buffer);
+	return -1;
+}
+
+// like close_socket() of tcp : SOCKET_CLOSE at once, and the session lives until the data and FIN are acked
+static int
+rudp_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, int shutdown, struct socket_message *result) {
+	struct socket_rudp *r = s->rudp;
+	int shutdown_read = ATOM_LOAD(&s->type) == SOCKET_TYPE_HALFCLOSE_READ;
+	if (shutdown || r->eof || r->err || r->fd < 0) {
+		force_close(ss, s, l, result);
+		return shutdown_read ? -1 : SOCKET_CLOSE;
+	}
+	uint32_t now = rudp_clock();
+	rudp_fin(r->arq);
+	rudp_flush(r->arq, now);
+	r->flush = rudp_check(r->arq, now);
+	s->closing = true;
+	if (shutdown_read) {
+		return -1;
+	}
+	ATOM_STORE(&s->type, SOCKET_TYPE_HALFCLOSE_READ);
+	s->reading = false;
+	result->id = s->id;
+	result->ud = 0;
+	result->data = NULL;
+	result->opaque = s->opaque;
+	return SOCKET_CLOSE;
+}
+
+// call after sp_wait : the retransmissions, the keepalive, and the closing sessions
+static void
+check_rudp(struct socket_server *ss) {
+	uint32_t now = rudp_clock();
+	if ((int32_t)(now - ss->rudp_time) < RUDP_INTERVAL)
+		return;
+	ss->rudp_time = now;
+	struct throttle_list *t = &ss->rudp;
+	int i, n = 0;
+	for (i=0;i<t->n;i++) {
+		int id = t->id[i];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || s->protocol != PROTOCOL_RUDP)
+			continue;
+		t->id[n++] = id;
+		struct socket_rudp *r = s->rudp;
+		rudp_stat(r->arq, &r->stat);
+		if (r->err)
+			continue;
+		int32_t idle = (int32_t)(now - r->recent);
+		if (idle >= RUDP_TIMEOUT) {
+			rudp_error(ss, s, "timeout");
+			continue;
+		}
+		if (idle >= RUDP_KEEPALIVE && (int32_t)(now - r->ping) >= RUDP_KEEPALIVE) {
+			r->ping = now;
+			rudp_probe(r->arq);
+			r->flush = now;
+		}
+		if ((int32_t)(now - r->flush) >= 0) {
+			rudp_flush(r->arq, now);
+			r->flush = rudp_check(r->arq, now);
+		}
+		if (rudp_dead(r->arq)) {
+			rudp_error(ss, s, "dead link");
+		} else if (s->closing && rudp_waitsnd(r->arq) == 0) {
+			struct socket_lock l;
+			struct socket_message dummy;
+			socket_lock_init(s, &l);
+			force_close(ss, s, &l, &dummy);
+			--n;
+		}
+	}
+	t->n = n;
+}
+
+// report the data, FIN or error of the sessions in rudp_ready, return -1 when there is nothing
+static int
+rudp_report(struct socket_server *ss, struct socket_message *result) {
+	struct throttle_list *t = &ss->rudp_ready;
+	while (t->n > 0) {
+		int id = t->id[t->n - 1];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || s->protocol != PROTOCOL_RUDP) {
+			--t->n;
+			continue;
+		}
+		struct socket_rudp *r = s->rudp;
+		uint8_t type = ATOM_LOAD(&s->type);
+		if (r->err) {
+			const char * err = r->err;
+			// nobody knows the session not started, or closed by self
+			int report = type != SOCKET_TYPE_PACCEPT && !s->closing;
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			--t->n;
+			force_close(ss, s, &l, result);
+			if (!report)
+				continue;
+			result->data = (char *)err;
+			return SOCKET_ERR;
+		}
+		int sz = -1;
+		if (type == SOCKET_TYPE_CONNECTED && s->reading) {
+			sz = rudp_peeksize(r->arq);
+		}
+		if (sz == RUDP_EOF) {
+			// closed by peer, like recv 0 of tcp
+			--t->n;
+			r->ready = false;
+			r->eof = true;
+			ATOM_STORE(&s->type, SOCKET_TYPE_HALFCLOSE_READ);
+			result->opaque = s->opaque;
+			result->id = s->id;
+			result->ud = 0;
+			result->data = NULL;
+			return SOCKET_CLOSE;
+		}
+		if (sz <= 0) {
+			if (sz == 0) {
+				// skip the empty segments
+				rudp_recv(r->arq, NULL, 0);
+				continue;
+			}
+			--t->n;
+			r->ready = false;
+			continue;
+		}
+		char * buffer = MALLOC(sz);
+		rudp_recv(r->arq, buffer, sz);
+		stat_read(ss, s, sz);
+		// tell the peer when the window is open again
+		r->flush = rudp_check(r->arq, rudp_clock());
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = sz;
+		result->data = buffer;
+		return SOCKET_DATA;
+	}
+	return -1;
+}
+
+/*
+	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
+
+	If socket buffer is empty, write to fd directly.
+		If write a part, append the rest part to high list. (Even priority is PRIORITY_LOW)
+	Else append package to high (PRIORITY_HIGH) or low (PRIORITY_LOW) list.
+ */
+static int
+send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
+	int id = request->id;
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct send_object so;
+	send_object_init(ss, &so, request->buffer, request->sz);
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_INVALID || s->id != id
+		|| type == SOCKET_TYPE_HALFCLOSE_WRITE
+		|| type == SOCKET_TYPE_PACCEPT
+		|| s->closing) {
+		so.free_func((void *)request->buffer);
+		return -1;
+	}
+	if (type == SOCKET_TYPE_PLISTEN || type == SOCKET_TYPE_LISTEN) {
+		skynet_error(NULL, "socket-server: write to listen fd %d.", id);
+		so.free_func((void *)request->buffer);
+		return -1;
+	}
+	if (s->protocol == PROTOCOL_RUDP) {
+		return rudp_send_socket(ss, s, &so, request->buffer);
+	}
+	if (s->shape && s->shape->limit > 0 && s->wb_size + (int64_t)so.sz > s->shape->limit && s->protocol == PROTOCOL_TCP) {
+		// only SOCKET_LIMIT_CLOSE is a hard cap : the high priority packages (DROP) and PAUSE are still queued
+		switch (s->shape->policy) {
+		case SOCKET_LIMIT_DROP:
+			if (priority == PRIORITY_LOW) {
+				s->shape->dropped += so.sz;
+				so.free_func((void *)request->buffer);
+				return -1;
+			}
+			break;
+		case SOCKET_LIMIT_CLOSE: {
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			so.free_func((void *)request->buffer);
+			force_close(ss, s, &l, result);
+			result->data = "send buffer overflow";
+			return SOCKET_ERR;
+		}
+		case SOCKET_LIMIT_PAUSE:
+			if (type == SOCKET_TYPE_CONNECTED) {
+				hold_read(ss, s, HOLD_LIMIT, true);
+			}
+			break;
+		}
+	}
+	if (send_buffer_empty(s)) {
+		if (s->protocol == PROTOCOL_TCP) {
+			append_sendbuffer(ss, s, request);	// add to high priority list, even priority == PRIORITY_LOW
+		} else {
+			// udp
 			if (udp_address == NULL) {
 				udp_address = s->p.udp_address;
 			}
@@ -1097,7 +2491,9 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				return -1;
 			}
 		}
-		if (enable_write(ss, s, true)) {
+		if (s->cork && s->cork->on && !cork_append(ss, s)) {
+			// hold it until flush
+		} else if (!is_throttled(s) && enable_write(ss, s, true)) {
 			return report_error(s, result, "enable write failed");
 		}
 	} else {
@@ -1107,6 +2503,9 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			} else {
 				append_sendbuffer(ss, s, request);
 			}
+			if (is_corked(s) && cork_append(ss, s) && !is_throttled(s) && enable_write(ss, s, true)) {
+				return report_error(s, result, "enable write failed");
+			}
 		} else {
 			if (udp_address == NULL) {
 				udp_address = s->p.udp_address;
@@ -1114,6 +2513,9 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
+	if (s->wb_size > s->stat.wpeak) {
+		s->stat.wpeak = s->wb_size;
+	}
 	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
 		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
 		result->opaque = s->opaque;
@@ -1125,29 +2527,84 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 	return -1;
 }
 
+/*
+	A file is always appended to the high list, so it keeps the order with the packages sent before and after.
+	SOCKET_SENDFILE will be raised when the file is finished, see send_file_tcp().
+ */
 static int
-listen_socket(struct socket_server *ss, struct request_listen * request, struct socket_message *result) {
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
 	int id = request->id;
-	int listen_fd = request->fd;
-	struct socket *s = new_fd(ss, id, listen_fd, PROTOCOL_TCP, request->opaque, false);
-	if (s == NULL) {
-		goto _failed;
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		close(request->fd);
+		return -1;
 	}
-	ATOM_STORE(&s->type , SOCKET_TYPE_PLISTEN);
-	result->opaque = request->opaque;
-	result->id = id;
-	result->ud = 0;
-	result->data = "listen";
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_HALFCLOSE_WRITE
+		|| type == SOCKET_TYPE_PACCEPT
+		|| type == SOCKET_TYPE_PLISTEN
+		|| type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP
+		|| s->closing) {
+		close(request->fd);
+		return report_sendfile(s, result, "sendfile: invalid socket");
+	}
+	int empty = send_buffer_empty(s);
+	struct write_buffer_file * f = MALLOC(sizeof(*f));
+	struct write_buffer * buf = &f->buffer;
+	buf->next = NULL;
+	buf->buffer = NULL;
+	buf->ptr = NULL;
+	buf->sz = request->sz;
+	buf->type = WRITE_BUFFER_FILE;
+	buf->zerocopy = false;
+	buf->nozc = false;
+	f->fd = request->fd;
+	f->offset = request->offset;
+	struct wb_list *list = &s->high;
+	if (list->head == NULL) {
+		list->head = list->tail = buf;
+	} else {
+		list->tail->next = buf;
+		list->tail = buf;
+	}
+	s->wb_size += buf->sz;
+	if (is_corked(s)) {
+		// don't hold a file
+		empty = 1;
+		s->cork->corked = false;
+	}
+	if (empty && !is_throttled(s) && enable_write(ss, s, true)) {
+		return report_error(s, result, "enable write failed");
+	}
+	return -1;
+}
 
+static void
+init_latency(struct socket *s) {
+	if (s->latency == NULL) {
+		s->latency = MALLOC(SOCKET_LATENCY_BUCKETS * sizeof(ATOM_ULONG));
+	}
+	int i;
+	for (i=0;i<SOCKET_LATENCY_BUCKETS;i++) {
+		ATOM_INIT(&s->latency[i], 0);
+	}
+}
+
+// SOCKET_OPEN of listen socket : the address in data, and the port in ud
+static int
+listen_name(struct socket_server *ss, int listen_fd, struct socket_message *result) {
 	union sockaddr_all u;
 	socklen_t slen = sizeof(u);
 	if (getsockname(listen_fd, &u.s, &slen) == 0) {
-		void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
-		if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer)) == 0) {
+		if (address_string(&u, slen, ss->buffer, sizeof(ss->buffer)) == 0) {
 			result->data = strerror(errno);
 			return SOCKET_ERR;
 		}
-		int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
+		int sin_port = 0;
+		if (u.s.sa_family != AF_UNIX) {
+			sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
+		}
 		result->data = ss->buffer;
 		result->ud = sin_port;
 	} else {
@@ -1156,6 +2613,30 @@ listen_socket(struct socket_server *ss, struct request_listen * request, struct
 	}
 
 	return SOCKET_OPEN;
+}
+
+static int
+listen_socket(struct socket_server *ss, struct request_listen * request, struct socket_message *result) {
+	int id = request->id;
+	int listen_fd = request->fd;
+	struct socket *s = new_fd(ss, id, listen_fd, PROTOCOL_TCP, request->opaque, false);
+	if (s == NULL) {
+		goto _failed;
+	}
+	// accept in batch until EAGAIN, see ACCEPT_BUDGET
+	sp_nonblocking(listen_fd);
+	init_latency(s);
+	if (s->aq) {
+		assert(s->aq->n == 0);
+		s->aq->max = 0;
+		s->aq->ready = false;
+	}
+	ATOM_STORE(&s->type , SOCKET_TYPE_PLISTEN);
+	result->opaque = request->opaque;
+	result->id = id;
+	result->ud = 0;
+	result->data = "listen";
+	return listen_name(ss, listen_fd, result);
 _failed:
 	close(listen_fd);
 	result->opaque = request->opaque;
@@ -1167,6 +2648,49 @@ _failed:
 	return SOCKET_ERR;
 }
 
+// the listen endpoint waits for socket_server_start() like a tcp listen socket, and the dial session is connected at once
+static int
+rudp_socket(struct socket_server *ss, struct request_rudp * request, struct socket_message *result) {
+	int id = request->id;
+	result->opaque = request->opaque;
+	result->id = id;
+	result->ud = 0;
+	struct socket *s;
+	if (request->listen) {
+		s = new_fd(ss, id, request->fd, request->address[0], request->opaque, false);
+	} else {
+		s = new_fd(ss, id, request->fd, PROTOCOL_RUDP, request->opaque, true);
+	}
+	if (s == NULL) {
+		close(request->fd);
+		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		result->data = "reach skynet socket number limit";
+		return SOCKET_ERR;
+	}
+	if (request->listen) {
+		struct socket_rudp *r = MALLOC(sizeof(*r));
+		memset(r, 0, sizeof(*r));
+		r->ss = ss;
+		r->endpoint = id;
+		r->fd = request->fd;
+		r->next = -1;
+		s->rudp = r;
+		init_latency(s);
+		ATOM_STORE(&s->type , SOCKET_TYPE_PLISTEN);
+		result->data = "listen";
+		return listen_name(ss, request->fd, result);
+	}
+	rudp_session(ss, s, s, request->conv, request->address);
+	ATOM_STORE(&s->type , SOCKET_TYPE_CONNECTED);
+	union sockaddr_all sa;
+	socklen_t sasz = udp_sockaddr(request->address, &sa);
+	result->data = NULL;
+	if (address_string(&sa, sasz, ss->buffer, sizeof(ss->buffer))) {
+		result->data = ss->buffer;
+	}
+	return SOCKET_OPEN;
+}
+
 static inline int
 nomore_sending_data(struct socket *s) {
 	return (send_buffer_empty(s) && s->dw_buffer == NULL && (ATOM_LOAD(&s->sending) & 0xffff) == 0)
@@ -1206,15 +2730,25 @@ close_socket(struct socket_server *ss, struct request_close *request, struct soc
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 
+	if (s->protocol == PROTOCOL_RUDP) {
+		return rudp_close(ss, s, &l, request->shutdown, result);
+	}
+
 	int shutdown_read = halfclose_read(s);
 
-	if (request->shutdown || nomore_sending_data(s)) {
+	if (request->shutdown || (nomore_sending_data(s) && !zc_pending(s))) {
 		// If socket is SOCKET_TYPE_HALFCLOSE_READ, Do not raise SOCKET_CLOSE again.
 		int r = shutdown_read ? -1 : SOCKET_CLOSE;
 		force_close(ss,s,&l,result);
 		return r;
 	}
 	s->closing = true;
+	if (s->cork && s->cork->on) {
+		// send the corked buffer before closing
+		s->cork->on = false;
+		set_nodirect(s, NODIRECT_CORK, false);
+		cork_flush(ss, s, 0);
+	}
 	if (!shutdown_read) {
 		// don't read socket after socket.close()
 		close_read(ss, s, result);
@@ -1242,66 +2776,277 @@ bind_socket(struct socket_server *ss, struct request_bind *request, struct socke
 }
 
 static int
-resume_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
-	int id = request->id;
-	result->id = id;
-	result->opaque = request->opaque;
-	result->ud = 0;
-	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (socket_invalid(s, id)) {
-		result->data = "invalid socket";
-		return SOCKET_ERR;
-	}
-	if (halfclose_read(s)) {
-		// The closing socket may be in transit, so raise an error. See https://github.com/cloudwu/skynet/issues/1374
-		result->data = "socket closed";
+resume_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
+	int id = request->id;
+	result->id = id;
+	result->opaque = request->opaque;
+	result->ud = 0;
+	result->data = NULL;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		result->data = "invalid socket";
+		return SOCKET_ERR;
+	}
+	if (halfclose_read(s)) {
+		// The closing socket may be in transit, so raise an error. See https://github.com/cloudwu/skynet/issues/1374
+		result->data = "socket closed";
+		return SOCKET_ERR;
+	}
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	if (enable_read(ss, s, true)) {
+		result->data = "enable read failed";
+		return SOCKET_ERR;
+	}
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_PACCEPT || type == SOCKET_TYPE_PLISTEN) {
+		ATOM_STORE(&s->type , (type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN);
+		s->opaque = request->opaque;
+		result->data = "start";
+		return SOCKET_OPEN;
+	} else if (type == SOCKET_TYPE_CONNECTED) {
+		// todo: maybe we should send a message SOCKET_TRANSFER to s->opaque
+		s->opaque = request->opaque;
+		result->data = "transfer";
+		return SOCKET_OPEN;
+	}
+	// if s->type == SOCKET_TYPE_HALFCLOSE_WRITE , SOCKET_CLOSE message will send later
+	return -1;
+}
+
+static int
+pause_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		return -1;
+	}
+	if (enable_read(ss, s, false)) {
+		return report_error(s, result, "enable read failed");
+	}
+	return -1;
+}
+
+static void
+setopt_socket(struct socket_server *ss, struct request_setopt *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		return;
+	}
+	int v = request->value;
+	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
+}
+
+static void
+option_socket(struct socket_server *ss, struct request_setopt *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		return;
+	}
+	switch (request->what) {
+	case SOCKET_OPT_ZEROCOPY:
+#ifdef SOCKET_ZEROCOPY
+		if (s->protocol == PROTOCOL_TCP) {
+			int v = request->value > 0;
+			if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+				if (v && s->zc == NULL) {
+					s->zc = MALLOC(sizeof(*s->zc));
+					memset(s->zc, 0, sizeof(*s->zc));
+				}
+				ATOM_STORE(&s->zerocopy, v ? request->value : 0);
+				return;
+			}
+			skynet_error(NULL, "socket-server : zerocopy (%d) error %s.", id, strerror(errno));
+		}
+#else
+		skynet_error(NULL, "socket-server : zerocopy is not supported.");
+#endif
+		break;
+	case SOCKET_OPT_RATE: {
+		uint8_t type = ATOM_LOAD(&s->type);
+		// the listen socket uses the shape fields for accept rate, see SOCKET_OPT_ACCEPTRATE
+		if (s->protocol != PROTOCOL_TCP || type == SOCKET_TYPE_LISTEN || type == SOCKET_TYPE_PLISTEN)
+			break;
+		struct socket_shape *shape = shape_get(s);
+		shape->rate = request->value > 0 ? request->value : 0;
+		shape->tokens = shape->rate;
+		shape->time = ss->time;
+		set_nodirect(s, NODIRECT_SHAPE, shape->rate != 0);
+		if (shape->throttled && shape->rate == 0) {
+			shape->throttled = false;
+			enable_write(ss, s, true);
+		}
+		break;
+	}
+	case SOCKET_OPT_LIMIT:
+		shape_get(s)->limit = request->value > 0 ? request->value : 0;
+		if (s->shape->limit == 0) {
+			hold_read(ss, s, HOLD_LIMIT, false);
+		}
+		break;
+	case SOCKET_OPT_POLICY:
+		shape_get(s)->policy = request->value;
+		break;
+	case SOCKET_OPT_FRAME: {
+		int header = request->value & 0xff;
+		if (s->protocol != PROTOCOL_TCP || !(header == 0 || header == 1 || header == 2 || header == 4))
+			break;
+		if (header == 0 && s->frame == NULL)
+			break;
+		struct socket_frame *f = frame_get(s);
+		if (header == 0 && f->sz + f->frame_read > 0) {
+			skynet_error(NULL, "socket-server : turn off frame mode (%d) with uncomplete frame.", id);
+		}
+		f->header = header;
+		f->little = (request->value >> 8) & 1;
+		if (header == 0) {
+			free_frame(f);
+		}
+		break;
+	}
+	case SOCKET_OPT_FRAMEMAX:
+		frame_get(s)->max = request->value;
+		break;
+	case SOCKET_OPT_CORK:
+		if (s->protocol != PROTOCOL_TCP)
+			break;
+		if (request->value == CORK_OFF) {
+			if (s->cork == NULL)
+				break;
+			s->cork->on = false;
+			set_nodirect(s, NODIRECT_CORK, false);
+			cork_flush(ss, s, 0);
+		} else {
+			struct socket_cork *c = cork_get(s);
+			c->on = true;
+			set_nodirect(s, NODIRECT_CORK, true);
+			c->threshold = request->value > 0 ? request->value : 0;
+		}
+		break;
+	case SOCKET_OPT_CORKTIME:
+		cork_get(s)->interval = request->value > 0 ? request->value : 0;
+		break;
+	case SOCKET_OPT_FLUSH:
+		if (s->cork && s->cork->on) {
+			cork_flush(ss, s, socket_server_clock());
+		}
+		break;
+	case SOCKET_OPT_ACCEPTRATE:
+	case SOCKET_OPT_ACCEPTQUEUE: {
+		uint8_t type = ATOM_LOAD(&s->type);
+		if (type != SOCKET_TYPE_LISTEN && type != SOCKET_TYPE_PLISTEN)
+			break;
+		if (s->aq == NULL) {
+			s->aq = MALLOC(sizeof(struct accept_queue));
+			memset(s->aq, 0, sizeof(struct accept_queue));
+		}
+		// the accept rate is in s->shape, so the listen socket with aq always has the shape
+		shape_get(s);
+		int v = request->value > 0 ? request->value : 0;
+		if (request->what == SOCKET_OPT_ACCEPTQUEUE) {
+			s->aq->max = v;
+		} else {
+			// the throttled listen socket is resumed by check_throttle()
+			s->shape->rate = v;
+			s->shape->tokens = v;
+			s->shape->time = ss->time;
+		}
+		break;
+	}
+	}
+}
+
+// drive the tls handshake, return -1 when it's going on (or finished), SOCKET_ERR when it failed
+static int
+tls_handshake(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	int r = s->tls->tif->handshake(s->tls->ud);
+	switch (r) {
+	case SOCKET_TLS_FINISH:
+		s->tls->ready = true;
+		// send the data buffered during handshake
+		if (!send_buffer_empty(s) && !is_throttled(s) && !is_corked(s) && enable_write(ss, s, true)) {
+			return report_error(s, result, "enable write failed");
+		}
+		return -1;
+	case SOCKET_TLS_WANTREAD:
+		enable_write(ss, s, false);
+		return -1;
+	case SOCKET_TLS_WANTWRITE:
+		enable_write(ss, s, true);
+		return -1;
+	default:
+		force_close(ss, s, l, result);
+		result->data = "tls handshake failed";
 		return SOCKET_ERR;
 	}
-	struct socket_lock l;
-	socket_lock_init(s, &l);
-	if (enable_read(ss, s, true)) {
-		result->data = "enable read failed";
-		return SOCKET_ERR;
+}
+
+// the tls read waits for writable, or the tls write waits for readable
+static void
+tls_resume(struct socket_server *ss, struct socket *s, struct event *e) {
+	if (s->tls->read_wantwrite && e->write) {
+		s->tls->read_wantwrite = false;
+		e->read = true;
+		if (send_buffer_empty(s)) {
+			enable_write(ss, s, false);
+			e->write = false;
+		}
 	}
-	uint8_t type = ATOM_LOAD(&s->type);
-	if (type == SOCKET_TYPE_PACCEPT || type == SOCKET_TYPE_PLISTEN) {
-		ATOM_STORE(&s->type , (type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN);
-		s->opaque = request->opaque;
-		result->data = "start";
-		return SOCKET_OPEN;
-	} else if (type == SOCKET_TYPE_CONNECTED) {
-		// todo: maybe we should send a message SOCKET_TRANSFER to s->opaque
-		s->opaque = request->opaque;
-		result->data = "transfer";
-		return SOCKET_OPEN;
+	if (s->tls->write_wantread && e->read) {
+		s->tls->write_wantread = false;
+		if (!send_buffer_empty(s) && !is_throttled(s) && !is_corked(s)) {
+			enable_write(ss, s, true);
+			e->write = true;
+		}
 	}
-	// if s->type == SOCKET_TYPE_HALFCLOSE_WRITE , SOCKET_CLOSE message will send later
-	return -1;
 }
 
 static int
-pause_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
+tls_socket(struct socket_server *ss, struct request_tls *request, struct socket_message *result) {
 	int id = request->id;
 	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (socket_invalid(s, id)) {
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (socket_invalid(s, id) || s->tls) {
+		skynet_error(NULL, "socket-server : can't turn on tls for socket (%d).", id);
+		request->tif->release(request->ud);
 		return -1;
 	}
-	if (enable_read(ss, s, false)) {
-		return report_error(s, result, "enable read failed");
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	if (type != SOCKET_TYPE_PACCEPT && type != SOCKET_TYPE_CONNECTED) {
+		skynet_error(NULL, "socket-server : can't turn on tls for socket (%d).", id);
+		request->tif->release(request->ud);
+		socket_lock(&l);
+		set_nodirect(s, NODIRECT_TLS, false);
+		socket_unlock(&l);
+		return -1;
 	}
-	return -1;
-}
-
-static void
-setopt_socket(struct socket_server *ss, struct request_setopt *request) {
-	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (socket_invalid(s, id)) {
-		return;
+	if (!send_buffer_empty(s)) {
+		// the data queued before the request are plain text, don't encrypt them
+		request->tif->release(request->ud);
+		force_close(ss, s, &l, result);
+		result->data = "tls with data queued";
+		return SOCKET_ERR;
 	}
-	int v = request->value;
-	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
+	if (request->tif->attach(request->ud, s->fd)) {
+		request->tif->release(request->ud);
+		force_close(ss, s, &l, result);
+		result->data = "tls attach failed";
+		return SOCKET_ERR;
+	}
+	struct socket_tls *t = MALLOC(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	t->tif = request->tif;
+	t->ud = request->ud;
+	t->ready = false;
+	s->tls = t;
+	if (type == SOCKET_TYPE_PACCEPT) {
+		// the handshake starts after socket_server_start
+		return -1;
+	}
+	return tls_handshake(ss, s, &l, result);
 }
 
 static void
@@ -1431,6 +3176,27 @@ dec_sending_ref(struct socket_server *ss, int id) {
 	}
 }
 
+// send the shared buffer to the sockets one by one, it's interrupted when send_socket returns a result
+// (warning or error), and resumed by socket_server_poll.
+static int
+multisend_socket(struct socket_server *ss, struct socket_message *result) {
+	struct request_multisend *m = &ss->multisend;
+	while (ss->multisend_index < m->n) {
+		int id = m->id[ss->multisend_index++];
+		struct request_send request;
+		request.id = id;
+		request.sz = SHAREDOBJECT;
+		request.buffer = m->buffer;
+		int ret = send_socket(ss, &request, result, PRIORITY_HIGH, NULL);
+		dec_sending_ref(ss, id);
+		if (ret != -1)
+			return ret;
+	}
+	FREE(m->id);
+	m->id = NULL;
+	return -1;
+}
+
 // return type
 static int
 ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
@@ -1472,6 +3238,17 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		dec_sending_ref(ss, request->id);
 		return ret;
 	}
+	case 'M':
+		assert(ss->multisend.id == NULL);
+		ss->multisend = *(struct request_multisend *)buffer;
+		ss->multisend_index = 0;
+		return multisend_socket(ss, result);
+	case 'F': {
+		struct request_sendfile * request = (struct request_sendfile *) buffer;
+		int ret = sendfile_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
 	case 'A': {
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
 		return send_socket(ss, &rsu->send, result, PRIORITY_HIGH, rsu->address);
@@ -1483,9 +3260,16 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'T':
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'G':
+		option_socket(ss, (struct request_setopt *)buffer);
+		return -1;
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'E':
+		return tls_socket(ss, (struct request_tls *)buffer, result);
+	case 'Q':
+		return rudp_socket(ss, (struct request_rudp *)buffer, result);
 	default:
 		skynet_error(NULL, "socket-server: Unknown ctrl %c.",type);
 		return -1;
@@ -1494,12 +3278,180 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+// read returns 0
+static int
+read_eof(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	if (s->closing) {
+		// Rare case : if s->closing is true, reading event is disable, and SOCKET_CLOSE is raised.
+		if (nomore_sending_data(s)) {
+			force_close(ss,s,l,result);
+		}
+		return -1;
+	}
+	int t = ATOM_LOAD(&s->type);
+	if (t == SOCKET_TYPE_HALFCLOSE_READ) {
+		// Rare case : Already shutdown read.
+		return -1;
+	}
+	if (t == SOCKET_TYPE_HALFCLOSE_WRITE) {
+		// Remote shutdown read (write error) before.
+		force_close(ss,s,l,result);
+	} else {
+		close_read(ss, s, result);
+	}
+	return SOCKET_CLOSE;
+}
+
+static inline int
+frame_size(struct socket_frame *f, const uint8_t *ptr) {
+	uint32_t sz = 0;
+	int i;
+	if (f->little) {
+		for (i=f->header-1;i>=0;i--) {
+			sz = sz << 8 | ptr[i];
+		}
+	} else {
+		for (i=0;i<f->header;i++) {
+			sz = sz << 8 | ptr[i];
+		}
+	}
+	if (sz > (uint32_t)f->max)
+		return -1;
+	return (int)sz;
+}
+
+// return 1 when a frame is complete (set result->data/ud), 0 for more data, -1 when the frame is too large
+static int
+pop_frame(struct socket_frame *f, struct socket_message *result) {
+	if (f->frame) {
+		if (f->frame_read < f->frame_sz)
+			return 0;
+		result->data = f->frame;
+		result->ud = f->frame_sz;
+		f->frame = NULL;
+		return 1;
+	}
+	if (f->sz < f->header)
+		return 0;
+	const uint8_t * ptr = (const uint8_t *)f->buffer + f->offset;
+	int sz = frame_size(f, ptr);
+	if (sz < 0)
+		return -1;
+	int total = f->header + sz;
+	if (f->sz >= total) {
+		char * data = MALLOC(sz);
+		memcpy(data, ptr + f->header, sz);
+		f->offset += total;
+		f->sz -= total;
+		if (f->sz == 0)
+			f->offset = 0;
+		result->data = data;
+		result->ud = sz;
+		return 1;
+	}
+	int n = f->sz - f->header;
+	if (sz >= FRAME_DIRECT) {
+		// read the rest into the frame directly
+		f->frame = MALLOC(sz);
+		memcpy(f->frame, ptr + f->header, n);
+		f->frame_sz = sz;
+		f->frame_read = n;
+		f->offset = 0;
+		f->sz = 0;
+		return 0;
+	}
+	if (total > f->cap - f->offset) {
+		if (total > f->cap) {
+			f->cap = total;
+			f->buffer = skynet_realloc(f->buffer, f->cap);
+		}
+		memmove(f->buffer, f->buffer + f->offset, f->sz);
+		f->offset = 0;
+	}
+	return 0;
+}
+
+/*
+	Frame mode : read into s->frame, and raise one SOCKET_DATA for each complete frame.
+	Return SOCKET_MORE when a frame is ready, so that socket_server_poll can process this socket again for the next one.
+ */
+static int
+forward_message_frame(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	struct socket_frame *f = s->frame;
+	bool more = true;
+	for (;;) {
+		int r = pop_frame(f, result);
+		if (r > 0) {
+			result->opaque = s->opaque;
+			result->id = s->id;
+			return SOCKET_MORE;
+		}
+		if (r < 0) {
+			force_close(ss, s, l, result);
+			result->data = "frame too large";
+			return SOCKET_ERR;
+		}
+		if (!more) {
+			// no more data now
+			return -1;
+		}
+		char * ptr;
+		int sz;
+		if (f->frame) {
+			ptr = f->frame + f->frame_read;
+			sz = f->frame_sz - f->frame_read;
+		} else {
+			if (f->buffer == NULL) {
+				f->cap = FRAME_BUFFER;
+				f->buffer = MALLOC(f->cap);
+			} else if (f->offset + f->sz == f->cap) {
+				memmove(f->buffer, f->buffer + f->offset, f->sz);
+				f->offset = 0;
+			}
+			ptr = f->buffer + f->offset + f->sz;
+			sz = f->cap - f->offset - f->sz;
+		}
+		int n = (int)socket_read(ss, s, ptr, sz);
+		if (n<0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			default:
+				return report_error(s, result, strerror(errno));
+			}
+		}
+		if (n==0) {
+			return read_eof(ss, s, l, result);
+		}
+		if (halfclose_read(s)) {
+			// discard recv data (Rare case : if socket is HALFCLOSE_READ, reading event is disable.)
+			free_frame(f);
+			return -1;
+		}
+		stat_read(ss,s,n);
+		if (f->frame) {
+			f->frame_read += n;
+		} else {
+			f->sz += n;
+			if (n == sz && f->cap < FRAME_BUFFER_MAX) {
+				f->cap *= 2;
+				f->buffer = skynet_realloc(f->buffer, f->cap);
+			}
+		}
+		more = (n == sz);
+	}
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	if (s->frame && s->frame->header) {
+		return forward_message_frame(ss, s, l, result);
+	}
 	int sz = s->p.size;
 	char * buffer = MALLOC(sz);
-	int n = (int)read(s->fd, buffer, sz);
+	int n = (int)socket_read(ss, s, buffer, sz);
 	if (n<0) {
 		FREE(buffer);
 		switch(errno) {
@@ -1513,27 +3465,8 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	}
 	if (n==0) {
 		FREE(buffer);
-		if (s->closing) {
-			// Rare case : if s->closing is true, reading event is disable, and SOCKET_CLOSE is raised.
-			if (nomore_sending_data(s)) {
-				force_close(ss,s,l,result);
-			}
-			return -1;
-		}
-		int t = ATOM_LOAD(&s->type);
-		if (t == SOCKET_TYPE_HALFCLOSE_READ) {
-			// Rare case : Already shutdown read.
-			return -1;
-		}
-		if (t == SOCKET_TYPE_HALFCLOSE_WRITE) {
-			// Remote shutdown read (write error) before.
-			force_close(ss,s,l,result);
-		} else {
-			close_read(ss, s, result);
-		}
-		return SOCKET_CLOSE;
+		return read_eof(ss, s, l, result);
 	}
-
 	if (halfclose_read(s)) {
 		// discard recv data (Rare case : if socket is HALFCLOSE_READ, reading event is disable.)
 		FREE(buffer);
@@ -1641,8 +3574,7 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
 		if (getpeername(s->fd, &u.s, &slen) == 0) {
-			void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
-			if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
+			if (address_string(&u, slen, ss->buffer, sizeof(ss->buffer))) {
 				result->data = ss->buffer;
 				return SOCKET_OPEN;
 			}
@@ -1653,72 +3585,281 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 }
 
 static int
-getname(union sockaddr_all *u, char *buffer, size_t sz) {
-	char tmp[INET6_ADDRSTRLEN];
-	void * sin_addr = (u->s.sa_family == AF_INET) ? (void*)&u->v4.sin_addr : (void *)&u->v6.sin6_addr;
-	if (inet_ntop(u->s.sa_family, sin_addr, tmp, sizeof(tmp))) {
-		int sin_port = ntohs((u->s.sa_family == AF_INET) ? u->v4.sin_port : u->v6.sin6_port);
-		snprintf(buffer, sz, "%s:%d", tmp, sin_port);
-		return 1;
-	} else {
-		buffer[0] = '\0';
+getname(union sockaddr_all *u, socklen_t len, char *buffer, size_t sz) {
+	if (u->s.sa_family == AF_UNIX) {
+		address_string(u, len, buffer, sz);
+		return 1;
+	}
+	char tmp[INET6_ADDRSTRLEN];
+	void * sin_addr = (u->s.sa_family == AF_INET) ? (void*)&u->v4.sin_addr : (void *)&u->v6.sin6_addr;
+	if (inet_ntop(u->s.sa_family, sin_addr, tmp, sizeof(tmp))) {
+		int sin_port = ntohs((u->s.sa_family == AF_INET) ? u->v4.sin_port : u->v6.sin6_port);
+		snprintf(buffer, sz, "%s:%d", tmp, sin_port);
+		return 1;
+	} else {
+		buffer[0] = '\0';
+		return 0;
+	}
+}
+
+// accept a connection into a new socket in PACCEPT state, return the id.
+// return -1 when there is no more, -2 when the fds are exhausted (result is filled).
+static int
+accept_socket(struct socket_server *ss, struct socket *s, union sockaddr_all *u, socklen_t *len, struct socket_message *result) {
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+	int client_fd = accept4(s->fd, &u->s, len, SOCK_NONBLOCK);
+#else
+	int client_fd = accept(s->fd, &u->s, len);
+#endif
+	if (client_fd < 0) {
+		if (errno == EMFILE || errno == ENFILE) {
+			result->opaque = s->opaque;
+			result->id = s->id;
+			result->ud = 0;
+			result->data = strerror(errno);
+
+			// See https://stackoverflow.com/questions/47179793/how-to-gracefully-handle-accept-giving-emfile-and-close-the-connection
+			if (ss->reserve_fd >= 0) {
+				close(ss->reserve_fd);
+				client_fd = accept(s->fd, &u->s, len);
+				if (client_fd >= 0) {
+					close(client_fd);
+					++s->stat.rejected;
+				}
+				ss->reserve_fd = dup(1);
+			}
+			return -2;
+		} else {
+			return -1;
+		}
+	}
+	int id = reserve_id(ss);
+	if (id < 0) {
+		close(client_fd);
+		++s->stat.rejected;
+		return -1;
+	}
+	socket_keepalive(client_fd);
+#if !(defined(__linux__) && defined(SOCK_NONBLOCK))
+	sp_nonblocking(client_fd);
+#endif
+	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
+	if (ns == NULL) {
+		close(client_fd);
+		++s->stat.rejected;
+		return -1;
+	}
+	ATOM_STORE(&ns->listener, s->id);
+	ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
+	return id;
+}
+
+// a new session of the listen endpoint, like report_accepted()
+static struct socket *
+rudp_accept(struct socket_server *ss, struct socket *ep, uint32_t conv, const uint8_t address[UDP_ADDRESS_SIZE], struct socket_message *result) {
+	int id = reserve_id(ss);
+	if (id < 0) {
+		++ep->stat.rejected;
+		return NULL;
+	}
+	struct socket *s = new_fd(ss, id, -1, PROTOCOL_RUDP, ep->opaque, false);
+	if (s == NULL)
+		return NULL;
+	rudp_session(ss, s, ep, conv, address);
+	rudp_insert(ss, ep->rudp, s);
+	ATOM_STORE(&s->listener, ep->id);
+	ATOM_STORE(&s->type , SOCKET_TYPE_PACCEPT);
+	stat_read(ss, ep, 1);
+	result->opaque = ep->opaque;
+	result->id = ep->id;
+	result->ud = id;
+	result->data = NULL;
+	union sockaddr_all sa;
+	socklen_t sasz = udp_sockaddr(address, &sa);
+	if (getname(&sa, sasz, ss->buffer, sizeof(ss->buffer))) {
+		result->data = ss->buffer;
+	}
+	return s;
+}
+
+// read the datagrams of endpoint ep, and feed them to the sessions. return SOCKET_ACCEPT for a new session, or -1
+static int
+rudp_read(struct socket_server *ss, struct socket *ep, struct socket_message *result) {
+	uint32_t now = rudp_clock();
+	for (;;) {
+		union sockaddr_all sa;
+		socklen_t slen = sizeof(sa);
+		int n = recvfrom(ep->fd, ss->udpbuffer, MAX_UDP_PACKAGE, 0, &sa.s, &slen);
+		if (n < 0)
+			return -1;
+		uint32_t conv;
+		int first = rudp_conv(ss->udpbuffer, n, &conv);
+		if (first < 0)
+			continue;
+		uint8_t address[UDP_ADDRESS_SIZE];
+		memset(address, 0, sizeof(address));
+		gen_udp_address(slen == sizeof(sa.v4) ? PROTOCOL_UDP : PROTOCOL_UDPv6, &sa, address);
+		struct socket *s = rudp_find(ss, ep, conv, address);
+		int type = -1;
+		if (s == NULL) {
+			// only the first segment of a stream opens a session, the others may be the remains of a closed one
+			if (!first || ep->rudp->arq || ATOM_LOAD(&ep->type) != SOCKET_TYPE_LISTEN)
+				continue;
+			s = rudp_accept(ss, ep, conv, address, result);
+			if (s == NULL)
+				continue;
+			type = SOCKET_ACCEPT;
+		}
+		struct socket_rudp *r = s->rudp;
+		if (rudp_input(r->arq, ss->udpbuffer, n, now) == 0) {
+			r->recent = now;
+			rudp_flush(r->arq, now);
+			r->flush = rudp_check(r->arq, now);
+			if (s->reading && rudp_peeksize(r->arq) != -1) {
+				rudp_ready(ss, s);
+			}
+		}
+		if (type != -1)
+			return type;
+	}
+}
+
+static int
+report_accepted(struct socket_server *ss, struct socket *s, int id, union sockaddr_all *u, socklen_t len, struct socket_message *result) {
+	// accept new one connection
+	stat_read(ss,s,1);
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = id;
+	result->data = NULL;
+
+	if (getname(u, len, ss->buffer, sizeof(ss->buffer))) {
+		result->data = ss->buffer;
+	}
+	return SOCKET_ACCEPT;
+}
+
+// the listen socket runs out of tokens, put the new connection into the queue, or stop accepting.
+static int
+defer_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	struct accept_queue *q = s->aq;
+	if (s->shape->tokens <= 0 && !s->shape->throttled) {
+		throttle_socket(ss, s);
+	}
+	if (q->max == 0) {
+		// the connections wait in the backlog of kernel, until check_throttle() enables reading
+		hold_read(ss, s, HOLD_THROTTLE, true);
 		return 0;
 	}
+	union sockaddr_all u;
+	socklen_t len = sizeof(u);
+	int id = accept_socket(ss, s, &u, &len, result);
+	if (id < 0)
+		return id == -2 ? -1 : 0;
+	if (q->n >= q->max) {
+		struct socket *ns = &ss->slot[HASH_ID(id)];
+		struct socket_lock l;
+		struct socket_message dummy;
+		socket_lock_init(ns, &l);
+		force_close(ss, ns, &l, &dummy);
+		++s->stat.rejected;
+	} else {
+		accept_push(q, id);
+		++q->deferred;
+		if (s->shape->tokens > 0) {
+			accept_ready(ss, s);
+		}
+	}
+	return 2;
 }
 
-// return 0 when failed, or -1 when file limit
+// return 1 when a connection is reported, 2 when it's accepted (or dropped) but not reported, 0 for no more, -1 for error.
 static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (s->aq && s->shape->rate) {
+		refill_tokens(ss, s);
+		if (s->shape->tokens <= 0 || s->aq->n > 0) {
+			// keep the order of the pending connections
+			return defer_accept(ss, s, result);
+		}
+	}
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
-	if (client_fd < 0) {
-		if (errno == EMFILE || errno == ENFILE) {
-			result->opaque = s->opaque;
-			result->id = s->id;
-			result->ud = 0;
-			result->data = strerror(errno);
+	int id = accept_socket(ss, s, &u, &len, result);
+	if (id < 0)
+		return id == -2 ? -1 : 0;
+	if (s->aq && s->shape->rate) {
+		--s->shape->tokens;
+	}
+	report_accepted(ss, s, id, &u, len, result);
+	return 1;
+}
 
-			// See https://stackoverflow.com/questions/47179793/how-to-gracefully-handle-accept-giving-emfile-and-close-the-connection
-			if (ss->reserve_fd >= 0) {
-				close(ss->reserve_fd);
-				client_fd = accept(s->fd, &u.s, &len);
-				if (client_fd >= 0) {
-					close(client_fd);
-				}
-				ss->reserve_fd = dup(1);
+// report the pending connections of the listen sockets which have tokens, see defer_accept()
+static int
+accept_pending(struct socket_server *ss, struct socket_message *result) {
+	struct throttle_list *t = &ss->accepting;
+	while (t->n > 0) {
+		int lid = t->id[t->n - 1];
+		struct socket *s = &ss->slot[HASH_ID(lid)];
+		if (socket_invalid(s, lid) || ATOM_LOAD(&s->type) != SOCKET_TYPE_LISTEN || s->aq == NULL) {
+			--t->n;
+			continue;
+		}
+		struct accept_queue *q = s->aq;
+		if (s->shape->rate) {
+			refill_tokens(ss, s);
+		}
+		if (q->n == 0 || (s->shape->rate && s->shape->tokens <= 0)) {
+			q->ready = false;
+			--t->n;
+			if (q->n > 0 && !s->shape->throttled) {
+				// wait for the tokens
+				throttle_socket(ss, s);
 			}
-			return -1;
-		} else {
-			return 0;
+			continue;
+		}
+		int id = q->id[q->head];
+		q->head = (q->head + 1) % q->cap;
+		--q->n;
+		struct socket *ns = &ss->slot[HASH_ID(id)];
+		if (ns->id != id || ATOM_LOAD(&ns->type) != SOCKET_TYPE_PACCEPT)
+			continue;
+		if (s->shape->rate) {
+			--s->shape->tokens;
+		}
+		union sockaddr_all u;
+		socklen_t len = sizeof(u);
+		if (getpeername(ns->fd, &u.s, &len) != 0) {
+			len = 0;
+			u.s.sa_family = AF_UNSPEC;
 		}
+		return report_accepted(ss, s, id, &u, len, result);
 	}
-	int id = reserve_id(ss);
-	if (id < 0) {
-		close(client_fd);
-		return 0;
+	return -1;
+}
+
+// The pending zerocopy notifications raise error event, return -1 and clear e->error if there is no real error.
+static int
+zerocopy_event(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct event *e, struct socket_message *result) {
+	zerocopy_complete(ss, s);
+	int error;
+	socklen_t len = sizeof(error);
+	int code = getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+	if (code < 0) {
+		return report_error(s, result, strerror(errno));
 	}
-	socket_keepalive(client_fd);
-	sp_nonblocking(client_fd);
-	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
-	if (ns == NULL) {
-		close(client_fd);
-		return 0;
+	if (error != 0) {
+		return report_error(s, result, strerror(error));
 	}
-	// accept new one connection
-	stat_read(ss,s,1);
-
-	ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
-	result->opaque = s->opaque;
-	result->id = s->id;
-	result->ud = id;
-	result->data = NULL;
-
-	if (getname(&u, ss->buffer, sizeof(ss->buffer))) {
-		result->data = ss->buffer;
+	e->error = false;
+	if (s->closing && !zc_pending(s) && send_buffer_empty(s)) {
+		// the closing socket is waiting for the notifications, see send_buffer_()
+		force_close(ss, s, l, result);
+		e->read = e->write = false;
 	}
-
-	return 1;
+	return -1;
 }
 
 static inline void 
@@ -1743,6 +3884,26 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 int 
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
 	for (;;) {
+		result->time = ss->event_time;
+		if (ss->multisend.id) {
+			int type = multisend_socket(ss, result);
+			if (type != -1) {
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+		}
+		if (ss->accepting.n) {
+			int type = accept_pending(ss, result);
+			if (type != -1)
+				return type;
+		}
+		if (ss->rudp_ready.n) {
+			int type = rudp_report(ss, result);
+			if (type != -1) {
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+		}
 		if (ss->checkctrl) {
 			if (has_cmd(ss)) {
 				int type = ctrl_cmd(ss, result);
@@ -1756,18 +3917,33 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 		}
 		if (ss->event_index == ss->event_n) {
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			// wake up periodically to refill the tokens of throttled sockets, or flush the corked sockets
+			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT, wait_timeout(ss));
+			ss->event_time = socket_server_clock();
+			result->time = ss->event_time;
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
 			}
 			ss->event_index = 0;
+			ss->accept_n = 0;
+			if (ss->throttle.n) {
+				check_throttle(ss);
+			}
+			if (ss->cork.n) {
+				check_cork(ss);
+			}
+			if (ss->rudp.n) {
+				check_rudp(ss);
+			}
 			if (ss->event_n <= 0) {
-				ss->event_n = 0;
-				int err = errno;
-				if (err != EINTR) {
-					skynet_error(NULL, "socket-server: %s", strerror(err));
+				if (ss->event_n < 0) {
+					int err = errno;
+					if (err != EINTR) {
+						skynet_error(NULL, "socket-server: %s", strerror(err));
+					}
 				}
+				ss->event_n = 0;
 				continue;
 			}
 		}
@@ -1783,19 +3959,56 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_CONNECTING:
 			return report_connect(ss, s, &l, result);
 		case SOCKET_TYPE_LISTEN: {
+			if (s->protocol != PROTOCOL_TCP) {
+				// the endpoint of reliable udp
+				int type = rudp_read(ss, s, result);
+				if (type != -1) {
+					--ss->event_index;
+					return type;
+				}
+				break;
+			}
 			int ok = report_accept(ss, s, result);
-			if (ok > 0) {
+			if (ok > 0 && ++ss->accept_n < ACCEPT_BUDGET) {
+				// accept the next connection in batch, the rest waits for the next sp_wait
+				--ss->event_index;
+			}
+			if (ok == 1) {
 				return SOCKET_ACCEPT;
 			} if (ok < 0 ) {
 				return SOCKET_ERR;
 			}
-			// when ok == 0, retry
+			// when ok == 0 (or 2), retry
 			break;
 		}
 		case SOCKET_TYPE_INVALID:
 			skynet_error(NULL, "socket-server: invalid socket");
 			break;
 		default:
+			if (s->protocol == PROTOCOL_RUDP) {
+				// the dial session reads its own udp socket
+				if (e->read && rudp_read(ss, s, result) != -1) {
+					--ss->event_index;
+				}
+				break;
+			}
+			if (e->error && zc_pending(s)) {
+				int type = zerocopy_event(ss, s, &l, e, result);
+				if (type != -1)
+					return type;
+				if (!e->read && !e->write && !e->error)
+					break;
+			}
+			if (s->tls && !s->tls->ready) {
+				int type = tls_handshake(ss, s, &l, result);
+				if (type != -1)
+					return type;
+				if (!s->tls->ready)
+					break;
+			}
+			if (s->tls && (s->tls->read_wantwrite || s->tls->write_wantread)) {
+				tls_resume(ss, s, e);
+			}
 			if (e->read) {
 				int type;
 				if (s->protocol == PROTOCOL_TCP) {
@@ -1892,6 +4105,7 @@ open_request(struct socket_server *ss, struct request_package *req, uintptr_t op
 	req->u.open.opaque = opaque;
 	req->u.open.id = id;
 	req->u.open.port = port;
+	req->u.open.family = is_unix_address(addr) ? AF_UNIX : AF_UNSPEC;
 	// 因为 request_package 分配的内存空间足够大, 所以这样处理是没有问题的, 尽管 open.host 表示的是 1 个大小的 char 数组,
 	// 但是 request_package 为 u.open.host 预留了足够的连续内存空间, 所以可以直接 memcpy 而不用担心内存覆盖问题. 
 	// 其实也就是把 addr 的数据放入到 request_package 的内存空间中.
@@ -1913,7 +4127,8 @@ socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * a
 
 static inline int
 can_direct_write(struct socket *s, int id) {
-	return s->id == id && nomore_sending_data(s) && ATOM_LOAD(&s->type) == SOCKET_TYPE_CONNECTED && ATOM_LOAD(&s->udpconnecting) == 0;
+	return s->id == id && nomore_sending_data(s) && ATOM_LOAD(&s->type) == SOCKET_TYPE_CONNECTED && ATOM_LOAD(&s->udpconnecting) == 0
+		&& ATOM_LOAD(&s->nodirect) == 0 && s->protocol != PROTOCOL_RUDP;
 }
 
 // return -1 when error, 0 when success
@@ -1929,7 +4144,11 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 
-	if (can_direct_write(s,id) && socket_trylock(&l)) {
+	// large buffer for zerocopy should be sent by socket thread. (shaping, cork and tls turn off direct write, see can_direct_write)
+	int threshold = ATOM_LOAD(&s->zerocopy);
+	int direct = threshold == 0 || buf->type == SOCKET_BUFFER_OBJECT || buf->sz < threshold;
+
+	if (direct && can_direct_write(s,id) && socket_trylock(&l)) {
 		// may be we can send directly, double check
 		if (can_direct_write(s,id)) {
 			// send directly
@@ -2010,6 +4229,51 @@ socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffe
 	return 0;
 }
 
+// return -1 when error, 0 when success. the buffer is shared by the sockets and freed after the last one sent.
+int
+socket_server_multisend(struct socket_server *ss, const int *id, int n, struct socket_sendbuffer *buf) {
+	if (n <= 0 || buf->type == SOCKET_BUFFER_OBJECT) {
+		free_buffer(ss, buf);
+		return -1;
+	}
+	struct send_shared *sh = MALLOC(sizeof(*sh));
+	ATOM_INIT(&sh->ref, n);
+	sh->buffer = clone_buffer(buf, &sh->sz);
+
+	struct request_package request;
+	request.u.multisend.n = n;
+	request.u.multisend.id = MALLOC(n * sizeof(int));
+	request.u.multisend.buffer = sh;
+	int i;
+	for (i=0;i<n;i++) {
+		request.u.multisend.id[i] = id[i];
+		inc_sending_ref(&ss->slot[HASH_ID(id[i])], id[i]);
+	}
+	send_request(ss, &request, 'M', sizeof(request.u.multisend));
+	return 0;
+}
+
+// return -1 when error, 0 when success. fd will be closed by socket server in any case.
+int
+socket_server_sendfile(struct socket_server *ss, int id, int fd, int64_t offset, size_t sz) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id) || s->closing) {
+		close(fd);
+		return -1;
+	}
+
+	inc_sending_ref(s, id);
+
+	struct request_package request;
+	request.u.sendfile.id = id;
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.offset = offset;
+	request.u.sendfile.sz = sz;
+
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return 0;
+}
+
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
@@ -2084,10 +4348,46 @@ _failed_fd:
 	return -1;
 }
 
+// bind a unix domain stream socket, remove the stale socket file first
+// The socket file left by a dead listener refuses the connection. Don't take over the path of a live one,
+// it accepts (or its backlog is full).
+static int
+unix_stale(struct sockaddr_un *sa, socklen_t len) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return 0;
+	sp_nonblocking(fd);
+	int stale = connect(fd, (struct sockaddr *)sa, len) != 0 && errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+
+static int
+do_bind_unix(const char *host) {
+	struct sockaddr_un sa;
+	socklen_t len = unix_address(host, &sa);
+	if (len == 0)
+		return -1;
+	if (sa.sun_path[0]) {
+		struct stat st;
+		if (stat(sa.sun_path, &st) == 0 && S_ISSOCK(st.st_mode) && unix_stale(&sa, len)) {
+			unlink(sa.sun_path);
+		}
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&sa, len) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
 static int
 do_listen(const char * host, int port, int backlog) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = is_unix_address(host) ? do_bind_unix(host) : do_bind(host, port, IPPROTO_TCP, &family);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -2155,6 +4455,78 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+static void
+option_request(struct socket_server *ss, int id, int what, int value) {
+	struct request_package request;
+	request.u.setopt.id = id;
+	request.u.setopt.what = what;
+	request.u.setopt.value = value;
+	send_request(ss, &request, 'G', sizeof(request.u.setopt));
+}
+
+void
+socket_server_zerocopy(struct socket_server *ss, int id, int threshold) {
+	option_request(ss, id, SOCKET_OPT_ZEROCOPY, threshold);
+}
+
+void
+socket_server_shape(struct socket_server *ss, int id, int rate, int limit, int policy) {
+	option_request(ss, id, SOCKET_OPT_POLICY, policy);
+	option_request(ss, id, SOCKET_OPT_LIMIT, limit);
+	option_request(ss, id, SOCKET_OPT_RATE, rate);
+}
+
+void
+socket_server_frame(struct socket_server *ss, int id, int header, int little, int max) {
+	option_request(ss, id, SOCKET_OPT_FRAMEMAX, max);
+	option_request(ss, id, SOCKET_OPT_FRAME, header | (little ? 0x100 : 0));
+}
+
+void
+socket_server_cork(struct socket_server *ss, int id, int threshold, int interval) {
+	if (threshold < 0) {
+		option_request(ss, id, SOCKET_OPT_CORK, CORK_OFF);
+		return;
+	}
+	option_request(ss, id, SOCKET_OPT_CORKTIME, interval);
+	option_request(ss, id, SOCKET_OPT_CORK, threshold);
+}
+
+void
+socket_server_flush(struct socket_server *ss, int id) {
+	option_request(ss, id, SOCKET_OPT_FLUSH, 0);
+}
+
+void
+socket_server_acceptrate(struct socket_server *ss, int id, int rate, int queue) {
+	option_request(ss, id, SOCKET_OPT_ACCEPTQUEUE, queue);
+	option_request(ss, id, SOCKET_OPT_ACCEPTRATE, rate);
+}
+
+int
+socket_server_tls(struct socket_server *ss, int id, const struct socket_tls_interface *tif, void *ud) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP || s->dw_buffer) {
+		// refuse to switch during the direct write, the rest of it is plain text
+		socket_unlock(&l);
+		tif->release(ud);
+		return -1;
+	}
+	// stop direct write before the request, the data sent after it will be encrypted
+	set_nodirect(s, NODIRECT_TLS, true);
+	socket_unlock(&l);
+
+	struct request_package request;
+	request.u.tls.id = id;
+	request.u.tls.tif = tif;
+	request.u.tls.ud = ud;
+	send_request(ss, &request, 'E', sizeof(request.u.tls));
+	return 0;
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
@@ -2282,6 +4654,81 @@ socket_server_udp_dial(struct socket_server *ss, uintptr_t opaque, const char* a
 	return id;
 }
 
+// the endpoint of reliable udp, port 0 for any port (see the SOCKET_OPEN message)
+int
+socket_server_rudp_listen(struct socket_server *ss, uintptr_t opaque, const char* addr, int port) {
+	int family;
+	int fd = do_bind(addr, port, IPPROTO_UDP, &family);
+	if (fd < 0) {
+		return -1;
+	}
+	sp_nonblocking(fd);
+	int id = reserve_id(ss);
+	if (id < 0) {
+		close(fd);
+		return -1;
+	}
+	struct request_package request;
+	memset(&request.u.rudp, 0, sizeof(request.u.rudp));
+	request.u.rudp.id = id;
+	request.u.rudp.fd = fd;
+	request.u.rudp.listen = 1;
+	request.u.rudp.opaque = opaque;
+	request.u.rudp.address[0] = (family == AF_INET) ? PROTOCOL_UDP : PROTOCOL_UDPv6;
+
+	send_request(ss, &request, 'Q', sizeof(request.u.rudp));
+	return id;
+}
+
+// a session of reliable udp, conv is the id of the stream, 0 for the socket id
+int
+socket_server_rudp_dial(struct socket_server *ss, uintptr_t opaque, const char* addr, int port, uint32_t conv) {
+	struct addrinfo ai_hints;
+	struct addrinfo *ai_list = NULL;
+	char portstr[16];
+	sprintf(portstr, "%d", port);
+	memset( &ai_hints, 0, sizeof( ai_hints ) );
+	ai_hints.ai_family = AF_UNSPEC;
+	ai_hints.ai_socktype = SOCK_DGRAM;
+	ai_hints.ai_protocol = IPPROTO_UDP;
+
+	if (getaddrinfo(addr, portstr, &ai_hints, &ai_list) != 0) {
+		return -1;
+	}
+	int protocol;
+	if (ai_list->ai_family == AF_INET) {
+		protocol = PROTOCOL_UDP;
+	} else if (ai_list->ai_family == AF_INET6) {
+		protocol = PROTOCOL_UDPv6;
+	} else {
+		freeaddrinfo( ai_list );
+		return -1;
+	}
+	int fd = socket(ai_list->ai_family, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		freeaddrinfo( ai_list );
+		return -1;
+	}
+	sp_nonblocking(fd);
+	int id = reserve_id(ss);
+	if (id < 0) {
+		freeaddrinfo( ai_list );
+		close(fd);
+		return -1;
+	}
+	struct request_package request;
+	memset(&request.u.rudp, 0, sizeof(request.u.rudp));
+	request.u.rudp.id = id;
+	request.u.rudp.fd = fd;
+	request.u.rudp.conv = conv ? conv : (uint32_t)id;
+	request.u.rudp.opaque = opaque;
+	gen_udp_address(protocol, (union sockaddr_all *)ai_list->ai_addr, request.u.rudp.address);
+	freeaddrinfo( ai_list );
+
+	send_request(ss, &request, 'Q', sizeof(request.u.rudp));
+	return id;
+}
+
 int 
 socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address *addr, struct socket_sendbuffer *buf) {
 	int id = buf->id;
@@ -2444,22 +4891,43 @@ query_info(struct socket *s, struct socket_info *si) {
 	case SOCKET_TYPE_LISTEN:
 		si->type = SOCKET_INFO_LISTEN;
 		if (getsockname(s->fd, &u.s, &slen) == 0) {
-			getname(&u, si->name, sizeof(si->name));
+			getname(&u, slen, si->name, sizeof(si->name));
+		}
+		int i;
+		for (i=0;i<SOCKET_LATENCY_BUCKETS;i++) {
+			si->latency[i] = ATOM_LOAD(&s->latency[i]);
 		}
 		break;
 	case SOCKET_TYPE_HALFCLOSE_READ:
 	case SOCKET_TYPE_HALFCLOSE_WRITE:
 		closing = 1;
 	case SOCKET_TYPE_CONNECTED:
-		if (s->protocol == PROTOCOL_TCP) {
+		if (s->protocol == PROTOCOL_RUDP) {
+			si->type = SOCKET_INFO_RUDP;
+			spinlock_lock(&s->dw_lock);
+			if (s->rudp) {
+				const struct rudp_stat *st = &s->rudp->stat;
+				si->rtt = st->rtt;
+				si->rto = st->rto;
+				si->cwnd = st->cwnd;
+				si->inflight = st->inflight;
+				si->waitsnd = st->waitsnd;
+				si->resend = st->resend;
+			}
+			spinlock_unlock(&s->dw_lock);
+			socklen_t sasz = udp_sockaddr(s->p.udp_address, &u);
+			if (sasz) {
+				getname(&u, sasz, si->name, sizeof(si->name));
+			}
+		} else if (s->protocol == PROTOCOL_TCP) {
 			si->type = closing ? SOCKET_INFO_CLOSING : SOCKET_INFO_TCP;
 			if (getpeername(s->fd, &u.s, &slen) == 0) {
-				getname(&u, si->name, sizeof(si->name));
+				getname(&u, slen, si->name, sizeof(si->name));
 			}
 		} else {
 			si->type = SOCKET_INFO_UDP;
 			if (udp_socket_address(s, s->p.udp_address, &u)) {
-				getname(&u, si->name, sizeof(si->name));
+				getname(&u, sizeof(u), si->name, sizeof(si->name));
 			}
 		}
 		break;
@@ -2472,7 +4940,24 @@ query_info(struct socket *s, struct socket_info *si) {
 	si->write = s->stat.write;
 	si->rtime = s->stat.rtime;
 	si->wtime = s->stat.wtime;
+	si->rejected = s->stat.rejected;
+	// zc, shape and aq are never freed before socket_server_release
+	if (s->zc) {
+		si->zerocopy = s->zc->zerocopy;
+		si->zcfallback = s->zc->fallback;
+	}
+	if (s->shape) {
+		si->dropped = s->shape->dropped;
+		si->throttled = s->shape->throttle;
+		si->rate = s->shape->rate;
+		si->wlimit = s->shape->limit;
+	}
+	if (s->aq) {
+		si->deferred = s->aq->deferred;
+		si->pending = si->type == SOCKET_INFO_LISTEN ? s->aq->n : 0;
+	}
 	si->wbuffer = s->wb_size;
+	si->wpeak = s->stat.wpeak;
 	si->reading = s->reading;
 	si->writing = s->writing;
 
@@ -2487,6 +4972,7 @@ socket_server_info(struct socket_server *ss) {
 		struct socket * s = &ss->slot[i];
 		int id = s->id;
 		struct socket_info temp;
+		memset(&temp, 0, sizeof(temp));
 		if (query_info(s, &temp) && s->id == id) {
 			// socket_server_info may call in different thread, so check socket id again
 			si = socket_info_create(si);
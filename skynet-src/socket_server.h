@@ -13,10 +13,11 @@
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
 #define SOCKET_WARNING 7
+#define SOCKET_SENDFILE 8
 
 // Only for internal use
-#define SOCKET_RST 8
-#define SOCKET_MORE 9
+#define SOCKET_RST 9
+#define SOCKET_MORE 10
 
 struct socket_server;
 
@@ -25,11 +26,16 @@ struct socket_message {
 	uintptr_t opaque;
 	int ud;	// for accept, ud is new connection id ; for data, ud is size of data 
 	char * data;
+	uint64_t time;	// the time (in microsecond, see socket_server_clock) when the event is ready
 };
 
 struct socket_server * socket_server_create(uint64_t time);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
+// monotonic clock in microsecond
+uint64_t socket_server_clock(void);
+// record the latency from socket thread (the time of socket_message) to worker, into the histogram of its listener
+void socket_server_latency(struct socket_server *, int id, uint64_t time);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
 
 void socket_server_exit(struct socket_server *);
@@ -41,14 +47,68 @@ void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int socket_server_send(struct socket_server *, struct socket_sendbuffer *buffer);
 int socket_server_send_lowpriority(struct socket_server *, struct socket_sendbuffer *buffer);
+// send one buffer to n sockets (buffer->id is ignored) in one request, the buffer is shared (refcounted) by them.
+int socket_server_multisend(struct socket_server *, const int *id, int n, struct socket_sendbuffer *buffer);
+// send [offset, offset+sz) of file fd after the data queued before, the socket server takes the ownership of fd.
+// SOCKET_SENDFILE will be raised when it's finished (data is the error string, or NULL when succ)
+int socket_server_sendfile(struct socket_server *, int id, int fd, int64_t offset, size_t sz);
 
 // ctrl command below returns id
+// addr can be "unix:/path/of/socket" (or "unix:@name" for linux abstract namespace) for unix domain stream socket, port is ignored.
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// send the buffers not less than threshold with MSG_ZEROCOPY (linux only), 0 for turn off
+void socket_server_zerocopy(struct socket_server *, int id, int threshold);
+
+// policy when the send buffer of a tcp socket reach the limit
+#define SOCKET_LIMIT_DROP 0		// drop the low priority packages, the high priority ones are still queued
+#define SOCKET_LIMIT_CLOSE 1	// close the socket and raise SOCKET_ERR
+#define SOCKET_LIMIT_PAUSE 2	// stop reading the socket until the send buffer drains to half of the limit.
+								// It is the back pressure of request/response peers : it doesn't block the local sender,
+								// so the buffer keeps growing if the service writes without reading.
+
+// rate : bytes per second (token bucket) for sending, limit of send buffer (0 for unlimited).
+// The limit is only a hard cap with SOCKET_LIMIT_CLOSE, see the policies above.
+void socket_server_shape(struct socket_server *, int id, int rate, int limit, int policy);
+// split the tcp stream by a length header (1/2/4 bytes, 0 for turn off), raise one SOCKET_DATA for each frame (without header).
+// the socket is closed with SOCKET_ERR when a frame is larger than max. call it before socket_server_start.
+void socket_server_frame(struct socket_server *, int id, int header, int little, int max);
+// cork mode : hold the outbound packages until socket_server_flush, the send buffer reach threshold bytes,
+// or every interval microseconds. threshold < 0 for turn off, 0 (threshold or interval) for no limit.
+void socket_server_cork(struct socket_server *, int id, int threshold, int interval);
+void socket_server_flush(struct socket_server *, int id);
+// limit the accept rate (connections per second, 0 for unlimited) of a listen socket. the connections beyond the rate
+// wait in a queue (at most queue, the rest are closed), and are reported when the tokens refill.
+// queue 0 stops accepting instead, the connections wait in the backlog of kernel.
+void socket_server_acceptrate(struct socket_server *, int id, int rate, int queue);
+
+// tls mode : encrypt the tcp stream in socket thread, see lualib-src/ltls.c for the implementation by openssl
+#define SOCKET_TLS_FINISH 1
+#define SOCKET_TLS_WANTREAD 0
+#define SOCKET_TLS_WANTWRITE 2
+
+struct socket_tls_interface {
+	// bind the fd of socket, return 0 when succ
+	int (*attach)(void *ud, int fd);
+	// return SOCKET_TLS_*, or -1 for error
+	int (*handshake)(void *ud);
+	// the same as read(2)/write(2) for the plain text, return -1 and set errno to EAGAIN when it would block
+	int (*read)(void *ud, void *buffer, int sz);
+	int (*write)(void *ud, const void *buffer, int sz);
+	// after read/write returns EAGAIN, return SOCKET_TLS_WANTREAD or SOCKET_TLS_WANTWRITE, the event it waits for
+	int (*want)(void *ud);
+	void (*release)(void *ud);
+};
+
+// turn on tls mode, socket server takes the ownership of ud (released by tif->release even if it fails).
+// call it before socket_server_start for the accepted socket, or after connected for the client.
+// the data sent after it are buffered until the handshake is finished.
+// it fails (returns -1, or closes the socket with an error) if the data sent before it are not written out yet.
+int socket_server_tls(struct socket_server *, int id, const struct socket_tls_interface *tif, void *ud);
 
 struct socket_udp_address;
 
@@ -63,6 +123,12 @@ int socket_server_udp_dial(struct socket_server *ss, uintptr_t opaque, const cha
 // create an udp server socket handle, and bind the host port, return id when success
 int socket_server_udp_listen(struct socket_server *ss, uintptr_t opaque, const char* addr, int port);
 
+// reliable udp (see rudp.h). The sessions are like tcp connections : SOCKET_OPEN, SOCKET_DATA, SOCKET_CLOSE and SOCKET_ERR.
+// create an endpoint, call socket_server_start to accept the sessions (SOCKET_ACCEPT). return id when success
+int socket_server_rudp_listen(struct socket_server *ss, uintptr_t opaque, const char* addr, int port);
+// create a session to the endpoint, conv is the id of the session (0 for the socket id). return id when success
+int socket_server_rudp_dial(struct socket_server *ss, uintptr_t opaque, const char* addr, int port, uint32_t conv);
+
 // If the socket_udp_address is NULL, use last call socket_server_udp_connect address instead
 // You can also use socket_server_send 
 int socket_server_udp_send(struct socket_server *, const struct socket_udp_address *, struct socket_sendbuffer *buffer);
@@ -0,0 +1,133 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local function listen()
+	local accepted = {}
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen_id, function(id)
+		accepted[#accepted+1] = id
+	end)
+	return listen_id, port, accepted
+end
+
+local function connect(port, n)
+	local clients = {}
+	for i = 1, n do
+		clients[i] = assert(socket.open("127.0.0.1", port))
+	end
+	return clients
+end
+
+local function wait(f)
+	for i = 1, 500 do
+		if f() then
+			return
+		end
+		skynet.sleep(1)
+	end
+	error "timeout"
+end
+
+local function close(listen_id, accepted, clients)
+	for _, id in ipairs(accepted) do
+		socket.close(id)
+	end
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	socket.close(listen_id)
+end
+
+local function test_batch(n)
+	local listen_id, port, accepted = listen()
+	local ti = skynet.hpc()
+	local clients = connect(port, n)
+	wait(function() return #accepted == n end)
+	ti = (skynet.hpc() - ti) / 1000000
+	local info = socket.netstat(listen_id)
+	assert(info.accept == n and info.rejected == nil)
+	print(string.format("accept %d connections : %.1f ms", n, ti))
+	close(listen_id, accepted, clients)
+end
+
+-- the connections beyond the rate are queued, and the rest are closed
+local function test_queue()
+	local RATE, QUEUE, N = 50, 20, 100
+	local listen_id, port, accepted = listen()
+	socket.acceptrate(listen_id, RATE, QUEUE)
+	skynet.sleep(0)	-- the option is set before the connections
+	local clients = connect(port, N)
+	skynet.sleep(5)
+	local info = socket.netstat(listen_id)
+	print("rate", info.rate, "accept", info.accept, "deferred", info.deferred, "pending", info.pending, "rejected", info.rejected)
+	assert(info.accept < RATE + QUEUE and info.deferred >= QUEUE and info.rejected > 0)
+	-- the pending connections are reported when the tokens refill
+	wait(function()
+		info = socket.netstat(listen_id)
+		return info.pending == 0 and info.accept + info.rejected == N
+	end)
+	assert(#accepted == info.accept)
+	local closed = 0
+	for _, id in ipairs(clients) do
+		-- the connections accepted are not closed, so read them with timeout
+		local co = coroutine.running()
+		local r, done
+		-- only the first one wakes up co, the later one would break the wait of next socket.listen
+		local function resume()
+			if not done then
+				done = true
+				skynet.wakeup(co)
+			end
+		end
+		skynet.fork(function()
+			r = socket.read(id)
+			resume()
+		end)
+		skynet.timeout(1, resume)
+		skynet.wait(co)
+		if r == false then
+			closed = closed + 1
+		end
+	end
+	print("accept", info.accept, "rejected", info.rejected, "closed", closed)
+	assert(closed == info.rejected)
+	close(listen_id, accepted, clients)
+end
+
+-- stop accepting when it runs out of tokens, the connections wait in the backlog
+local function test_pause()
+	local RATE, N = 20, 40
+	local listen_id, port, accepted = listen()
+	socket.acceptrate(listen_id, RATE)
+	skynet.sleep(0)
+	local ti = skynet.now()
+	local clients = connect(port, N)
+	wait(function() return #accepted == N end)
+	ti = skynet.now() - ti
+	local info = socket.netstat(listen_id)
+	print("rate", info.rate, "accept", info.accept, "throttled", info.throttled, "time", ti)
+	assert(info.rejected == 0 and info.deferred == 0 and info.throttled > 0)
+	-- 20 at once, and 20 in the next second
+	assert(ti >= 80)
+	close(listen_id, accepted, clients)
+end
+
+-- socket.shape is for the connections, it's ignored by the listen socket
+local function test_shape()
+	local listen_id, port, accepted = listen()
+	socket.shape(listen_id, 1)
+	skynet.sleep(0)
+	local clients = connect(port, 10)
+	wait(function() return #accepted == 10 end)
+	assert(socket.netstat(listen_id).rate == nil)
+	close(listen_id, accepted, clients)
+end
+
+skynet.start(function()
+	test_batch(1000)
+	test_shape()
+	test_queue()
+	test_pause()
+	print("accept ok")
+	skynet.exit()
+end)
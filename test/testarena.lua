@@ -0,0 +1,64 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- skynet.kill
+
+-- set snlua_arena = true in config to allocate the small objects of lua services from the arenas
+
+local mode = ...
+
+local OBJECTS = 300000
+
+local function churn(n)
+	local t = {}
+	for i = 1, n do
+		t[i % 1000 + 1] = { i, tostring(i), function() return i end }
+	end
+	return t
+end
+
+local function bench_alloc(n)
+	skynet.yield()
+	collectgarbage()
+	local ti = skynet.hpc()
+	churn(n)
+	ti = (skynet.hpc() - ti) / n
+	print(string.format("alloc : %.0f ns per iteration (4 objects)", ti))
+end
+
+-- kill a service holding the objects, the lua state is closed in this thread
+local function bench_exit()
+	local agent = skynet.newservice(SERVICE_NAME, "agent")
+	local mem = skynet.call(agent, "lua")
+	local ti = skynet.hpc()
+	skynet.kill(agent)
+	ti = (skynet.hpc() - ti) / 1000
+	print(string.format("exit a service of %d objects (%.1f M) : %.0f us", OBJECTS, mem / 1024, ti))
+end
+
+skynet.start(function()
+	if mode == "agent" then
+		local hold = {}
+		for i = 1, OBJECTS do
+			hold[i] = { i }
+		end
+		skynet.dispatch("lua", function()
+			skynet.ret(skynet.pack(collectgarbage "count"))
+		end)
+		return
+	end
+	print("snlua_arena", skynet.getenv "snlua_arena")
+	-- the strings and the tables grow across the size classes
+	local s = ""
+	local t = {}
+	for i = 1, 1000 do
+		s = s .. "x"
+		t[i] = s
+	end
+	for i = 1, 1000 do
+		assert(#t[i] == i)
+	end
+	bench_alloc(1000000)
+	for i = 1, 3 do
+		bench_exit()
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,94 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- skynet.kill
+
+-- set bytecode_cache = "bytecode.cache" in config, and run it twice : the first boot fills the cache
+
+local mode = ...
+
+local FILES = {
+	"lualib/skynet.lua",
+	"lualib/skynet/socket.lua",
+	"lualib/skynet/socketchannel.lua",
+	"lualib/skynet/manager.lua",
+	"lualib/skynet/debug.lua",
+	"lualib/skynet/cluster.lua",
+	"lualib/skynet/snax.lua",
+	"lualib/http/httpd.lua",
+	"lualib/sprotoparser.lua",
+	"lualib/sproto.lua",
+}
+
+-- compile from source, or load the bytecode
+local function bench_load(n)
+	local cache = skynet.cache
+	local ti = skynet.hpc()
+	cache.mode "OFF"
+	for i = 1, n do
+		for _, f in ipairs(FILES) do
+			assert(loadfile(f))
+		end
+	end
+	local compile = (skynet.hpc() - ti) / n / 1000
+	cache.mode "ON"
+	ti = skynet.hpc()
+	for i = 1, n do
+		-- drop the protos shared in process, so the next loadfile goes to the bytecode cache
+		cache.clear()
+		for _, f in ipairs(FILES) do
+			assert(loadfile(f))
+		end
+	end
+	local bytecode = (skynet.hpc() - ti) / n / 1000
+	print(string.format("load %d files : compile %.0f us, bytecode cache %.0f us", #FILES, compile, bytecode))
+end
+
+-- the services launched after cache.clear() load every file like the first boot
+local function bench_launch(n)
+	local cache = skynet.cache
+	local ti = skynet.hpc()
+	for i = 1, n do
+		cache.clear()
+		skynet.kill(skynet.newservice(SERVICE_NAME, "agent"))
+	end
+	ti = (skynet.hpc() - ti) / n / 1000
+	print(string.format("launch an agent (cold) : %.0f us, %.0f launches/s", ti, 1000000 / ti))
+end
+
+skynet.start(function()
+	if mode == "agent" then
+		require "skynet.socket"
+		require "skynet.manager"
+		require "sproto"
+		return
+	end
+	local file = skynet.cache.bytecode()
+	if not file then
+		print "bytecode_cache is off"
+		bench_launch(200)
+		skynet.exit()
+		return
+	end
+	-- the bytecode of a changed file isn't used
+	local tmp = "bytecode_test.lua"
+	local f = assert(io.open(tmp, "wb"))
+	f:write "return 1"
+	f:close()
+	assert(loadfile(tmp)() == 1)
+	skynet.cache.clear()
+	f = assert(io.open(tmp, "wb"))
+	f:write "return 22"
+	f:close()
+	assert(loadfile(tmp)() == 22)
+	skynet.cache.clear()
+	assert(loadfile(tmp)() == 22)
+	os.remove(tmp)
+	-- the errors are the same
+	local _, err = loadfile "not_exist.lua"
+	assert(err:find "cannot open not_exist.lua")
+
+	bench_load(100)
+	bench_launch(200)
+	local _, hit, miss = skynet.cache.bytecode()
+	print("bytecode cache", file, "hit", hit, "miss", miss)
+	skynet.exit()
+end)
@@ -0,0 +1,128 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.register, skynet.launch
+
+local PORT = 8997
+local REPLY = 20	-- the replies of each request
+local gate
+local last	-- the connection id of gate for the last request
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		local id, cmd = msg:match "(%d+) (%a+)"
+		if cmd == "open" then
+			skynet.send(gate, "text", "start " .. id)
+		end
+	end,
+}
+
+-- the agent emits REPLY small messages for each request
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	pack = function(msg) return msg end,
+	unpack = skynet.tostring,
+	dispatch = function(id, _, msg)
+		skynet.ignoreret()	-- session is the socket id
+		last = id
+		local idbuf = string.pack("<I4", id)
+		for i = 1, REPLY do
+			skynet.send(gate, "client", string.pack(">s2", msg .. i) .. idbuf)
+		end
+	end,
+}
+
+local function start_gate(max, coalesce)
+	PORT = PORT + 1
+	gate = skynet.launch("gate", string.format("S .coalesce 127.0.0.1:%d %d %d", PORT, skynet.PTYPE_CLIENT, max))
+	skynet.send(gate, "text", "broker .coalesce")
+	if coalesce then
+		skynet.send(gate, "text", "coalesce " .. coalesce)
+	end
+end
+
+local function read_package(id)
+	local sz = string.unpack(">I2", assert(socket.read(id, 2)))
+	return assert(socket.read(id, sz))
+end
+
+local function test(coalesce)
+	start_gate(4, coalesce)
+	local id = socket.open("127.0.0.1", PORT)
+	local ti = skynet.now()
+	socket.write(id, string.pack(">s2", "hello"))
+	for i = 1, REPLY do
+		assert(read_package(id) == "hello" .. i)
+	end
+	if coalesce == 10 then
+		assert(skynet.now() - ti >= 10)
+	end
+	-- the replies before kick are sent
+	socket.write(id, string.pack(">s2", "bye"))
+	skynet.sleep(2)
+	skynet.send(gate, "text", "kick " .. last)
+	for i = 1, REPLY do
+		assert(read_package(id) == "bye" .. i)
+	end
+	assert(socket.read(id) == false)
+	socket.close(id)
+	skynet.send(gate, "text", "coalesce off")
+	id = socket.open("127.0.0.1", PORT)
+	socket.write(id, string.pack(">s2", "off"))
+	for i = 1, REPLY do
+		assert(read_package(id) == "off" .. i)
+	end
+	socket.close(id)
+	skynet.kill(gate)
+	print("coalesce", coalesce, "ok")
+end
+
+local function bench(coalesce, n, times)
+	start_gate(n, coalesce)
+	local clients = {}
+	for i = 1, n do
+		clients[i] = socket.open("127.0.0.1", PORT)
+	end
+	local co = coroutine.running()
+	local done = 0
+	local req = string.pack(">s2", "x")
+	local expect = 0
+	for i = 1, REPLY do
+		expect = expect + 2 + #("x" .. i)
+	end
+	local ti = skynet.hpc()
+	for _, id in ipairs(clients) do
+		skynet.fork(function()
+			for i = 1, times do
+				socket.write(id, req)
+				assert(socket.read(id, expect))
+			end
+			done = done + 1
+			if done == n then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("%-8s %d clients x %d requests x %d replies : %.1f ms",
+		coalesce and "coalesce" or "off", n, times, REPLY, ti))
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	skynet.kill(gate)
+end
+
+skynet.start(function()
+	skynet.register ".coalesce"
+	test()
+	test(0)
+	test(10)
+	bench(nil, 100, 100)
+	bench(0, 100, 100)
+	skynet.exit()
+end)
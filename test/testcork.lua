@@ -0,0 +1,101 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local function pair()
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = socket.open(addr, port)
+	while not server do
+		skynet.yield()
+	end
+	socket.close(listen_id)
+	return server, client
+end
+
+local function test_flush()
+	local server, client = pair()
+	socket.cork(server)
+	skynet.sleep(1)	-- cork is async
+	for i = 1, 3 do
+		socket.write(server, "hello" .. i)
+	end
+	skynet.sleep(10)
+	local stat = socket.netstat(server)
+	print("flush", "held", stat.wbuffer)
+	assert(stat.write == 0 and stat.wbuffer == 18)
+	socket.flush(server)
+	assert(socket.read(client, 18) == "hello1hello2hello3")
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_threshold()
+	local server, client = pair()
+	socket.cork(server, 1024)
+	skynet.sleep(1)
+	socket.write(server, string.rep("x", 512))
+	skynet.sleep(10)
+	assert(socket.netstat(server).write == 0)
+	socket.write(server, string.rep("y", 512))
+	local data = socket.read(client, 1024)
+	print("threshold", #data)
+	assert(data == string.rep("x", 512) .. string.rep("y", 512))
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_timer()
+	local server, client = pair()
+	socket.cork(server, 0, 100000)	-- 100ms
+	skynet.sleep(1)
+	-- the first package after an idle interval is sent at once
+	socket.write(server, "a")
+	assert(socket.read(client, 1) == "a")
+	local ti = skynet.now()
+	for i = 1, 10 do
+		socket.write(server, "b")
+	end
+	assert(socket.read(client, 10) == string.rep("b", 10))
+	local elapsed = skynet.now() - ti
+	print("timer", "elapsed", elapsed / 100)
+	assert(elapsed >= 5 and elapsed < 50)
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_close()
+	local server, client = pair()
+	socket.cork(server)
+	skynet.sleep(1)
+	socket.write(server, "bye")
+	socket.close(server)
+	assert(socket.readall(client) == "bye")
+	socket.close(client)
+end
+
+local function test_off()
+	local server, client = pair()
+	socket.cork(server)
+	skynet.sleep(1)
+	socket.write(server, "held")
+	socket.cork(server, false)
+	assert(socket.read(client, 4) == "held")
+	socket.write(server, "direct")
+	assert(socket.read(client, 6) == "direct")
+	socket.close(server)
+	socket.close(client)
+end
+
+skynet.start(function()
+	test_flush()
+	test_threshold()
+	test_timer()
+	test_close()
+	test_off()
+	print("cork ok")
+	skynet.exit()
+end)
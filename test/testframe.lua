@@ -0,0 +1,125 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.register, skynet.launch
+
+local function pair(...)
+	local frame = table.pack(...)
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen_id, function(id)
+		socket.frame(id, table.unpack(frame, 1, frame.n))	-- set frame mode before start
+		socket.start(id)
+		server = id
+	end)
+	local client = socket.open(addr, port)
+	while not server do
+		skynet.yield()
+	end
+	socket.close(listen_id)
+	return server, client
+end
+
+local function payloads(max)
+	local r = {}
+	for i = 1, 100 do
+		r[i] = string.rep(string.char(i), (i * 997) % 3000 % (max + 1))
+	end
+	table.insert(r, string.rep("L", math.min(60000, max)))	-- read directly into the frame
+	table.insert(r, "")
+	table.insert(r, "end")
+	return r
+end
+
+local function test_stream(header, endian)
+	local server, client = pair(header, endian)
+	local fmt = (endian == "little" and "<" or ">") .. "s" .. header
+	local data = payloads((1 << (header * 8)) - 1)
+	local expect = table.concat(data)
+	local stream = {}
+	for i, v in ipairs(data) do
+		stream[i] = string.pack(fmt, v)
+	end
+	stream = table.concat(stream)
+	-- write in small pieces, so the headers are split
+	local pos = 1
+	while pos <= #stream do
+		local n = math.random(1, 8192)
+		socket.write(client, stream:sub(pos, pos + n - 1))
+		pos = pos + n
+	end
+	local r = socket.read(server, #expect)
+	assert(r == expect)
+	print("frame", header, endian or "big", #data, #expect)
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_max()
+	local server, client = pair(2, "big", 100)
+	socket.write(client, string.pack(">s2", string.rep("x", 50)))
+	assert(socket.read(server, 50))
+	socket.write(client, string.pack(">s2", string.rep("x", 200)))
+	assert(not socket.read(server, 1))
+	print("frame too large")
+	socket.close(server)
+	socket.close(client)
+end
+
+-- C gate forwards each frame as one message
+local function test_gate()
+	local PORT = 8999
+	local COUNT = 20
+	local co = coroutine.running()
+	local recv = {}
+	local gate
+	skynet.register_protocol {
+		name = "text",
+		id = skynet.PTYPE_TEXT,
+		pack = function(text) return text end,
+		unpack = skynet.tostring,
+		dispatch = function(_, _, msg)
+			local id, cmd = msg:match "(%d+) (%a+)"
+			if cmd == "open" then
+				skynet.send(gate, "text", "start " .. id)
+			end
+		end,
+	}
+	skynet.register_protocol {
+		name = "client",
+		id = skynet.PTYPE_CLIENT,
+		unpack = skynet.tostring,
+		dispatch = function(_, _, msg)
+			skynet.ignoreret()	-- session is the socket id
+			table.insert(recv, msg)
+			if #recv == COUNT then
+				skynet.wakeup(co)
+			end
+		end,
+	}
+	skynet.register ".frametest"
+	gate = skynet.launch("gate", string.format("S .frametest 127.0.0.1:%d %d 16", PORT, skynet.PTYPE_CLIENT))
+	skynet.send(gate, "text", "broker .frametest")
+	local client = socket.open("127.0.0.1", PORT)
+	local stream = {}
+	for i = 1, COUNT do
+		stream[i] = string.pack(">s2", string.rep(tostring(i), i * 100))
+	end
+	socket.write(client, table.concat(stream))
+	skynet.wait(co)
+	for i = 1, COUNT do
+		assert(recv[i] == string.rep(tostring(i), i * 100))
+	end
+	print("gate", #recv)
+	socket.close(client)
+	skynet.kill(gate)
+end
+
+skynet.start(function()
+	test_stream(1)
+	test_stream(2)
+	test_stream(4, "little")
+	test_max()
+	test_gate()
+	print("ok")
+	skynet.exit()
+end)
@@ -0,0 +1,144 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.register, skynet.launch
+
+local PORT = 8996
+local gate
+local sources = {}	-- the shards forward the messages
+local connection = {}	-- the content of message -> the connection id of gate
+local direct = false	-- the bench replies to the shard which owns the connection
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, source, msg)
+		local id, cmd = msg:match "(%d+) (%a+)"
+		if cmd == "open" then
+			-- the shard which owns the connection reports open, start it by the shard or by the gate
+			skynet.send(id % 2 == 0 and source or gate, "text", "start " .. id)
+		end
+	end,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	pack = function(msg) return msg end,
+	unpack = skynet.tostring,
+	dispatch = function(id, source, msg)
+		skynet.ignoreret()	-- session is the socket id
+		sources[source] = true
+		connection[msg] = id
+		-- reply to the shard directly, or by the gate
+		local reply = (direct or id % 2 == 0) and source or gate
+		skynet.send(reply, "client", string.pack(">s2", msg) .. string.pack("<I4", id))
+	end,
+}
+
+local function start_gate(max, shards)
+	PORT = PORT + 1
+	gate = skynet.launch("gate", string.format("S .shardtest 127.0.0.1:%d %d %d %d", PORT, skynet.PTYPE_CLIENT, max, shards))
+	skynet.send(gate, "text", "broker .shardtest")
+end
+
+local function echo(id, msg)
+	socket.write(id, string.pack(">s2", msg))
+	local sz = string.unpack(">I2", assert(socket.read(id, 2)))
+	assert(socket.read(id, sz) == msg)
+end
+
+local function test_shard(n, shards)
+	start_gate(n, shards)
+	sources = {}
+	local clients = {}
+	for i = 1, n do
+		clients[i] = socket.open("127.0.0.1", PORT)
+	end
+	for i = 1, n do
+		echo(clients[i], "hello" .. i)
+	end
+	local count = 0
+	for _ in pairs(sources) do
+		count = count + 1
+	end
+	assert(count == shards)
+	-- kick by the gate
+	skynet.send(gate, "text", "kick " .. connection["hello1"])
+	assert(socket.read(clients[1]) == false)
+	for i = 2, n do
+		echo(clients[i], "again" .. i)
+	end
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	skynet.kill(gate)
+	print("shards", shards, "connections", n, "ok")
+end
+
+-- max connection is counted by the gate which listens
+local function test_max(shards)
+	start_gate(2, shards)
+	local c1 = socket.open("127.0.0.1", PORT)
+	local c2 = socket.open("127.0.0.1", PORT)
+	local c3 = socket.open("127.0.0.1", PORT)
+	echo(c1, "c1")
+	echo(c2, "c2")
+	assert(socket.read(c3) == false)
+	socket.close(c3)
+	-- the shard tells the gate after the connection closed (c2 is handed over to the second shard)
+	socket.close(c2)
+	skynet.sleep(10)
+	local c4 = socket.open("127.0.0.1", PORT)
+	echo(c4, "c4")
+	socket.close(c1)
+	socket.close(c4)
+	skynet.kill(gate)
+	print("shards", shards, "max ok")
+end
+
+-- the clients send the requests at the same time, the replies go by the gate or to the shards directly
+local function bench(shards, n, times)
+	start_gate(n, shards)
+	local clients = {}
+	for i = 1, n do
+		clients[i] = socket.open("127.0.0.1", PORT)
+	end
+	local co = coroutine.running()
+	local done = 0
+	local ti = skynet.hpc()
+	for _, id in ipairs(clients) do
+		skynet.fork(function()
+			for _ = 1, times do
+				echo(id, "x")
+			end
+			done = done + 1
+			if done == n then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("shards %d%s : %d clients x %d echoes : %.1f ms",
+		shards, direct and " (direct)" or "", n, times, ti))
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	skynet.kill(gate)
+end
+
+skynet.start(function()
+	skynet.register ".shardtest"
+	test_shard(200, 1)
+	test_shard(200, 4)
+	test_max(1)
+	test_max(2)
+	bench(1, 100, 100)
+	bench(4, 100, 100)
+	direct = true
+	bench(4, 100, 100)
+	direct = false
+	skynet.exit()
+end)
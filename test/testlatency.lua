@@ -0,0 +1,37 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+skynet.start(function()
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local COUNT = 20
+	local recv = 0
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		skynet.fork(function()
+			while recv < COUNT do
+				recv = recv + #assert(socket.read(id))
+			end
+			socket.close(id)
+		end)
+	end)
+	local client = socket.open(addr, port)
+	for i = 1, COUNT do
+		socket.write(client, "x")
+		skynet.sleep(1)	-- one data message for each write
+	end
+	while recv < COUNT do
+		skynet.sleep(1)
+	end
+	socket.close(client)
+	local n = 0
+	for i, c in ipairs(socket.netstat(listen_id).latency) do
+		n = n + c
+		if c > 0 then
+			print(string.format("latency < %dus", 1 << (i - 1)), c)
+		end
+	end
+	print("data messages", n)
+	assert(n == COUNT)
+	socket.close(listen_id)
+	skynet.exit()
+end)
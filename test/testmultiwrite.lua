@@ -0,0 +1,92 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local function pairs_n(n)
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local servers = {}
+	local co
+	socket.start(listen_id, function(id)
+		servers[#servers+1] = id
+		socket.start(id)
+		if #servers == n and co then
+			skynet.wakeup(co)
+		end
+	end)
+	local clients = {}
+	for i = 1, n do
+		clients[i] = socket.open(addr, port)
+	end
+	if #servers < n then
+		co = coroutine.running()
+		skynet.wait(co)
+	end
+	socket.close(listen_id)
+	return servers, clients
+end
+
+local function close_all(list)
+	for _, id in ipairs(list) do
+		socket.close(id)
+	end
+end
+
+local function test()
+	local servers, clients = pairs_n(4)
+	socket.multiwrite(servers, "hello")
+	socket.multiwrite(servers, { "wor", "ld" })
+	for _, id in ipairs(clients) do
+		assert(socket.read(id, 10) == "helloworld")
+	end
+	-- closed or invalid socket in the list is skipped
+	socket.close(servers[1])
+	local ids = { servers[1], servers[2], 0x7fffffff, servers[3], servers[4] }
+	assert(socket.multiwrite(ids, "bye"))
+	assert(socket.read(clients[1]) == false)
+	for i = 2, 4 do
+		assert(socket.read(clients[i], 3) == "bye")
+	end
+	assert(not socket.multiwrite({}, "empty"))
+	close_all(servers)
+	close_all(clients)
+	print("multiwrite ok")
+end
+
+local function bench(n, count, size, multi)
+	local servers, clients = pairs_n(n)
+	local msg = string.rep("x", size)
+	local done = 0
+	local co = coroutine.running()
+	for _, id in ipairs(clients) do
+		skynet.fork(function()
+			assert(socket.read(id, count * size))
+			done = done + 1
+			if done == n then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	local ti = skynet.hpc()
+	for i = 1, count do
+		if multi then
+			socket.multiwrite(servers, msg)
+		else
+			for _, id in ipairs(servers) do
+				socket.write(id, msg)
+			end
+		end
+	end
+	local send = skynet.hpc() - ti
+	skynet.wait(co)
+	local total = skynet.hpc() - ti
+	print(string.format("%-10s %d sockets x %d x %d bytes : send %.1f ms, all received %.1f ms",
+		multi and "multiwrite" or "write", n, count, size, send / 1000000, total / 1000000))
+	close_all(servers)
+	close_all(clients)
+end
+
+skynet.start(function()
+	test()
+	bench(200, 100, 1024, false)
+	bench(200, 100, 1024, true)
+	skynet.exit()
+end)
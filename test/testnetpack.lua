@@ -0,0 +1,159 @@
+local skynet = require "skynet"
+local netpack = require "skynet.netpack"
+local driver = require "skynet.socketdriver"
+
+local SKYNET_SOCKET_TYPE_DATA = 1
+local filter = netpack.filter
+
+-- fake a socket message (struct skynet_socket_message) of data received by fd, as the socket thread does
+local function message(fd, data)
+	local buf, sz = driver.str2p(data)
+	local addr = tonumber(tostring(buf):match "0x(%x+)", 16)
+	return driver.str2p(string.pack("i4i4i4i4jj", SKYNET_SOCKET_TYPE_DATA, fd, sz, 0, addr, 0))
+end
+
+local function feed(q, fd, data)
+	local msg, sz = message(fd, data)
+	local r = table.pack(filter(q, msg, sz))
+	netpack.tostring(msg, sz)	-- free the message
+	return table.unpack(r, 1, r.n)
+end
+
+local function pack(...)
+	local r = {}
+	for i, s in ipairs {...} do
+		r[i] = string.pack(">s2", s)
+	end
+	return table.concat(r)
+end
+
+local function pop_all(q)
+	local r = {}
+	for fd, msg, sz in netpack.pop, q do
+		r[#r+1] = fd .. ":" .. netpack.tostring(msg, sz)
+	end
+	return table.concat(r, ",")
+end
+
+local function test()
+	local q, type, fd, msg, sz = feed(nil, 1, pack "hello")
+	assert(type == "data" and fd == 1 and netpack.tostring(msg, sz) == "hello")
+	q, type = feed(q, 1, pack("a", "bc", "def"))
+	assert(type == "more" and pop_all(q) == "1:a,1:bc,1:def")
+	-- the package is split in the header and body
+	local stream = pack("hello", "abc", "xy")
+	assert(select("#", feed(q, 2, stream:sub(1,1))) == 1)
+	assert(select("#", feed(q, 2, stream:sub(2,5))) == 1)
+	q, type = feed(q, 2, stream:sub(6, 13))
+	assert(type == "more" and pop_all(q) == "2:hello,2:abc")
+	q, type, fd, msg, sz = feed(q, 2, stream:sub(14))
+	assert(type == "data" and fd == 2 and netpack.tostring(msg, sz) == "xy")
+	-- empty package
+	q, type, fd, msg, sz = feed(q, 2, "\0\0")
+	assert(type == "data" and netpack.tostring(msg, sz) == "")
+	-- uncomplete packages of many fds
+	stream = pack(string.rep("x", 100), "y")
+	for i = 1, 1000 do
+		feed(q, 100 + i, stream:sub(1, 50))
+	end
+	for i = 1000, 1, -1 do
+		q, type = feed(q, 100 + i, stream:sub(51))
+		assert(type == "more")
+		assert(pop_all(q) == string.format("%d:%s,%d:y", 100 + i, string.rep("x", 100), 100 + i))
+	end
+	-- the queue grows
+	local many = {}
+	for i = 1, 3000 do
+		many[i] = tostring(i)
+	end
+	q, type = feed(q, 3, pack(table.unpack(many)))
+	assert(type == "more")
+	for i = 1, 3000 do
+		local fd, msg, sz = netpack.pop(q)
+		assert(fd == 3 and netpack.tostring(msg, sz) == many[i])
+	end
+	assert(netpack.pop(q) == nil)
+	-- clear the uncomplete packages and the queue
+	feed(q, 4, stream:sub(1, 10))
+	feed(q, 5, pack("a", "b"))
+	netpack.clear(q)
+	assert(netpack.pop(q) == nil)
+	assert(select("#", feed(q, 4, pack "new")) == 5)
+	-- the queue without clear is freed by gc
+	assert(debug.getmetatable(q).__gc)
+	feed(q, 6, stream:sub(1, 10))
+	q = nil
+	collectgarbage()
+end
+
+local N = 50000
+
+-- every connection sends n packages in one read
+local function bench_whole(n, size)
+	local tmp = {}
+	for i = 1, n do
+		tmp[i] = string.rep("x", size)
+	end
+	local data = pack(table.unpack(tmp))
+	local msgs = {}
+	for i = 1, N do
+		msgs[i] = { message(i, data) }
+	end
+	local q
+	local ti = skynet.hpc()
+	for i = 1, N do
+		local m = msgs[i]
+		local type, fd, msg, sz
+		q, type, fd, msg, sz = filter(q, m[1], m[2])
+		if type == "data" then
+			skynet.trash(msg, sz)
+		else
+			for fd, msg, sz in netpack.pop, q do
+				skynet.trash(msg, sz)
+			end
+		end
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	for i = 1, N do
+		netpack.tostring(msgs[i][1], 0)
+	end
+	print(string.format("%d connections x %d x %d bytes : %.1f ms", N, n, size, ti))
+	netpack.clear(q)
+end
+
+-- the package of every connection is split into 2 reads
+local function bench_split(size)
+	local data = pack(string.rep("x", size))
+	local msgs = {}
+	for i = 1, N do
+		msgs[i] = { message(i, data:sub(1, size // 2)) }
+		msgs[N + i] = { message(i, data:sub(size // 2 + 1)) }
+	end
+	local q
+	local ti = skynet.hpc()
+	for i = 1, N * 2 do
+		local m = msgs[i]
+		local type, fd, msg, sz
+		q, type, fd, msg, sz = filter(q, m[1], m[2])
+		if type then
+			skynet.trash(msg, sz)
+		end
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	for i = 1, N * 2 do
+		netpack.tostring(msgs[i][1], 0)
+	end
+	print(string.format("%d connections x %d bytes in 2 reads : %.1f ms", N, size, ti))
+	netpack.clear(q)
+end
+
+skynet.start(function()
+	test()
+	print("netpack ok")
+	for _, size in ipairs { 64, 4096 } do
+		bench_whole(1, size)
+		bench_whole(4, size)
+		bench_split(size)
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,90 @@
+local skynet = require "skynet"
+local driver = require "skynet.socketdriver"
+
+local function header_block(lines)
+	local tmp = { "GET /index.html HTTP/1.1" }
+	for i = 1, lines do
+		tmp[#tmp+1] = string.format("X-Header-%d: %s", i, string.rep("v", 60))
+	end
+	return table.concat(tmp, "\r\n") .. "\r\n\r\n"
+end
+
+local function push(buffer, pool, str)
+	local msg, sz = driver.str2p(str)
+	return driver.push(buffer, pool, msg, sz)
+end
+
+-- split str into chunks of size n, as they arrive from the socket
+local function chunks(str, n)
+	local r = {}
+	for i = 1, #str, n do
+		r[#r+1] = str:sub(i, i + n - 1)
+	end
+	return r
+end
+
+local function test()
+	local buffer = driver.buffer()
+	local pool = {}
+	push(buffer, pool, "hello\r")
+	assert(not driver.readline(buffer, nil, "\r\n"))
+	-- the separator crosses the nodes
+	push(buffer, pool, "\nwor")
+	assert(driver.readline(buffer, nil, "\r\n"))
+	assert(driver.readline(buffer, nil, "\n"))	-- another separator
+	assert(not driver.readline(buffer, nil, "\r\n\r\n"))
+	assert(driver.readline(buffer, pool, "\r\n") == "hello")
+	push(buffer, pool, "ld\r")
+	push(buffer, pool, "\r")
+	push(buffer, pool, "\n\r\n")
+	assert(driver.readline(buffer, pool, "\r\n") == "world\r")
+	assert(driver.readline(buffer, pool, "\r\n") == "")
+	assert(not driver.readline(buffer, pool, "\r\n"))
+	push(buffer, pool, "aaab")
+	assert(driver.readline(buffer, pool, "aab") == "a")
+	driver.clear(buffer, pool)
+	print("readline ok")
+end
+
+local function bench(name, block, chunk, n, f)
+	local data = chunks(block, chunk)
+	local buffer = driver.buffer()
+	local pool = {}
+	local ti = skynet.hpc()
+	for i = 1, n do
+		f(buffer, pool, data)
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("%-12s %6d bytes x %d : %.2f ms", name, #block, n, ti))
+end
+
+-- read the header lines one by one
+local function read_lines(buffer, pool, data)
+	for _, v in ipairs(data) do
+		push(buffer, pool, v)
+	end
+	while driver.readline(buffer, pool, "\r\n") ~= "" do
+	end
+end
+
+-- wait for the whole header block, check it after each chunk arrives (as socket.readline(id, "\r\n\r\n"))
+local function read_block(buffer, pool, data)
+	for _, v in ipairs(data) do
+		push(buffer, pool, v)
+		if driver.readline(buffer, nil, "\r\n\r\n") then
+			break
+		end
+	end
+	assert(driver.readline(buffer, pool, "\r\n\r\n"))
+end
+
+skynet.start(function()
+	test()
+	for _, lines in ipairs { 16, 64, 256 } do
+		local block = header_block(lines)
+		bench("lines", block, 512, 1000, read_lines)
+		bench("block", block, 512, 1000, read_block)
+		bench("block/64", block, 64, 100, read_block)
+	end
+	skynet.exit()
+end)
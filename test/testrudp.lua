@@ -0,0 +1,175 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local TOTAL = 16 * 1024 * 1024
+local CHUNK = 16 * 1024
+local RELAY_PORT = 8870
+
+-- the sessions are used like tcp connections
+local function server(mode)
+	local listen_id, addr, port = socket.rudp_listen("127.0.0.1", 0)
+	socket.start(listen_id, function(id, from)
+		skynet.fork(function()
+			socket.start(id)
+			local n = 0
+			while true do
+				local s = socket.read(id)
+				if not s then
+					break
+				end
+				if mode == "echo" then
+					socket.write(id, s)
+				elseif mode == "count" then
+					n = n + #s
+					if n == TOTAL then
+						socket.write(id, "ok")
+					end
+				elseif s == "quit" then
+					break
+				end
+			end
+			socket.close(id)
+		end)
+	end)
+	return listen_id, port
+end
+
+-- forward the datagrams between the client and the endpoint, and drop some of them
+local function relay(port, loss)
+	local client, front
+	local back = socket.udp(function(str)
+		if math.random() >= loss then
+			socket.sendto(front, client, str)
+		end
+	end)
+	socket.udp_connect(back, "127.0.0.1", port)
+	front = socket.udp(function(str, from)
+		client = from
+		if math.random() >= loss then
+			socket.write(back, str)
+		end
+	end, "127.0.0.1", RELAY_PORT)
+	return function()
+		socket.close(front)
+		socket.close(back)
+	end
+end
+
+local function echo(id, msg)
+	socket.write(id, msg)
+	assert(socket.read(id, #msg) == msg)
+end
+
+local function test_echo()
+	local listen_id, port = server "echo"
+	local id = assert(socket.rudp_open("127.0.0.1", port))
+	echo(id, "hello")
+	-- the stream is split into segments of mtu, and the order is kept
+	echo(id, string.rep("0123456789abcdef", 100000))
+	socket.write(id, "line1\nline2\n")
+	assert(socket.readline(id) == "line1")
+	assert(socket.readline(id) == "line2")
+	local info = socket.netstat(id)
+	print("type", info.type, "peer", info.peer, "rtt", info.rtt, "rto", info.rto, "cwnd", info.cwnd, "resend", info.resend)
+	assert(info.type == "RUDP" and info.read > 1600000)
+	socket.close(id)
+
+	-- many sessions of an endpoint
+	local clients = {}
+	for i = 1, 20 do
+		clients[i] = assert(socket.rudp_open("127.0.0.1", port, 1000 + i))
+	end
+	for i = 1, 20 do
+		echo(clients[i], "session" .. i)
+	end
+	for i = 1, 20 do
+		socket.close(clients[i])
+	end
+	assert(socket.netstat(listen_id).accept >= 20)
+	-- the sessions are closed with the endpoint, so wait for the FIN of clients
+	skynet.sleep(10)
+	socket.close(listen_id)
+	print("rudp echo ok")
+end
+
+-- the peer closes the session : read returns false
+local function test_close()
+	local listen_id, port = server "quit"
+	local id = assert(socket.rudp_open("127.0.0.1", port))
+	socket.write(id, "quit")
+	assert(socket.read(id) == false)
+	socket.close(id)
+	socket.close(listen_id)
+	print("rudp close ok")
+end
+
+local function test_loss(loss)
+	local listen_id, port = server "echo"
+	local close_relay = relay(port, loss)
+	local id = assert(socket.rudp_open("127.0.0.1", RELAY_PORT))
+	local msg = string.rep("x", 256 * 1024) .. "end"
+	local ti = skynet.now()
+	for i = 1, 4 do
+		echo(id, msg)
+	end
+	local info = socket.netstat(id)
+	print(string.format("loss %d%% : %.2f s, rtt %d, rto %d, resend %d", loss * 100, (skynet.now() - ti) / 100,
+		info.rtt, info.rto, info.resend))
+	assert(info.resend > 0)
+	socket.close(id)
+	close_relay()
+	socket.close(listen_id)
+end
+
+-- the replies of server are sent from another address, the dial session ignores them
+local function test_spoof()
+	local listen_id, port = server "echo"
+	local client, front
+	local spoof = socket.udp(function() end)
+	local back = socket.udp(function(str)
+		socket.sendto(spoof, client, str)
+	end)
+	socket.udp_connect(back, "127.0.0.1", port)
+	front = socket.udp(function(str, from)
+		client = from
+		socket.write(back, str)
+	end, "127.0.0.1", RELAY_PORT + 1)
+	local id = assert(socket.rudp_open("127.0.0.1", RELAY_PORT + 1))
+	socket.write(id, "hello")
+	local r
+	skynet.fork(function()
+		r = socket.read(id)
+	end)
+	skynet.sleep(50)
+	assert(r == nil)
+	socket.close(id)
+	socket.close(front)
+	socket.close(back)
+	socket.close(spoof)
+	socket.close(listen_id)
+	print("rudp spoof ok")
+end
+
+local function bench()
+	local listen_id, port = server "count"
+	local id = assert(socket.rudp_open("127.0.0.1", port))
+	local chunk = string.rep("x", CHUNK)
+	local ti = skynet.hpc()
+	for i = 1, TOTAL // CHUNK do
+		socket.write(id, chunk)
+	end
+	assert(socket.read(id, 2) == "ok")
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("rudp %d MB : %.1f ms, %.1f MB/s", TOTAL // (1024 * 1024), ti, TOTAL / (1024 * 1024) / (ti / 1000)))
+	socket.close(id)
+	socket.close(listen_id)
+end
+
+skynet.start(function()
+	test_echo()
+	test_close()
+	test_loss(0.1)
+	test_spoof()
+	bench()
+	skynet.exit()
+end)
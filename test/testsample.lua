@@ -0,0 +1,134 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- skynet.kill
+
+local mode = ...
+
+local CONSOLE_PORT = 8123
+
+local function hot_a(n)
+	local s = 0
+	for i = 1, n do
+		s = s + i % 7
+	end
+	return s
+end
+
+local function hot_b(n)
+	local t = {}
+	for i = 1, n do
+		t[i % 100 + 1] = i
+	end
+	return #t
+end
+
+local msg = {}
+for i = 1, 100 do
+	msg[i] = { id = i, name = tostring(i) }
+end
+
+-- the time in C is charged to the C frame
+local function hot_c(n)
+	for i = 1, n do
+		skynet.unpack(skynet.pack(msg))
+	end
+end
+
+-- hot_a takes most of the time
+local function burn(ti)
+	local stop = skynet.hpc() + ti * 1000000000
+	local n = 0
+	while skynet.hpc() < stop do
+		hot_a(20000)
+		hot_b(4000)
+		hot_c(1)
+		n = n + 1
+	end
+	return n
+end
+
+-- the hook of the user survives the sampling
+local function burn_hooked(ti)
+	local count = 0
+	local function hook()
+		count = count + 1
+	end
+	debug.sethook(hook, "", 1000)
+	local n = burn(ti)
+	local h = debug.gethook()
+	debug.sethook()
+	assert(h == hook and count > 0)
+	return n
+end
+
+local function samples(folded, name)
+	local n = 0
+	for stack, count in folded:gmatch "([^\n]+) (%d+)" do
+		if stack:find(name .. "@", 1, true) then
+			n = n + tonumber(count)
+		end
+	end
+	return n
+end
+
+-- the rounds of burn in a second, with or without sampling
+local function bench(agent)
+	local ti = 1
+	local plain = skynet.call(agent, "lua", ti)
+	skynet.call(agent, "debug", "SAMPLE", 100)
+	local sampling = skynet.call(agent, "lua", ti)
+	skynet.call(agent, "debug", "SAMPLE")
+	print(string.format("burn : %d rounds/s, %d rounds/s with sampling at 100 Hz", plain / ti, sampling / ti))
+end
+
+-- download the folded stacks by http from the debug console
+local function console(agent)
+	skynet.newservice("debug_console", CONSOLE_PORT)
+	local addr = skynet.address(agent)
+	-- burn after the console starts sampling
+	skynet.fork(function()
+		skynet.sleep(20)
+		skynet.send(agent, "lua", 0.5)
+	end)
+	local id = socket.open("127.0.0.1", CONSOLE_PORT)
+	socket.write(id, string.format("GET /sample/%s/1 HTTP/1.1\r\n\r\n", addr))
+	local result = socket.readall(id)
+	socket.close(id)
+	assert(result:find "<CMD OK>")
+	assert(samples(result, "hot_a") > 0)
+	print("console ok")
+end
+
+skynet.start(function()
+	if mode == "agent" then
+		skynet.dispatch("lua", function(_, _, ti, hooked)
+			skynet.ret(skynet.pack(hooked and burn_hooked(ti) or burn(ti)))
+		end)
+		return
+	end
+	local agent = skynet.newservice(SERVICE_NAME, "agent")
+	skynet.call(agent, "debug", "SAMPLE", 100)
+	skynet.call(agent, "lua", 1)
+	-- the idle time isn't sampled
+	skynet.sleep(50)
+	local folded = skynet.call(agent, "debug", "SAMPLE")
+	local a, b = samples(folded, "hot_a"), samples(folded, "hot_b")
+	local c = samples(folded, "pack")	-- pack and unpack
+	local total = samples(folded, "")
+	print(folded)
+	print(string.format("samples %d, hot_a %d, hot_b %d, pack %d", total, a, b, c))
+	assert(total > 80 and total <= 110 and a > b and b > 0 and c > 0)
+	-- with a hook of the user
+	skynet.call(agent, "debug", "SAMPLE", 100)
+	skynet.call(agent, "lua", 0.5, true)
+	folded = skynet.call(agent, "debug", "SAMPLE")
+	total = samples(folded, "")
+	print(string.format("samples %d with a hook of the user", total))
+	assert(total > 30 and total <= 60)
+	-- stopped
+	assert(skynet.call(agent, "debug", "SAMPLE") == nil)
+	bench(agent)
+	console(agent)
+	skynet.kill(agent)
+	skynet.exit()
+end)
@@ -0,0 +1,77 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local FILE = "./test/testsendfile.lua"
+
+local function readfile(filename)
+	local f = assert(io.open(filename, "rb"))
+	local content = f:read "a"
+	f:close()
+	return content
+end
+
+local function bigfile(n)
+	local filename = os.tmpname()
+	local f = assert(io.open(filename, "wb"))
+	for i = 1, (n or 1) * 64 * 1024 do
+		f:write(string.format("%063d\n", i))	-- 4M bytes
+	end
+	f:close()
+	return filename
+end
+
+skynet.start(function()
+	local content = readfile(FILE)
+	local big = bigfile()
+	local big_content = readfile(big)
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen_id, function(id, addr)
+		socket.start(id)
+		socket.write(id, "HEAD")
+		local n = socket.sendfile(id, FILE)
+		assert(n == #content)
+		n = socket.sendfile(id, FILE, 6, 10)	-- a part of file
+		assert(n == 10)
+		n = socket.sendfile(id, big)	-- large file would be blocked by socket buffer
+		assert(n == #big_content)
+		socket.write(id, "TAIL")
+		socket.close(id)
+	end)
+
+	local fd = socket.open(addr, port)
+	local tmp = {}
+	while true do
+		local str = socket.read(fd)
+		if not str then
+			break
+		end
+		tmp[#tmp+1] = str
+	end
+	local data = table.concat(tmp)
+	socket.close(fd)
+	socket.close(listen_id)
+	assert(data == "HEAD" .. content .. content:sub(7, 16) .. big_content .. "TAIL")
+	print("sendfile ok", #data)
+
+	-- the peer closes before the file is sent out, larger than the socket buffers
+	local done
+	os.remove(big)
+	big = bigfile(16)
+	listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen_id, function(id, addr)
+		socket.start(id)
+		done = table.pack(socket.sendfile(id, big))
+		socket.close(id)
+	end)
+	fd = socket.open(addr, port)
+	assert(socket.read(fd, 1024))
+	socket.close(fd)
+	while not done do
+		skynet.sleep(1)
+	end
+	assert(done[1] == false)
+	socket.close(listen_id)
+	os.remove(big)
+	print("sendfile closed by peer", done[2])
+	skynet.exit()
+end)
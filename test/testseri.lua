@@ -0,0 +1,214 @@
+local skynet = require "skynet"
+
+local function small()
+	return { 1, 2, 3, "hello", x = 1.5, y = true, name = "skynet" }
+end
+
+-- about 10KB
+local function medium()
+	local t = {}
+	for i = 1, 200 do
+		t[i] = { id = i, name = "item" .. i, count = i * 100, price = i / 3, tags = { "a", "b" } }
+	end
+	return t
+end
+
+local function nested()
+	local t = { leaf = "bottom" }
+	for i = 1, 30 do
+		t = { level = i, child = t, list = { i, i + 1, i + 2 } }
+	end
+	return t
+end
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function bench(name, obj, n)
+	skynet.yield()	-- avoid the warning of endless loop
+	local msg, sz = skynet.pack(obj)
+	assert(equal(skynet.unpack(msg, sz), obj))
+	skynet.trash(msg, sz)
+	local pack, trash = skynet.pack, skynet.trash
+	local ti = skynet.hpc()
+	for i = 1, n do
+		trash(pack(obj))
+	end
+	ti = (skynet.hpc() - ti) / n
+	print(string.format("%-8s %6d bytes : pack %8.0f ns", name, sz, ti))
+end
+
+-- format 1 and 2 : the size, pack and unpack
+local function bench_format(name, obj, n)
+	skynet.yield()
+	local unpack, trash = skynet.unpack, skynet.trash
+	for _, pack in ipairs { skynet.pack, skynet.pack2 } do
+		local msg, sz = pack(obj)
+		assert(equal(unpack(msg, sz), obj))
+		local ti = skynet.hpc()
+		for i = 1, n do
+			trash(pack(obj))
+		end
+		local tp = (skynet.hpc() - ti) / n
+		ti = skynet.hpc()
+		for i = 1, n do
+			unpack(msg, sz)
+		end
+		local tu = (skynet.hpc() - ti) / n
+		trash(msg, sz)
+		print(string.format("%-8s format %d %6d bytes : pack %8.0f ns, unpack %8.0f ns", name, pack == skynet.pack and 1 or 2, sz, tp, tu))
+	end
+end
+
+local function roundtrip(...)
+	local msg, sz = skynet.pack2(...)
+	local r = table.pack(skynet.unpack(msg, sz))
+	skynet.trash(msg, sz)
+	local n = select("#", ...)
+	assert(r.n == n)
+	for i = 1, n do
+		assert(equal(r[i], (select(i, ...))))
+	end
+	return sz
+end
+
+local function test_format2()
+	roundtrip(small(), medium(), nested())
+	roundtrip(nil, true, 1, "string", "string", { "string", string = "string" })
+	-- mixed keys, the keys beyond the array part, too many keys and long keys are packed as plain tables
+	roundtrip({ 1, 2, [4] = 4, x = 1 }, { [1.5] = 1, x = 1 }, { [true] = 1 }, { [string.rep("k", 100)] = 1 })
+	local many = {}
+	for i = 1, 100 do
+		many["key" .. i] = i
+	end
+	roundtrip(many, many)
+	-- the string table and the shape table are full
+	local t = {}
+	for i = 1, 1000 do
+		t[i] = { ["k" .. i] = "value" .. i, x = i }
+	end
+	roundtrip(t, t)
+	-- __pairs
+	local proxy = setmetatable({}, { __pairs = function() return next, { uid = 1, name = "proxy" } end })
+	local msg, sz = skynet.pack2 { proxy, proxy, { uid = 2, name = "raw" } }
+	local r = skynet.unpack(msg, sz)
+	skynet.trash(msg, sz)
+	assert(equal(r, { { uid = 1, name = "proxy" }, { uid = 1, name = "proxy" }, { uid = 2, name = "raw" } }))
+	-- the shapes are referenced
+	local rows = {}
+	for i = 1, 100 do
+		rows[i] = { uid = i, pos = { x = i, y = i }, hp = 100 }
+	end
+	msg, sz = skynet.pack(rows)
+	local sz2 = roundtrip(rows)
+	print("format 2", sz2, "bytes, format 1", sz, "bytes")
+	assert(sz2 < sz)
+	skynet.trash(msg, sz)
+	-- the invalid references
+	for _, s in ipairs { "\7\0", "\15\2\1", "\23\2\1\2\1", "\31\2\1\2\1" } do
+		assert(not pcall(skynet.unpack, s))
+	end
+end
+
+local function test_schema()
+	local Player = skynet.packschema("player", { "uid:int", "x:number", "y:number", "hp:int32", "alive:boolean", "name:string", "extra" })
+	-- the same name and fields, the same schema
+	assert(skynet.packschema("player", { "uid:int", "x:number", "y:number", "hp:int32", "alive:boolean", "name:string", "extra:any" }) == Player)
+	local p = setmetatable({ uid = 1 << 40, x = 1.5, y = -2, hp = 100, alive = true, name = "skynet", extra = { 1, 2, 3 }, ignored = 1 }, Player)
+	local msg, sz = skynet.pack(p, { p, p }, "end")
+	local r1, r2, r3 = skynet.unpack(msg, sz)
+	skynet.trash(msg, sz)
+	assert(getmetatable(r1) == Player and r1.ignored == nil)
+	r1.ignored = 1
+	assert(equal(r1, p) and r2[1].name == "skynet" and getmetatable(r2[2]) == Player and r3 == "end")
+	msg, sz = skynet.pack2(p, p)
+	r1, r2 = skynet.unpack(msg, sz)
+	skynet.trash(msg, sz)
+	assert(r1.name == "skynet" and r2.uid == 1 << 40)
+	-- the type of field
+	p.hp = 1.5
+	assert(not pcall(skynet.pack, p))
+	p.hp = 1 << 40
+	assert(not pcall(skynet.pack, p))
+	p.hp = 100
+	p.name = nil
+	assert(not pcall(skynet.pack, p))
+	p.name = "skynet"
+	-- no conversion from string, nor from nil to false
+	p.uid = "1"
+	assert(not pcall(skynet.pack, p))
+	p.uid = 1
+	p.x = "1.5"
+	assert(not pcall(skynet.pack, p))
+	p.x = 1.5
+	p.alive = nil
+	assert(not pcall(skynet.pack, p))
+	p.alive = false
+	-- the receiver without the schema
+	local s = skynet.packstring(p)
+	local ok, err = pcall(skynet.unpack, s:sub(1,1) .. "\0\0\0\0" .. s:sub(6))
+	assert(not ok and err:find "Unknown schema")
+	print("schema ok")
+end
+
+local function bench_schema(n)
+	skynet.yield()
+	local Player = skynet.packschema("player", { "uid:int", "x:number", "y:number", "hp:int32", "alive:boolean", "name:string", "extra" })
+	local plain = { uid = 10001, x = 1.5, y = 2.5, hp = 100, alive = true, name = "player", extra = false }
+	local record = setmetatable({}, Player)
+	for k, v in pairs(plain) do
+		record[k] = v
+	end
+	local pack, unpack, trash = skynet.pack, skynet.unpack, skynet.trash
+	for _, obj in ipairs { plain, record } do
+		local msg, sz = pack(obj)
+		local ti = skynet.hpc()
+		for i = 1, n do
+			trash(pack(obj))
+		end
+		local tp = (skynet.hpc() - ti) / n
+		ti = skynet.hpc()
+		for i = 1, n do
+			unpack(msg, sz)
+		end
+		local tu = (skynet.hpc() - ti) / n
+		trash(msg, sz)
+		print(string.format("%-8s %6d bytes : pack %8.0f ns, unpack %8.0f ns", obj == plain and "generic" or "schema", sz, tp, tu))
+	end
+end
+
+skynet.start(function()
+	-- the buffer grows across the boundaries of the initial buffer
+	for _, len in ipairs { 0, 1, 127, 128, 129, 4095, 4096, 65536, 1000000 } do
+		local s = string.rep("x", len)
+		local msg, sz = skynet.pack(s, len, s)
+		local a, b, c = skynet.unpack(msg, sz)
+		assert(a == s and b == len and c == s)
+		skynet.trash(msg, sz)
+	end
+	bench("small", small(), 200000)
+	bench("medium", medium(), 5000)
+	bench("nested", nested(), 50000)
+	test_format2()
+	bench_format("small", small(), 200000)
+	bench_format("medium", medium(), 5000)
+	bench_format("nested", nested(), 50000)
+	test_schema()
+	bench_schema(200000)
+	print("seri ok")
+	skynet.exit()
+end)
@@ -0,0 +1,100 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local function pair()
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = socket.open(addr, port)
+	while not server do
+		skynet.yield()
+	end
+	socket.close(listen_id)
+	return server, client
+end
+
+local function test_rate()
+	local server, client = pair()
+	local SIZE = 1024 * 1024
+	socket.shape(server, SIZE // 2)	-- 512K/s, and the bucket is full at beginning
+	local ti = skynet.now()
+	socket.write(server, string.rep("x", SIZE))
+	assert(#socket.read(client, SIZE) == SIZE)
+	local elapsed = skynet.now() - ti
+	print("rate", "elapsed", elapsed / 100, "throttled", socket.netstat(server).throttled)
+	assert(elapsed >= 80)
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_drop()
+	local server, client = pair()
+	socket.shape(server, 1024, 8 * 1024, "drop")
+	for i = 1, 64 do
+		socket.lwrite(server, string.rep("x", 1024))
+	end
+	skynet.sleep(10)	-- wait the socket thread
+	local stat = socket.netstat(server)
+	print("drop", "dropped", stat.dropped, "wpeak", stat.wpeak)
+	assert(stat.dropped > 0 and stat.wpeak <= 8 * 1024)
+	-- the high priority packages are queued beyond the limit
+	socket.write(server, string.rep("y", 16 * 1024))
+	skynet.sleep(10)
+	assert(socket.netstat(server).dropped == stat.dropped)
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_close()
+	local server, client = pair()
+	socket.shape(server, 1024, 8 * 1024, "close")
+	skynet.sleep(1)	-- shape is async, don't let the first write go out directly before it
+	for i = 1, 64 do
+		socket.write(server, string.rep("x", 1024))
+	end
+	local ok = socket.read(client, 64 * 1024)
+	print("close", ok)
+	assert(not ok)
+	socket.close(server)
+	socket.close(client)
+end
+
+local function test_pause()
+	local server, client = pair()
+	socket.shape(server, 8 * 1024, 8 * 1024, "pause")
+	skynet.sleep(1)
+	-- beyond the limit, stop reading until the send buffer drains to 4K (about 0.5s)
+	socket.write(server, string.rep("x", 16 * 1024))
+	skynet.sleep(1)
+	socket.write(client, "ping")
+	local ti = skynet.now()
+	-- socket.read starts the socket paused by the service, the policy still holds it
+	socket.pause(server)
+	assert(socket.read(server, 4) == "ping")
+	local elapsed = skynet.now() - ti
+	print("pause", "elapsed", elapsed / 100)
+	assert(elapsed >= 30)
+	assert(#socket.read(client, 16 * 1024) == 16 * 1024)
+	-- the policy releases the socket after the drain, but the service still pauses it
+	socket.write(server, string.rep("y", 16 * 1024))
+	socket.pause(server)
+	assert(#socket.read(client, 16 * 1024) == 16 * 1024)
+	local read = socket.netstat(server).read
+	socket.write(client, "pong")
+	skynet.sleep(10)
+	assert(socket.netstat(server).read == read)
+	assert(socket.read(server, 4) == "pong")
+	socket.close(server)
+	socket.close(client)
+end
+
+skynet.start(function()
+	test_rate()
+	test_drop()
+	test_close()
+	test_pause()
+	skynet.exit()
+end)
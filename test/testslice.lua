@@ -0,0 +1,107 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local netpack = require "skynet.netpack"
+local sproto = require "sproto"
+
+local function pair()
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = socket.open(addr, port)
+	while not server do
+		skynet.yield()
+	end
+	socket.close(listen_id)
+	return server, client
+end
+
+local function test_view(server, client)
+	socket.write(client, "hello world")
+	local s1 = socket.read_slice(server, 5)
+	local s2 = socket.read_slice(server, 6)
+	assert(#s1 == 5 and tostring(s1) == "hello")
+	assert(s2:tostring() == " world")
+	local ptr, sz = s2:ptr()
+	assert(type(ptr) == "userdata" and sz == 6)
+	-- s1 still refers the memory of the node after it's returned to the pool
+	collectgarbage()
+	assert(tostring(s1) == "hello")
+	s1:free()
+	assert(not pcall(tostring, s1))
+	print("view ok")
+end
+
+local function test_cross(server, client)
+	socket.write(client, "abc")
+	skynet.sleep(1)
+	socket.write(client, "defg")
+	assert(socket.read(server, 1) == "a")
+	local s = socket.read_slice(server, 5)
+	assert(tostring(s) == "bcdef")
+	assert(socket.read(server, 1) == "g")
+	print("cross ok")
+end
+
+local function test_unpack(server, client)
+	local msg = skynet.packstring("hello", 1, { x = 2 })
+	socket.write(client, string.pack(">s2", msg))
+	local sz = string.unpack(">I2", socket.read(server, 2))
+	local s = socket.read_slice(server, sz)
+	local a, b, c = skynet.unpack(s)
+	assert(a == "hello" and b == 1 and c.x == 2)
+	-- netpack.pack accepts slice
+	socket.write(client, "netpack")
+	s = socket.read_slice(server, 7)
+	local p, psz = netpack.pack(s)
+	assert(netpack.tostring(p, psz) == "\0\7netpack")
+	print("unpack ok")
+end
+
+local function test_sproto(server, client)
+	local sp = sproto.parse [[
+.Person {
+	name 0 : string
+	id 1 : integer
+}
+]]
+	local code = sp:encode("Person", { name = "alice", id = 10000 })
+	socket.write(client, code)
+	local s = socket.read_slice(server, #code)
+	local p = sp:decode("Person", s)
+	assert(p.name == "alice" and p.id == 10000)
+	print("sproto ok")
+end
+
+local function test_write(server, client)
+	socket.write(client, "echo")
+	local s = socket.read_slice(server, 4)
+	socket.write(server, s)
+	socket.lwrite(server, s)
+	assert(socket.read(client, 8) == "echoecho")
+	print("write ok")
+end
+
+local function test_close(server, client)
+	socket.write(client, "xyz")
+	socket.close(client)
+	local s = socket.read_slice(server, 3)
+	assert(tostring(s) == "xyz")
+	local ok, rest = socket.read_slice(server, 1)
+	assert(ok == false and rest == "")
+	socket.close(server)
+	print("close ok")
+end
+
+skynet.start(function()
+	local server, client = pair()
+	test_view(server, client)
+	test_cross(server, client)
+	test_unpack(server, client)
+	test_sproto(server, client)
+	test_write(server, client)
+	test_close(server, client)
+	skynet.exit()
+end)
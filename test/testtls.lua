@@ -0,0 +1,166 @@
+-- build with TLS_MODULE=ltls, and put enablessl = true in config
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local tls = require "http.tlshelper"
+
+local PORT = 8801
+local TOTAL = 64 * 1024 * 1024
+local CHUNK = 16 * 1024
+
+local dir = "/tmp/skynet_testtls"
+local certfile = dir .. "/cert.pem"
+local keyfile = dir .. "/key.pem"
+
+local function gencert()
+	assert(os.execute(string.format("mkdir -p %s && openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost " ..
+		"-keyout %s -out %s > /dev/null 2>&1", dir, keyfile, certfile)), "openssl failed")
+end
+
+local server_ctx, client_ctx
+
+-- the server of socket thread tls : echo, or count the bytes and reply "ok"
+local function tls_server(id, mode)
+	assert(tls.socket(id, "server", server_ctx))
+	socket.start(id)
+	local n = 0
+	while true do
+		local s = socket.read(id)
+		if not s then
+			break
+		end
+		if mode == "echo" then
+			socket.write(id, s)
+		else
+			n = n + #s
+			if n == TOTAL then
+				socket.write(id, "ok")
+			end
+		end
+	end
+	socket.close(id)
+end
+
+-- the server of ltls in lua
+local function lua_server(id)
+	socket.start(id)
+	local tls_ctx = tls.newtls("server", server_ctx)
+	tls.init_responsefunc(id, tls_ctx)()
+	local read = tls.readfunc(id, tls_ctx)
+	local write = tls.writefunc(id, tls_ctx)
+	local n = 0
+	while n < TOTAL do
+		local ok, s = pcall(read)
+		if not ok then
+			break
+		end
+		n = n + #s
+	end
+	write "ok"
+	socket.close(id)
+	tls_ctx:close()
+end
+
+local function listen(mode)
+	PORT = PORT + 1
+	local listen_id = socket.listen("127.0.0.1", PORT)
+	socket.start(listen_id, function(id)
+		if mode == "lua" then
+			skynet.fork(lua_server, id)
+		else
+			skynet.fork(tls_server, id, mode)
+		end
+	end)
+	return listen_id
+end
+
+local function connect()
+	local id = assert(socket.open("127.0.0.1", PORT))
+	assert(tls.socket(id, "client", client_ctx, "localhost"))
+	return id
+end
+
+local function test()
+	local listen_id = listen "echo"
+	local id = connect()
+	-- the data are buffered before the handshake is finished
+	socket.write(id, "hello")
+	assert(socket.read(id, 5) == "hello")
+	local big = string.rep("0123456789abcdef", 100000)
+	socket.write(id, big)
+	assert(socket.read(id, #big) == big)
+	socket.write(id, "line1\nline2\n")
+	assert(socket.readline(id) == "line1")
+	assert(socket.readline(id) == "line2")
+	-- the file is encrypted in socket thread, instead of sendfile(2)
+	local f = io.open(certfile, "rb")
+	local cert = f:read "a"
+	f:close()
+	assert(socket.sendfile(id, certfile) == #cert)
+	assert(socket.read(id, #cert) == cert)
+	socket.close(id)
+
+	-- the plain text client fails the handshake
+	id = assert(socket.open("127.0.0.1", PORT))
+	socket.write(id, "GET / HTTP/1.1\r\n\r\n")
+	assert(socket.read(id) == false)
+	socket.close(id)
+	socket.close(listen_id)
+	print("tls ok")
+end
+
+-- the plain text sent before the switch isn't written out (the listener doesn't accept), so tls is refused
+local function test_queued()
+	PORT = PORT + 1
+	local listen_id = socket.listen("127.0.0.1", PORT)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	socket.write(id, string.rep("x", 16 * 1024 * 1024))
+	if tls.socket(id, "client", client_ctx, "localhost") then
+		-- refused in socket thread, the socket is closed
+		assert(socket.read(id) == false)
+	end
+	socket.close(id)
+	socket.close(listen_id)
+	print("tls queued ok")
+end
+
+local function bench(mode)
+	local listen_id = listen(mode)
+	local chunk = string.rep("x", CHUNK)
+	local ti = skynet.hpc()
+	if mode == "lua" then
+		local id = assert(socket.open("127.0.0.1", PORT))
+		local tls_ctx = tls.newtls("client", client_ctx, "localhost")
+		tls.init_requestfunc(id, tls_ctx)("localhost")
+		local write = tls.writefunc(id, tls_ctx)
+		local read = tls.readfunc(id, tls_ctx)
+		for i = 1, TOTAL // CHUNK do
+			write(chunk)
+		end
+		assert(read(2) == "ok")
+		socket.close(id)
+		tls_ctx:close()
+	else
+		local id = connect()
+		for i = 1, TOTAL // CHUNK do
+			socket.write(id, chunk)
+		end
+		assert(socket.read(id, 2) == "ok")
+		socket.close(id)
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("%-13s %d MB : %.1f ms, %.1f MB/s", mode == "lua" and "ltls (lua)" or "socket thread",
+		TOTAL // (1024 * 1024), ti, TOTAL / (1024 * 1024) / (ti / 1000)))
+	socket.close(listen_id)
+end
+
+skynet.start(function()
+	gencert()
+	server_ctx = tls.newctx()
+	server_ctx:set_cert(certfile, keyfile)
+	client_ctx = tls.newctx()
+	test()
+	test_queued()
+	bench "lua"
+	bench "count"
+	skynet.exit()
+end)
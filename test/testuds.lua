@@ -0,0 +1,91 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local cluster = require "skynet.cluster"
+
+local PATH = "unix:/tmp/skynet_testuds.sock"
+
+local function pair(host, port)
+	local listen_id, addr, lport = socket.listen(host, port)
+	local server
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = assert(socket.open(addr, lport))
+	while not server do
+		skynet.yield()
+	end
+	socket.close(listen_id)
+	return server, client, addr
+end
+
+local function test_stream(path)
+	local server, client, addr = pair(path)
+	assert(addr == path, addr)
+	socket.write(client, "hello")
+	assert(socket.read(server, 5) == "hello")
+	socket.write(server, "world")
+	assert(socket.read(client, 5) == "world")
+	socket.close(client)
+	assert(not socket.read(server))
+	socket.close(server)
+	print("stream", path)
+end
+
+-- the path of a live listener isn't taken over, the stale one is reused
+local function test_takeover(path)
+	local listen_id = socket.listen(path)
+	assert(not pcall(socket.listen, path))
+	socket.close(listen_id)
+	listen_id = socket.listen(path)
+	socket.close(listen_id)
+	print("takeover", path)
+end
+
+local function test_cluster()
+	cluster.reload { uds = PATH }
+	cluster.register("testuds", skynet.self())
+	cluster.open "uds"
+	assert(cluster.call("uds", "@testuds", "ping", 42) == 42)
+	print("cluster", PATH)
+end
+
+local function throughput(host, port, total)
+	local server, client = pair(host, port)
+	local CHUNK = 64 * 1024
+	local block = string.rep("x", CHUNK)
+	local WINDOW = 128 * 1024	-- don't queue all the data in send buffer, and keep the reader under the pause limit
+	local n = 0
+	local ti = skynet.hpc()
+	skynet.fork(function()
+		for i = 1, total // CHUNK do
+			while i * CHUNK - n > WINDOW do
+				skynet.yield()
+			end
+			socket.write(client, block)
+		end
+	end)
+	while n < total do
+		n = n + #assert(socket.read(server))
+	end
+	local elapsed = (skynet.hpc() - ti) / 1e9
+	socket.close(client)
+	socket.close(server)
+	return total / elapsed / (1024 * 1024)
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, v)
+		assert(cmd == "ping")
+		skynet.ret(skynet.pack(v))
+	end)
+	test_stream(PATH)
+	test_stream "unix:@skynet_testuds"	-- linux abstract namespace
+	test_takeover(PATH)
+	test_cluster()
+	local TOTAL = 256 * 1024 * 1024
+	local tcp = throughput("127.0.0.1", 0, TOTAL)
+	local uds = throughput("unix:/tmp/skynet_testuds_bench.sock", nil, TOTAL)	-- PATH is listened by cluster
+	print(string.format("throughput (%dM) : tcp %.1f MB/s, unix %.1f MB/s", TOTAL // (1024 * 1024), tcp, uds))
+	skynet.exit()
+end)
@@ -0,0 +1,186 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- skynet.kill
+
+local mode, nexthop = ...
+
+local BLOB = 1024 * 1024
+
+local function isview(v)
+	return type(v) == "userdata"
+end
+
+-- forward the request to the next hop, and return the response to the caller
+local function relay()
+	if mode == "view" then
+		skynet.unpackmode(1024)
+	end
+	skynet.dispatch("lua", function(_, _, cmd, blob, tag)
+		if nexthop then
+			skynet.ret(skynet.pack(skynet.call(tonumber(nexthop), "lua", cmd, blob, tag)))
+		else
+			assert(isview(blob) == (mode == "view"))
+			skynet.ret(skynet.pack(#blob, tag))
+		end
+		if isview(blob) then
+			-- give back the message now, the collector doesn't know the size of it
+			blob:free()
+		end
+	end)
+end
+
+local function test_unpack()
+	local blob = string.rep("0123456789abcdef", 4096)
+	local key = string.rep("k", 2000)
+	local msg, sz = skynet.pack(blob, "short", { blob, [key] = blob }, 1)
+	-- msg is owned by the views, don't trash it
+	local v1, short, t, n = skynet.unpackview(msg, sz)
+	assert(isview(v1) and #v1 == #blob and tostring(v1) == blob)
+	assert(short == "short" and n == 1)
+	assert(isview(t[1]) and isview(t[key]) and tostring(t[key]) == blob)
+	-- the memory is shared until the last view is collected
+	v1:free()
+	t[1] = nil
+	collectgarbage()
+	assert(tostring(t[key]) == blob)
+	-- the threshold
+	msg, sz = skynet.pack(blob)
+	assert(type(skynet.unpackview(msg, sz, #blob + 1)) == "string")
+	-- the views are packed as strings
+	local view = t[key]
+	msg, sz = skynet.pack(view, { view })
+	local s, r = skynet.unpack(msg, sz)
+	skynet.trash(msg, sz)
+	assert(s == blob and r[1] == blob)
+	-- the views of a slice
+	msg, sz = skynet.pack(skynet.packstring(blob, view))
+	local whole = skynet.unpackview(msg, sz, 64)
+	local a, b = skynet.unpackview(whole, nil, 64)
+	assert(isview(a) and tostring(b) == blob)
+	whole:free()
+	assert(tostring(a) == blob)
+	-- the string field of schema
+	local Record = skynet.packschema("blob", { "id:int", "data:string" })
+	local rec = setmetatable({ id = 1, data = view }, Record)
+	r = skynet.unpack(skynet.packstring(rec))
+	assert(r.data == blob)
+	print("unpackview ok")
+end
+
+-- the message of dispatch is kept by the views
+local function test_dispatch()
+	local hops = {}
+	local last
+	for i = 1, 3 do
+		last = skynet.newservice(SERVICE_NAME, "view", last)
+		hops[i] = last
+	end
+	local blob = string.rep("x", BLOB)
+	local n, tag = skynet.call(last, "lua", "relay", blob, "tag")
+	assert(n == BLOB and tag == "tag")
+	for _, addr in ipairs(hops) do
+		skynet.kill(addr)
+	end
+	-- the response is unpacked as views too
+	skynet.unpackmode(1024)
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local v = skynet.call(echo, "lua", blob)
+	assert(isview(v) and tostring(v) == blob)
+	-- the views are sent as the raw message
+	assert(skynet.call(echo, "echo", v) == blob)
+	skynet.unpackmode()
+	assert(skynet.call(echo, "lua", "short") == "short")
+	skynet.kill(echo)
+	print("dispatch ok")
+end
+
+-- forward mode : the message is trashed after dispatch, so the views own a copy of it
+local function forward()
+	local last
+	skynet.forward_type({}, function()
+		skynet.unpackmode(1024)
+		skynet.dispatch("lua", function(_, _, blob)
+			local prev = last and tostring(last)
+			last = blob
+			skynet.ret(skynet.pack(isview(blob), prev))
+		end)
+	end)
+end
+
+local function test_forward()
+	local addr = skynet.newservice(SERVICE_NAME, "forward")
+	local a = string.rep("a", BLOB)
+	assert(skynet.call(addr, "lua", a) == true)
+	local view, prev = skynet.call(addr, "lua", string.rep("b", BLOB))
+	assert(view and prev == a)
+	skynet.kill(addr)
+	print("forward ok")
+end
+
+local function test_socket()
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen_id, function(id)
+		server = id
+	end)
+	local client = socket.open(addr, port)
+	while not server do
+		skynet.sleep(1)
+	end
+	socket.start(server)
+	socket.close(listen_id)
+	local blob = string.rep("y", 100000)
+	local view = skynet.unpackview(skynet.pack(blob))
+	socket.write(client, view)
+	assert(socket.read(server, #blob) == blob)
+	socket.close(client)
+	socket.close(server)
+	print("socket ok")
+end
+
+-- unpack a message of 1MB string, from a slice of the message
+local function bench(n)
+	skynet.yield()
+	local whole = skynet.unpackview(skynet.pack(skynet.packstring(string.rep("z", BLOB), "tag")))
+	for _, unpack in ipairs { skynet.unpack, skynet.unpackview } do
+		local ti = skynet.hpc()
+		for i = 1, n do
+			unpack(whole)
+		end
+		ti = (skynet.hpc() - ti) / n / 1000
+		print(string.format("unpack 1MB (%s) : %.2f us", unpack == skynet.unpack and "string" or "view", ti))
+	end
+	whole:free()
+end
+
+if mode == "forward" then
+	forward()
+	return
+end
+
+skynet.start(function()
+	skynet.register_protocol {
+		name = "echo",
+		id = skynet.PTYPE_TEXT,
+		pack = function(...) return ... end,
+		unpack = skynet.tostring,
+	}
+	if mode == "echo" then
+		skynet.dispatch("echo", function(_, _, s)
+			skynet.ret(s)
+		end)
+		skynet.dispatch("lua", function(_, _, v)
+			skynet.ret(skynet.pack(v))
+		end)
+	elseif mode then
+		relay()
+	else
+		test_unpack()
+		test_dispatch()
+		test_forward()
+		test_socket()
+		bench(1000)
+		print("test ok")
+		skynet.exit()
+	end
+end)
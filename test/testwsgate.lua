@@ -0,0 +1,190 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local websocket = require "http.websocket"
+local codec = require "skynet.websocket"
+local crypt = require "skynet.crypt"
+require "skynet.manager"	-- import skynet.register, skynet.launch
+
+local PORT = 8998
+local gate
+local echo = true
+local count = 0
+local co
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		local id, cmd = msg:match "(%d+) (%a+)"
+		if cmd == "open" then
+			skynet.send(gate, "text", "start " .. id)
+		end
+	end,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	pack = function(msg) return msg end,
+	unpack = skynet.tostring,
+	dispatch = function(id, _, msg)
+		skynet.ignoreret()	-- session is the socket id
+		if echo then
+			-- the last 4 bytes are the socket id
+			skynet.send(gate, "client", msg .. string.pack("<I4", id))
+		else
+			count = count - 1
+			if count == 0 then
+				skynet.wakeup(co)
+			end
+		end
+	end,
+}
+
+local function start_gate(mode, max)
+	PORT = PORT + 1
+	gate = skynet.launch("gate", string.format("%s .wsgate 127.0.0.1:%d %d %d", mode, PORT, skynet.PTYPE_CLIENT, max))
+	skynet.send(gate, "text", "broker .wsgate")
+end
+
+local function handshake(id)
+	local key = crypt.base64encode(crypt.randomkey() .. crypt.randomkey())
+	socket.write(id, "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" ..
+		"sec-websocket-key:  " .. key .. "\r\nSec-WebSocket-Version: 13\r\n\r\n")
+	local resp = assert(socket.readline(id, "\r\n\r\n"))
+	assert(resp:match "^HTTP/1.1 101")
+	local accept = resp:match "Sec%-WebSocket%-Accept: ([^\r]+)"
+	assert(accept == crypt.base64encode(crypt.sha1(key .. "258EAFA5-E914-47DA-95CA-C5AB0DC85B11")))
+end
+
+local function read_frame(id)
+	local s = assert(socket.read(id, 2))
+	local n = codec.header_size(s)
+	if n > 2 then
+		s = s .. assert(socket.read(id, n - 2))
+	end
+	local fin, op, len = codec.parse(s)
+	return fin, op, len > 0 and assert(socket.read(id, len)) or ""
+end
+
+local function test_client()
+	local id = websocket.connect("ws://127.0.0.1:" .. PORT)
+	websocket.write(id, "hello", "binary")
+	assert(websocket.read(id) == "hello")
+	-- masked by client
+	local big = string.rep("0123456789", 10000)
+	websocket.write(id, big, "binary", 0x12345678)
+	assert(websocket.read(id) == big)
+	websocket.close(id)
+	print("client ok")
+end
+
+local function test_frames()
+	local id = socket.open("127.0.0.1", PORT)
+	handshake(id)
+	local key = 0x01020304
+	-- fragmented message with a ping between the fragments, split the stream into small pieces
+	local stream = codec.pack(1, "hel", key, false) .. codec.pack(9, "ping", key) ..
+		codec.pack(0, "", key, false) .. codec.pack(0, "lo", key, true)
+	for i = 1, #stream, 3 do
+		socket.write(id, stream:sub(i, i + 2))
+	end
+	local fin, op, data = read_frame(id)
+	assert(fin and op == 10 and data == "ping")
+	fin, op, data = read_frame(id)
+	assert(fin and op == 2 and data == "hello")
+	-- empty message is dropped, as the gate does for empty package
+	socket.write(id, codec.pack(2, "", key) .. codec.pack(2, "world", key))
+	fin, op, data = read_frame(id)
+	assert(op == 2 and data == "world")
+	-- close frame is echoed
+	socket.write(id, codec.pack(8, string.pack(">I2", 1000) .. "bye", key))
+	fin, op, data = read_frame(id)
+	assert(op == 8 and string.unpack(">I2", data) == 1000)
+	assert(socket.read(id) == false)
+	socket.close(id)
+
+	-- continuation without the first fragment
+	id = socket.open("127.0.0.1", PORT)
+	handshake(id)
+	socket.write(id, codec.pack(0, "bad", key))
+	assert(socket.read(id) == false)
+	socket.close(id)
+
+	-- rsv bits without extension
+	id = socket.open("127.0.0.1", PORT)
+	handshake(id)
+	local frame = codec.pack(2, "rsv", key)
+	socket.write(id, string.char(frame:byte(1) | 0x40) .. frame:sub(2))
+	assert(socket.read(id) == false)
+	socket.close(id)
+
+	-- bad requests : no key, no upgrade, or the version isn't 13
+	local key_header = "Sec-WebSocket-Key: " .. crypt.base64encode(crypt.randomkey() .. crypt.randomkey()) .. "\r\n"
+	for _, header in ipairs {
+		"Upgrade: websocket\r\nSec-WebSocket-Version: 13\r\n",
+		key_header .. "Sec-WebSocket-Version: 13\r\n",
+		key_header .. "Upgrade: websocket\r\nSec-WebSocket-Version: 8\r\n",
+	} do
+		id = socket.open("127.0.0.1", PORT)
+		socket.write(id, "GET / HTTP/1.1\r\nHost: localhost\r\n" .. header .. "\r\n")
+		assert(socket.readline(id, "\r\n\r\n"):match "^HTTP/1.1 400")
+		assert(socket.read(id) == false)
+		socket.close(id)
+	end
+	print("frames ok")
+end
+
+local function bench(mode, n, times, size)
+	start_gate(mode, n)
+	local clients = {}
+	for i = 1, n do
+		clients[i] = socket.open("127.0.0.1", PORT)
+		if mode == "W" then
+			handshake(clients[i])
+		end
+	end
+	local msg = string.rep("x", size)
+	local batch = {}
+	for i = 1, 100 do
+		if mode == "W" then
+			batch[i] = codec.pack(2, msg, i)
+		else
+			batch[i] = string.pack(">s2", msg)
+		end
+	end
+	batch = table.concat(batch)
+	echo = false
+	count = n * times * 100
+	co = coroutine.running()
+	local ti = skynet.hpc()
+	for i = 1, times do
+		for _, id in ipairs(clients) do
+			socket.write(id, batch)
+		end
+	end
+	skynet.wait(co)
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("%-10s %d clients x %d messages x %d bytes : %.1f ms",
+		mode == "W" and "websocket" or "tcp", n, times * 100, size, ti))
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	skynet.kill(gate)
+	echo = true
+end
+
+skynet.start(function()
+	skynet.register ".wsgate"
+	start_gate("W", 16)
+	test_client()
+	test_frames()
+	skynet.kill(gate)
+	for _, size in ipairs { 64, 1024 } do
+		bench("S", 20, 10, size)
+		bench("W", 20, 10, size)
+	end
+	skynet.exit()
+end)
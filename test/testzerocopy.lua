@@ -0,0 +1,44 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local BLOCK = 4 * 1024 * 1024
+local COUNT = 8
+
+skynet.start(function()
+	local blocks = {}
+	for i = 1, COUNT do
+		blocks[i] = string.rep(string.char(string.byte "a" + i), BLOCK)
+	end
+	local listen_id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen_id, function(id)
+		socket.start(id)
+		socket.zerocopy(id)	-- use default threshold
+		for i = 1, COUNT do
+			socket.write(id, blocks[i])
+		end
+		socket.write(id, "small")	-- small buffer is always copied
+		socket.read(id)	-- wait for client
+		for _, v in ipairs(socket.netstat()) do
+			if v.id == id then
+				-- loopback never does zerocopy actually, the kernel reports the blocks are copied
+				print("netstat", "write", v.write, "zerocopy", v.zerocopy, "zcfallback", v.zcfallback)
+				assert(v.zcfallback > 0 and v.zerocopy + v.zcfallback <= COUNT * BLOCK)
+			end
+		end
+		socket.close(id)
+	end)
+
+	local fd = socket.open(addr, port)
+	for i = 1, COUNT do
+		local data = socket.read(fd, BLOCK)
+		assert(data == blocks[i])
+	end
+	assert(socket.read(fd, 5) == "small")
+	skynet.sleep(10)	-- wait for zerocopy notifications
+	socket.write(fd, "done")
+	assert(socket.read(fd) == false)
+	socket.close(fd)
+	socket.close(listen_id)
+	print("zerocopy ok")
+	skynet.exit()
+end)